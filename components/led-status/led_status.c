@@ -1,8 +1,8 @@
 #include <freertos/FreeRTOS.h>
-#include <freertos/timers.h>
+#include <freertos/task.h>
 
-#include <stdlib.h>
 #include <stdbool.h>
+#include <string.h>
 
 #include <driver/gpio.h>
 
@@ -10,39 +10,65 @@
 
 #define ABS(x) (((x) < 0) ? -(x) : (x))
 
-typedef struct {
+// One task runs every LED. Lowest priority above idle: a late blink does no harm, and
+//  it never takes time from anything else.
+#define LED_STATUS_TASK_PRIORITY    1
+#define LED_STATUS_TASK_STACK       1024
+
+// LEDs are static slots rather than heap; a slot is reused after led_status_done().
+//  How many is fixed at build time
+#define LED_STATUS_MAX              CONFIG_LED_STATUS_MAX
+
+// led_status_t.posted
+#define LED_STATUS_POST_PATTERN     (1 << 0)
+#define LED_STATUS_POST_SIGNAL      (1 << 1)
+#define LED_STATUS_POST_DONE        (1 << 2)
+
+typedef struct led_status_s {
+    bool in_use;                                // slot taken, until the scheduler drops it
     uint8_t gpio;
     uint8_t active;
-    TimerHandle_t timer;
 
+    // owned by the scheduler task
     int n;
-    led_status_pattern_t *pattern;              // led_status_set    -> repeating
-    led_status_pattern_t *signal_pattern;       // led_status_signal -> 1 shot
+    TickType_t deadline;                        // when step n is due. 0 when idle
+    const led_status_pattern_t *pattern;        // led_status_set    -> repeating
+    const led_status_pattern_t *signal_pattern; // led_status_signal -> 1 shot
+
+    // posted from any task, inside a critical section
+    uint8_t posted;
+    const led_status_pattern_t *posted_pattern;
+    const led_status_pattern_t *posted_signal;
+
+    struct led_status_s *next;
 } led_status_t;
 
+static led_status_t led_slots[LED_STATUS_MAX];
+static led_status_t *leds;                      // every LED, for the scheduler
+static TaskHandle_t led_status_task_handle;
+
 
 static void led_status_write(led_status_t *status, bool on) {
     gpio_set_level(status->gpio, on ? status->active : !status->active);
 }
 
-static void led_status_tick_callback(TimerHandle_t timer);
-
-static void led_status_tick(led_status_t *status) {
-    led_status_pattern_t *p = status->signal_pattern ? status->signal_pattern : status->pattern;
+// Show step n and work out when the next one is due
+static void led_status_tick(led_status_t *status, TickType_t now) {
+    const led_status_pattern_t *p = status->signal_pattern ? status->signal_pattern : status->pattern;
 
     if (!p) {
-//        sdk_os_timer_disarm(&status->timer);
-        xTimerStop(status->timer, 1);
-
+        status->deadline = 0;
         led_status_write(status, false);
         return;
     }
 
     led_status_write(status, p->delay[status->n] > 0);
 
-//    sdk_os_timer_arm(&status->timer, ABS(p->delay[status->n]), 0);
-    xTimerChangePeriod(status->timer, pdMS_TO_TICKS(ABS(p->delay[status->n])), 1);
-    xTimerStart(status->timer, 1);
+    TickType_t ticks = pdMS_TO_TICKS(ABS(p->delay[status->n]));
+    status->deadline = now + (ticks ? ticks : 1);
+    if (status->deadline == 0) {
+        status->deadline = 1;                   // 0 means idle
+    }
 
     status->n = (status->n + 1) % p->n;
     if (status->signal_pattern && status->n == 0) {
@@ -50,25 +76,113 @@ static void led_status_tick(led_status_t *status) {
     }
 }
 
-static void led_status_tick_callback(TimerHandle_t timer) {
-    led_status_t *status = (led_status_t*) pvTimerGetTimerID(timer);
+// Take whatever led_status_set()/led_status_signal() posted since the last run.
+//  Returns false once the LED has been handed to led_status_done()
+static bool led_status_apply(led_status_t *status, TickType_t now) {
+    taskENTER_CRITICAL();
+    uint8_t posted = status->posted;
+    const led_status_pattern_t *pattern = status->posted_pattern;
+    const led_status_pattern_t *signal = status->posted_signal;
+    status->posted = 0;
+    taskEXIT_CRITICAL();
+
+    if (posted & LED_STATUS_POST_DONE) {
+        return false;
+    }
+    if (posted & LED_STATUS_POST_PATTERN) {
+        status->pattern = pattern;
+        if (!status->signal_pattern) {
+            status->n = 0;
+            led_status_tick(status, now);
+        }
+    }
+    if ((posted & LED_STATUS_POST_SIGNAL) && (status->signal_pattern || signal)) {
+        status->signal_pattern = signal;
+        status->n = 0;  // whether signal pattern is NULL or not, just reset the state
+        led_status_tick(status, now);
+    }
+    return true;
+}
+
+// One pass over every LED. Returns the ticks until the next step is due
+static TickType_t led_status_run(TickType_t now) {
+    TickType_t wait = portMAX_DELAY;
+    led_status_t **link = &leds;
+
+    while (*link != NULL) {
+        led_status_t *status = *link;
+
+        if (!led_status_apply(status, now)) {
+            // led_status_init() may have pushed a new head since 'link' was read
+            taskENTER_CRITICAL();
+            for (link = &leds; *link != status; link = &(*link)->next);
+            *link = status->next;
+            status->in_use = false;
+            taskEXIT_CRITICAL();
+            continue;
+        }
+
+        if (status->deadline != 0 && (int32_t)(now - status->deadline) >= 0) {
+            led_status_tick(status, now);
+        }
+        if (status->deadline != 0) {
+            TickType_t left = status->deadline - now;
+            if (left < wait) {
+                wait = left;
+            }
+        }
+        link = &status->next;
+    }
+    return wait;
+}
+
+// Sleeps until the earliest step of any LED is due or something is posted. A step
+//  is a GPIO write and a notify timeout; nothing goes through the timer daemon queue.
+static void led_status_task(void *param) {
+    TickType_t wait = portMAX_DELAY;
+    while (1) {
+        ulTaskNotifyTake(pdTRUE, wait);
+        wait = led_status_run(xTaskGetTickCount());
+    }
+}
 
-    led_status_tick(status);
+static void led_status_post(led_status_t *status, uint8_t what,
+        const led_status_pattern_t *pattern) {
+    taskENTER_CRITICAL();
+    status->posted |= what;
+    if (what == LED_STATUS_POST_PATTERN) {
+        status->posted_pattern = pattern;
+    } else if (what == LED_STATUS_POST_SIGNAL) {
+        status->posted_signal = pattern;
+    }
+    taskEXIT_CRITICAL();
+
+    xTaskNotifyGive(led_status_task_handle);
 }
 
 led_status_t *led_status_init(uint8_t gpio, uint8_t active_level) {
-    led_status_t *status = malloc(sizeof(led_status_t));
+    if (led_status_task_handle == NULL &&
+        xTaskCreate(&led_status_task, "led_status", LED_STATUS_TASK_STACK, NULL,
+            LED_STATUS_TASK_PRIORITY, &led_status_task_handle) != pdPASS) {
+        return NULL;
+    }
+
+    led_status_t *status = NULL;
+    taskENTER_CRITICAL();
+    for (int i = 0; i < LED_STATUS_MAX; i++) {
+        if (!led_slots[i].in_use) {
+            status = &led_slots[i];
+            memset(status, 0, sizeof(led_status_t));
+            status->in_use = true;
+            break;
+        }
+    }
+    taskEXIT_CRITICAL();
+    if (status == NULL) {
+        return NULL;
+    }
     status->gpio = gpio;
     status->active = active_level;
-    status->pattern = NULL;
-    status->signal_pattern = NULL;
-    status->timer = NULL;
-
-    // set the timer, with an arbitrary time - but don't start
-//    sdk_os_timer_setfn(&status->timer, (void(*)(void*))led_status_tick, status);
-    status->timer = xTimerCreate(
-        "Toggle timer", 100, pdFALSE, status, led_status_tick_callback
-    );
 
     gpio_config_t io_conf = {0};
     io_conf.mode = GPIO_MODE_OUTPUT;
@@ -77,40 +191,33 @@ led_status_t *led_status_init(uint8_t gpio, uint8_t active_level) {
 
     led_status_write(status, false);
 
+    taskENTER_CRITICAL();
+    status->next = leds;
+    leds = status;
+    taskEXIT_CRITICAL();
+
     return status;
 }
 
 void led_status_done(led_status_t *status) {
-//    sdk_os_timer_disarm(&status->timer);
-    xTimerStop(status->timer, 1);
-    xTimerDelete(status->timer, 1);
-
-//    gpio_disable(status->gpio);
+    if (status == NULL)
+        return;
 
-    free(status);
+    // the scheduler unlinks it and gives the slot back
+    led_status_post(status, LED_STATUS_POST_DONE, NULL);
 }
 
-void led_status_set(led_status_t *status, led_status_pattern_t *pattern) {
+void led_status_set(led_status_t *status, const led_status_pattern_t *pattern) {
     // if led_status_init has not been called and led_status_t pointer is NULL; just return
     if (status == NULL)
         return;
 
-    status->pattern = pattern;
-
-    if (!status->signal_pattern) {
-        status->n = 0;
-        led_status_tick(status);
-    }
+    led_status_post(status, LED_STATUS_POST_PATTERN, pattern);
 }
 
-void led_status_signal(led_status_t *status, led_status_pattern_t *pattern) {
+void led_status_signal(led_status_t *status, const led_status_pattern_t *pattern) {
     if (status == NULL)
         return;
 
-    if (!status->signal_pattern && !pattern)
-        return;
-
-    status->signal_pattern = pattern;
-    status->n = 0;  // whether signal pattern is NULL or not, just reset the state
-    led_status_tick(status);
+    led_status_post(status, LED_STATUS_POST_SIGNAL, pattern);
 }
@@ -8,15 +8,18 @@ extern "C" {
 
 typedef void * led_status_t;
 
+// NULL once CONFIG_LED_STATUS_MAX (default 2) LEDs are in use. A slot is free again
+//  once the LED task has handled led_status_done()
 led_status_t led_status_init(uint8_t gpio, bool active_high);
 void led_status_done(led_status_t status);
 
 // Set looped pattern that will be executing until changed.
 // Passing NULL as pattern disables blinking.
-void led_status_set(led_status_t status, led_status_pattern_t *pattern);
+// Callable from any task; the change is picked up by the LED scheduler task.
+void led_status_set(led_status_t status, const led_status_pattern_t *pattern);
 
 // Execute given pattern once and then return to pattern set by led_status_set().
-void led_status_signal(led_status_t status, led_status_pattern_t *pattern);
+void led_status_signal(led_status_t status, const led_status_pattern_t *pattern);
 
 #ifdef __cplusplus
 }
@@ -6,17 +6,20 @@ extern "C" {
 
 #include <stdint.h>
 
+// Steps of a pattern, in ms. Positive is on, negative is off.
 typedef struct {
     int n;
-    int16_t *delay;
+    const int16_t *delay;
 } led_status_pattern_t;
 
 
+// Expands to a const pattern. At file scope the step array is a static const table,
+//  so 'const led_status_pattern_t x = LED_STATUS_PATTERN(...)' lives in flash.
 #define LED_STATUS_PATTERN(...) { \
-    .n = sizeof((int16_t[])__VA_ARGS__) / sizeof(int16_t), \
-    .delay = (int16_t[])__VA_ARGS__, \
+    .n = sizeof((const int16_t[])__VA_ARGS__) / sizeof(int16_t), \
+    .delay = (const int16_t[])__VA_ARGS__, \
 }
 
 #ifdef __cplusplus
 }
-#endif 
\ No newline at end of file
+#endif
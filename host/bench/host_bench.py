@@ -0,0 +1,334 @@
+#!/usr/bin/env python3
+"""Benchmark the firmware as built for the host (ota_sim), on this machine's loopback.
+
+    host_bench.py BUILD_DIR ota [--size 262144] [--repeat 3] [--latency esp8266,none]
+    host_bench.py BUILD_DIR sse [--subscribers 2] [--probes 50]
+    host_bench.py BUILD_DIR clients [--clients 8] [--requests 50] [--path /metrics]
+    host_bench.py BUILD_DIR tasks [--size 262144] [--clients 8]
+    host_bench.py BUILD_DIR all --quick
+
+BUILD_DIR is where host/CMakeLists.txt was built, holding ota_sim. Each run starts a
+fresh simulator on an erased flash image.
+
+    ota       POST /send throughput. As in tools/tcp_bench.py, the upload claims one
+              byte more than it sends, so every sector is written but nothing is
+              installed and the simulator doesn't restart. With --latency esp8266
+              every erase and write takes as long as on a 1MB ESP8266 part
+              (HOST_FLASH_LATENCY_ESP8266), which is what the OTA pipeline overlaps
+              with receiving; 'none' shows what the rest of the path costs.
+    sse       event latency: from a new GET /event to its 'Connected..' broadcast
+              reaching each of --subscribers existing streams (at most
+              MAX_SSE_CLIENTS - 1, as the probe takes a slot), idle and during an
+              upload to the ESP8266 flash model
+    clients   --clients connections at once, each making --requests GETs in turn.
+              Requests per second, latency, and how many were turned away (503)
+              or dropped once the request buffers or sockets run out
+    tasks     an upload to the ESP8266 flash model while --clients poll /metrics and
+              an event stream is probed, with every task at one priority and then
+              under SCHED_FIFO at the firmware's priorities (--priorities, which
+              needs root or CAP_SYS_NICE, or it is skipped). Upload rate and the
+              others' latency, then the most stack each task used on this host,
+              from ota_sim's report on SIGTERM. x86-64 frames and glibc's printf
+              are larger than the ESP8266's, so these bound what a device uses
+              rather than measure it; stack_free in a device's /metrics does that
+
+Timings are of this host, not of a device: they compare builds and settings, and
+show where queueing or blocking sits, but the absolute numbers are not an ESP8266's.
+"""
+
+import argparse
+import os
+import socket
+import statistics
+import sys
+import tempfile
+import threading
+import time
+
+sys.path.insert(0, os.path.join(os.path.dirname(os.path.abspath(__file__)), "..", "sim"))
+from ota_sim import MAIN_ADDRESS, Sim, app_image, read_response  # noqa: E402
+
+MARKER = b"Connected.."
+
+
+def percentile(samples, p):
+    if not samples:
+        return float("nan")
+    samples = sorted(samples)
+    return samples[min(len(samples) - 1, int(len(samples) * p))]
+
+
+def upload(sim, payload):
+    """Seconds for a POST /send of 'payload', sent as all but the last byte of an image"""
+    length = len(payload)
+    header = ("POST /send HTTP/1.1\r\nHost: 127.0.0.1\r\nContent-Length: %d\r\n"
+              "Content-Range: bytes 0-%d/%d\r\n\r\n" % (length, length - 1, length + 1))
+    with sim.connect(60) as sock:
+        start = time.monotonic()
+        sock.sendall(header.encode() + payload)
+        status, _, _ = read_response(sock)
+        elapsed = time.monotonic() - start
+    if status != 200:
+        raise RuntimeError("upload answered %s" % status)
+    return elapsed
+
+
+class EventStream(threading.Thread):
+    """A GET /event subscriber that notes when each 'Connected..' event arrives"""
+
+    def __init__(self, sim):
+        super().__init__(daemon=True)
+        self.sock = sim.connect()
+        self.sock.sendall(b"GET /event HTTP/1.1\r\nHost: 127.0.0.1\r\n\r\n")
+        self.sock.settimeout(None)
+        self.arrived = threading.Condition()
+        self.count = 0
+        self.last = 0.0
+        self.start()
+        # the replayed 'Connected..' events and this subscriber's own come first
+        with self.arrived:
+            if not self.arrived.wait_for(lambda: self.count > 0, 10):
+                sys.exit("no events from /event")
+        time.sleep(0.2)
+
+    def run(self):
+        pending = b""
+        while True:
+            try:
+                data = self.sock.recv(4096)
+            except OSError:
+                return
+            if not data:
+                return
+            now = time.monotonic()
+            pending += data
+            *lines, pending = pending.split(b"\n")
+            for line in lines:
+                if line.startswith(b"data:") and MARKER in line:
+                    with self.arrived:
+                        self.count += 1
+                        self.last = now
+                        self.arrived.notify_all()
+
+    def close(self):
+        self.sock.close()
+
+
+def probe(sim, streams, timeout=5.0):
+    """Seconds from subscribing to the broadcast reaching each of 'streams' (None if
+    it didn't)"""
+    seen = []
+    for stream in streams:
+        with stream.arrived:
+            seen.append(stream.count)
+    start = time.monotonic()
+    result = []
+    with sim.connect(timeout) as sock:
+        sock.sendall(b"GET /event HTTP/1.1\r\nHost: 127.0.0.1\r\n\r\n")
+        for stream, count in zip(streams, seen):
+            with stream.arrived:
+                arrived = stream.arrived.wait_for(lambda: stream.count > count, timeout)
+                result.append(stream.last - start if arrived else None)
+    return result
+
+
+def bench_ota(args, workdir):
+    print("%-8s %8s %8s %8s %8s" % ("latency", "KB", "KB/s", "min", "max"))
+    for latency in args.latency:
+        with Sim(args.sim, workdir, "--flash-latency", latency) as sim:
+            rates = []
+            for _ in range(args.repeat):
+                payload = app_image(MAIN_ADDRESS, args.size)
+                rates.append(args.size / upload(sim, payload) / 1024)
+        print("%-8s %8d %8.1f %8.1f %8.1f" % (latency, args.size // 1024, statistics.median(rates),
+                                              min(rates), max(rates)), flush=True)
+        os.remove(sim.flash)
+        os.remove(sim.nvs)
+
+
+def bench_sse(args, workdir):
+    with Sim(args.sim, workdir, "--flash-latency", "esp8266") as sim:
+        streams = [EventStream(sim) for _ in range(args.subscribers)]
+        try:
+            idle = [probe(sim, streams) for _ in range(args.probes)]
+
+            loaded = []
+            done = threading.Event()
+            result = {}
+
+            def run():
+                try:
+                    upload(sim, app_image(MAIN_ADDRESS, args.size))
+                except (OSError, RuntimeError) as e:
+                    result["error"] = e
+                done.set()
+
+            threading.Thread(target=run, daemon=True).start()
+            while not done.wait(0.05):
+                loaded.append(probe(sim, streams))
+            if "error" in result:
+                sys.exit("upload failed: %s" % result["error"])
+        finally:
+            for stream in streams:
+                stream.close()
+
+    print("%-7s %6s %8s %8s %8s %5s" % ("when", "probes", "p50_ms", "p95_ms", "max_ms", "lost"))
+    for name, rounds in (("idle", idle), ("upload", loaded)):
+        samples = [s * 1000 for r in rounds for s in r if s is not None]
+        lost = sum(1 for r in rounds for s in r if s is None)
+        print("%-7s %6d %8.2f %8.2f %8.2f %5d" % (name, len(rounds), percentile(samples, 0.5),
+                                                 percentile(samples, 0.95),
+                                                 max(samples, default=float("nan")), lost), flush=True)
+
+
+def bench_clients(args, workdir):
+    request = ("GET %s HTTP/1.1\r\nHost: 127.0.0.1\r\n\r\n" % args.path).encode()
+    lock = threading.Lock()
+    latencies = []
+    statuses = {}
+
+    def client():
+        for _ in range(args.requests):
+            start = time.monotonic()
+            try:
+                with sim.connect(10) as sock:
+                    sock.sendall(request)
+                    status, _, _ = read_response(sock)
+            except OSError:
+                status = None
+            elapsed = time.monotonic() - start
+            with lock:
+                statuses[status] = statuses.get(status, 0) + 1
+                if status == 200:
+                    latencies.append(elapsed * 1000)
+
+    with Sim(args.sim, workdir) as sim:
+        threads = [threading.Thread(target=client) for _ in range(args.clients)]
+        start = time.monotonic()
+        for t in threads:
+            t.start()
+        for t in threads:
+            t.join()
+        elapsed = time.monotonic() - start
+
+    total = args.clients * args.requests
+    print("%7s %8s %8s %8s %8s %6s %6s" % ("clients", "req/s", "p50_ms", "p99_ms", "max_ms", "503", "failed"))
+    print("%7d %8.0f %8.2f %8.2f %8.2f %6d %6d" % (
+        args.clients, total / elapsed, percentile(latencies, 0.5), percentile(latencies, 0.99),
+        max(latencies, default=float("nan")), statuses.get(503, 0),
+        total - statuses.get(200, 0) - statuses.get(503, 0)), flush=True)
+    if not statuses.get(200):
+        sys.exit("no request was answered")
+
+
+def stack_report(sim):
+    """SIGTERM ota_sim and parse what it prints: {task: (depth, used)}"""
+    sim.process.terminate()
+    sim.wait()
+    report = {}
+    with open(sim.log, errors="replace") as log:
+        lines = log.read().splitlines()
+    start = max(i for i, line in enumerate(lines) if line.startswith("task "))
+    for line in lines[start + 1:]:
+        fields = line.split()
+        if len(fields) == 5:
+            report[fields[0]] = (int(fields[2]), int(fields[3]))
+    return report
+
+
+def bench_tasks(args, workdir):
+    request = b"GET /metrics HTTP/1.1\r\nHost: 127.0.0.1\r\n\r\n"
+    print("%-10s %8s %10s %10s %10s %10s" % ("priority", "KB/s", "metrics_p50", "metrics_p95",
+                                            "event_p50", "event_p95"))
+    stacks = {}
+    for name, options in (("equal", []), ("fifo", ["--priorities"])):
+        sim = Sim(args.sim, workdir, "--flash-latency", "esp8266", *options)
+        try:
+            sim.start()
+        except RuntimeError:
+            print("%-10s skipped: SCHED_FIFO not permitted" % name, flush=True)
+            continue
+        try:
+            streams = [EventStream(sim)]
+            done = threading.Event()
+            result = {}
+            metrics_ms = []
+            events = []
+
+            def run():
+                try:
+                    result["elapsed"] = upload(sim, app_image(MAIN_ADDRESS, args.size))
+                except (OSError, RuntimeError) as e:
+                    result["error"] = e
+                done.set()
+
+            def poll():
+                while not done.is_set():
+                    start = time.monotonic()
+                    try:
+                        with sim.connect(10) as sock:
+                            sock.sendall(request)
+                            status, _, _ = read_response(sock)
+                    except OSError:
+                        continue
+                    if status == 200:
+                        metrics_ms.append((time.monotonic() - start) * 1000)
+
+            # the upload first, so it isn't the request turned away when buffers run out
+            threading.Thread(target=run, daemon=True).start()
+            time.sleep(0.2)
+            pollers = [threading.Thread(target=poll, daemon=True) for _ in range(args.clients)]
+            for t in pollers:
+                t.start()
+            while not done.wait(0.05):
+                events += [s * 1000 for s in probe(sim, streams) if s is not None]
+            for t in pollers:
+                t.join()
+            for stream in streams:
+                stream.close()
+            if "error" in result:
+                sys.exit("upload failed: %s" % result["error"])
+            print("%-10s %8.1f %10.2f %10.2f %10.2f %10.2f" % (
+                name, args.size / result["elapsed"] / 1024, percentile(metrics_ms, 0.5),
+                percentile(metrics_ms, 0.95), percentile(events, 0.5), percentile(events, 0.95)), flush=True)
+
+            for task, (depth, used) in stack_report(sim).items():
+                stacks[task] = (depth, max(used, stacks.get(task, (0, 0))[1]))
+        finally:
+            sim.stop()
+        os.remove(sim.flash)
+        os.remove(sim.nvs)
+
+    print("%-16s %8s %10s" % ("task", "depth", "host_used"))
+    for task, (depth, used) in sorted(stacks.items()):
+        print("%-16s %8d %10d" % (task, depth, used), flush=True)
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__, formatter_class=argparse.RawDescriptionHelpFormatter)
+    parser.add_argument("build", help="the host build directory")
+    parser.add_argument("mode", choices=["ota", "sse", "clients", "tasks", "all"])
+    parser.add_argument("--size", type=int, default=256 * 1024, help="bytes per upload")
+    parser.add_argument("--repeat", type=int, default=3, help="uploads per flash model")
+    parser.add_argument("--latency", type=lambda v: v.split(","), default=["esp8266", "none"],
+                        help="flash models, of esp8266 and none")
+    parser.add_argument("--subscribers", type=int, default=2)
+    parser.add_argument("--probes", type=int, default=50, help="latency samples with the simulator idle")
+    parser.add_argument("--clients", type=int, default=8)
+    parser.add_argument("--requests", type=int, default=50, help="per client")
+    parser.add_argument("--path", default="/metrics")
+    parser.add_argument("--quick", action="store_true", help="a short run of each, to check they work")
+    args = parser.parse_args()
+
+    args.sim = os.path.join(args.build, "ota_sim")
+    if args.quick:
+        args.size, args.repeat, args.probes, args.requests = 64 * 1024, 1, 5, 5
+    modes = ["ota", "sse", "clients", "tasks"] if args.mode == "all" else [args.mode]
+    with tempfile.TemporaryDirectory() as workdir:
+        for mode in modes:
+            print("== %s" % mode)
+            globals()["bench_" + mode](args, workdir)
+
+
+if __name__ == "__main__":
+    main()
@@ -0,0 +1,75 @@
+// http_parser speed on a browser's request, fed whole and as it often arrives from
+//  lwIP: in TCP segments of a few hundred bytes
+//
+//   http_parser_bench [iterations]
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "http_parser.h"
+
+static const char *const wanted[] = {
+    "Content-Encoding", "Content-Range", "If-None-Match", "Last-Event-ID", "Range",
+    "Sec-WebSocket-Key", "X-Image-SHA256", "X-OTA-Session", NULL,
+};
+
+static const char request[] =
+    "GET /event?level=I&tags=main HTTP/1.1\r\n"
+    "Host: 192.168.4.1\r\n"
+    "Connection: keep-alive\r\n"
+    "Accept: text/event-stream\r\n"
+    "Cache-Control: no-cache\r\n"
+    "User-Agent: Mozilla/5.0 (X11; Linux x86_64; rv:121.0) Gecko/20100101 Firefox/121.0\r\n"
+    "Accept-Language: en-GB,en;q=0.5\r\n"
+    "Accept-Encoding: gzip, deflate\r\n"
+    "Referer: http://192.168.4.1/\r\n"
+    "Last-Event-ID: 42\r\n"
+    "Sec-Fetch-Dest: empty\r\n"
+    "Sec-Fetch-Mode: cors\r\n"
+    "Sec-Fetch-Site: same-origin\r\n"
+    "Pragma: no-cache\r\n"
+    "\r\n";
+
+static double now_s(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static double run(int iterations, size_t segment) {
+    size_t len = strlen(request);
+    http_parser_t p;
+    int done = 0;
+    double start = now_s();
+    for (int i = 0; i < iterations; i++) {
+        http_parser_init(&p, wanted);
+        http_parse_result_t result = HTTP_PARSE_INCOMPLETE;
+        for (size_t fed = segment; result == HTTP_PARSE_INCOMPLETE; fed += segment) {
+            result = http_parser_feed(&p, request, (fed < len) ? fed : len);
+        }
+        done += (result == HTTP_PARSE_DONE && p.header_count == 1);
+    }
+    double elapsed = now_s() - start;
+    if (done != iterations) {
+        fprintf(stderr, "parsed %d of %d\n", done, iterations);
+        exit(1);
+    }
+    return elapsed;
+}
+
+int main(int argc, char **argv) {
+    int iterations = (argc > 1) ? atoi(argv[1]) : 1000000;
+    size_t len = strlen(request);
+
+    printf("%zu byte request, %d iterations\n", len, iterations);
+    printf("%8s %10s %8s\n", "segment", "ns/req", "MB/s");
+    static const size_t segments[] = { 1, 64, 536, 1460 };
+    for (size_t i = 0; i < sizeof(segments) / sizeof(segments[0]); i++) {
+        int n = (segments[i] == 1) ? iterations / 10 : iterations;
+        double elapsed = run(n, segments[i]);
+        printf("%8zu %10.0f %8.1f\n", segments[i], elapsed / n * 1e9, len * n / elapsed / 1e6);
+    }
+    return 0;
+}
@@ -0,0 +1,77 @@
+// log_capture under contention: 1 to 8 tasks logging as fast as they can while one
+//  reader drains the ring, as the sse task does. Reports what gets through per second
+//  and how much is dropped, both for want of ring space and of staging slots (more
+//  tasks than LOG_CAPTURE_PRODUCERS logging at once)
+//
+//   log_capture_bench [seconds per run]
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+
+#include "esp_log.h"
+#include "esp_timer.h"
+#include "host.h"
+#include "log_capture.h"
+
+static const char *TAG = "bench";
+
+static volatile bool running;
+static volatile int active;
+
+static void producer_task(void *param) {
+    for (uint32_t n = 0; running; n++) {
+        // a typical line, about 50 characters
+        ESP_LOGI(TAG, "upload %u bytes of %u, %u KB/s", n * 1024, 655360, n % 700);
+    }
+    __atomic_sub_fetch(&active, 1, __ATOMIC_SEQ_CST);
+    vTaskDelete(NULL);
+}
+
+int main(int argc, char **argv) {
+    double seconds = (argc > 1) ? atof(argv[1]) : 1.0;
+    static const int producer_counts[] = { 1, 2, 4, 8 };
+
+    host_log_quiet(true);
+    log_capture_init();
+
+    printf("%d byte ring, %.1f s per run\n", CONFIG_LOG_CAPTURE_RING_SIZE, seconds);
+    printf("%9s %10s %10s %10s %8s\n", "producers", "lines/s", "chars/s", "dropped/s", "dropped");
+    for (size_t i = 0; i < sizeof(producer_counts) / sizeof(producer_counts[0]); i++) {
+        int producers = producer_counts[i];
+        uint32_t dropped_before = log_capture_dropped();
+        uint64_t lines = 0, chars = 0;
+
+        running = true;
+        active = producers;
+        for (int p = 0; p < producers; p++) {
+            char name[16];
+            sprintf(name, "log%d", p);
+            xTaskCreate(producer_task, name, 8192, NULL, 5, NULL);
+        }
+
+        int64_t start = esp_timer_get_time();
+        int64_t end = start + (int64_t)(seconds * 1000000);
+        log_record_t record;
+        while (esp_timer_get_time() < end) {
+            if (log_capture_read(&record, pdMS_TO_TICKS(10))) {
+                lines++;
+                chars += record.len + 1;
+            }
+        }
+        running = false;
+        while (active > 0 || log_capture_read(&record, 0)) {
+            vTaskDelay(1);
+        }
+        double elapsed = (esp_timer_get_time() - start) / 1e6;
+
+        uint32_t dropped = log_capture_dropped() - dropped_before;
+        printf("%9d %10.0f %10.0f %10.0f %7.1f%%\n", producers, lines / elapsed, chars / elapsed,
+            dropped / elapsed, 100.0 * dropped / (lines + dropped));
+        fflush(stdout);
+    }
+    return 0;
+}
@@ -0,0 +1,112 @@
+// Upload throughput with the ESP8266 flash model, written the way handle_upload() did
+//  before the pipeline (read a fragment, write it, read the next) and through
+//  ota_pipeline, across a range of network rates. The network is a sleep per
+//  fragment at the link rate; the flash is HOST_FLASH_LATENCY_ESP8266, so neither
+//  depends on this machine's speed.
+//
+//   ota_throughput [--size BYTES] [--quick]
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "esp_partition.h"
+#include "esp_timer.h"
+
+#include "host.h"
+#include "ota_pipeline.h"
+#include "ota_writer.h"
+#include "server.h"
+
+// what one read() returns at 'kbps' KB/s
+static void network_read(uint8_t *buf, size_t len, uint32_t kbps) {
+    for (size_t i = 0; i < len; i += 4) {
+        uint32_t r = rand();
+        memcpy(buf + i, &r, (len - i < 4) ? len - i : 4);
+    }
+    usleep((useconds_t)(len * 1000000ull / (kbps * 1024ull)));
+}
+
+static double serial_kbps(const esp_partition_t *partition, size_t size, uint32_t kbps) {
+    static uint8_t buf[SERVER_BUFF_SIZE];
+    ota_writer_t writer = ota_writer_create(partition, 0, size, NULL, NULL);
+    int64_t start = esp_timer_get_time();
+    for (size_t done = 0; done < size; done += sizeof(buf)) {
+        network_read(buf, sizeof(buf), kbps);
+        ota_writer_write(writer, buf, sizeof(buf));
+    }
+    ota_writer_flush(writer);
+    int64_t elapsed = esp_timer_get_time() - start;
+    ota_writer_delete(writer);
+    return size * 1000000.0 / 1024 / elapsed;
+}
+
+static double pipeline_kbps(const esp_partition_t *partition, size_t size, uint32_t kbps) {
+    ota_pipeline_config_t config = {
+        .partition = partition,
+        .size = size,
+        .encoding = OTA_ENCODING_NONE,
+    };
+    ota_pipeline_t pipeline = ota_pipeline_start(&config);
+    int64_t start = esp_timer_get_time();
+    for (size_t done = 0; done < size; ) {
+        size_t chunk_size;
+        uint8_t *chunk = ota_pipeline_acquire(pipeline, &chunk_size);
+        // as read() on the upload socket: up to a buffer, usually less
+        size_t len = (size - done < SERVER_BUFF_SIZE) ? size - done : SERVER_BUFF_SIZE;
+        network_read(chunk, len, kbps);
+        ota_pipeline_submit(pipeline, chunk, len);
+        done += len;
+    }
+    ota_pipeline_finish(pipeline, NULL);
+    int64_t elapsed = esp_timer_get_time() - start;
+    return size * 1000000.0 / 1024 / elapsed;
+}
+
+int main(int argc, char **argv) {
+    static const uint32_t link_kbps[] = { 50, 100, 200, 400, 800 };
+    size_t size = 128 * 1024;
+    int links = sizeof(link_kbps) / sizeof(link_kbps[0]);
+
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "--size") == 0 && i + 1 < argc) {
+            size = strtoul(argv[++i], NULL, 0) & ~(SERVER_BUFF_SIZE - 1);
+        } else if (strcmp(argv[i], "--quick") == 0) {
+            size = 16 * 1024;
+            links = 2;
+        } else {
+            fprintf(stderr, "usage: %s [--size BYTES] [--quick]\n", argv[0]);
+            return 2;
+        }
+    }
+
+    host_log_quiet(true);
+    host_flash_latency_t latency = HOST_FLASH_LATENCY_ESP8266;
+    if (host_flash_open(NULL, HOST_PARTITION_TABLE, HOST_FLASH_SIZE_DEFAULT) != ESP_OK) {
+        return 1;
+    }
+    host_flash_set_latency(&latency);
+    const esp_partition_t *partition = esp_partition_find_first(ESP_PARTITION_TYPE_APP,
+        ESP_PARTITION_SUBTYPE_APP_OTA_1, NULL);
+
+    // the flash alone: erase and program every sector
+    double flash_kbps = 4.0 * 1000000 / (latency.erase_sector_us + 4 * latency.write_kb_us);
+    printf("%u KB image, %d x %d byte pipeline buffers, flash alone %.1f KB/s\n",
+        (unsigned)(size / 1024), CONFIG_OTA_PIPELINE_BUFFERS, CONFIG_OTA_PIPELINE_BUFFER_SIZE, flash_kbps);
+    printf("%9s %10s %10s %8s\n", "link_KB/s", "serial", "pipeline", "gain");
+    for (int i = 0; i < links; i++) {
+        double serial = serial_kbps(partition, size, link_kbps[i]);
+        double pipelined = pipeline_kbps(partition, size, link_kbps[i]);
+        printf("%9u %10.1f %10.1f %7.0f%%\n", link_kbps[i], serial, pipelined, (pipelined / serial - 1) * 100);
+        fflush(stdout);
+    }
+
+    host_flash_stats_t stats;
+    host_flash_get_stats(&stats);
+    if (stats.unerased_writes != 0) {
+        fprintf(stderr, "%u writes over data that wasn't erased\n", stats.unerased_writes);
+        return 1;
+    }
+    return 0;
+}
@@ -0,0 +1,126 @@
+// RAM the /event replay history costs at one CONFIG_SSE_REPLAY_DEPTH (this bench is
+//  built once per depth; 'cmake --build . --target replay_bench' runs them all). The
+//  events of an upload go through sse.c with one subscriber kept up to date: per
+//  second, a few log lines, a coalesced progress update and a 'sectors' event, and a
+//  metrics event every other second. Then a subscriber that reconnects without
+//  Last-Event-ID is sent everything kept.
+//
+//  The pools are sized well past what's needed, so their peaks show what this depth
+//  uses: peak blocks times block size is the pool RAM to configure, and the history
+//  itself adds a pointer (4 bytes on the device) per event it can keep.
+//
+//   sse_replay_bench_<depth> [--header] [seconds of upload]
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "pool.h"
+#include "sse.h"
+
+static int server_fd, peer_fd;
+
+static int64_t now_us(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (int64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+// Send what is queued for the subscriber and read it, as the server loop and a
+//  browser would. Returns the bytes it was sent
+static size_t deliver(int fd, int peer) {
+    static char buf[4096];
+    size_t total = 0;
+    while (sse_client_pending(fd)) {
+        if (sse_client_flush(fd) < 0) {
+            fprintf(stderr, "subscriber dropped\n");
+            exit(1);
+        }
+        ssize_t n;
+        while ((n = recv(peer, buf, sizeof(buf), MSG_DONTWAIT)) > 0) {
+            total += n;
+        }
+    }
+    return total;
+}
+
+static void subscribe(int *fd, int *peer) {
+    int fds[2];
+    if (socketpair(AF_UNIX, SOCK_STREAM, 0, fds) != 0 || !sse_add_client(fds[0], NULL, NULL)) {
+        fprintf(stderr, "no subscriber\n");
+        exit(1);
+    }
+    *fd = fds[0];
+    *peer = fds[1];
+}
+
+static void log_line(const char *tag, const char *message) {
+    sse_broadcast_log(message, NULL, 3, tag, strlen(tag));
+    deliver(server_fd, peer_fd);
+}
+
+static void event(const char *message, const char *name, bool coalesce) {
+    sse_broadcast(message, name, coalesce);
+    deliver(server_fd, peer_fd);
+}
+
+int main(int argc, char **argv) {
+    int arg = 1;
+    if (arg < argc && strcmp(argv[arg], "--header") == 0) {
+        printf("%5s %5s %8s %8s %6s %6s %8s %9s %10s\n", "depth", "kept", "held_B", "index_B",
+               "small", "large", "pool_B", "replay_B", "replay_us");
+        arg++;
+    }
+    int seconds = (arg < argc) ? atoi(argv[arg]) : 120;
+
+    // about the size of the firmware's own, /metrics JSON included
+    char metrics[640];
+    memset(metrics, '0', sizeof(metrics) - 1);
+    metrics[sizeof(metrics) - 1] = '\0';
+    char message[128];
+
+    sse_init(NULL);
+    subscribe(&server_fd, &peer_fd);
+    for (int s = 0; s < seconds; s++) {
+        for (int i = 0; i < 4; i++) {
+            snprintf(message, sizeof(message), "I (%d) ota_writer: sector 0x%05x written, %u bytes in %u ms",
+                     s * 1000 + i * 250, 0x10000 + (s * 4 + i) * 0x1000, 4096, 23 + i);
+            log_line("ota_writer", message);
+        }
+        snprintf(message, sizeof(message), "W (%d) server: socket %d idle, closing", s * 1000 + 990, 4 + s % 5);
+        log_line("server", message);
+        snprintf(message, sizeof(message), "{\"progress\":\"%d\", \"status\":\"Writing..\"}", s * 100 / seconds);
+        event(message, "update", true);
+        snprintf(message, sizeof(message), "{\"written\":%d,\"skipped\":%d}", s * 4, s / 3);
+        event(message, "sectors", false);
+        if (s % 2 == 0) {
+            event(metrics, "metrics", true);
+        }
+    }
+
+    sse_stats_t stats;
+    pool_stats_t small, large;
+    sse_get_stats(&stats);
+    pool_get_stats(&sse_frame_pool, &small);
+    pool_get_stats(&sse_large_frame_pool, &large);
+    if (small.exhausted != 0 || large.exhausted != 0) {
+        fprintf(stderr, "pools ran out: sized too small for this bench\n");
+        return 1;
+    }
+
+    // a browser reconnecting, to everything kept
+    int fd, peer;
+    subscribe(&fd, &peer);
+    int64_t start = now_us();
+    size_t replayed = deliver(fd, peer);
+    int64_t elapsed = now_us() - start;
+
+    printf("%5d %5u %8u %8u %6u %6u %8u %9zu %10lld\n", CONFIG_SSE_REPLAY_DEPTH, stats.history,
+           (unsigned)stats.history_bytes, (unsigned)(CONFIG_SSE_REPLAY_DEPTH * sizeof(uint32_t)),
+           small.peak, large.peak, (unsigned)(small.peak * small.block_size + large.peak * large.block_size),
+           replayed, (long long)elapsed);
+    return 0;
+}
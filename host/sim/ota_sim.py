@@ -0,0 +1,135 @@
+"""Start ota_sim and talk to it over HTTP, for host_bench.py and the tests.
+
+    with Sim(path_to_ota_sim, workdir) as sim:
+        status, headers, body = sim.request("GET", "/metrics")
+"""
+
+import os
+import socket
+import struct
+import subprocess
+import time
+
+RESTART_EXIT_CODE = 3           # HOST_RESTART_EXIT_CODE in stubs/host.h
+
+APP_ENTRY_BASE = 0x40200010     # as in main/ota_target.c
+BOOT_ADDRESS = 0x10000          # the ota_0 and ota_1 slots of custom.csv
+MAIN_ADDRESS = 0x60000
+CHECKSUM_SEED = 0xEF
+
+
+def app_image(address, size, fill=None):
+    """A valid app image of 'size' bytes (a multiple of 16) for the slot at 'address':
+    one segment of 'fill' (random by default) and the checksum"""
+    data_len = size - 32
+    data = fill(data_len) if fill else os.urandom(data_len)
+    header = struct.pack("<BBBBI", 0xE9, 1, 0, 0, APP_ENTRY_BASE + address + 0x100)
+    segment = struct.pack("<II", APP_ENTRY_BASE + address, data_len)
+    checksum = CHECKSUM_SEED
+    for b in data:
+        checksum ^= b
+    return header + segment + data + bytes(15) + bytes([checksum])
+
+
+def free_port():
+    with socket.socket() as s:
+        s.bind(("127.0.0.1", 0))
+        return s.getsockname()[1]
+
+
+class Sim:
+    """An ota_sim process with its flash and NVS files in 'workdir', kept across
+    restart() so a second run boots what the first one installed"""
+
+    def __init__(self, binary, workdir, *args, quiet=True):
+        self.binary = binary
+        self.workdir = workdir
+        self.args = list(args) + (["--quiet"] if quiet else [])
+        self.flash = os.path.join(workdir, "flash.bin")
+        self.nvs = os.path.join(workdir, "nvs.bin")
+        self.log = os.path.join(workdir, "sim.log")
+        self.process = None
+        self.port = None
+
+    def __enter__(self):
+        self.start()
+        return self
+
+    def __exit__(self, *exc):
+        self.stop()
+
+    def start(self, timeout=10):
+        self.port = free_port()
+        command = [self.binary, "--port", str(self.port), "--flash", self.flash,
+                   "--nvs", self.nvs] + self.args
+        with open(self.log, "ab") as log:
+            self.process = subprocess.Popen(command, stdout=log, stderr=log)
+        deadline = time.monotonic() + timeout
+        while True:
+            try:
+                socket.create_connection(("127.0.0.1", self.port), timeout=1).close()
+                return
+            except OSError:
+                if self.process.poll() is not None or time.monotonic() > deadline:
+                    raise RuntimeError("ota_sim didn't start; see %s" % self.log)
+                time.sleep(0.02)
+
+    def stop(self):
+        if self.process is not None and self.process.poll() is None:
+            self.process.kill()
+        if self.process is not None:
+            self.process.wait()
+
+    def wait(self, timeout=10):
+        """Exit code, once the process ends (e.g. restarts)"""
+        return self.process.wait(timeout)
+
+    def restart(self):
+        """After an esp_restart(): start again on the same flash and NVS"""
+        code = self.wait()
+        if code != RESTART_EXIT_CODE:
+            raise RuntimeError("ota_sim exited with %d, not a restart" % code)
+        self.start()
+
+    def connect(self, timeout=10):
+        return socket.create_connection(("127.0.0.1", self.port), timeout=timeout)
+
+    def request(self, method, path, headers=(), body=b"", raw=None, timeout=30):
+        """Send one request ('raw' replaces the one built from the arguments) and return
+        (status, {lowercased name: value}, body). The body is read up to Content-Length,
+        or until the connection closes"""
+        if raw is None:
+            lines = ["%s %s HTTP/1.1" % (method, path), "Host: 127.0.0.1:%d" % self.port]
+            lines += ["%s: %s" % h for h in headers]
+            if body or method == "POST":
+                lines.append("Content-Length: %d" % len(body))
+            raw = ("\r\n".join(lines) + "\r\n\r\n").encode() + body
+        with self.connect(timeout) as sock:
+            sock.sendall(raw)
+            return read_response(sock)
+
+
+def read_response(sock):
+    data = b""
+    while b"\r\n\r\n" not in data:
+        chunk = sock.recv(4096)
+        if not chunk:
+            if not data:
+                return None, {}, b""
+            break
+        data += chunk
+    head, _, rest = data.partition(b"\r\n\r\n")
+    lines = head.decode(errors="replace").split("\r\n")
+    status = int(lines[0].split(" ")[1])
+    headers = {}
+    for line in lines[1:]:
+        name, _, value = line.partition(":")
+        headers[name.strip().lower()] = value.strip()
+    # no body to a 304, whatever the headers; otherwise up to the length, or the close
+    length = 0 if status == 304 else int(headers.get("content-length", -1))
+    while length < 0 or len(rest) < length:
+        chunk = sock.recv(4096)
+        if not chunk:
+            break
+        rest += chunk
+    return status, headers, rest
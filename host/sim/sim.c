@@ -0,0 +1,120 @@
+// ota_sim: the firmware's app_main() on this machine. The flash chip and NVS are
+//  files, so an upload, a restart (exit code HOST_RESTART_EXIT_CODE) and the next run
+//  see what a device would. On SIGTERM it prints each task's stack use to stderr, and
+//  exits.
+//
+//   ota_sim --port 8080 --flash flash.bin --nvs nvs.bin --flash-latency esp8266
+
+#include <getopt.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+
+#include "host.h"
+
+void app_main(void);
+
+uint16_t host_listen_port = 8080;
+
+static void usage(const char *name) {
+    fprintf(stderr,
+        "usage: %s [options]\n"
+        "  --port N                 listen here instead of %u\n"
+        "  --flash FILE             flash image, created erased if missing (default: in memory)\n"
+        "  --flash-size N           bytes, for a new image (default %u)\n"
+        "  --table CSV              partition table (default %s)\n"
+        "  --nvs FILE               NVS contents, kept across runs (default: in memory)\n"
+        "  --flash-latency MODEL    esp8266 or none (default none)\n"
+        "  --priorities             run tasks under SCHED_FIFO at their priorities\n"
+        "  --quiet                  no log output\n",
+        name, host_listen_port, HOST_FLASH_SIZE_DEFAULT, HOST_PARTITION_TABLE);
+}
+
+int main(int argc, char **argv) {
+    static const struct option options[] = {
+        { "port",           required_argument, NULL, 'p' },
+        { "flash",          required_argument, NULL, 'f' },
+        { "flash-size",     required_argument, NULL, 's' },
+        { "table",          required_argument, NULL, 't' },
+        { "nvs",            required_argument, NULL, 'n' },
+        { "flash-latency",  required_argument, NULL, 'l' },
+        { "priorities",     no_argument,       NULL, 'r' },
+        { "quiet",          no_argument,       NULL, 'q' },
+        { "help",           no_argument,       NULL, 'h' },
+        { NULL },
+    };
+    const char *flash_path = NULL;
+    const char *nvs_path = NULL;
+    const char *table = HOST_PARTITION_TABLE;
+    size_t flash_size = HOST_FLASH_SIZE_DEFAULT;
+    bool priorities = false;
+    int opt;
+
+    while ((opt = getopt_long(argc, argv, "", options, NULL)) != -1) {
+        switch (opt) {
+        case 'p':
+            host_listen_port = (uint16_t)atoi(optarg);
+            break;
+        case 'f':
+            flash_path = optarg;
+            break;
+        case 's':
+            flash_size = strtoul(optarg, NULL, 0);
+            break;
+        case 't':
+            table = optarg;
+            break;
+        case 'n':
+            nvs_path = optarg;
+            break;
+        case 'l':
+            if (strcmp(optarg, "esp8266") == 0) {
+                host_flash_latency_t latency = HOST_FLASH_LATENCY_ESP8266;
+                host_flash_set_latency(&latency);
+            } else if (strcmp(optarg, "none") != 0) {
+                usage(argv[0]);
+                return 2;
+            }
+            break;
+        case 'r':
+            priorities = true;
+            break;
+        case 'q':
+            host_log_quiet(true);
+            break;
+        default:
+            usage(argv[0]);
+            return (opt == 'h') ? 0 : 2;
+        }
+    }
+
+    if (host_flash_open(flash_path, table, flash_size) != ESP_OK) {
+        return 1;
+    }
+    if (nvs_path != NULL && host_nvs_open(nvs_path) != ESP_OK) {
+        return 1;
+    }
+    if (priorities && !host_task_priorities(true)) {
+        fprintf(stderr, "--priorities needs CAP_SYS_NICE\n");
+        return 1;
+    }
+
+    // every task inherits the mask, so SIGTERM only ever reaches sigwait() below
+    sigset_t term;
+    sigemptyset(&term);
+    sigaddset(&term, SIGTERM);
+    pthread_sigmask(SIG_BLOCK, &term, NULL);
+
+    // as on the device, the tasks app_main() started carry on without it
+    app_main();
+
+    int sig;
+    sigwait(&term, &sig);
+    host_task_report(stderr);
+    return 0;
+}
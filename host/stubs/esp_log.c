@@ -0,0 +1,58 @@
+#include <stdarg.h>
+#include <stdio.h>
+
+#include "esp_log.h"
+#include "esp_timer.h"
+#include "host.h"
+
+#define HOST_LOG_LINE_MAX 512
+
+static bool quiet;
+
+// whole lines to stderr, so lines of different threads don't interleave
+static int host_log_putchar(int chr) {
+    static __thread char line[HOST_LOG_LINE_MAX];
+    static __thread size_t len;
+
+    if (len < sizeof(line)) {
+        line[len++] = chr;
+    }
+    if (chr == '\n' || len == sizeof(line)) {
+        if (!quiet) {
+            fwrite(line, 1, len, stderr);
+        }
+        len = 0;
+    }
+    return chr;
+}
+
+static putchar_like_t log_putchar = host_log_putchar;
+
+putchar_like_t esp_log_set_putchar(putchar_like_t func) {
+    putchar_like_t old = log_putchar;
+    log_putchar = func;
+    return old;
+}
+
+uint32_t esp_log_timestamp(void) {
+    return (uint32_t)(esp_timer_get_time() / 1000);
+}
+
+void esp_log_write(esp_log_level_t level, const char *tag, const char *format, ...) {
+    char text[HOST_LOG_LINE_MAX];
+    va_list args;
+
+    va_start(args, format);
+    int len = vsnprintf(text, sizeof(text), format, args);
+    va_end(args);
+    if (len > (int)sizeof(text) - 1) {
+        len = sizeof(text) - 1;
+    }
+    for (int i = 0; i < len; i++) {
+        log_putchar(text[i]);
+    }
+}
+
+void host_log_quiet(bool on) {
+    quiet = on;
+}
@@ -0,0 +1,27 @@
+#pragma once
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "esp_err.h"
+#include "esp_partition.h"
+
+// The boot selection is a sequence number at the start of the otadata partition; 
+//  what it picked when the flash was opened is the running partition. With nothing
+//  selected it is the first app partition
+
+const esp_partition_t *esp_ota_get_running_partition(void);
+const esp_partition_t *esp_ota_get_boot_partition(void);
+
+// Verifies the image first, as the SDK does. ESP_ERR_OTA_VALIDATE_FAILED if it isn't one
+esp_err_t esp_ota_set_boot_partition(const esp_partition_t *partition);
+
+const esp_partition_t *esp_ota_get_next_update_partition(const esp_partition_t *start_from);
+
+#ifdef __cplusplus
+}
+#endif
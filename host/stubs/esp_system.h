@@ -0,0 +1,31 @@
+#pragma once
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stdint.h>
+
+#include "esp_err.h"
+#include "esp_timer.h"
+
+typedef enum {
+    ESP_MAC_WIFI_STA = 0,
+    ESP_MAC_WIFI_SOFTAP,
+} esp_mac_type_t;
+
+// Runs the restart hook (see host.h). By default the process exits with
+//  HOST_RESTART_EXIT_CODE, for whatever started it to start it again
+void esp_restart(void) __attribute__((noreturn));
+
+uint32_t esp_random(void);
+
+// no heap to speak of on a host: both are 0
+uint32_t esp_get_free_heap_size(void);
+uint32_t esp_get_minimum_free_heap_size(void);
+
+esp_err_t esp_read_mac(uint8_t *mac, esp_mac_type_t type);
+
+#ifdef __cplusplus
+}
+#endif
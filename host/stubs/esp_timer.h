@@ -0,0 +1,14 @@
+#pragma once
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stdint.h>
+
+// us since the process started, or the fake clock's time (see host.h)
+int64_t esp_timer_get_time(void);
+
+#ifdef __cplusplus
+}
+#endif
@@ -0,0 +1,485 @@
+#define _GNU_SOURCE
+#include <ctype.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "esp_image_format.h"
+#include "esp_log.h"
+#include "esp_ota_ops.h"
+#include "esp_partition.h"
+#include "esp_spi_flash.h"
+#include "host.h"
+
+static const char *TAG = "host_flash";
+
+// The partition table itself sits at 0x8000, so the first partition without an offset
+//  goes after it, as gen_esp32part.py places it
+#define HOST_PARTITION_TABLE_END    0x9000
+#define HOST_APP_ALIGN              0x10000
+#define HOST_MAX_PARTITIONS         16
+
+static uint8_t *flash;
+static size_t flash_size;
+static int flash_fd = -1;
+static esp_partition_t partitions[HOST_MAX_PARTITIONS];
+static int partition_count;
+static const esp_partition_t *running;
+
+// one operation at a time, as the SPI flash driver's lock allows
+static pthread_mutex_t flash_lock = PTHREAD_MUTEX_INITIALIZER;
+static host_flash_latency_t latency;
+static host_flash_stats_t stats;
+
+static void flash_delay(uint64_t us) {
+    if (us > 0) {
+        struct timespec ts = { .tv_sec = us / 1000000, .tv_nsec = (us % 1000000) * 1000 };
+        while (nanosleep(&ts, &ts) != 0 && errno == EINTR);
+    }
+}
+
+// '0x10000', '64K', '1M' or plain decimal
+static bool parse_size(const char *s, uint32_t *out) {
+    char *end;
+    unsigned long n = strtoul(s, &end, 0);
+    if (end == s) {
+        return false;
+    }
+    if (*end == 'K' || *end == 'k') {
+        n *= 1024;
+        end++;
+    } else if (*end == 'M' || *end == 'm') {
+        n *= 1024 * 1024;
+        end++;
+    }
+    *out = n;
+    return *end == '\0';
+}
+
+static bool parse_type(const char *s, esp_partition_type_t *type) {
+    if (strcmp(s, "app") == 0) {
+        *type = ESP_PARTITION_TYPE_APP;
+    } else if (strcmp(s, "data") == 0) {
+        *type = ESP_PARTITION_TYPE_DATA;
+    } else {
+        uint32_t n;
+        if (!parse_size(s, &n) || n > 0xfe) {
+            return false;
+        }
+        *type = (esp_partition_type_t)n;
+    }
+    return true;
+}
+
+static bool parse_subtype(const char *s, esp_partition_type_t type, esp_partition_subtype_t *subtype) {
+    static const struct { esp_partition_type_t type; const char *name; esp_partition_subtype_t subtype; } names[] = {
+        { ESP_PARTITION_TYPE_APP, "factory", ESP_PARTITION_SUBTYPE_APP_FACTORY },
+        { ESP_PARTITION_TYPE_APP, "test", ESP_PARTITION_SUBTYPE_APP_TEST },
+        { ESP_PARTITION_TYPE_DATA, "ota", ESP_PARTITION_SUBTYPE_DATA_OTA },
+        { ESP_PARTITION_TYPE_DATA, "phy", ESP_PARTITION_SUBTYPE_DATA_PHY },
+        { ESP_PARTITION_TYPE_DATA, "nvs", ESP_PARTITION_SUBTYPE_DATA_NVS },
+    };
+    for (size_t i = 0; i < sizeof(names) / sizeof(names[0]); i++) {
+        if (names[i].type == type && strcmp(names[i].name, s) == 0) {
+            *subtype = names[i].subtype;
+            return true;
+        }
+    }
+    if (type == ESP_PARTITION_TYPE_APP && strncmp(s, "ota_", 4) == 0) {
+        int n = atoi(s + 4);
+        *subtype = (esp_partition_subtype_t)(ESP_PARTITION_SUBTYPE_APP_OTA_MIN + n);
+        return n >= 0 && *subtype <= ESP_PARTITION_SUBTYPE_APP_OTA_MAX;
+    }
+    uint32_t n;
+    if (*s == '\0') {
+        n = 0;
+    } else if (!parse_size(s, &n) || n > 0xfe) {
+        return false;
+    }
+    *subtype = (esp_partition_subtype_t)n;
+    return true;
+}
+
+static char *trim(char *s) {
+    while (isspace((unsigned char)*s)) {
+        s++;
+    }
+    char *end = s + strlen(s);
+    while (end > s && isspace((unsigned char)end[-1])) {
+        *--end = '\0';
+    }
+    return s;
+}
+
+// name, type, subtype, offset, size[, flags]
+static esp_err_t load_table(const char *path) {
+    FILE *f = fopen(path, "r");
+    if (f == NULL) {
+        ESP_LOGE(TAG, "can't open partition table %s: %s", path, strerror(errno));
+        return ESP_ERR_NOT_FOUND;
+    }
+    char line[256];
+    int line_no = 0;
+    uint32_t next = HOST_PARTITION_TABLE_END;
+    esp_err_t err = ESP_OK;
+
+    partition_count = 0;
+    while (err == ESP_OK && fgets(line, sizeof(line), f) != NULL) {
+        line_no++;
+        char *hash = strchr(line, '#');
+        if (hash != NULL) {
+            *hash = '\0';
+        }
+        char *fields[6] = { 0 };
+        int n = 0;
+        for (char *p = line, *field; n < 6 && (field = strsep(&p, ",")) != NULL; ) {
+            fields[n++] = trim(field);
+        }
+        if (n == 0 || (n == 1 && fields[0][0] == '\0')) {
+            continue;
+        }
+
+        esp_partition_t *part = &partitions[partition_count];
+        memset(part, 0, sizeof(*part));
+        uint32_t offset = 0;
+        if (n < 5 || partition_count == HOST_MAX_PARTITIONS || strlen(fields[0]) > 16 ||
+                !parse_type(fields[1], &part->type) ||
+                !parse_subtype(fields[2], part->type, &part->subtype) ||
+                (fields[3][0] != '\0' && !parse_size(fields[3], &offset)) ||
+                !parse_size(fields[4], &part->size)) {
+            ESP_LOGE(TAG, "%s:%d: bad partition", path, line_no);
+            err = ESP_ERR_INVALID_ARG;
+            break;
+        }
+        if (fields[3][0] == '\0') {
+            uint32_t align = (part->type == ESP_PARTITION_TYPE_APP) ? HOST_APP_ALIGN : SPI_FLASH_SEC_SIZE;
+            offset = (next + align - 1) / align * align;
+        }
+        strcpy(part->label, fields[0]);
+        part->address = offset;
+        part->encrypted = (n == 6 && strstr(fields[5], "encrypted") != NULL);
+        next = offset + part->size;
+        if (next > flash_size) {
+            ESP_LOGE(TAG, "%s:%d: partition '%s' ends at 0x%x, past the end of flash",
+                path, line_no, part->label, next);
+            err = ESP_ERR_INVALID_SIZE;
+            break;
+        }
+        partition_count++;
+    }
+    fclose(f);
+    return err;
+}
+
+esp_err_t host_flash_open(const char *path, const char *table, size_t size) {
+    bool erase = true;
+
+    host_flash_close();
+    flash_size = size;
+    if (path != NULL) {
+        struct stat st;
+        flash_fd = open(path, O_RDWR | O_CREAT, 0644);
+        if (flash_fd < 0 || fstat(flash_fd, &st) != 0) {
+            ESP_LOGE(TAG, "can't open flash image %s: %s", path, strerror(errno));
+            return ESP_FAIL;
+        }
+        erase = (st.st_size == 0);
+        if (ftruncate(flash_fd, size) != 0) {
+            ESP_LOGE(TAG, "can't size flash image %s: %s", path, strerror(errno));
+            return ESP_FAIL;
+        }
+        flash = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, flash_fd, 0);
+    } else {
+        flash = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    }
+    if (flash == MAP_FAILED) {
+        flash = NULL;
+        ESP_LOGE(TAG, "can't map flash: %s", strerror(errno));
+        return ESP_FAIL;
+    }
+    if (erase) {
+        memset(flash, 0xff, size);
+    }
+
+    esp_err_t err = load_table(table);
+    if (err == ESP_OK) {
+        running = esp_ota_get_boot_partition();
+    }
+    return err;
+}
+
+void host_flash_close(void) {
+    if (flash != NULL) {
+        munmap(flash, flash_size);
+        flash = NULL;
+    }
+    if (flash_fd >= 0) {
+        close(flash_fd);
+        flash_fd = -1;
+    }
+    partition_count = 0;
+    running = NULL;
+}
+
+uint8_t *host_flash_data(void) {
+    return flash;
+}
+
+void host_flash_set_latency(const host_flash_latency_t *l) {
+    latency = *l;
+}
+
+void host_flash_get_stats(host_flash_stats_t *out) {
+    pthread_mutex_lock(&flash_lock);
+    *out = stats;
+    pthread_mutex_unlock(&flash_lock);
+}
+
+void host_flash_reset_stats(void) {
+    pthread_mutex_lock(&flash_lock);
+    memset(&stats, 0, sizeof(stats));
+    pthread_mutex_unlock(&flash_lock);
+}
+
+// Partitions
+
+const esp_partition_t *esp_partition_find_first(esp_partition_type_t type,
+        esp_partition_subtype_t subtype, const char *label) {
+    for (int i = 0; i < partition_count; i++) {
+        const esp_partition_t *p = &partitions[i];
+        if ((type == ESP_PARTITION_TYPE_ANY || p->type == type) &&
+            (subtype == ESP_PARTITION_SUBTYPE_ANY || p->subtype == subtype) &&
+            (label == NULL || strcmp(p->label, label) == 0)) {
+            return p;
+        }
+    }
+    return NULL;
+}
+
+static esp_err_t check_range(const esp_partition_t *partition, size_t offset, size_t size) {
+    if (partition == NULL || flash == NULL) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    if (offset > partition->size || size > partition->size - offset) {
+        return ESP_ERR_INVALID_SIZE;
+    }
+    return ESP_OK;
+}
+
+static esp_err_t flash_read(uint32_t address, void *dst, size_t size) {
+    pthread_mutex_lock(&flash_lock);
+    flash_delay((uint64_t)latency.read_kb_us * size / 1024);
+    memcpy(dst, flash + address, size);
+    stats.reads++;
+    stats.bytes_read += size;
+    pthread_mutex_unlock(&flash_lock);
+    return ESP_OK;
+}
+
+esp_err_t esp_partition_read(const esp_partition_t *partition, size_t offset, void *dst, size_t size) {
+    esp_err_t err = check_range(partition, offset, size);
+    if (err != ESP_OK) {
+        return err;
+    }
+    return flash_read(partition->address + offset, dst, size);
+}
+
+esp_err_t esp_partition_write(const esp_partition_t *partition, size_t offset, const void *src, size_t size) {
+    esp_err_t err = check_range(partition, offset, size);
+    if (err != ESP_OK) {
+        return err;
+    }
+    const uint8_t *data = src;
+    uint8_t *p = flash + partition->address + offset;
+    bool unerased = false;
+
+    pthread_mutex_lock(&flash_lock);
+    flash_delay((uint64_t)latency.write_kb_us * size / 1024);
+    for (size_t i = 0; i < size; i++) {
+        unerased |= (p[i] & data[i]) != data[i];
+        p[i] &= data[i];
+    }
+    stats.writes++;
+    stats.bytes_written += size;
+    if (unerased) {
+        stats.unerased_writes++;
+    }
+    pthread_mutex_unlock(&flash_lock);
+
+    if (unerased) {
+        ESP_LOGW(TAG, "write of %d bytes at 0x%x over data not erased", (int)size,
+            (unsigned)(partition->address + offset));
+    }
+    return ESP_OK;
+}
+
+esp_err_t esp_partition_erase_range(const esp_partition_t *partition, size_t offset, size_t size) {
+    esp_err_t err = check_range(partition, offset, size);
+    if (err != ESP_OK) {
+        return err;
+    }
+    if (offset % SPI_FLASH_SEC_SIZE != 0 || size % SPI_FLASH_SEC_SIZE != 0) {
+        return ESP_ERR_INVALID_SIZE;
+    }
+    pthread_mutex_lock(&flash_lock);
+    flash_delay((uint64_t)latency.erase_sector_us * (size / SPI_FLASH_SEC_SIZE));
+    memset(flash + partition->address + offset, 0xff, size);
+    stats.erases += size / SPI_FLASH_SEC_SIZE;
+    pthread_mutex_unlock(&flash_lock);
+    return ESP_OK;
+}
+
+// Images
+
+esp_err_t esp_image_verify(esp_image_load_mode_t mode, const esp_partition_pos_t *part, esp_image_metadata_t *data) {
+    memset(data, 0, sizeof(*data));
+    data->start_addr = part->offset;
+    if (flash == NULL || part->offset > flash_size || part->size > flash_size - part->offset ||
+            part->size < sizeof(esp_image_header_t)) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    const uint8_t *image = flash + part->offset;
+    memcpy(&data->image, image, sizeof(esp_image_header_t));
+    if (data->image.magic != ESP_IMAGE_HEADER_MAGIC || data->image.segment_count > ESP_IMAGE_MAX_SEGMENTS) {
+        if (mode != ESP_IMAGE_VERIFY_SILENT) {
+            ESP_LOGE(TAG, "image at 0x%x has invalid magic byte or segment count", part->offset);
+        }
+        return ESP_ERR_IMAGE_INVALID;
+    }
+
+    uint32_t pos = sizeof(esp_image_header_t);
+    uint8_t checksum = ESP_IMAGE_CHECKSUM_SEED;
+    for (int i = 0; i < data->image.segment_count; i++) {
+        esp_image_segment_header_t *segment = &data->segments[i];
+        if (part->size - pos < sizeof(*segment)) {
+            return ESP_ERR_IMAGE_INVALID;
+        }
+        memcpy(segment, image + pos, sizeof(*segment));
+        pos += sizeof(*segment);
+        if (segment->data_len > part->size - pos) {
+            if (mode != ESP_IMAGE_VERIFY_SILENT) {
+                ESP_LOGE(TAG, "segment %d of image at 0x%x runs past the partition", i, part->offset);
+            }
+            return ESP_ERR_IMAGE_INVALID;
+        }
+        data->segment_data[i] = part->offset + pos;
+        for (uint32_t j = 0; j < segment->data_len; j++) {
+            checksum ^= image[pos + j];
+        }
+        pos += segment->data_len;
+    }
+    // the checksum is the last byte of a 16 byte block
+    pos = (pos + 16) & ~15;
+    if (pos > part->size || image[pos - 1] != checksum) {
+        if (mode != ESP_IMAGE_VERIFY_SILENT) {
+            ESP_LOGE(TAG, "image at 0x%x has a bad checksum", part->offset);
+        }
+        return ESP_ERR_IMAGE_INVALID;
+    }
+    data->image_len = pos;
+    return ESP_OK;
+}
+
+// OTA data: the first word of the otadata partition is a sequence number; ota_<n> is
+//  booted for (sequence - 1) % app slots. Erased, it selects the first app partition
+
+static int ota_slot_count(void) {
+    int count = 0;
+    for (int i = 0; i < partition_count; i++) {
+        if (partitions[i].type == ESP_PARTITION_TYPE_APP &&
+                partitions[i].subtype >= ESP_PARTITION_SUBTYPE_APP_OTA_MIN &&
+                partitions[i].subtype <= ESP_PARTITION_SUBTYPE_APP_OTA_MAX) {
+            count++;
+        }
+    }
+    return count;
+}
+
+const esp_partition_t *esp_ota_get_boot_partition(void) {
+    const esp_partition_t *otadata = esp_partition_find_first(ESP_PARTITION_TYPE_DATA,
+        ESP_PARTITION_SUBTYPE_DATA_OTA, NULL);
+    uint32_t seq = 0xffffffff;
+    int slots = ota_slot_count();
+    if (otadata != NULL) {
+        memcpy(&seq, flash + otadata->address, sizeof(seq));
+    }
+    if (seq != 0xffffffff && seq != 0 && slots > 0) {
+        const esp_partition_t *p = esp_partition_find_first(ESP_PARTITION_TYPE_APP,
+            ESP_PARTITION_SUBTYPE_APP_OTA_MIN + (seq - 1) % slots, NULL);
+        if (p != NULL) {
+            return p;
+        }
+    }
+    return esp_partition_find_first(ESP_PARTITION_TYPE_APP, ESP_PARTITION_SUBTYPE_ANY, NULL);
+}
+
+const esp_partition_t *esp_ota_get_running_partition(void) {
+    return running;
+}
+
+esp_err_t esp_ota_set_boot_partition(const esp_partition_t *partition) {
+    if (partition == NULL || partition->type != ESP_PARTITION_TYPE_APP) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    const esp_partition_pos_t pos = { .offset = partition->address, .size = partition->size };
+    esp_image_metadata_t metadata;
+    if (esp_image_verify(ESP_IMAGE_VERIFY, &pos, &metadata) != ESP_OK) {
+        return ESP_ERR_OTA_VALIDATE_FAILED;
+    }
+
+    const esp_partition_t *otadata = esp_partition_find_first(ESP_PARTITION_TYPE_DATA,
+        ESP_PARTITION_SUBTYPE_DATA_OTA, NULL);
+    if (otadata == NULL) {
+        // a factory app only, nothing to select
+        return (partition->subtype == ESP_PARTITION_SUBTYPE_APP_FACTORY) ? ESP_OK : ESP_ERR_NOT_FOUND;
+    }
+    if (partition->subtype < ESP_PARTITION_SUBTYPE_APP_OTA_MIN || partition->subtype > ESP_PARTITION_SUBTYPE_APP_OTA_MAX) {
+        // booting a factory app is erasing the selection
+        return esp_partition_erase_range(otadata, 0, SPI_FLASH_SEC_SIZE);
+    }
+
+    uint32_t seq;
+    int slots = ota_slot_count();
+    int index = partition->subtype - ESP_PARTITION_SUBTYPE_APP_OTA_MIN;
+    memcpy(&seq, flash + otadata->address, sizeof(seq));
+    if (seq == 0xffffffff) {
+        seq = 0;
+    }
+    do {
+        seq++;
+    } while ((int)((seq - 1) % slots) != index);
+
+    esp_err_t err = esp_partition_erase_range(otadata, 0, SPI_FLASH_SEC_SIZE);
+    if (err == ESP_OK) {
+        err = esp_partition_write(otadata, 0, &seq, sizeof(seq));
+    }
+    return err;
+}
+
+const esp_partition_t *esp_ota_get_next_update_partition(const esp_partition_t *start_from) {
+    const esp_partition_t *from = (start_from != NULL) ? start_from : running;
+    const esp_partition_t *first = NULL;
+    bool passed = false;
+    for (int i = 0; i < partition_count; i++) {
+        const esp_partition_t *p = &partitions[i];
+        if (p->type != ESP_PARTITION_TYPE_APP || p->subtype < ESP_PARTITION_SUBTYPE_APP_OTA_MIN ||
+                p->subtype > ESP_PARTITION_SUBTYPE_APP_OTA_MAX) {
+            continue;
+        }
+        if (first == NULL) {
+            first = p;
+        }
+        if (passed) {
+            return p;
+        }
+        passed = (p == from);
+    }
+    return (first != from) ? first : NULL;
+}
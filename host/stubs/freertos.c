@@ -0,0 +1,585 @@
+#define _GNU_SOURCE
+#include <errno.h>
+#include <pthread.h>
+#include <sched.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "freertos/queue.h"
+#include "freertos/semphr.h"
+
+#include "esp_log.h"
+#include "host.h"
+
+static const char *TAG = "host";
+
+// Every task, queue and notification blocks on its own condition variable under one
+//  scheduler lock. A task waiting on something has 'waiting_on' set to it; whatever
+//  changes that object wakes each task waiting on it, and the task checks again.
+//  That one lock is also what lets host_tasks_settle() tell running from blocked.
+
+#define HOST_TASK_STACK_SLACK   (64 * 1024)
+#define HOST_TASK_NAME_LEN      16
+#define HOST_STACK_PAINT        0xa5
+
+struct host_task {
+    char name[HOST_TASK_NAME_LEN];
+    pthread_t thread;
+    bool created;                   // by xTaskCreate(), rather than a thread found calling in
+    bool dead;
+    TaskFunction_t fn;
+    void *param;
+    UBaseType_t priority;
+    uint32_t depth;
+    uint8_t *stack;                 // depth + HOST_TASK_STACK_SLACK bytes, painted
+    size_t stack_size;
+    uint8_t *stack_top;             // frame of the task's entry point; usage is measured down from here
+    pthread_cond_t cond;
+    const void *waiting_on;         // NULL while running
+    uint64_t deadline_us;           // of the wait, in esp_timer time. UINT64_MAX for none
+    uint32_t notify;
+    struct host_task *next;
+};
+
+struct host_queue {
+    UBaseType_t length;
+    UBaseType_t item_size;          // 0 for a semaphore
+    UBaseType_t count;
+    UBaseType_t head;               // index of the oldest item
+    uint8_t *items;
+};
+
+// the most stack any task of that name used, for tasks that have deleted themselves
+#define HOST_FINISHED_TASKS     16
+
+struct host_finished_task {
+    char name[HOST_TASK_NAME_LEN];
+    UBaseType_t priority;
+    uint32_t depth;
+    uint32_t used;
+};
+
+static pthread_mutex_t sched_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t settle_cond;
+static struct host_task *tasks;
+static struct host_finished_task finished[HOST_FINISHED_TASKS];
+static int finished_count;
+static __thread struct host_task *current;
+static pthread_key_t current_key;
+static pthread_once_t current_once = PTHREAD_ONCE_INIT;
+
+static pthread_mutex_t critical_lock;
+static pthread_once_t critical_once = PTHREAD_ONCE_INIT;
+
+static struct timespec clock_start;
+static bool clock_faked;
+static volatile uint64_t fake_us;
+static bool priorities;
+
+// timed waits are against CLOCK_MONOTONIC, as esp_timer is
+static void cond_init(pthread_cond_t *cond) {
+    pthread_condattr_t attr;
+    pthread_condattr_init(&attr);
+    pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+    pthread_cond_init(cond, &attr);
+    pthread_condattr_destroy(&attr);
+}
+
+__attribute__((constructor)) static void host_clock_init(void) {
+    clock_gettime(CLOCK_MONOTONIC, &clock_start);
+    cond_init(&settle_cond);
+}
+
+// 0 when the process started, as esp_timer is at reset
+int64_t esp_timer_get_time(void) {
+    if (clock_faked) {
+        return fake_us;
+    }
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (int64_t)(now.tv_sec - clock_start.tv_sec) * 1000000 +
+        (now.tv_nsec - clock_start.tv_nsec) / 1000;
+}
+
+static uint64_t ticks_to_us(TickType_t ticks) {
+    return (uint64_t)ticks * 1000000 / configTICK_RATE_HZ;
+}
+
+static uint64_t deadline_after(TickType_t ticks) {
+    return (ticks == portMAX_DELAY) ? UINT64_MAX : esp_timer_get_time() + ticks_to_us(ticks);
+}
+
+TickType_t xTaskGetTickCount(void) {
+    return (TickType_t)(esp_timer_get_time() * configTICK_RATE_HZ / 1000000);
+}
+
+// Critical sections
+
+static void critical_init(void) {
+    pthread_mutexattr_t attr;
+    pthread_mutexattr_init(&attr);
+    pthread_mutexattr_settype(&attr, PTHREAD_MUTEX_RECURSIVE);
+    pthread_mutex_init(&critical_lock, &attr);
+    pthread_mutexattr_destroy(&attr);
+}
+
+void vPortEnterCritical(void) {
+    pthread_once(&critical_once, critical_init);
+    pthread_mutex_lock(&critical_lock);
+}
+
+void vPortExitCritical(void) {
+    pthread_mutex_unlock(&critical_lock);
+}
+
+// Tasks
+
+static void task_unlink(struct host_task *t) {
+    for (struct host_task **link = &tasks; *link != NULL; link = &(*link)->next) {
+        if (*link == t) {
+            *link = t->next;
+            break;
+        }
+    }
+}
+
+// a thread that wasn't made by xTaskCreate() is forgotten when it exits
+static void current_release(void *p) {
+    struct host_task *t = p;
+    pthread_mutex_lock(&sched_lock);
+    task_unlink(t);
+    pthread_mutex_unlock(&sched_lock);
+    pthread_cond_destroy(&t->cond);
+    free(t);
+}
+
+static void current_key_init(void) {
+    pthread_key_create(&current_key, current_release);
+}
+
+static struct host_task *task_self(void) {
+    if (current == NULL) {
+        struct host_task *t = calloc(1, sizeof(struct host_task));
+        if (t == NULL) {
+            abort();
+        }
+        strcpy(t->name, "main");
+        t->thread = pthread_self();
+        cond_init(&t->cond);
+        pthread_once(&current_once, current_key_init);
+        pthread_setspecific(current_key, t);
+
+        pthread_mutex_lock(&sched_lock);
+        t->next = tasks;
+        tasks = t;
+        pthread_mutex_unlock(&sched_lock);
+        current = t;
+    }
+    return current;
+}
+
+static void *task_entry(void *param) {
+    struct host_task *t = param;
+    current = t;
+    t->stack_top = __builtin_frame_address(0);
+    t->fn(t->param);
+    // a FreeRTOS task must not return; treat it as deleting itself
+    vTaskDelete(NULL);
+    return NULL;
+}
+
+// join and free tasks that have deleted themselves. sched_lock held
+static void task_reap(void) {
+    struct host_task **link = &tasks;
+    while (*link != NULL) {
+        struct host_task *t = *link;
+        if (t->dead) {
+            *link = t->next;
+            pthread_join(t->thread, NULL);
+            pthread_cond_destroy(&t->cond);
+            free(t->stack);
+            free(t);
+        } else {
+            link = &t->next;
+        }
+    }
+}
+
+BaseType_t xTaskCreate(TaskFunction_t fn, const char *name, uint32_t depth, void *param,
+        UBaseType_t priority, TaskHandle_t *handle) {
+    struct host_task *t = calloc(1, sizeof(struct host_task));
+    if (t == NULL) {
+        return pdFAIL;
+    }
+    strncpy(t->name, name, HOST_TASK_NAME_LEN - 1);
+    t->created = true;
+    t->fn = fn;
+    t->param = param;
+    t->priority = priority;
+    t->depth = depth;
+    t->stack_size = depth + HOST_TASK_STACK_SLACK;
+    if (posix_memalign((void **)&t->stack, 64, t->stack_size) != 0) {
+        free(t);
+        return pdFAIL;
+    }
+    memset(t->stack, HOST_STACK_PAINT, t->stack_size);
+    cond_init(&t->cond);
+
+    pthread_attr_t attr;
+    pthread_attr_init(&attr);
+    pthread_attr_setstack(&attr, t->stack, t->stack_size);
+    if (priorities) {
+        struct sched_param sp = { .sched_priority = priority + 1 };
+        pthread_attr_setinheritsched(&attr, PTHREAD_EXPLICIT_SCHED);
+        pthread_attr_setschedpolicy(&attr, SCHED_FIFO);
+        pthread_attr_setschedparam(&attr, &sp);
+    }
+
+    pthread_mutex_lock(&sched_lock);
+    task_reap();
+    int err = pthread_create(&t->thread, &attr, task_entry, t);
+    if (err == 0) {
+        t->next = tasks;
+        tasks = t;
+    }
+    pthread_mutex_unlock(&sched_lock);
+    pthread_attr_destroy(&attr);
+
+    if (err != 0) {
+        ESP_LOGE(TAG, "unable to start task %s: %s", name, strerror(err));
+        pthread_cond_destroy(&t->cond);
+        free(t->stack);
+        free(t);
+        return pdFAIL;
+    }
+    if (handle != NULL) {
+        *handle = t;
+    }
+    return pdPASS;
+}
+
+void vTaskDelete(TaskHandle_t task) {
+    struct host_task *t = task_self();
+    if (task != NULL && task != t) {
+        ESP_LOGE(TAG, "vTaskDelete of another task (%s) isn't supported", task->name);
+        abort();
+    }
+    if (!t->created) {
+        pthread_exit(NULL);
+    }
+    uint32_t used = host_task_stack_used(t);
+    pthread_mutex_lock(&sched_lock);
+    struct host_finished_task *f = finished;
+    while (f < finished + finished_count && strcmp(f->name, t->name) != 0) {
+        f++;
+    }
+    if (f < finished + HOST_FINISHED_TASKS) {
+        if (f == finished + finished_count) {
+            finished_count++;
+            *f = (struct host_finished_task){ .priority = t->priority, .depth = t->depth };
+            strcpy(f->name, t->name);
+        }
+        f->used = (used > f->used) ? used : f->used;
+    }
+    t->dead = true;
+    pthread_cond_broadcast(&settle_cond);
+    pthread_mutex_unlock(&sched_lock);
+    pthread_exit(NULL);
+}
+
+TaskHandle_t xTaskGetCurrentTaskHandle(void) {
+    return task_self();
+}
+
+char *pcTaskGetTaskName(TaskHandle_t task) {
+    return (task != NULL ? task : task_self())->name;
+}
+
+uint32_t host_task_stack_used(TaskHandle_t task) {
+    struct host_task *t = (task != NULL) ? task : task_self();
+    if (t->stack == NULL || t->stack_top == NULL) {
+        return 0;
+    }
+    // the stack grows down. find the lowest byte ever written
+    const uint8_t *p = t->stack;
+    while (p < t->stack_top && *p == HOST_STACK_PAINT) {
+        p++;
+    }
+    return t->stack_top - p;
+}
+
+UBaseType_t uxTaskGetStackHighWaterMark(TaskHandle_t task) {
+    struct host_task *t = (task != NULL) ? task : task_self();
+    uint32_t used = host_task_stack_used(t);
+    return (used < t->depth) ? t->depth - used : 0;
+}
+
+void host_task_report(FILE *out) {
+    pthread_mutex_lock(&sched_lock);
+    fprintf(out, "%-16s %8s %8s %8s %s\n", "task", "priority", "depth", "used", "state");
+    for (struct host_task *t = tasks; t != NULL; t = t->next) {
+        if (t->created && !t->dead) {
+            fprintf(out, "%-16s %8u %8u %8u running\n", t->name, (unsigned)t->priority, t->depth,
+                host_task_stack_used(t));
+        }
+    }
+    for (int i = 0; i < finished_count; i++) {
+        fprintf(out, "%-16s %8u %8u %8u ended\n", finished[i].name, (unsigned)finished[i].priority,
+            finished[i].depth, finished[i].used);
+    }
+    pthread_mutex_unlock(&sched_lock);
+}
+
+bool host_task_priorities(bool enable) {
+    if (enable) {
+        // the caller goes first, which also tells whether SCHED_FIFO is allowed at all
+        struct sched_param sp = { .sched_priority = 1 };
+        int err = pthread_setschedparam(pthread_self(), SCHED_FIFO, &sp);
+        if (err != 0) {
+            ESP_LOGW(TAG, "SCHED_FIFO not permitted (%s); priorities ignored", strerror(err));
+            return false;
+        }
+        // the caller stays above every task, so it can always get back in
+        sp.sched_priority = configMAX_PRIORITIES + 1;
+        pthread_setschedparam(pthread_self(), SCHED_FIFO, &sp);
+    } else {
+        struct sched_param sp = { .sched_priority = 0 };
+        pthread_setschedparam(pthread_self(), SCHED_OTHER, &sp);
+    }
+    priorities = enable;
+    return true;
+}
+
+// Blocking. sched_lock held
+
+static void task_wake(struct host_task *t) {
+    t->waiting_on = NULL;
+    pthread_cond_signal(&t->cond);
+}
+
+static void wake_waiters(const void *object) {
+    for (struct host_task *t = tasks; t != NULL; t = t->next) {
+        if (t->waiting_on == object) {
+            task_wake(t);
+        }
+    }
+}
+
+// Wait for something to change 'object', or for 'deadline_us'. Returns false once
+//  the deadline has passed
+static bool task_block(struct host_task *t, const void *object, uint64_t deadline_us) {
+    if ((uint64_t)esp_timer_get_time() >= deadline_us) {
+        return false;
+    }
+    t->waiting_on = object;
+    t->deadline_us = deadline_us;
+    pthread_cond_broadcast(&settle_cond);
+
+    while (t->waiting_on == object) {
+        if (deadline_us == UINT64_MAX || clock_faked) {
+            // a fake clock's deadlines are checked by host_clock_advance()
+            pthread_cond_wait(&t->cond, &sched_lock);
+            continue;
+        }
+        struct timespec ts = {
+            .tv_sec = clock_start.tv_sec + deadline_us / 1000000,
+            .tv_nsec = clock_start.tv_nsec + (deadline_us % 1000000) * 1000,
+        };
+        if (ts.tv_nsec >= 1000000000) {
+            ts.tv_sec++;
+            ts.tv_nsec -= 1000000000;
+        }
+        if (pthread_cond_timedwait(&t->cond, &sched_lock, &ts) == ETIMEDOUT) {
+            t->waiting_on = NULL;
+        }
+    }
+    return (uint64_t)esp_timer_get_time() < deadline_us;
+}
+
+static const char delay_object;
+
+void vTaskDelay(TickType_t ticks) {
+    struct host_task *t = task_self();
+    uint64_t deadline = deadline_after(ticks);
+    pthread_mutex_lock(&sched_lock);
+    while (task_block(t, &delay_object, deadline));
+    pthread_mutex_unlock(&sched_lock);
+}
+
+BaseType_t xTaskNotifyGive(TaskHandle_t task) {
+    pthread_mutex_lock(&sched_lock);
+    task->notify++;
+    if (task->waiting_on == &task->notify) {
+        task_wake(task);
+    }
+    pthread_mutex_unlock(&sched_lock);
+    return pdPASS;
+}
+
+uint32_t ulTaskNotifyTake(BaseType_t clear, TickType_t ticks) {
+    struct host_task *t = task_self();
+    uint64_t deadline = deadline_after(ticks);
+    pthread_mutex_lock(&sched_lock);
+    while (t->notify == 0 && task_block(t, &t->notify, deadline));
+    uint32_t value = t->notify;
+    if (value > 0) {
+        t->notify = clear ? 0 : value - 1;
+    }
+    pthread_mutex_unlock(&sched_lock);
+    return value;
+}
+
+// Queues
+
+QueueHandle_t xQueueCreate(UBaseType_t length, UBaseType_t item_size) {
+    struct host_queue *q = calloc(1, sizeof(struct host_queue));
+    if (q == NULL) {
+        return NULL;
+    }
+    q->length = length;
+    q->item_size = item_size;
+    if (item_size > 0) {
+        q->items = malloc(length * item_size);
+        if (q->items == NULL) {
+            free(q);
+            return NULL;
+        }
+    }
+    return q;
+}
+
+void vQueueDelete(QueueHandle_t q) {
+    if (q != NULL) {
+        free(q->items);
+        free(q);
+    }
+}
+
+BaseType_t xQueueGenericSend(QueueHandle_t q, const void *item, TickType_t ticks, bool front) {
+    struct host_task *t = task_self();
+    uint64_t deadline = deadline_after(ticks);
+    BaseType_t sent = pdFAIL;
+
+    pthread_mutex_lock(&sched_lock);
+    while (q->count == q->length && task_block(t, q, deadline));
+    if (q->count < q->length) {
+        UBaseType_t slot;
+        if (front) {
+            q->head = (q->head + q->length - 1) % q->length;
+            slot = q->head;
+        } else {
+            slot = (q->head + q->count) % q->length;
+        }
+        if (q->item_size > 0) {
+            memcpy(q->items + slot * q->item_size, item, q->item_size);
+        }
+        q->count++;
+        sent = pdPASS;
+        wake_waiters(q);
+    }
+    pthread_mutex_unlock(&sched_lock);
+    return sent;
+}
+
+BaseType_t xQueueReceive(QueueHandle_t q, void *item, TickType_t ticks) {
+    struct host_task *t = task_self();
+    uint64_t deadline = deadline_after(ticks);
+    BaseType_t received = pdFAIL;
+
+    pthread_mutex_lock(&sched_lock);
+    while (q->count == 0 && task_block(t, q, deadline));
+    if (q->count > 0) {
+        if (q->item_size > 0 && item != NULL) {
+            memcpy(item, q->items + q->head * q->item_size, q->item_size);
+        }
+        q->head = (q->head + 1) % q->length;
+        q->count--;
+        received = pdPASS;
+        wake_waiters(q);
+    }
+    pthread_mutex_unlock(&sched_lock);
+    return received;
+}
+
+BaseType_t xQueueReset(QueueHandle_t q) {
+    pthread_mutex_lock(&sched_lock);
+    q->count = 0;
+    q->head = 0;
+    wake_waiters(q);
+    pthread_mutex_unlock(&sched_lock);
+    return pdPASS;
+}
+
+UBaseType_t uxQueueMessagesWaiting(QueueHandle_t q) {
+    pthread_mutex_lock(&sched_lock);
+    UBaseType_t count = q->count;
+    pthread_mutex_unlock(&sched_lock);
+    return count;
+}
+
+SemaphoreHandle_t xSemaphoreCreateBinary(void) {
+    return xQueueCreate(1, 0);
+}
+
+SemaphoreHandle_t xSemaphoreCreateMutex(void) {
+    SemaphoreHandle_t mutex = xQueueCreate(1, 0);
+    if (mutex != NULL) {
+        mutex->count = 1;
+    }
+    return mutex;
+}
+
+// Fake clock
+
+void host_clock_fake(void) {
+    pthread_mutex_lock(&sched_lock);
+    if (!clock_faked) {
+        fake_us = esp_timer_get_time();
+        clock_faked = true;
+    }
+    pthread_mutex_unlock(&sched_lock);
+}
+
+void host_clock_advance(TickType_t ticks) {
+    pthread_mutex_lock(&sched_lock);
+    fake_us += ticks_to_us(ticks);
+    for (struct host_task *t = tasks; t != NULL; t = t->next) {
+        if (t->waiting_on != NULL && t->deadline_us <= fake_us) {
+            task_wake(t);
+        }
+    }
+    pthread_mutex_unlock(&sched_lock);
+}
+
+static bool tasks_settled(const struct host_task *self) {
+    uint64_t now = esp_timer_get_time();
+    for (const struct host_task *t = tasks; t != NULL; t = t->next) {
+        if (t->created && !t->dead && t != self &&
+                (t->waiting_on == NULL || t->deadline_us <= now)) {
+            return false;
+        }
+    }
+    return true;
+}
+
+void host_tasks_settle(void) {
+    struct host_task *self = task_self();
+    pthread_mutex_lock(&sched_lock);
+    while (!tasks_settled(self)) {
+        // a task woken by a real clock deadline doesn't announce itself, so look again
+        //  every ms as well
+        struct timespec ts;
+        clock_gettime(CLOCK_MONOTONIC, &ts);
+        ts.tv_nsec += 1000000;
+        if (ts.tv_nsec >= 1000000000) {
+            ts.tv_sec++;
+            ts.tv_nsec -= 1000000000;
+        }
+        pthread_cond_timedwait(&settle_cond, &sched_lock, &ts);
+    }
+    pthread_mutex_unlock(&sched_lock);
+}
@@ -0,0 +1,48 @@
+#pragma once
+
+// FreeRTOS on pthreads: tasks are threads, queues and semaphores are a mutex and two
+//  condition variables, a critical section is one process wide recursive mutex. Only
+//  what the app uses is here. Stack depths and high-water marks are in bytes, as on
+//  the ESP8266 port.
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "esp_timer.h"
+
+typedef int32_t BaseType_t;
+typedef uint32_t UBaseType_t;
+typedef uint32_t TickType_t;
+typedef uint8_t StackType_t;
+
+#define pdTRUE                  1
+#define pdFALSE                 0
+#define pdPASS                  pdTRUE
+#define pdFAIL                  pdFALSE
+
+#define portMAX_DELAY           ((TickType_t)0xffffffff)
+#define configTICK_RATE_HZ      CONFIG_FREERTOS_HZ
+#define portTICK_PERIOD_MS      (1000 / configTICK_RATE_HZ)
+#define portTICK_RATE_MS        portTICK_PERIOD_MS
+#define pdMS_TO_TICKS(ms)       ((TickType_t)((uint64_t)(ms) * configTICK_RATE_HZ / 1000))
+
+#define configMAX_PRIORITIES    15
+#define tskIDLE_PRIORITY        0
+
+// no timer daemon task on the host
+#define INCLUDE_xTimerGetTimerDaemonTaskHandle 0
+
+void vPortEnterCritical(void);
+void vPortExitCritical(void);
+
+#define portENTER_CRITICAL()    vPortEnterCritical()
+#define portEXIT_CRITICAL()     vPortExitCritical()
+
+#ifdef __cplusplus
+}
+#endif
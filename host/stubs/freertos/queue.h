@@ -0,0 +1,25 @@
+#pragma once
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include "freertos/FreeRTOS.h"
+
+typedef struct host_queue * QueueHandle_t;
+
+QueueHandle_t xQueueCreate(UBaseType_t length, UBaseType_t item_size);
+void vQueueDelete(QueueHandle_t queue);
+
+BaseType_t xQueueGenericSend(QueueHandle_t queue, const void *item, TickType_t ticks, bool front);
+BaseType_t xQueueReceive(QueueHandle_t queue, void *item, TickType_t ticks);
+BaseType_t xQueueReset(QueueHandle_t queue);
+UBaseType_t uxQueueMessagesWaiting(QueueHandle_t queue);
+
+#define xQueueSend(queue, item, ticks)          xQueueGenericSend(queue, item, ticks, false)
+#define xQueueSendToBack(queue, item, ticks)    xQueueGenericSend(queue, item, ticks, false)
+#define xQueueSendToFront(queue, item, ticks)   xQueueGenericSend(queue, item, ticks, true)
+
+#ifdef __cplusplus
+}
+#endif
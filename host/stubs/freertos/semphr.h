@@ -0,0 +1,22 @@
+#pragma once
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include "freertos/queue.h"
+
+// queues of empty items, as in FreeRTOS. a mutex is a binary semaphore that starts
+//  given; there is no priority inheritance
+typedef QueueHandle_t SemaphoreHandle_t;
+
+SemaphoreHandle_t xSemaphoreCreateBinary(void);
+SemaphoreHandle_t xSemaphoreCreateMutex(void);
+
+#define xSemaphoreTake(sem, ticks)  xQueueReceive(sem, NULL, ticks)
+#define xSemaphoreGive(sem)         xQueueGenericSend(sem, NULL, 0, false)
+#define vSemaphoreDelete(sem)       vQueueDelete(sem)
+
+#ifdef __cplusplus
+}
+#endif
@@ -0,0 +1,42 @@
+#pragma once
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include "freertos/FreeRTOS.h"
+
+typedef struct host_task * TaskHandle_t;
+typedef void (*TaskFunction_t)(void *param);
+
+#define taskENTER_CRITICAL()    portENTER_CRITICAL()
+#define taskEXIT_CRITICAL()     portEXIT_CRITICAL()
+
+// A thread with a stack of its own, 'depth' bytes plus HOST_TASK_STACK_SLACK for 
+//  what the host's C library needs. The whole stack is painted, so the high-water
+//  mark is what the task itself touched below its entry point
+BaseType_t xTaskCreate(TaskFunction_t fn, const char *name, uint32_t depth, void *param,
+    UBaseType_t priority, TaskHandle_t *handle);
+
+// Only NULL (the calling task) is supported
+void vTaskDelete(TaskHandle_t task);
+
+void vTaskDelay(TickType_t ticks);
+
+TickType_t xTaskGetTickCount(void);
+
+// The thread that calls app_main(), or any other not made by xTaskCreate(), is a
+//  task named "main"
+TaskHandle_t xTaskGetCurrentTaskHandle(void);
+
+char *pcTaskGetTaskName(TaskHandle_t task);
+
+// Bytes of the task's 'depth' it has never used. 0 if it has gone past it
+UBaseType_t uxTaskGetStackHighWaterMark(TaskHandle_t task);
+
+BaseType_t xTaskNotifyGive(TaskHandle_t task);
+uint32_t ulTaskNotifyTake(BaseType_t clear, TickType_t ticks);
+
+#ifdef __cplusplus
+}
+#endif
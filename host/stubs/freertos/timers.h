@@ -0,0 +1,6 @@
+#pragma once
+
+// nothing the app uses; the daemon task isn't there (INCLUDE_xTimerGetTimerDaemonTaskHandle)
+
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
@@ -0,0 +1,122 @@
+#pragma once
+
+// What the host build adds to the SDK stand-ins in this directory: the flash image,
+//  NVS file, clock, GPIO and task controls a simulator, test or benchmark sets up
+//  before calling into the app. Nothing here exists on the device.
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+
+#include "esp_err.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+
+// Flash
+
+#define HOST_FLASH_SIZE_DEFAULT (1024 * 1024)
+
+// Map 'path' (created, and erased, if it doesn't exist; NULL for an anonymous one) as
+//  a flash chip of 'size' bytes, and lay the partitions of 'table', a partition table
+//  CSV such as custom.csv, over it. The boot partition at this point is the running one
+esp_err_t host_flash_open(const char *path, const char *table, size_t size);
+void host_flash_close(void);
+
+// The flash contents, for tests to prepare or inspect
+uint8_t *host_flash_data(void);
+
+// Time each operation takes, spent holding the flash lock as the SPI flash driver does
+typedef struct {
+    uint32_t erase_sector_us;       // per 4KB sector
+    uint32_t write_kb_us;           // per KB programmed
+    uint32_t read_kb_us;            // per KB read
+} host_flash_latency_t;
+
+// Roughly an ESP8266 with its usual 1MB parts: a sector erase is 30-60 ms, a page
+//  program 0.7 ms
+#define HOST_FLASH_LATENCY_ESP8266 { .erase_sector_us = 45000, .write_kb_us = 2800, .read_kb_us = 50 }
+
+void host_flash_set_latency(const host_flash_latency_t *latency);
+
+typedef struct {
+    uint32_t erases;                // sectors
+    uint32_t writes;
+    uint32_t reads;
+    uint64_t bytes_written;
+    uint64_t bytes_read;
+    uint32_t unerased_writes;       // writes over bytes that weren't erased; always a bug
+} host_flash_stats_t;
+
+void host_flash_get_stats(host_flash_stats_t *stats);
+void host_flash_reset_stats(void);
+
+// NVS
+
+// Load the namespaces kept in 'path' (if it exists), and save them there on every
+//  nvs_commit(). Without it NVS starts empty and lives in RAM only
+esp_err_t host_nvs_open(const char *path);
+
+// Clock
+
+// Freeze the tick count and esp_timer. From then on they only move with
+//  host_clock_advance(), and so do the timeouts of everything that blocks
+void host_clock_fake(void);
+
+// Move a fake clock on by 'ticks' and wake whatever was waiting for that long
+void host_clock_advance(TickType_t ticks);
+
+// Wait until every task made with xTaskCreate() is blocked in vTaskDelay(), a queue,
+//  a semaphore or ulTaskNotifyTake(), with nothing due. Tasks blocked in a socket call
+//  count as running, so this is only for code that doesn't touch the network
+void host_tasks_settle(void);
+
+// GPIO
+
+// Called for every gpio_set_level(), with the tick count at the time
+typedef void (*host_gpio_hook_t)(TickType_t tick, int gpio, uint32_t level);
+
+void host_gpio_set_hook(host_gpio_hook_t hook);
+
+// Tasks
+
+// Run tasks made from now on under SCHED_FIFO at their FreeRTOS priority, so a busy
+//  higher priority task starves lower ones as it would on the single core device.
+//  Needs root (or CAP_SYS_NICE); returns false, and changes nothing, without it
+bool host_task_priorities(bool enable);
+
+// Bytes of its stack 'task' (NULL for the caller) has touched so far. Unlike
+//  uxTaskGetStackHighWaterMark() this can be more than the depth it was created with
+uint32_t host_task_stack_used(TaskHandle_t task);
+
+// A line for each task made with xTaskCreate(): its name, priority, the depth it was
+//  created with and host_task_stack_used(). Tasks that deleted themselves are listed
+//  once per name, with the most any of them used
+void host_task_report(FILE *out);
+
+// Restart
+
+// esp_restart() exits with this by default, for a script running the simulator to
+//  start it again
+#define HOST_RESTART_EXIT_CODE 3
+
+// Called by esp_restart() instead. If it returns, the process exits as by default
+void host_set_restart_hook(void (*hook)(void));
+
+// Logging
+
+// Keep ESP_LOGx output off stderr. It still goes through esp_log_set_putchar()'s hook
+void host_log_quiet(bool quiet);
+
+// Simulator
+
+// The port app_main() listens on in ota_sim, for OTA_LISTEN_PORT
+extern uint16_t host_listen_port;
+
+#ifdef __cplusplus
+}
+#endif
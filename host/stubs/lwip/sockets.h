@@ -0,0 +1,16 @@
+#pragma once
+
+// BSD sockets are lwIP's API too, so this is the host's own
+
+#include <errno.h>
+#include <stdio.h>
+#include <unistd.h>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/ioctl.h>
+#include <sys/select.h>
+#include <sys/socket.h>
+
+// Linux has TCP_KEEPIDLE, TCP_KEEPINTVL and TCP_KEEPCNT
+#define LWIP_TCP_KEEPALIVE 1
@@ -0,0 +1,70 @@
+#include <string.h>
+
+#include <openssl/evp.h>
+
+#include "mbedtls/base64.h"
+#include "mbedtls/sha1.h"
+#include "mbedtls/sha256.h"
+
+void mbedtls_sha256_init(mbedtls_sha256_context *ctx) {
+    ctx->md = EVP_MD_CTX_new();
+}
+
+void mbedtls_sha256_free(mbedtls_sha256_context *ctx) {
+    EVP_MD_CTX_free(ctx->md);
+    ctx->md = NULL;
+}
+
+int mbedtls_sha256_starts_ret(mbedtls_sha256_context *ctx, int is224) {
+    return EVP_DigestInit_ex(ctx->md, is224 ? EVP_sha224() : EVP_sha256(), NULL) == 1 ? 0 : -1;
+}
+
+int mbedtls_sha256_update_ret(mbedtls_sha256_context *ctx, const unsigned char *input, size_t len) {
+    return EVP_DigestUpdate(ctx->md, input, len) == 1 ? 0 : -1;
+}
+
+int mbedtls_sha256_finish_ret(mbedtls_sha256_context *ctx, unsigned char output[32]) {
+    return EVP_DigestFinal_ex(ctx->md, output, NULL) == 1 ? 0 : -1;
+}
+
+int mbedtls_sha256_ret(const unsigned char *input, size_t len, unsigned char output[32], int is224) {
+    return EVP_Digest(input, len, output, NULL, is224 ? EVP_sha224() : EVP_sha256(), NULL) == 1 ? 0 : -1;
+}
+
+int mbedtls_sha1_ret(const unsigned char *input, size_t len, unsigned char output[20]) {
+    return EVP_Digest(input, len, output, NULL, EVP_sha1(), NULL) == 1 ? 0 : -1;
+}
+
+int mbedtls_base64_encode(unsigned char *dst, size_t dlen, size_t *olen, const unsigned char *src, size_t slen) {
+    size_t needed = (slen + 2) / 3 * 4 + 1;
+    if (dst == NULL || dlen < needed) {
+        *olen = needed;
+        return MBEDTLS_ERR_BASE64_BUFFER_TOO_SMALL;
+    }
+    // EVP_EncodeBlock() writes the terminating NUL too
+    *olen = EVP_EncodeBlock(dst, src, slen);
+    return 0;
+}
+
+int mbedtls_base64_decode(unsigned char *dst, size_t dlen, size_t *olen, const unsigned char *src, size_t slen) {
+    size_t padding = 0;
+    if (slen % 4 != 0) {
+        return MBEDTLS_ERR_BASE64_INVALID_CHARACTER;
+    }
+    for (size_t i = slen; i > 0 && src[i - 1] == '='; i--) {
+        padding++;
+    }
+    size_t needed = slen / 4 * 3 - padding;
+    if (dst == NULL || dlen < needed) {
+        *olen = needed;
+        return MBEDTLS_ERR_BASE64_BUFFER_TOO_SMALL;
+    }
+    // EVP_DecodeBlock() counts the padding as data, and wants room for it
+    unsigned char out[slen / 4 * 3 + 1];
+    if (EVP_DecodeBlock(out, src, slen) < 0) {
+        return MBEDTLS_ERR_BASE64_INVALID_CHARACTER;
+    }
+    memcpy(dst, out, needed);
+    *olen = needed;
+    return 0;
+}
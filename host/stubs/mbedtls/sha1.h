@@ -0,0 +1,13 @@
+#pragma once
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stddef.h>
+
+int mbedtls_sha1_ret(const unsigned char *input, size_t len, unsigned char output[20]);
+
+#ifdef __cplusplus
+}
+#endif
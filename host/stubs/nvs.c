@@ -0,0 +1,306 @@
+#include <errno.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "esp_log.h"
+#include "host.h"
+#include "nvs.h"
+#include "nvs_flash.h"
+
+static const char *TAG = "host_nvs";
+
+// As the nvs_flash component: keys and namespaces up to 15 characters, and an item is
+//  found by its namespace, key and type, so reading one back as another type finds
+//  nothing. Saved as a flat list of items
+#define HOST_NVS_NAME_MAX       16
+#define HOST_NVS_NAMESPACES     16
+#define HOST_NVS_HANDLES        16
+#define HOST_NVS_BLOB_MAX       1984
+
+typedef enum {
+    HOST_NVS_U8 = 1,
+    HOST_NVS_U32,
+    HOST_NVS_BLOB,
+} host_nvs_type_t;
+
+typedef struct host_nvs_item {
+    uint8_t ns;
+    uint8_t type;               // host_nvs_type_t
+    char key[HOST_NVS_NAME_MAX];
+    uint32_t len;
+    struct host_nvs_item *next;
+    uint8_t data[];
+} host_nvs_item_t;
+
+static pthread_mutex_t nvs_lock = PTHREAD_MUTEX_INITIALIZER;
+static char namespaces[HOST_NVS_NAMESPACES][HOST_NVS_NAME_MAX];
+static int namespace_count;
+static host_nvs_item_t *items;
+static char *nvs_path;
+
+// handle n is handles[n - 1]: its namespace + 1, or 0 if free. bit 7 marks read-write
+static uint8_t handles[HOST_NVS_HANDLES];
+
+static int namespace_find(const char *name, bool create) {
+    for (int i = 0; i < namespace_count; i++) {
+        if (strcmp(namespaces[i], name) == 0) {
+            return i;
+        }
+    }
+    if (!create || namespace_count == HOST_NVS_NAMESPACES) {
+        return -1;
+    }
+    strcpy(namespaces[namespace_count], name);
+    return namespace_count++;
+}
+
+static host_nvs_item_t **item_find(uint8_t ns, const char *key, host_nvs_type_t type) {
+    for (host_nvs_item_t **link = &items; *link != NULL; link = &(*link)->next) {
+        if ((*link)->ns == ns && (*link)->type == type && strcmp((*link)->key, key) == 0) {
+            return link;
+        }
+    }
+    return NULL;
+}
+
+// namespace of an open handle, or an error
+static esp_err_t handle_get(nvs_handle handle, bool write, uint8_t *ns) {
+    if (handle == 0 || handle > HOST_NVS_HANDLES || handles[handle - 1] == 0) {
+        return ESP_ERR_NVS_INVALID_HANDLE;
+    }
+    uint8_t h = handles[handle - 1];
+    if (write && !(h & 0x80)) {
+        return ESP_ERR_NVS_READ_ONLY;
+    }
+    *ns = (h & 0x7f) - 1;
+    return ESP_OK;
+}
+
+esp_err_t nvs_flash_init(void) {
+    return ESP_OK;
+}
+
+esp_err_t nvs_flash_erase(void) {
+    pthread_mutex_lock(&nvs_lock);
+    while (items != NULL) {
+        host_nvs_item_t *item = items;
+        items = item->next;
+        free(item);
+    }
+    namespace_count = 0;
+    if (nvs_path != NULL) {
+        FILE *f = fopen(nvs_path, "wb");
+        if (f != NULL) {
+            fclose(f);
+        }
+    }
+    pthread_mutex_unlock(&nvs_lock);
+    return ESP_OK;
+}
+
+esp_err_t nvs_open(const char *name, nvs_open_mode mode, nvs_handle *handle) {
+    if (strlen(name) >= HOST_NVS_NAME_MAX) {
+        return ESP_ERR_NVS_KEY_TOO_LONG;
+    }
+    pthread_mutex_lock(&nvs_lock);
+    esp_err_t err = ESP_ERR_NVS_NOT_ENOUGH_SPACE;
+    int ns = namespace_find(name, mode == NVS_READWRITE);
+    if (ns < 0) {
+        err = (mode == NVS_READWRITE) ? ESP_ERR_NVS_NOT_ENOUGH_SPACE : ESP_ERR_NVS_NOT_FOUND;
+    } else {
+        for (int i = 0; i < HOST_NVS_HANDLES; i++) {
+            if (handles[i] == 0) {
+                handles[i] = (ns + 1) | ((mode == NVS_READWRITE) ? 0x80 : 0);
+                *handle = i + 1;
+                err = ESP_OK;
+                break;
+            }
+        }
+    }
+    pthread_mutex_unlock(&nvs_lock);
+    return err;
+}
+
+void nvs_close(nvs_handle handle) {
+    pthread_mutex_lock(&nvs_lock);
+    if (handle > 0 && handle <= HOST_NVS_HANDLES) {
+        handles[handle - 1] = 0;
+    }
+    pthread_mutex_unlock(&nvs_lock);
+}
+
+static esp_err_t nvs_get(nvs_handle handle, const char *key, host_nvs_type_t type, void *value, size_t *len) {
+    uint8_t ns;
+    pthread_mutex_lock(&nvs_lock);
+    esp_err_t err = handle_get(handle, false, &ns);
+    if (err == ESP_OK) {
+        host_nvs_item_t **link = item_find(ns, key, type);
+        if (link == NULL) {
+            err = ESP_ERR_NVS_NOT_FOUND;
+        } else if (value == NULL) {
+            *len = (*link)->len;        // the length a blob needs
+        } else if (*len < (*link)->len) {
+            err = ESP_ERR_NVS_INVALID_LENGTH;
+        } else {
+            memcpy(value, (*link)->data, (*link)->len);
+            *len = (*link)->len;
+        }
+    }
+    pthread_mutex_unlock(&nvs_lock);
+    return err;
+}
+
+static esp_err_t nvs_set(nvs_handle handle, const char *key, host_nvs_type_t type, const void *value, size_t len) {
+    uint8_t ns;
+    if (strlen(key) >= HOST_NVS_NAME_MAX) {
+        return ESP_ERR_NVS_KEY_TOO_LONG;
+    }
+    if (len > HOST_NVS_BLOB_MAX) {
+        return ESP_ERR_NVS_VALUE_TOO_LONG;
+    }
+    pthread_mutex_lock(&nvs_lock);
+    esp_err_t err = handle_get(handle, true, &ns);
+    if (err == ESP_OK) {
+        host_nvs_item_t *item = malloc(sizeof(host_nvs_item_t) + len);
+        if (item == NULL) {
+            err = ESP_ERR_NO_MEM;
+        } else {
+            host_nvs_item_t **link = item_find(ns, key, type);
+            item->ns = ns;
+            item->type = type;
+            strcpy(item->key, key);
+            item->len = len;
+            memcpy(item->data, value, len);
+            if (link != NULL) {
+                item->next = (*link)->next;
+                free(*link);
+                *link = item;
+            } else {
+                item->next = items;
+                items = item;
+            }
+        }
+    }
+    pthread_mutex_unlock(&nvs_lock);
+    return err;
+}
+
+esp_err_t nvs_get_u8(nvs_handle handle, const char *key, uint8_t *value) {
+    size_t len = sizeof(*value);
+    return nvs_get(handle, key, HOST_NVS_U8, value, &len);
+}
+
+esp_err_t nvs_set_u8(nvs_handle handle, const char *key, uint8_t value) {
+    return nvs_set(handle, key, HOST_NVS_U8, &value, sizeof(value));
+}
+
+esp_err_t nvs_get_u32(nvs_handle handle, const char *key, uint32_t *value) {
+    size_t len = sizeof(*value);
+    return nvs_get(handle, key, HOST_NVS_U32, value, &len);
+}
+
+esp_err_t nvs_set_u32(nvs_handle handle, const char *key, uint32_t value) {
+    return nvs_set(handle, key, HOST_NVS_U32, &value, sizeof(value));
+}
+
+esp_err_t nvs_get_blob(nvs_handle handle, const char *key, void *value, size_t *length) {
+    return nvs_get(handle, key, HOST_NVS_BLOB, value, length);
+}
+
+esp_err_t nvs_set_blob(nvs_handle handle, const char *key, const void *value, size_t length) {
+    return nvs_set(handle, key, HOST_NVS_BLOB, value, length);
+}
+
+esp_err_t nvs_erase_key(nvs_handle handle, const char *key) {
+    uint8_t ns;
+    pthread_mutex_lock(&nvs_lock);
+    esp_err_t err = handle_get(handle, true, &ns);
+    if (err == ESP_OK) {
+        err = ESP_ERR_NVS_NOT_FOUND;
+        for (host_nvs_item_t **link = &items; *link != NULL; ) {
+            if ((*link)->ns == ns && strcmp((*link)->key, key) == 0) {
+                host_nvs_item_t *item = *link;
+                *link = item->next;
+                free(item);
+                err = ESP_OK;
+            } else {
+                link = &(*link)->next;
+            }
+        }
+    }
+    pthread_mutex_unlock(&nvs_lock);
+    return err;
+}
+
+// one record per item: namespace, key, type, u32 length, data
+esp_err_t nvs_commit(nvs_handle handle) {
+    uint8_t ns;
+    pthread_mutex_lock(&nvs_lock);
+    esp_err_t err = handle_get(handle, true, &ns);
+    if (err == ESP_OK && nvs_path != NULL) {
+        FILE *f = fopen(nvs_path, "wb");
+        if (f == NULL) {
+            ESP_LOGE(TAG, "can't write %s: %s", nvs_path, strerror(errno));
+            err = ESP_FAIL;
+        } else {
+            for (host_nvs_item_t *item = items; item != NULL; item = item->next) {
+                fwrite(namespaces[item->ns], 1, HOST_NVS_NAME_MAX, f);
+                fwrite(item->key, 1, HOST_NVS_NAME_MAX, f);
+                fwrite(&item->type, 1, 1, f);
+                fwrite(&item->len, sizeof(item->len), 1, f);
+                fwrite(item->data, 1, item->len, f);
+            }
+            if (fclose(f) != 0) {
+                err = ESP_FAIL;
+            }
+        }
+    }
+    pthread_mutex_unlock(&nvs_lock);
+    return err;
+}
+
+esp_err_t host_nvs_open(const char *path) {
+    nvs_flash_erase();
+
+    pthread_mutex_lock(&nvs_lock);
+    free(nvs_path);
+    nvs_path = strdup(path);
+    FILE *f = fopen(path, "rb");
+    esp_err_t err = ESP_OK;
+    if (f != NULL) {
+        char ns_name[HOST_NVS_NAME_MAX];
+        char key[HOST_NVS_NAME_MAX];
+        uint8_t type;
+        uint32_t len;
+        while (fread(ns_name, 1, sizeof(ns_name), f) == sizeof(ns_name)) {
+            if (fread(key, 1, sizeof(key), f) != sizeof(key) || fread(&type, 1, 1, f) != 1 ||
+                    fread(&len, sizeof(len), 1, f) != 1 || len > HOST_NVS_BLOB_MAX) {
+                err = ESP_ERR_NVS_INVALID_LENGTH;
+                break;
+            }
+            ns_name[HOST_NVS_NAME_MAX - 1] = '\0';
+            key[HOST_NVS_NAME_MAX - 1] = '\0';
+            host_nvs_item_t *item = malloc(sizeof(host_nvs_item_t) + len);
+            int ns = namespace_find(ns_name, true);
+            if (item == NULL || ns < 0 || fread(item->data, 1, len, f) != len) {
+                free(item);
+                err = ESP_ERR_NVS_INVALID_LENGTH;
+                break;
+            }
+            item->ns = ns;
+            item->type = type;
+            strcpy(item->key, key);
+            item->len = len;
+            item->next = items;
+            items = item;
+        }
+        fclose(f);
+    }
+    pthread_mutex_unlock(&nvs_lock);
+    if (err != ESP_OK) {
+        ESP_LOGE(TAG, "%s is damaged; loaded what came before", path);
+    }
+    return err;
+}
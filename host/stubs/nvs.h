@@ -0,0 +1,38 @@
+#pragma once
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "esp_err.h"
+
+// Namespaces and keys in RAM, written to the file given to host_nvs_open() (if any)
+//  on every nvs_commit(). Values keep their type
+
+typedef uint32_t nvs_handle;
+typedef nvs_handle nvs_handle_t;
+
+typedef enum {
+    NVS_READONLY,
+    NVS_READWRITE,
+} nvs_open_mode;
+
+// ESP_ERR_NVS_NOT_FOUND for a namespace that doesn't exist yet, opened read only
+esp_err_t nvs_open(const char *name, nvs_open_mode mode, nvs_handle *handle);
+void nvs_close(nvs_handle handle);
+
+esp_err_t nvs_get_u8(nvs_handle handle, const char *key, uint8_t *value);
+esp_err_t nvs_set_u8(nvs_handle handle, const char *key, uint8_t value);
+esp_err_t nvs_get_u32(nvs_handle handle, const char *key, uint32_t *value);
+esp_err_t nvs_set_u32(nvs_handle handle, const char *key, uint32_t value);
+esp_err_t nvs_get_blob(nvs_handle handle, const char *key, void *value, size_t *length);
+esp_err_t nvs_set_blob(nvs_handle handle, const char *key, const void *value, size_t length);
+esp_err_t nvs_erase_key(nvs_handle handle, const char *key);
+esp_err_t nvs_commit(nvs_handle handle);
+
+#ifdef __cplusplus
+}
+#endif
@@ -0,0 +1,17 @@
+#pragma once
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include "esp_err.h"
+#include "nvs.h"
+
+esp_err_t nvs_flash_init(void);
+
+// drops every namespace, and empties the file
+esp_err_t nvs_flash_erase(void);
+
+#ifdef __cplusplus
+}
+#endif
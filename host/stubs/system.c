@@ -0,0 +1,192 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/random.h>
+
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "freertos/queue.h"
+
+#include "driver/gpio.h"
+#include "esp_event.h"
+#include "esp_log.h"
+#include "esp_system.h"
+#include "esp_wifi.h"
+#include "host.h"
+
+static const char *TAG = "host";
+
+// Events
+
+#define HOST_EVENT_HANDLERS 8
+#define HOST_EVENT_QUEUE_DEPTH 8
+
+esp_event_base_t const WIFI_EVENT = "WIFI_EVENT";
+
+typedef struct {
+    esp_event_base_t base;
+    int32_t id;
+    esp_event_handler_t handler;
+    void *arg;
+} host_event_handler_t;
+
+typedef struct {
+    esp_event_base_t base;
+    int32_t id;
+} host_event_t;
+
+static host_event_handler_t handlers[HOST_EVENT_HANDLERS];
+static int handler_count;
+static QueueHandle_t event_queue;
+
+// the SDK's default event loop task
+static void event_task(void *param) {
+    host_event_t event;
+    while (1) {
+        xQueueReceive(event_queue, &event, portMAX_DELAY);
+        for (int i = 0; i < handler_count; i++) {
+            host_event_handler_t *h = &handlers[i];
+            if (h->base == event.base && (h->id == ESP_EVENT_ANY_ID || h->id == event.id)) {
+                h->handler(h->arg, event.base, event.id, NULL);
+            }
+        }
+    }
+}
+
+esp_err_t esp_event_loop_create_default(void) {
+    if (event_queue != NULL) {
+        return ESP_ERR_INVALID_STATE;
+    }
+    event_queue = xQueueCreate(HOST_EVENT_QUEUE_DEPTH, sizeof(host_event_t));
+    if (event_queue == NULL || xTaskCreate(&event_task, "sys_evt", 2048, NULL, 20, NULL) != pdPASS) {
+        return ESP_ERR_NO_MEM;
+    }
+    return ESP_OK;
+}
+
+esp_err_t esp_event_handler_register(esp_event_base_t base, int32_t id, esp_event_handler_t handler, void *arg) {
+    if (handler_count == HOST_EVENT_HANDLERS) {
+        return ESP_ERR_NO_MEM;
+    }
+    handlers[handler_count++] = (host_event_handler_t){ base, id, handler, arg };
+    return ESP_OK;
+}
+
+esp_err_t esp_event_post(esp_event_base_t base, int32_t id, void *data, size_t size, uint32_t ticks) {
+    host_event_t event = { base, id };
+    if (event_queue == NULL) {
+        return ESP_ERR_INVALID_STATE;
+    }
+    return (xQueueSendToBack(event_queue, &event, ticks) == pdPASS) ? ESP_OK : ESP_ERR_TIMEOUT;
+}
+
+// Wifi
+
+static bool wifi_initialized;
+static wifi_mode_t wifi_mode;
+
+void tcpip_adapter_init(void) {
+}
+
+esp_err_t esp_wifi_init(const wifi_init_config_t *config) {
+    wifi_initialized = true;
+    return ESP_OK;
+}
+
+esp_err_t esp_wifi_set_mode(wifi_mode_t mode) {
+    if (!wifi_initialized) {
+        return ESP_ERR_INVALID_STATE;
+    }
+    wifi_mode = mode;
+    return ESP_OK;
+}
+
+esp_err_t esp_wifi_set_config(esp_interface_t interface, wifi_config_t *config) {
+    if (!wifi_initialized) {
+        return ESP_ERR_INVALID_STATE;
+    }
+    if (interface == ESP_IF_WIFI_AP) {
+        ESP_LOGI(TAG, "AP '%.32s'", (const char *)config->ap.ssid);
+    }
+    return ESP_OK;
+}
+
+esp_err_t esp_wifi_start(void) {
+    if (!wifi_initialized) {
+        return ESP_ERR_INVALID_STATE;
+    }
+    if (wifi_mode == WIFI_MODE_AP || wifi_mode == WIFI_MODE_APSTA) {
+        return esp_event_post(WIFI_EVENT, WIFI_EVENT_AP_START, NULL, 0, portMAX_DELAY);
+    }
+    return ESP_OK;
+}
+
+esp_err_t esp_wifi_stop(void) {
+    if (wifi_mode == WIFI_MODE_AP || wifi_mode == WIFI_MODE_APSTA) {
+        return esp_event_post(WIFI_EVENT, WIFI_EVENT_AP_STOP, NULL, 0, portMAX_DELAY);
+    }
+    return ESP_OK;
+}
+
+// GPIO
+
+static host_gpio_hook_t gpio_hook;
+
+void host_gpio_set_hook(host_gpio_hook_t hook) {
+    gpio_hook = hook;
+}
+
+esp_err_t gpio_config(const gpio_config_t *config) {
+    return (config->pin_bit_mask >> 17) ? ESP_ERR_INVALID_ARG : ESP_OK;
+}
+
+esp_err_t gpio_set_level(gpio_num_t gpio, uint32_t level) {
+    if (gpio < 0 || gpio > 16) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    if (gpio_hook != NULL) {
+        gpio_hook(xTaskGetTickCount(), gpio, level);
+    }
+    return ESP_OK;
+}
+
+// System
+
+static void (*restart_hook)(void);
+
+void host_set_restart_hook(void (*hook)(void)) {
+    restart_hook = hook;
+}
+
+void esp_restart(void) {
+    if (restart_hook != NULL) {
+        restart_hook();
+    }
+    fflush(NULL);
+    _exit(HOST_RESTART_EXIT_CODE);
+}
+
+uint32_t esp_random(void) {
+    uint32_t value;
+    if (getrandom(&value, sizeof(value), 0) != sizeof(value)) {
+        value = (uint32_t)random();
+    }
+    return value;
+}
+
+uint32_t esp_get_free_heap_size(void) {
+    return 0;
+}
+
+uint32_t esp_get_minimum_free_heap_size(void) {
+    return 0;
+}
+
+// Espressif's OUI. Always the same, as a device's is across restarts
+esp_err_t esp_read_mac(uint8_t *mac, esp_mac_type_t type) {
+    static const uint8_t base[6] = { 0x5c, 0xcf, 0x7f, 0x00, 0x00, 0x10 };
+    memcpy(mac, base, sizeof(base));
+    mac[5] += (type == ESP_MAC_WIFI_SOFTAP);
+    return ESP_OK;
+}
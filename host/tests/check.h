@@ -0,0 +1,32 @@
+#pragma once
+
+// Just enough for the host tests: CHECK() reports a failure and carries on, and main()
+//  returns check_result() for ctest
+
+#include <stdio.h>
+
+static int check_failures;
+
+#define CHECK(cond) do { \
+        if (!(cond)) { \
+            fprintf(stderr, "%s:%d: CHECK(%s) failed\n", __FILE__, __LINE__, #cond); \
+            check_failures++; \
+        } \
+    } while (0)
+
+#define CHECK_EQ(a, b) do { \
+        long long check_a = (long long)(a), check_b = (long long)(b); \
+        if (check_a != check_b) { \
+            fprintf(stderr, "%s:%d: CHECK_EQ(%s, %s) failed: %lld != %lld\n", \
+                __FILE__, __LINE__, #a, #b, check_a, check_b); \
+            check_failures++; \
+        } \
+    } while (0)
+
+static inline int check_result(void) {
+    if (check_failures != 0) {
+        fprintf(stderr, "%d checks failed\n", check_failures);
+        return 1;
+    }
+    return 0;
+}
@@ -0,0 +1,99 @@
+// LOGB_x calls built with CONFIG_LOG_BINARY, for test_log_decode.py. Each record taken
+//  from log capture is written to 'stream' as the sse task sends it: timestamp and record,
+//  base64 encoded in a 'logb' event. 'expected' gets the level and the text the C
+//  library prints for the same call, one line each.
+//
+//   log_binary_emit stream.txt expected.txt
+
+#include <stdio.h>
+#include <string.h>
+
+#include "mbedtls/base64.h"
+
+#include "host.h"
+#include "log_binary.h"
+#include "log_capture.h"
+
+static const char *TAG = "logb_test";
+
+static FILE *stream;
+static FILE *expected;
+
+// Everything logged since the last call, as /event carries it
+static void drain(void) {
+    log_record_t record;
+    while (log_capture_read(&record, 0)) {
+        if (!record.binary) {
+            fprintf(stream, "data: %s\n\n", record.text);
+            continue;
+        }
+        uint8_t raw[sizeof(record.timestamp) + LOG_CAPTURE_LINE_MAX];
+        char encoded[2 * sizeof(raw)];
+        size_t len;
+        memcpy(raw, &record.timestamp, sizeof(record.timestamp));
+        memcpy(raw + sizeof(record.timestamp), record.text, record.len);
+        mbedtls_base64_encode((unsigned char *)encoded, sizeof(encoded), &len, raw,
+            sizeof(record.timestamp) + record.len);
+        fprintf(stream, "event: logb\ndata: %.*s\n\n", (int)len, encoded);
+    }
+}
+
+// A call whose text printf agrees on
+#define CASE(level, format, ...) do { \
+        LOGB_##level(TAG, format, ##__VA_ARGS__); \
+        fprintf(expected, #level " " format "\n", ##__VA_ARGS__); \
+        drain(); \
+    } while (0)
+
+// One where the record keeps less than printf would print
+#define CASE_TEXT(level, text, format, ...) do { \
+        LOGB_##level(TAG, format, ##__VA_ARGS__); \
+        fprintf(expected, #level " %s\n", text); \
+        drain(); \
+    } while (0)
+
+int main(int argc, char **argv) {
+    if (argc != 3 || (stream = fopen(argv[1], "w")) == NULL || (expected = fopen(argv[2], "w")) == NULL) {
+        fprintf(stderr, "usage: %s stream.txt expected.txt\n", argv[0]);
+        return 2;
+    }
+    host_log_quiet(true);
+    log_capture_init();
+
+    static const char long_string[] =
+        "0123456789abcdefghijklmnopqrstuvwxyz0123456789ABCDEFGHIJKLMNOPQRSTUVWXYZ0123456789";
+    char first[LOG_BINARY_STRING_MAX + 1];
+    char both[2 * LOG_BINARY_STRING_MAX];
+    snprintf(first, sizeof(first), "%.*s", LOG_BINARY_STRING_MAX, long_string);
+
+    CASE(I, "no arguments");
+    CASE(E, "%d %i %u", -5, 2147483647, 4000000000u);
+    CASE(W, "%x %X %08x %o %#x", 0xdeadbeef, 0xab, 0x1f, 8, 255);
+    CASE(I, "%lld %llu", -1234567890123LL, 18446744073709551615ULL);
+    CASE(I, "%f %.2f %e %g %5.1f", 3.5, 2.345, 12345.678, 0.0001, -2.25);
+    CASE(I, "%s and '%s'", "abc", "");
+    CASE(I, "%c%c", 'o', 'k');
+    CASE(I, "[%5d|%-5d|%05d]", 42, 42, -42);
+    CASE(I, "%.*s|%*d", 3, "abcdef", 6, 7);
+    CASE(I, "%ld %lu %zu", -7L, 4000000000UL, sizeof(uint32_t));
+    CASE(I, "%d %d %d %d %d %d %d %d", 1, 2, 3, 4, 5, 6, 7, 8);
+    CASE(I, "100%% of %d, %%s", 5);
+    CASE(I, "%s=%u", "uint8_t", (uint8_t)200);
+    CASE_TEXT(I, "0x1234", "%p", (void *)0x1234);
+    CASE_TEXT(I, "(null)", "%s", (const char *)NULL);
+    // strings are cut to LOG_BINARY_STRING_MAX, and the record to LOG_BINARY_RECORD_MAX:
+    //  after the u32 site ID and one whole string, the next keeps what fits, and
+    //  nothing is left for the one after that
+    CASE_TEXT(I, first, "%s", long_string);
+    snprintf(both, sizeof(both), "%s %.*s <?>", first,
+        LOG_BINARY_RECORD_MAX - 4 - (1 + LOG_BINARY_STRING_MAX) - 1, long_string);
+    CASE_TEXT(W, both, "%s %s %d", long_string, long_string, 1);
+
+    // plain log lines go through as they are
+    ESP_LOGI(TAG, "a text line");
+    drain();
+
+    fclose(stream);
+    fclose(expected);
+    return 0;
+}
@@ -0,0 +1,38 @@
+// metrics_format() as a command line tool, for test_metrics.py to parse. Each argument
+//  is the time of a flash write in us, given to metrics_flash_write(). The clock is
+//  faked so every snapshot is the same; the first line is the whole JSON, then one line
+//  per buffer size from 1 to a byte past the whole: '<size> <returned length> <text>'
+//
+//   metrics_emit [us...]
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "host.h"
+#include "metrics.h"
+#include "sse.h"
+
+int main(int argc, char **argv) {
+    static char full[METRICS_JSON_MAX], buf[METRICS_JSON_MAX];
+    host_log_quiet(true);
+    host_clock_fake();
+    sse_init(NULL);
+
+    for (int i = 1; i < argc; i++) {
+        metrics_flash_write((uint32_t)strtoul(argv[i], NULL, 10));
+    }
+
+    int len = metrics_format(full, sizeof(full));
+    if (len >= (int)sizeof(full) - 1) {
+        fprintf(stderr, "metrics JSON filled METRICS_JSON_MAX\n");
+        return 1;
+    }
+    printf("%s\n", full);
+    for (int size = 1; size <= len + 1; size++) {
+        memset(buf, 'x', sizeof(buf));
+        int n = metrics_format(buf, size);
+        printf("%d %d %s\n", size, n, buf);
+    }
+    return 0;
+}
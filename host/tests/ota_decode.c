@@ -0,0 +1,141 @@
+// ota_decoder.c as a command line tool, for test_ota_decoder.py to check against what
+//  tools/ota_pack.py encodes. The delta base is written into the running partition of
+//  a flash in memory, as on the device.
+//
+//   ota_decode [--heatshrink] [--delta base.bin] [--splits] payload.bin output.bin
+//
+// --splits also decodes the payload fed in two pieces, split at every byte, and fails
+//  unless each gives the same result as feeding it whole. Exits 0 once decoded, 1 if
+//  the decoder failed (its error on stderr), 2 on bad arguments, 3 if a split differed
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "esp_ota_ops.h"
+#include "esp_partition.h"
+#include "host.h"
+#include "ota_decoder.h"
+
+#define OUTPUT_MAX (1024 * 1024)
+
+typedef struct {
+    uint8_t *data;
+    size_t len;
+} output_t;
+
+static esp_err_t output_sink(void *ctx, const uint8_t *data, size_t len) {
+    output_t *out = ctx;
+    if (len > OUTPUT_MAX - out->len) {
+        return ESP_ERR_INVALID_SIZE;
+    }
+    memcpy(out->data + out->len, data, len);
+    out->len += len;
+    return ESP_OK;
+}
+
+// The payload fed as data[0, split) then data[split, len)
+static esp_err_t decode(uint8_t encoding, const esp_partition_t *base, const uint8_t *data, size_t len,
+                        size_t split, output_t *out) {
+    out->len = 0;
+    ota_decoder_t decoder = ota_decoder_create(encoding, base, output_sink, out);
+    if (decoder == NULL) {
+        return ESP_ERR_NO_MEM;
+    }
+    esp_err_t err = ota_decoder_write(decoder, data, split);
+    if (err == ESP_OK) {
+        err = ota_decoder_write(decoder, data + split, len - split);
+    }
+    if (err == ESP_OK) {
+        err = ota_decoder_finish(decoder);
+    }
+    ota_decoder_delete(decoder);
+    return err;
+}
+
+static uint8_t *read_file(const char *path, size_t *len) {
+    FILE *f = fopen(path, "rb");
+    if (f == NULL) {
+        perror(path);
+        return NULL;
+    }
+    fseek(f, 0, SEEK_END);
+    *len = ftell(f);
+    fseek(f, 0, SEEK_SET);
+    uint8_t *data = malloc(*len + 1);
+    if (data != NULL && fread(data, 1, *len, f) != *len) {
+        perror(path);
+        free(data);
+        data = NULL;
+    }
+    fclose(f);
+    return data;
+}
+
+int main(int argc, char **argv) {
+    uint8_t encoding = OTA_ENCODING_NONE;
+    const char *base_path = NULL;
+    bool splits = false;
+    int arg = 1;
+    for (; arg < argc && strncmp(argv[arg], "--", 2) == 0; arg++) {
+        if (strcmp(argv[arg], "--heatshrink") == 0) {
+            encoding |= OTA_ENCODING_HEATSHRINK;
+        } else if (strcmp(argv[arg], "--delta") == 0 && arg + 1 < argc) {
+            encoding |= OTA_ENCODING_DELTA;
+            base_path = argv[++arg];
+        } else if (strcmp(argv[arg], "--splits") == 0) {
+            splits = true;
+        } else {
+            break;
+        }
+    }
+    if (argc - arg != 2) {
+        fprintf(stderr, "usage: %s [--heatshrink] [--delta base.bin] [--splits] payload.bin output.bin\n", argv[0]);
+        return 2;
+    }
+
+    host_log_quiet(true);
+    if (host_flash_open(NULL, HOST_PARTITION_TABLE, HOST_FLASH_SIZE_DEFAULT) != ESP_OK) {
+        return 2;
+    }
+    const esp_partition_t *running = esp_ota_get_running_partition();
+    if (base_path != NULL) {
+        size_t base_len;
+        uint8_t *base = read_file(base_path, &base_len);
+        if (base == NULL || base_len > running->size) {
+            return 2;
+        }
+        memcpy(host_flash_data() + running->address, base, base_len);
+        free(base);
+    }
+
+    size_t len;
+    uint8_t *payload = read_file(argv[arg], &len);
+    if (payload == NULL) {
+        return 2;
+    }
+    output_t whole = { .data = malloc(OUTPUT_MAX) };
+    output_t split = { .data = malloc(OUTPUT_MAX) };
+
+    esp_err_t err = decode(encoding, running, payload, len, len, &whole);
+    for (size_t at = 0; splits && at < len; at++) {
+        esp_err_t split_err = decode(encoding, running, payload, len, at, &split);
+        if (split_err != err || split.len != whole.len || memcmp(split.data, whole.data, whole.len) != 0) {
+            fprintf(stderr, "split at %zu: 0x%x and %zu bytes, whole: 0x%x and %zu bytes\n",
+                at, split_err, split.len, err, whole.len);
+            return 3;
+        }
+    }
+    if (err != ESP_OK) {
+        fprintf(stderr, "decoder failed: 0x%x after %zu bytes\n", err, whole.len);
+        return 1;
+    }
+
+    FILE *f = fopen(argv[arg + 1], "wb");
+    if (f == NULL || fwrite(whole.data, 1, whole.len, f) != whole.len) {
+        perror(argv[arg + 1]);
+        return 2;
+    }
+    fclose(f);
+    return 0;
+}
@@ -0,0 +1,194 @@
+// relay.c as two instances on loopback, for test_relay.py: one serving a file as GET
+//  /firmware, the other pulling it from there the way handle_pull() does, picking a
+//  dropped connection up again with a Range request.
+//
+//   relay_peer serve [--drop-at N] [--bad-sha256] port image.bin
+//   relay_peer pull url output.bin
+//
+// --drop-at fails the image read at offset N, once, so that connection is closed part
+//  way; --bad-sha256 sends a digest that doesn't match. 'pull' prints the bytes pulled
+//  and how many times it resumed. Exits 0 once the image is pulled and its
+//  X-Image-SHA256 checked, 1 if the peer couldn't be reached or gave up, 2 on bad
+//  arguments, 3 if the digest or a resumed image differed
+
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <openssl/sha.h>
+
+#include "port.h"
+#include "relay.h"
+#include "server.h"
+
+#define RETRIES 3
+
+static uint8_t *image_data;
+static relay_image_t image;
+static long drop_at = -1;
+
+static bool image_read(void *ctx, uint32_t offset, void *buf, size_t len) {
+    if (drop_at >= 0 && offset + len > (uint32_t)drop_at) {
+        drop_at = -1;
+        return false;
+    }
+    memcpy(buf, image_data + offset, len);
+    return true;
+}
+
+static const char *const wanted_headers[] = { "Range", NULL };
+
+static int on_request(server_conn_t *conn) {
+    const http_parser_t *req = &conn->parser;
+    if (!http_slice_equals(conn->buffer, req->method, "GET") ||
+            !http_slice_equals(conn->buffer, req->path, "/firmware")) {
+        const char *not_found = "HTTP/1.1 404 Not Found\r\nContent-Length: 0\r\n\r\n";
+        send(conn->fd, not_found, strlen(not_found), 0);
+        return -1;
+    }
+    char range[40];
+    size_t range_len = 0;
+    const http_header_t *range_header = http_parser_find_header(req, conn->buffer, "Range");
+    if (range_header != NULL) {
+        range_len = (range_header->value.len < sizeof(range)) ? range_header->value.len : sizeof(range) - 1;
+        memcpy(range, conn->buffer + range_header->value.off, range_len);
+    }
+    static uint8_t buf[SERVER_BUFF_SIZE];
+    relay_serve(conn->fd, &image, range_header ? range : NULL, range_len, image_read, NULL, buf, sizeof(buf));
+    return -1;
+}
+
+static bool wants_write(server_conn_t *conn) {
+    return false;
+}
+
+static int on_writable(server_conn_t *conn) {
+    return -1;
+}
+
+static void on_idle(server_conn_t *conn) {
+}
+
+static int serve(int argc, char **argv) {
+    bool bad_sha256 = false;
+    int arg = 0;
+    for (; arg < argc && strncmp(argv[arg], "--", 2) == 0; arg++) {
+        if (strcmp(argv[arg], "--drop-at") == 0 && arg + 1 < argc) {
+            drop_at = atol(argv[++arg]);
+        } else if (strcmp(argv[arg], "--bad-sha256") == 0) {
+            bad_sha256 = true;
+        } else {
+            return 2;
+        }
+    }
+    if (argc - arg != 2) {
+        return 2;
+    }
+    FILE *f = fopen(argv[arg + 1], "rb");
+    if (f == NULL) {
+        perror(argv[arg + 1]);
+        return 2;
+    }
+    fseek(f, 0, SEEK_END);
+    image.length = ftell(f);
+    rewind(f);
+    image_data = malloc(image.length);
+    if (image_data == NULL || fread(image_data, 1, image.length, f) != image.length) {
+        fprintf(stderr, "can't read %s\n", argv[arg + 1]);
+        return 2;
+    }
+    fclose(f);
+    SHA256(image_data, image.length, image.sha256);
+    if (bad_sha256) {
+        image.sha256[0] ^= 0xff;
+    }
+
+    const server_handlers_t handlers = {
+        .on_request = on_request,
+        .wants_write = wants_write,
+        .on_writable = on_writable,
+        .on_idle = on_idle,
+        .headers = wanted_headers,
+    };
+    // a client that leaves fails the send, as with lwIP, rather than ending the process
+    signal(SIGPIPE, SIG_IGN);
+    server_run((uint16_t)atoi(argv[arg]), &handlers);
+    return 1;
+}
+
+static int pull(const char *url_text, const char *path) {
+    relay_url_t url;
+    if (!relay_parse_url(url_text, strlen(url_text), &url)) {
+        fprintf(stderr, "bad URL %s\n", url_text);
+        return 2;
+    }
+    char buf[SERVER_BUFF_SIZE];
+    relay_response_t response;
+    if (!relay_fetch(&url, 0, 5000, &response, buf, sizeof(buf))) {
+        return 1;
+    }
+    uint8_t *data = malloc(response.length);
+    if (data == NULL) {
+        close(response.fd);
+        return 1;
+    }
+    memcpy(data, buf + response.body_off, response.body_len);
+    uint32_t received = response.body_len;
+    int resumed = 0;
+
+    while (received < response.length) {
+        ssize_t n = recv(response.fd, data + received, response.length - received, 0);
+        if (n > 0) {
+            received += n;
+            continue;
+        }
+        close(response.fd);
+        // carry on from where the data stopped. the same image, or nothing
+        relay_response_t next;
+        if (resumed == RETRIES || !relay_fetch(&url, received, 5000, &next, buf, sizeof(buf))) {
+            fprintf(stderr, "gave up at %u of %u\n", (unsigned)received, (unsigned)response.length);
+            return 1;
+        }
+        if (next.length != response.length || next.has_sha256 != response.has_sha256 ||
+                memcmp(next.sha256, response.sha256, sizeof(next.sha256)) != 0) {
+            fprintf(stderr, "the image changed while it was pulled\n");
+            close(next.fd);
+            return 3;
+        }
+        memcpy(data + received, buf + next.body_off, next.body_len);
+        received += next.body_len;
+        response.fd = next.fd;
+        resumed++;
+    }
+    close(response.fd);
+
+    uint8_t sha256[32];
+    SHA256(data, response.length, sha256);
+    if (!response.has_sha256 || memcmp(sha256, response.sha256, sizeof(sha256)) != 0) {
+        fprintf(stderr, "X-Image-SHA256 missing or doesn't match\n");
+        return 3;
+    }
+    FILE *f = fopen(path, "wb");
+    if (f == NULL || fwrite(data, 1, response.length, f) != response.length) {
+        perror(path);
+        return 1;
+    }
+    fclose(f);
+    printf("%u bytes, %d resumed\n", (unsigned)response.length, resumed);
+    return 0;
+}
+
+int main(int argc, char **argv) {
+    int ret = 2;
+    if (argc >= 2 && strcmp(argv[1], "serve") == 0) {
+        ret = serve(argc - 2, argv + 2);
+    } else if (argc == 4 && strcmp(argv[1], "pull") == 0) {
+        ret = pull(argv[2], argv[3]);
+    }
+    if (ret == 2) {
+        fprintf(stderr, "usage: %s serve [--drop-at N] [--bad-sha256] port image.bin\n"
+                        "       %s pull url output.bin\n", argv[0], argv[0]);
+    }
+    return ret;
+}
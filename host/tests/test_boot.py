@@ -0,0 +1,151 @@
+"""Boot phase timing in ota_sim: the phases in /metrics in the order app_main runs them,
+'ready' once both the listener and the AP are up, and the 'boot' event replayed to a
+subscriber that connects later. Then CONFIG_FAST_START (ota_sim_fast): the listener
+started before wifi, and the NVS blob it boots from, rewritten when NVS changes"""
+
+import json
+import os
+import socket
+import struct
+import sys
+import tempfile
+import time
+import unittest
+
+sys.path.insert(0, os.path.join(os.path.dirname(os.path.abspath(__file__)), "..", "sim"))
+from ota_sim import Sim  # noqa: E402
+
+OTA_SIM = os.environ["OTA_SIM"]
+OTA_SIM_FAST = os.environ["OTA_SIM_FAST"]
+
+PHASES = ["app_main", "event_loop", "config", "netif", "wifi_init", "wifi_start", "tasks"]
+FAST_PHASES = ["app_main", "event_loop", "config", "netif", "tasks", "wifi_init", "wifi_start"]
+
+# host/stubs/nvs.c's file: per item a 16 byte namespace and a 16 byte key (each up to
+#  its first NUL), a type byte, a u32 length and the data
+NVS_U8 = 1
+NVS_BLOB = 3
+
+
+def nvs_read(path):
+    items = {}
+    with open(path, "rb") as f:
+        data = f.read()
+    at = 0
+    while at < len(data):
+        ns = data[at:at + 16].split(b"\0")[0].decode()
+        key = data[at + 16:at + 32].split(b"\0")[0].decode()
+        item_type, length = struct.unpack_from("<BI", data, at + 32)
+        items[(ns, key)] = (item_type, data[at + 37:at + 37 + length])
+        at += 37 + length
+    return items
+
+
+def nvs_write(path, items):
+    with open(path, "wb") as f:
+        for (ns, key), (item_type, value) in items.items():
+            f.write(ns.encode().ljust(16, b"\0") + key.encode().ljust(16, b"\0"))
+            f.write(struct.pack("<BI", item_type, len(value)) + value)
+
+
+class BootTest(unittest.TestCase):
+
+    def setUp(self):
+        self.workdir = tempfile.TemporaryDirectory()
+
+    def tearDown(self):
+        self.workdir.cleanup()
+
+    def boot_phases(self, sim):
+        """/metrics' boot phases, once the boot is over, in the order they were marked"""
+        deadline = time.monotonic() + 10
+        while True:
+            status, _, body = sim.request("GET", "/metrics")
+            self.assertEqual(status, 200)
+            boot = json.loads(body)["boot"]
+            if "ready" in boot or time.monotonic() > deadline:
+                return boot
+            time.sleep(0.05)
+
+    def assertPhases(self, boot, order):
+        # each of app_main's phases once, in its order, at non-decreasing times
+        marked = [phase for phase in boot if phase in order]
+        self.assertEqual(marked, order)
+        times = [boot[phase] for phase in order]
+        self.assertEqual(times, sorted(times))
+        # listening and ap_start come from other tasks; ready is whichever is later,
+        #  which with CONFIG_FAST_START can be before esp_wifi_start() returns
+        self.assertGreaterEqual(boot["listening"], boot["netif"])
+        self.assertEqual(boot["ready"], max(boot["listening"], boot["ap_start"]))
+        ready = list(boot).index("ready")
+        self.assertGreater(ready, max(list(boot).index("listening"), list(boot).index("ap_start")))
+        self.assertEqual(len(boot), len(order) + 3)
+
+    def replayed_boot(self, sim):
+        """The 'boot' event a new subscriber is sent from the history"""
+        with sim.connect() as sock:
+            sock.sendall(b"GET /event?level=N HTTP/1.1\r\nHost: 127.0.0.1\r\n\r\n")
+            sock.settimeout(0.5)
+            data = b""
+            try:
+                while True:
+                    chunk = sock.recv(4096)
+                    if not chunk:
+                        break
+                    data += chunk
+            except socket.timeout:
+                pass
+        for frame in data.decode(errors="replace").split("\n\n"):
+            fields = frame.split("\n")
+            if "event: boot" in fields:
+                return json.loads(next(f[len("data: "):] for f in fields if f.startswith("data: ")))
+        self.fail("no boot event in %r" % data[:400])
+
+    def test_phases(self):
+        with Sim(OTA_SIM, self.workdir.name) as sim:
+            boot = self.boot_phases(sim)
+            self.assertPhases(boot, PHASES)
+            time.sleep(0.2)
+            self.assertEqual(self.replayed_boot(sim), boot)
+
+    def test_fast_start(self):
+        sim = Sim(OTA_SIM_FAST, self.workdir.name)
+        nvs_write(sim.nvs, {("lights", "status_led"): (NVS_U8, bytes([2]))})
+
+        # the first boot derives the configuration and saves it
+        with sim:
+            self.assertPhases(self.boot_phases(sim), FAST_PHASES)
+            time.sleep(0.2)
+        blob_type, blob = nvs_read(sim.nvs)[("boot", "config")]
+        self.assertEqual(blob_type, NVS_BLOB)
+        self.assertEqual(blob[:2], bytes([1, 2]))      # version, led_gpio
+        self.assertIn(b"esp_", blob)
+
+        # a boot from the blob leaves it as it was
+        mtime = os.stat(sim.nvs).st_mtime_ns
+        with sim:
+            self.assertPhases(self.boot_phases(sim), FAST_PHASES)
+            time.sleep(0.2)
+        self.assertEqual(os.stat(sim.nvs).st_mtime_ns, mtime)
+
+        # a changed status LED is written back for the next boot
+        items = nvs_read(sim.nvs)
+        items[("lights", "status_led")] = (NVS_U8, bytes([4]))
+        nvs_write(sim.nvs, items)
+        with sim:
+            self.boot_phases(sim)
+            time.sleep(0.2)
+        self.assertEqual(nvs_read(sim.nvs)[("boot", "config")][1][:2], bytes([1, 4]))
+
+        # and a blob from a build with another layout is replaced
+        items = nvs_read(sim.nvs)
+        items[("boot", "config")] = (NVS_BLOB, bytes([0]) + blob[1:])
+        nvs_write(sim.nvs, items)
+        with sim:
+            self.assertPhases(self.boot_phases(sim), FAST_PHASES)
+            time.sleep(0.2)
+        self.assertEqual(nvs_read(sim.nvs)[("boot", "config")][1][:2], bytes([1, 4]))
+
+
+if __name__ == "__main__":
+    unittest.main()
@@ -0,0 +1,94 @@
+"""Which sectors of the main slot an upload erases, read back from ota_sim's flash file
+with the slot filled with a pattern first: every sector the image reaches, the last
+partial one included, and none past it however far ahead the writer erases. And with
+skip-unchanged, a sector is compared rather than erased ahead after a lone change"""
+
+import os
+import sys
+import tempfile
+import unittest
+
+sys.path.insert(0, os.path.join(os.path.dirname(os.path.abspath(__file__)), "..", "sim"))
+from ota_sim import MAIN_ADDRESS, Sim, app_image, read_response  # noqa: E402
+
+OTA_SIM = os.environ["OTA_SIM"]
+SECTOR = 4096
+SLOT_SIZE = 640 * 1024          # main, in custom.csv
+
+
+def pattern(length):
+    # never 0xff, and unlike the random image, so a write over it without an erase shows
+    return bytes((i * 7 + 0x35) % 0xff for i in range(length))
+
+
+class EraseAheadTest(unittest.TestCase):
+
+    def setUp(self):
+        self.workdir = tempfile.TemporaryDirectory()
+        self.sim = Sim(OTA_SIM, self.workdir.name)
+        # once, to create the flash file; then the slot is filled behind its back
+        self.sim.start()
+        self.sim.stop()
+        self.fill = pattern(SLOT_SIZE)
+        self.write_flash(MAIN_ADDRESS, self.fill)
+
+    def tearDown(self):
+        self.sim.stop()
+        self.workdir.cleanup()
+
+    def write_flash(self, address, data):
+        with open(self.sim.flash, "r+b") as f:
+            f.seek(address)
+            f.write(data)
+
+    def flash(self, address, length):
+        with open(self.sim.flash, "rb") as f:
+            f.seek(address)
+            return f.read(length)
+
+    def upload(self, image):
+        """POST /send of 'image' to main: the response body, once the app has restarted"""
+        self.sim.start()
+        header = ("POST /send HTTP/1.1\r\nHost: 127.0.0.1\r\nContent-Length: %d\r\n\r\n"
+                  % len(image)).encode()
+        with self.sim.connect() as sock:
+            sock.sendall(header + image)
+            status, _, body = read_response(sock)
+        self.assertEqual(status, 200)
+        self.assertEqual(self.sim.wait(), 3)
+        return body
+
+    def assert_untouched(self, first):
+        # from sector 'first' to the end of the slot
+        start = first * SECTOR
+        self.assertEqual(self.flash(MAIN_ADDRESS + start, SLOT_SIZE - start), self.fill[start:])
+
+    def test_partial_last_sector(self):
+        image = app_image(MAIN_ADDRESS, 3 * SECTOR + 1024)
+        self.assertEqual(self.upload(image), b'{"written":4,"skipped":0}')
+        # each sector erased before it was written, the last one's tail included
+        self.assertEqual(self.flash(MAIN_ADDRESS, len(image)), image)
+        self.assertEqual(self.flash(MAIN_ADDRESS + len(image), SECTOR - 1024), b"\xff" * (SECTOR - 1024))
+        self.assert_untouched(4)
+
+    def test_whole_sectors(self):
+        # the image ends on a sector boundary: nothing erased ahead past it
+        image = app_image(MAIN_ADDRESS, 4 * SECTOR)
+        self.assertEqual(self.upload(image), b'{"written":4,"skipped":0}')
+        self.assertEqual(self.flash(MAIN_ADDRESS, len(image)), image)
+        self.assert_untouched(4)
+
+    def test_compared_before_erased(self):
+        # the slot already holds all of the image but its first sector. a lone changed
+        #  sector erases nothing ahead, so the rest is compared and skipped
+        image = app_image(MAIN_ADDRESS, 3 * SECTOR + 1024)
+        self.write_flash(MAIN_ADDRESS + SECTOR, image[SECTOR:])
+        self.assertEqual(self.upload(image), b'{"written":1,"skipped":3}')
+        self.assertEqual(self.flash(MAIN_ADDRESS, len(image)), image)
+        # the last sector was compared over the image only, and never erased
+        self.assertEqual(self.flash(MAIN_ADDRESS + len(image), SECTOR - 1024), self.fill[len(image):4 * SECTOR])
+        self.assert_untouched(4)
+
+
+if __name__ == "__main__":
+    unittest.main()
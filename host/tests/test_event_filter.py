@@ -0,0 +1,98 @@
+"""GET /event's filter query in ota_sim: values main.c must refuse with a 400, and
+subscribers with different filters each getting only their own log lines"""
+
+import os
+import socket
+import sys
+import tempfile
+import time
+import unittest
+
+sys.path.insert(0, os.path.join(os.path.dirname(os.path.abspath(__file__)), "..", "sim"))
+from ota_sim import Sim  # noqa: E402
+
+OTA_SIM = os.environ["OTA_SIM"]
+
+
+class EventFilterTest(unittest.TestCase):
+
+    @classmethod
+    def setUpClass(cls):
+        cls.workdir = tempfile.TemporaryDirectory()
+        cls.sim = Sim(OTA_SIM, cls.workdir.name)
+        cls.sim.start()
+
+    @classmethod
+    def tearDownClass(cls):
+        cls.sim.stop()
+        cls.workdir.cleanup()
+
+    def subscribe(self, query):
+        """An open /event stream, past its response header"""
+        sock = self.sim.connect()
+        sock.sendall(("GET /event?%s HTTP/1.1\r\nHost: 127.0.0.1\r\n\r\n" % query).encode())
+        head = b""
+        while b"\r\n\r\n" not in head:
+            chunk = sock.recv(1)
+            self.assertTrue(chunk, "closed before the response header")
+            head += chunk
+        self.assertTrue(head.startswith(b"HTTP/1.1 200"), head)
+        self.assertIn(b"text/event-stream", head)
+        return sock
+
+    def drain(self, sock, seconds=0.5):
+        sock.settimeout(0.1)
+        data = b""
+        deadline = time.monotonic() + seconds
+        while time.monotonic() < deadline:
+            try:
+                chunk = sock.recv(4096)
+            except socket.timeout:
+                continue
+            if not chunk:
+                break
+            data += chunk
+        return data.decode(errors="replace")
+
+    @staticmethod
+    def log_lines(stream):
+        """The data of each log line frame; named events always go through"""
+        lines = []
+        for frame in stream.split("\n\n"):
+            fields = frame.split("\n")
+            if not any(field.startswith("event:") for field in fields):
+                lines += [field[len("data: "):] for field in fields if field.startswith("data: ")]
+        return lines
+
+    def test_refused(self):
+        for query in ("level=X", "level=", "level=WE", "rate=abc", "rate=", "rate=65536",
+                      "rate=99999999999", "batch=0", "batch=17", "batch=-1",
+                      "tags=a,b,c,d,e", "exclude=a,b,,c,d,e"):
+            with self.subTest(query=query):
+                status, headers, body = self.sim.request("GET", "/event?" + query)
+                self.assertEqual(status, 400)
+                self.assertEqual(headers["content-length"], "0")
+
+    def test_accepted(self):
+        for query in ("level=V", "level=N&tags=ota", "rate=65535&batch=16", "tags=a,b,c,d&exclude=e", "tags=,"):
+            with self.subTest(query=query):
+                self.subscribe(query).close()
+
+    def test_own_lines(self):
+        # each subscription is logged at info under the "sse" tag
+        wanted = self.subscribe("tags=sse")
+        errors_only = self.subscribe("level=E")
+        self.drain(wanted)
+        self.drain(errors_only)
+        self.subscribe("level=N").close()
+        lines = self.log_lines(self.drain(wanted))
+        self.assertTrue(lines)
+        self.assertTrue(all(" sse: " in line for line in lines), lines)
+        self.assertTrue(any("sse_socket" in line for line in lines), lines)
+        self.assertEqual(self.log_lines(self.drain(errors_only)), [])
+        wanted.close()
+        errors_only.close()
+
+
+if __name__ == "__main__":
+    unittest.main()
@@ -0,0 +1,216 @@
+// http_parser: requests split at every byte, header limits, Content-Length bounds, the
+//  query helper, and random damage to real requests fed in random pieces
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "check.h"
+#include "http_parser.h"
+
+static const char *const wanted[] = { "If-None-Match", "Content-Length", "Range", NULL };
+
+// Chrome 120 reloading the upload page: 15 headers, the one that matters last
+static const char chrome[] =
+    "GET / HTTP/1.1\r\n"
+    "Host: 192.168.4.1\r\n"
+    "Connection: keep-alive\r\n"
+    "Cache-Control: max-age=0\r\n"
+    "Upgrade-Insecure-Requests: 1\r\n"
+    "User-Agent: Mozilla/5.0 (X11; Linux x86_64) AppleWebKit/537.36 (KHTML, like Gecko) Chrome/120.0.0.0 Safari/537.36\r\n"
+    "Accept: text/html,application/xhtml+xml,application/xml;q=0.9,image/avif,image/webp,image/apng,*/*;q=0.8\r\n"
+    "Sec-GPC: 1\r\n"
+    "Accept-Language: en-GB,en;q=0.9\r\n"
+    "Sec-Fetch-Site: none\r\n"
+    "Sec-Fetch-Mode: navigate\r\n"
+    "Sec-Fetch-User: ?1\r\n"
+    "Sec-Fetch-Dest: document\r\n"
+    "Accept-Encoding: gzip, deflate\r\n"
+    "DNT: 1\r\n"
+    "If-None-Match: \"3f2a9c1e\"\r\n"
+    "\r\n";
+
+static const char upload[] =
+    "POST /send?part=main HTTP/1.1\r\n"
+    "Host: 192.168.4.1\r\n"
+    "Content-Length: 4096\r\n"
+    "Content-Type: application/octet-stream\r\n"
+    "\r\n"
+    "\xe9\x01\x02\x20";
+
+static http_parse_result_t parse(http_parser_t *p, const char *const *keep, const char *buf, size_t len) {
+    http_parser_init(p, keep);
+    return http_parser_feed(p, buf, len);
+}
+
+// the same result however the bytes arrive: all at once, or split once at every offset
+static void test_splits(const char *req, size_t len, const char *const *keep) {
+    http_parser_t whole, split;
+    http_parse_result_t expected = parse(&whole, keep, req, len);
+    CHECK(expected == HTTP_PARSE_DONE);
+
+    for (size_t at = 0; at <= len; at++) {
+        http_parser_init(&split, keep);
+        http_parse_result_t first = http_parser_feed(&split, req, at);
+        http_parse_result_t result = http_parser_feed(&split, req, len);
+        CHECK(first == HTTP_PARSE_INCOMPLETE || at >= whole.body_offset);
+        CHECK_EQ(result, expected);
+        CHECK_EQ(split.body_offset, whole.body_offset);
+        CHECK_EQ(split.header_count, whole.header_count);
+        CHECK(memcmp(split.headers, whole.headers, sizeof(whole.headers)) == 0);
+        CHECK_EQ(split.content_length, whole.content_length);
+    }
+}
+
+static void test_late_header(void) {
+    http_parser_t p;
+    CHECK_EQ(parse(&p, wanted, chrome, strlen(chrome)), HTTP_PARSE_DONE);
+    CHECK_EQ(p.header_count, 1);
+    const http_header_t *h = http_parser_find_header(&p, chrome, "if-none-match");
+    CHECK(h != NULL);
+    CHECK(h != NULL && http_slice_equals(chrome, h->value, "\"3f2a9c1e\""));
+    CHECK(http_parser_find_header(&p, chrome, "User-Agent") == NULL);
+    CHECK(http_slice_equals(chrome, p.path, "/"));
+
+    // kept without a list, there are more than fit
+    CHECK_EQ(parse(&p, NULL, chrome, strlen(chrome)), HTTP_PARSE_TOO_MANY_HEADERS);
+}
+
+static void test_too_many_wanted(void) {
+    char req[1024];
+    int len = sprintf(req, "GET / HTTP/1.1\r\n");
+    for (int i = 0; i <= HTTP_MAX_HEADERS; i++) {
+        len += sprintf(req + len, "Range: bytes=%d-\r\n", i);
+    }
+    len += sprintf(req + len, "\r\n");
+
+    http_parser_t p;
+    CHECK_EQ(parse(&p, wanted, req, len), HTTP_PARSE_TOO_MANY_HEADERS);
+    // and stays failed
+    CHECK_EQ(http_parser_feed(&p, req, len), HTTP_PARSE_ERROR);
+
+    // exactly HTTP_MAX_HEADERS fit
+    int last = strstr(req, "Range: bytes=12-") - req;
+    strcpy(req + last, "\r\n");
+    CHECK_EQ(parse(&p, wanted, req, last + 2), HTTP_PARSE_DONE);
+    CHECK_EQ(p.header_count, HTTP_MAX_HEADERS);
+}
+
+static void test_content_length(void) {
+    static const struct {
+        const char *value;
+        bool valid;
+        uint32_t length;
+    } cases[] = {
+        { "0", true, 0 },
+        { "4096", true, 4096 },
+        { "4294967295", true, 4294967295u },
+        { "00000000000000004096", true, 4096 },
+        { "4294967296", false, 0 },
+        { "4294967297", false, 0 },
+        { "42949672950", false, 0 },
+        { "99999999999999999999", false, 0 },
+        { "-1", false, 0 },
+        { "12a", false, 0 },
+        { "", false, 0 },
+    };
+    for (size_t i = 0; i < sizeof(cases) / sizeof(cases[0]); i++) {
+        char req[128];
+        int len = sprintf(req, "POST /send HTTP/1.1\r\nContent-Length: %s\r\n\r\n", cases[i].value);
+        http_parser_t p;
+        CHECK_EQ(parse(&p, wanted, req, len), HTTP_PARSE_DONE);
+        if (p.has_content_length != cases[i].valid || p.content_length != cases[i].length) {
+            fprintf(stderr, "Content-Length: %s\n", cases[i].value);
+        }
+        CHECK_EQ(p.has_content_length, cases[i].valid);
+        CHECK_EQ(p.content_length, cases[i].length);
+    }
+}
+
+static void test_query(void) {
+    static const char buf[] = "GET /event?level=I&tags=main,sse&raw&x= HTTP/1.1\r\n\r\n";
+    http_parser_t p;
+    http_slice_t value;
+    CHECK_EQ(parse(&p, wanted, buf, strlen(buf)), HTTP_PARSE_DONE);
+    CHECK(http_query_param(buf, p.query, "level", &value) && http_slice_equals(buf, value, "I"));
+    CHECK(http_query_param(buf, p.query, "tags", &value) && http_slice_equals(buf, value, "main,sse"));
+    CHECK(http_query_param(buf, p.query, "raw", &value) && value.len == 0);
+    CHECK(http_query_param(buf, p.query, "x", &value) && value.len == 0);
+    CHECK(!http_query_param(buf, p.query, "lev", &value));
+    CHECK(!http_query_param(buf, p.query, "levels", &value));
+}
+
+// A slice must lie inside what was fed, and feeding in pieces must agree with feeding
+//  it whole, whatever the bytes
+static void test_fuzz(int iterations) {
+    static const char *const seeds[] = { chrome, upload };
+    static const char alphabet[] = "\r\n: \t?=&/AZaz09\x7f\x01\xff";
+    char buf[1024];
+    srand(1);
+
+    for (int n = 0; n < iterations; n++) {
+        const char *seed = seeds[n % 2];
+        size_t len = strlen(seed);
+        memcpy(buf, seed, len);
+        for (int edits = rand() % 8; edits > 0; edits--) {
+            size_t at = rand() % len;
+            switch (rand() % 3) {
+                case 0:     // replace
+                    buf[at] = alphabet[rand() % (sizeof(alphabet) - 1)];
+                    break;
+                case 1:     // delete
+                    memmove(buf + at, buf + at + 1, len - at - 1);
+                    len--;
+                    break;
+                default:    // duplicate a run
+                    if (len < sizeof(buf) - 64) {
+                        size_t run = 1 + rand() % 48;
+                        run = (run > len - at) ? len - at : run;
+                        memmove(buf + at + run, buf + at, len - at);
+                        len += run;
+                    }
+                    break;
+            }
+        }
+
+        http_parser_t whole, pieces;
+        http_parse_result_t expected = parse(&whole, (n & 4) ? NULL : wanted, buf, len);
+        http_parser_init(&pieces, (n & 4) ? NULL : wanted);
+        http_parse_result_t result = HTTP_PARSE_INCOMPLETE;
+        for (size_t fed = 0; fed < len && result == HTTP_PARSE_INCOMPLETE; ) {
+            fed += 1 + rand() % 16;
+            result = http_parser_feed(&pieces, buf, (fed > len) ? len : fed);
+        }
+        CHECK_EQ(result, expected);
+        if (expected != HTTP_PARSE_DONE) {
+            continue;
+        }
+        CHECK(whole.body_offset <= len);
+        CHECK(whole.header_count <= HTTP_MAX_HEADERS);
+        CHECK(whole.method.off + whole.method.len <= whole.body_offset);
+        CHECK(whole.path.off + whole.path.len <= whole.body_offset);
+        CHECK(whole.query.off + whole.query.len <= whole.body_offset);
+        for (int i = 0; i < whole.header_count; i++) {
+            CHECK(whole.headers[i].name.off + whole.headers[i].name.len <= whole.body_offset);
+            CHECK(whole.headers[i].value.off + whole.headers[i].value.len <= whole.body_offset);
+        }
+        CHECK_EQ(pieces.body_offset, whole.body_offset);
+        CHECK(memcmp(pieces.headers, whole.headers, sizeof(whole.headers)) == 0);
+        if (check_failures != 0) {
+            fprintf(stderr, "iteration %d: %.*s\n", n, (int)len, buf);
+            return;
+        }
+    }
+}
+
+int main(int argc, char **argv) {
+    int iterations = (argc > 1) ? atoi(argv[1]) : 200000;
+
+    test_splits(chrome, strlen(chrome), wanted);
+    test_splits(upload, strlen(upload) - 4, NULL);
+    test_late_header();
+    test_too_many_wanted();
+    test_content_length();
+    test_query();
+    test_fuzz(iterations);
+    return check_result();
+}
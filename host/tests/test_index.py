@@ -0,0 +1,105 @@
+"""GET / from ota_sim: the gzipped page, and 304 for the ETag however many headers
+the browser sends before If-None-Match. The requests are as Chrome and Firefox send
+them when reloading the page"""
+
+import os
+import sys
+import tempfile
+import unittest
+
+sys.path.insert(0, os.path.join(os.path.dirname(os.path.abspath(__file__)), "..", "sim"))
+from ota_sim import Sim  # noqa: E402
+
+OTA_SIM = os.environ["OTA_SIM"]
+
+CHROME = (
+    "GET / HTTP/1.1\r\n"
+    "Host: 192.168.4.1\r\n"
+    "Connection: keep-alive\r\n"
+    "Cache-Control: max-age=0\r\n"
+    "sec-ch-ua: \"Not_A Brand\";v=\"8\", \"Chromium\";v=\"120\", \"Google Chrome\";v=\"120\"\r\n"
+    "sec-ch-ua-mobile: ?0\r\n"
+    "sec-ch-ua-platform: \"Linux\"\r\n"
+    "Upgrade-Insecure-Requests: 1\r\n"
+    "User-Agent: Mozilla/5.0 (X11; Linux x86_64) AppleWebKit/537.36 (KHTML, like Gecko) "
+    "Chrome/120.0.0.0 Safari/537.36\r\n"
+    "Accept: text/html,application/xhtml+xml,application/xml;q=0.9,image/avif,image/webp,"
+    "image/apng,*/*;q=0.8,application/signed-exchange;v=b3;q=0.7\r\n"
+    "Sec-Fetch-Site: none\r\n"
+    "Sec-Fetch-Mode: navigate\r\n"
+    "Sec-Fetch-User: ?1\r\n"
+    "Sec-Fetch-Dest: document\r\n"
+    "Accept-Encoding: gzip, deflate\r\n"
+    "Accept-Language: en-GB,en-US;q=0.9,en;q=0.8\r\n"
+    "If-None-Match: %s\r\n"
+    "\r\n")
+
+FIREFOX = (
+    "GET / HTTP/1.1\r\n"
+    "Host: 192.168.4.1\r\n"
+    "User-Agent: Mozilla/5.0 (X11; Ubuntu; Linux x86_64; rv:121.0) Gecko/20100101 Firefox/121.0\r\n"
+    "Accept: text/html,application/xhtml+xml,application/xml;q=0.9,image/avif,image/webp,*/*;q=0.8\r\n"
+    "Accept-Language: en-GB,en;q=0.5\r\n"
+    "Accept-Encoding: gzip, deflate\r\n"
+    "DNT: 1\r\n"
+    "Sec-GPC: 1\r\n"
+    "Connection: keep-alive\r\n"
+    "Upgrade-Insecure-Requests: 1\r\n"
+    "Sec-Fetch-Dest: document\r\n"
+    "Sec-Fetch-Mode: navigate\r\n"
+    "Sec-Fetch-Site: none\r\n"
+    "Sec-Fetch-User: ?1\r\n"
+    "If-None-Match: %s\r\n"
+    "Pragma: no-cache\r\n"
+    "Cache-Control: no-cache\r\n"
+    "\r\n")
+
+
+class IndexTest(unittest.TestCase):
+
+    @classmethod
+    def setUpClass(cls):
+        cls.workdir = tempfile.TemporaryDirectory()
+        cls.sim = Sim(OTA_SIM, cls.workdir.name)
+        cls.sim.start()
+
+    @classmethod
+    def tearDownClass(cls):
+        cls.sim.stop()
+        cls.workdir.cleanup()
+
+    def etag(self):
+        status, headers, body = self.sim.request("GET", "/")
+        self.assertEqual(status, 200)
+        self.assertEqual(headers["content-encoding"], "gzip")
+        self.assertEqual(body[:2], b"\x1f\x8b")
+        self.assertEqual(len(body), int(headers["content-length"]))
+        return headers["etag"]
+
+    def test_not_modified(self):
+        etag = self.etag()
+        for name, request in (("chrome", CHROME), ("firefox", FIREFOX)):
+            with self.subTest(browser=name):
+                self.assertGreater(request.count("\r\n") - 2, 12)
+                status, headers, body = self.sim.request(None, None, raw=(request % etag).encode())
+                self.assertEqual(status, 304)
+                self.assertEqual(headers["etag"], etag)
+                self.assertEqual(body, b"")
+
+    def test_changed(self):
+        etag = self.etag()
+        for name, request in (("chrome", CHROME), ("firefox", FIREFOX)):
+            with self.subTest(browser=name):
+                status, headers, body = self.sim.request(None, None, raw=(request % '"00000000"').encode())
+                self.assertEqual(status, 200)
+                self.assertEqual(headers["etag"], etag)
+                self.assertEqual(len(body), int(headers["content-length"]))
+
+    def test_too_many_wanted_headers(self):
+        request = "GET / HTTP/1.1\r\n" + "Range: bytes=0-\r\n" * 13 + "\r\n"
+        status, _, _ = self.sim.request(None, None, raw=request.encode())
+        self.assertEqual(status, 431)
+
+
+if __name__ == "__main__":
+    unittest.main()
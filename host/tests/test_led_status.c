@@ -0,0 +1,180 @@
+// led_status on a fake clock: every GPIO write must land on the tick its pattern says,
+//  through signals, pattern changes, active low LEDs and the fixed number of slots
+
+#include <pthread.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+
+#include "check.h"
+#include "host.h"
+#include "led_status.h"
+
+#define MS(ms) ((ms) / portTICK_PERIOD_MS)
+
+typedef struct {
+    TickType_t tick;
+    int gpio;
+    uint32_t level;
+} gpio_write_t;
+
+static pthread_mutex_t writes_lock = PTHREAD_MUTEX_INITIALIZER;
+static gpio_write_t writes[256];
+static int write_count;
+static TickType_t start;
+
+static void gpio_hook(TickType_t tick, int gpio, uint32_t level) {
+    pthread_mutex_lock(&writes_lock);
+    if (write_count < (int)(sizeof(writes) / sizeof(writes[0]))) {
+        writes[write_count++] = (gpio_write_t){ tick - start, gpio, level };
+    }
+    pthread_mutex_unlock(&writes_lock);
+}
+
+// Start a new record of writes, with ticks counted from now
+static void reset(void) {
+    host_tasks_settle();
+    pthread_mutex_lock(&writes_lock);
+    write_count = 0;
+    start = xTaskGetTickCount();
+    pthread_mutex_unlock(&writes_lock);
+}
+
+// One tick at a time, so each write is stamped with the tick it was due at
+static void advance(TickType_t ticks) {
+    host_tasks_settle();
+    for (TickType_t i = 0; i < ticks; i++) {
+        host_clock_advance(1);
+        host_tasks_settle();
+    }
+}
+
+// The writes so far must be exactly 'expected', in order
+static void expect(const char *what, const gpio_write_t *expected, int count) {
+    host_tasks_settle();
+    pthread_mutex_lock(&writes_lock);
+    bool same = (write_count == count);
+    for (int i = 0; same && i < count; i++) {
+        same = (writes[i].tick == expected[i].tick && writes[i].gpio == expected[i].gpio &&
+                writes[i].level == expected[i].level);
+    }
+    if (!same) {
+        fprintf(stderr, "%s: expected", what);
+        for (int i = 0; i < count; i++) {
+            fprintf(stderr, " %u:%d=%u", expected[i].tick, expected[i].gpio, expected[i].level);
+        }
+        fprintf(stderr, "\n%s: got     ", what);
+        for (int i = 0; i < write_count; i++) {
+            fprintf(stderr, " %u:%d=%u", writes[i].tick, writes[i].gpio, writes[i].level);
+        }
+        fprintf(stderr, "\n");
+    }
+    pthread_mutex_unlock(&writes_lock);
+    CHECK(same);
+}
+
+static const led_status_pattern_t blink = LED_STATUS_PATTERN({100, -200});
+static const led_status_pattern_t flash = LED_STATUS_PATTERN({50, -50});
+static const led_status_pattern_t slow = LED_STATUS_PATTERN({300, -100});
+
+static void test_pattern(led_status_t led) {
+    reset();
+    led_status_set(led, &blink);
+    advance(MS(600));
+    const gpio_write_t expected[] = {
+        { 0, 2, 1 }, { MS(100), 2, 0 }, { MS(300), 2, 1 }, { MS(400), 2, 0 }, { MS(600), 2, 1 },
+    };
+    expect("pattern", expected, sizeof(expected) / sizeof(expected[0]));
+}
+
+// A signal runs once from its start, then the pattern starts again from its own
+static void test_signal(led_status_t led) {
+    reset();
+    led_status_signal(led, &flash);
+    advance(MS(300));
+    const gpio_write_t expected[] = {
+        { 0, 2, 1 }, { MS(50), 2, 0 }, { MS(100), 2, 1 }, { MS(200), 2, 0 },
+    };
+    expect("signal", expected, sizeof(expected) / sizeof(expected[0]));
+
+    // a new pattern during a signal waits for it to end
+    advance(MS(100));
+    reset();
+    led_status_signal(led, &flash);
+    advance(MS(20));
+    led_status_set(led, &slow);
+    advance(MS(200));
+    const gpio_write_t replaced[] = {
+        { 0, 2, 1 }, { MS(50), 2, 0 }, { MS(100), 2, 1 },
+    };
+    expect("set during signal", replaced, sizeof(replaced) / sizeof(replaced[0]));
+}
+
+static void test_off(led_status_t led) {
+    reset();
+    led_status_set(led, NULL);
+    advance(MS(1000));
+    const gpio_write_t expected[] = { { 0, 2, 0 } };
+    expect("off", expected, 1);
+}
+
+static void test_two_leds(led_status_t a, led_status_t b) {
+    reset();
+    led_status_set(a, &blink);
+    advance(MS(50));
+    led_status_set(b, &flash);
+    advance(MS(150));
+    led_status_set(a, NULL);
+    host_tasks_settle();
+    led_status_set(b, NULL);
+    // gpio 5 is active low. the newest LED is run first
+    const gpio_write_t expected[] = {
+        { 0, 2, 1 }, { MS(50), 5, 0 }, { MS(100), 5, 1 }, { MS(100), 2, 0 }, { MS(150), 5, 0 },
+        { MS(200), 5, 1 }, { MS(200), 2, 0 }, { MS(200), 5, 1 },
+    };
+    expect("two LEDs", expected, sizeof(expected) / sizeof(expected[0]));
+}
+
+// CONFIG_LED_STATUS_MAX is 3 here. A slot is only free again once the LED task has
+//  dropped the LED, and a dropped LED is never written again
+static void test_slots(led_status_t a) {
+    led_status_t c = led_status_init(12, 1);
+    CHECK(c != NULL);
+    CHECK(led_status_init(13, 1) == NULL);
+
+    led_status_set(a, &blink);
+    reset();
+    led_status_done(a);
+    advance(MS(500));
+    expect("done", NULL, 0);
+
+    led_status_t d = led_status_init(13, 1);
+    CHECK(d != NULL);
+    CHECK(led_status_init(14, 1) == NULL);
+    led_status_done(c);
+    led_status_done(d);
+    host_tasks_settle();
+    CHECK(led_status_init(15, 1) != NULL);
+}
+
+int main(void) {
+    host_log_quiet(true);
+    host_clock_fake();
+    host_gpio_set_hook(gpio_hook);
+
+    reset();
+    led_status_t a = led_status_init(2, 1);
+    led_status_t b = led_status_init(5, 0);
+    CHECK(a != NULL && b != NULL);
+    const gpio_write_t initial[] = { { 0, 2, 0 }, { 0, 5, 1 } };
+    expect("init", initial, 2);
+
+    test_pattern(a);
+    test_signal(a);
+    test_off(a);
+    test_two_leds(a, b);
+    test_slots(a);
+    return check_result();
+}
@@ -0,0 +1,118 @@
+// log_capture with as many tasks logging at once as it has staging slots, into a ring
+//  small enough to wrap every few lines at every possible offset. Every line and record
+//  read back must be whole and in order per task; the rest must be counted as dropped
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+
+#include "esp_log.h"
+#include "check.h"
+#include "host.h"
+#include "log_capture.h"
+
+#define PRODUCERS 4             // LOG_CAPTURE_PRODUCERS
+#define LINES 4000              // per producer
+
+static const char *TAG = "t";
+
+static volatile int finished;
+
+// the text after the 'n' number: 0 to 90 characters that depend on it and the producer
+static int payload(int producer, int n, char *out) {
+    int len = (n * 7 + producer * 13) % 91;
+    for (int i = 0; i < len; i++) {
+        out[i] = 'a' + (producer + n + i) % 26;
+    }
+    out[len] = '\0';
+    return len;
+}
+
+static void producer_task(void *param) {
+    int producer = (int)(intptr_t)param;
+    char text[100];
+    for (int n = 0; n < LINES; n++) {
+        payload(producer, n, text);
+        if (n % 5 == 4) {
+            // a binary record is written in one go, without a staging slot
+            char record[128];
+            int len = sprintf(record, "b%d n%d %s", producer, n, text);
+            log_capture_write_binary(record, len);
+        } else {
+            ESP_LOGI(TAG, "p%d n%d %s", producer, n, text);
+        }
+        if (n % 64 == 0) {
+            vTaskDelay(1);
+        }
+    }
+    __atomic_add_fetch(&finished, 1, __ATOMIC_SEQ_CST);
+    vTaskDelete(NULL);
+}
+
+int main(void) {
+    host_log_quiet(true);
+    log_capture_init();
+
+    for (int i = 0; i < PRODUCERS; i++) {
+        char name[16];
+        sprintf(name, "prod%d", i);
+        CHECK(xTaskCreate(producer_task, name, 8192, (void *)(intptr_t)i, 5, NULL) == pdPASS);
+    }
+
+    int last[PRODUCERS];
+    uint32_t received = 0;
+    for (int i = 0; i < PRODUCERS; i++) {
+        last[i] = -1;
+    }
+
+    log_record_t record;
+    while (true) {
+        // nothing to read after they had all finished: that was everything
+        bool all_finished = (finished == PRODUCERS);
+        if (!log_capture_read(&record, pdMS_TO_TICKS(10))) {
+            if (all_finished) {
+                break;
+            }
+            continue;
+        }
+
+        // "I (ts) t: p0 n12 text" or "b0 n12 text"
+        const char *line = record.text;
+        if (!record.binary) {
+            line = strstr(record.text, ": ");
+            CHECK(line != NULL);
+            if (line == NULL) {
+                continue;
+            }
+            line += 2;
+        }
+        char kind;
+        int producer, n, pos;
+        char expected[100];
+        if (sscanf(line, "%c%d n%d %n", &kind, &producer, &n, &pos) != 3 ||
+                kind != (record.binary ? 'b' : 'p') || producer < 0 || producer >= PRODUCERS) {
+            fprintf(stderr, "damaged: '%s'\n", record.text);
+            CHECK(false);
+            continue;
+        }
+        payload(producer, n, expected);
+        if (strcmp(line + pos, expected) != 0 || n <= last[producer] || record.len != strlen(record.text)) {
+            fprintf(stderr, "damaged or out of order after n%d: '%s'\n", last[producer], record.text);
+            CHECK(false);
+        }
+        char task[16];
+        sprintf(task, "prod%d", producer);
+        CHECK(strncmp(record.task, task, LOG_CAPTURE_TASK_NAME_LEN - 1) == 0);
+        last[producer] = n;
+        received++;
+    }
+
+    uint32_t dropped = log_capture_dropped();
+    printf("%u of %u read back, %u dropped\n", received, PRODUCERS * LINES, dropped);
+    CHECK(received > 0);
+    CHECK_EQ(received + dropped, PRODUCERS * LINES);
+    return check_result();
+}
@@ -0,0 +1,80 @@
+"""Binary log records from LOGB_x calls (log_binary_emit, built with CONFIG_LOG_BINARY),
+decoded by tools/log_decode.py with a dictionary read out of that binary's ELF. Each
+line must come back as printf would have written it"""
+
+import json
+import os
+import re
+import subprocess
+import sys
+import tempfile
+import unittest
+
+REPO_DIR = os.path.join(os.path.dirname(os.path.abspath(__file__)), "..", "..")
+LOG_DECODE = os.path.join(REPO_DIR, "tools", "log_decode.py")
+LOG_BINARY_EMIT = os.environ["LOG_BINARY_EMIT"]
+
+LINE = re.compile(r"^([EWIDV?]) \((\d+)\) ([^:]+): (.*)$")
+
+
+class LogDecodeTest(unittest.TestCase):
+
+    @classmethod
+    def setUpClass(cls):
+        cls.workdir = tempfile.TemporaryDirectory()
+        stream = os.path.join(cls.workdir.name, "stream.txt")
+        expected = os.path.join(cls.workdir.name, "expected.txt")
+        cls.dictionary = os.path.join(cls.workdir.name, "log_dict.json")
+        subprocess.run([LOG_BINARY_EMIT, stream, expected], check=True)
+        subprocess.run([sys.executable, LOG_DECODE, "dict", LOG_BINARY_EMIT, cls.dictionary], check=True,
+                       capture_output=True)
+        decoded = subprocess.run([sys.executable, LOG_DECODE, "decode", cls.dictionary, stream], check=True,
+                                 capture_output=True, text=True).stdout
+        with open(stream) as f:
+            cls.stream = f.read()
+        with open(expected) as f:
+            cls.expected = f.read().splitlines()
+        cls.decoded = decoded.splitlines()
+
+    @classmethod
+    def tearDownClass(cls):
+        cls.workdir.cleanup()
+
+    def test_dictionary(self):
+        with open(self.dictionary) as f:
+            sites = json.load(f)
+        formats = {site["format"] for site in sites.values()}
+        self.assertIn("%d %i %u", formats)
+        self.assertIn("no arguments", formats)
+        for site in sites.values():
+            self.assertIn(site["level"], "EWIDV")
+            self.assertTrue(site["tag"])
+
+    def test_round_trip(self):
+        binary = self.decoded[:len(self.expected)]
+        self.assertEqual(len(binary), len(self.expected))
+        for line, expected in zip(binary, self.expected):
+            with self.subTest(expected=expected):
+                m = LINE.match(line)
+                self.assertIsNotNone(m, line)
+                level, text = expected.split(" ", 1)
+                self.assertEqual(m.group(1), level)
+                self.assertEqual(m.group(3), "logb_test")
+                self.assertEqual(m.group(4), text)
+
+    def test_text_lines_pass_through(self):
+        self.assertEqual(len(self.decoded), len(self.expected) + 1)
+        self.assertTrue(self.decoded[-1].endswith("logb_test: a text line"), self.decoded[-1])
+
+    def test_unknown_site(self):
+        # a dictionary from other firmware: says so rather than guessing
+        path = os.path.join(self.workdir.name, "empty.json")
+        with open(path, "w") as f:
+            f.write("{}")
+        decoded = subprocess.run([sys.executable, LOG_DECODE, "decode", path], input=self.stream,
+                                 check=True, capture_output=True, text=True).stdout.splitlines()
+        self.assertIn("unknown site", decoded[0])
+
+
+if __name__ == "__main__":
+    unittest.main()
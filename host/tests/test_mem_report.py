@@ -0,0 +1,95 @@
+"""The static pools in ota_sim: request buffers running out and being counted in
+/metrics, and tools/mem_report.py reading ota_sim's link map and its /metrics for the
+per component RAM, the largest static buffers, task stacks and pool usage"""
+
+import json
+import os
+import re
+import subprocess
+import sys
+import tempfile
+import time
+import unittest
+
+sys.path.insert(0, os.path.join(os.path.dirname(os.path.abspath(__file__)), "..", "sim"))
+from ota_sim import Sim, read_response  # noqa: E402
+
+REPO_DIR = os.path.join(os.path.dirname(os.path.abspath(__file__)), "..", "..")
+MEM_REPORT = os.path.join(REPO_DIR, "tools", "mem_report.py")
+OTA_SIM = os.environ["OTA_SIM"]
+OTA_SIM_MAP = OTA_SIM + ".map"
+
+BUFFER_POOL = 3         # CONFIG_SERVER_BUFFER_POOL
+TASK_STACKS = {"ota_upload": 4096, "socket_server": 3072, "sse": 2048}
+
+
+class MemReportTest(unittest.TestCase):
+
+    @classmethod
+    def setUpClass(cls):
+        cls.workdir = tempfile.TemporaryDirectory()
+        cls.sim = Sim(OTA_SIM, cls.workdir.name)
+        cls.sim.start()
+
+    @classmethod
+    def tearDownClass(cls):
+        cls.sim.stop()
+        cls.workdir.cleanup()
+
+    def pools(self):
+        status, _, body = self.sim.request("GET", "/metrics")
+        self.assertEqual(status, 200)
+        return json.loads(body)["pools"]
+
+    def test_buffers_run_out(self):
+        before = self.pools()["conn"]
+        # each unfinished request holds a buffer, so the next client is turned away
+        holders = [self.sim.connect() for _ in range(BUFFER_POOL)]
+        for sock in holders:
+            sock.sendall(b"GET /metrics HTTP/1.1\r\n")
+        time.sleep(0.2)
+        with self.sim.connect() as sock:
+            sock.sendall(b"GET /metrics HTTP/1.1\r\n\r\n")
+            status, _, _ = read_response(sock)
+        self.assertEqual(status, 503)
+
+        # and they are all back once those requests are done
+        for sock in holders:
+            sock.sendall(b"\r\n")
+            status, _, _ = read_response(sock)
+            self.assertEqual(status, 200)
+            sock.close()
+        used, peak, count, exhausted = self.pools()["conn"]
+        self.assertEqual(count, BUFFER_POOL)
+        self.assertEqual(peak, BUFFER_POOL)
+        self.assertEqual(used, 1)                   # this request's
+        self.assertEqual(exhausted, before[3] + 1)
+
+    def test_report(self):
+        url = "http://127.0.0.1:%d" % self.sim.port
+        report = subprocess.run([sys.executable, MEM_REPORT, "--top", "40", "--metrics", url, OTA_SIM_MAP],
+                                check=True, capture_output=True, text=True).stdout
+
+        # main/ and led-status are linked from libfirmware.a
+        rows = {line.split()[0]: line.split()[1:] for line in report.splitlines() if line.strip()}
+        data, bss, ram, iram = (int(v) for v in rows["firmware"])
+        self.assertEqual(ram, data + bss)
+        # the pools are .bss, and named with -fdata-sections as on the device
+        top = {m.group(2): int(m.group(1)) for m in
+               re.finditer(r"^\s*(\d+)\s+bss\s+firmware\s+\S+\s+\.bss\.(\S+)$", report, re.M)}
+        self.assertEqual(top["server_buffer_pool_storage"], BUFFER_POOL * 1024)
+        self.assertEqual(top["sse_frame_pool_storage"], 24 * 192)
+        self.assertGreaterEqual(bss, sum(top.values()))
+
+        # stack_free is in bytes, as the stack sizes are: never more than the stack
+        for task, depth in TASK_STACKS.items():
+            with self.subTest(task=task):
+                self.assertLessEqual(int(rows[task][-1]), depth)
+        for pool in ("conn", "sse", "sse_large"):
+            used, peak, count, exhausted = (int(v) for v in rows[pool])
+            self.assertLessEqual(used, peak)
+            self.assertLessEqual(peak, count)
+
+
+if __name__ == "__main__":
+    unittest.main()
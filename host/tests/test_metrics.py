@@ -0,0 +1,60 @@
+"""metrics_format()'s JSON from metrics_emit: parsed whole, the flash write histogram's
+buckets for writes either side of each bound, and the snapshot cut short at every buffer
+size, which must be the start of the whole one, terminated, with its length returned"""
+
+import json
+import os
+import subprocess
+import unittest
+
+METRICS_EMIT = os.environ["METRICS_EMIT"]
+
+BOUNDS_MS = [5, 10, 20, 40, 80, 160]       # METRICS_FLASH_BUCKETS
+
+
+class MetricsTest(unittest.TestCase):
+
+    def emit(self, *writes_us):
+        out = subprocess.run([METRICS_EMIT] + [str(us) for us in writes_us], check=True,
+                             capture_output=True, text=True).stdout
+        lines = out.split("\n")
+        self.assertEqual(lines.pop(), "")
+        return lines[0], lines[1:]
+
+    def histogram(self, *writes_us):
+        flash = json.loads(self.emit(*writes_us)[0])["flash_ms"]
+        self.assertEqual(flash["le"], BOUNDS_MS)
+        self.assertEqual(len(flash["count"]), len(BOUNDS_MS) + 1)
+        return flash["count"]
+
+    def test_parses(self):
+        metrics = json.loads(self.emit()[0])
+        for key in ("uptime_ms", "rx_bytes", "upload", "flash_ms", "sse", "heap", "pools", "boot",
+                    "stack_free"):
+            self.assertIn(key, metrics)
+        self.assertEqual(metrics["flash_ms"]["count"], [0] * (len(BOUNDS_MS) + 1))
+        self.assertEqual(metrics["upload"]["active"], False)
+        self.assertEqual(sorted(metrics["pools"]), ["conn", "sse", "sse_large"])
+
+    def test_bucket_edges(self):
+        # each bucket holds the writes up to and including its bound
+        for i, bound in enumerate(BOUNDS_MS):
+            counts = [0] * (len(BOUNDS_MS) + 1)
+            counts[i] = 2
+            counts[i + 1] = 1
+            self.assertEqual(self.histogram(bound * 1000 - 1, bound * 1000, bound * 1000 + 1), counts, bound)
+        self.assertEqual(self.histogram(0, 1000000), [1, 0, 0, 0, 0, 0, 1])
+
+    def test_truncated(self):
+        whole, cut = self.emit(4500, 12000, 200000)
+        self.assertEqual(len(cut), len(whole) + 1)
+        for line in cut:
+            size, length, text = line.split(" ", 2)
+            size = int(size)
+            want = whole[:size - 1]
+            self.assertEqual(text, want, size)
+            self.assertEqual(int(length), len(want), size)
+
+
+if __name__ == "__main__":
+    unittest.main()
@@ -0,0 +1,202 @@
+"""What tools/ota_pack.py encodes, decoded by ota_decoder.c (the ota_decode tool): each
+encoding on its own and combined, fed whole and split at every byte, and payloads that
+are cut short or copy from outside the base"""
+
+import os
+import random
+import struct
+import subprocess
+import sys
+import tempfile
+import unittest
+
+REPO_DIR = os.path.join(os.path.dirname(os.path.abspath(__file__)), "..", "..")
+sys.path.insert(0, os.path.join(REPO_DIR, "tools"))
+import ota_pack  # noqa: E402
+
+OTA_DECODE = os.environ["OTA_DECODE"]
+
+
+def base_partition_size():
+    """The running partition, 'boot' in custom.csv, which a delta copies from"""
+    with open(os.path.join(REPO_DIR, "custom.csv")) as f:
+        for line in f:
+            fields = [field.strip() for field in line.split(",")]
+            if fields[0] == "boot":
+                return int(fields[4].rstrip("K")) * 1024
+    raise RuntimeError("no boot partition in custom.csv")
+
+
+def firmware_like(rng, size):
+    """Runs of code-like bytes, strings and erased padding, so it compresses about as
+    well as an app image"""
+    words = [rng.randbytes(4) for _ in range(64)]
+    out = bytearray()
+    while len(out) < size:
+        kind = rng.randrange(3)
+        if kind == 0:
+            out += b"".join(rng.choice(words) for _ in range(rng.randrange(1, 32)))
+        elif kind == 1:
+            out += b"ota_decoder: delta copy outside base partition\0"
+        else:
+            out += b"\xff" * rng.randrange(1, 64)
+    return bytes(out[:size])
+
+
+def next_version(rng, base):
+    """'base' with a few small edits, as between two builds"""
+    out = bytearray(base)
+    for _ in range(8):
+        at = rng.randrange(len(out))
+        if rng.randrange(2):
+            out[at:at + 16] = rng.randbytes(16)
+        else:
+            out[at:at] = rng.randbytes(rng.randrange(1, 40))
+    return bytes(out)
+
+
+class DecoderTest(unittest.TestCase):
+
+    @classmethod
+    def setUpClass(cls):
+        rng = random.Random(8)
+        cls.base = firmware_like(rng, 64 * 1024)
+        cls.image = next_version(rng, cls.base)
+        cls.small_base = firmware_like(rng, 2048)
+        cls.small_image = next_version(rng, cls.small_base)
+
+    def setUp(self):
+        self.workdir = tempfile.TemporaryDirectory()
+
+    def tearDown(self):
+        self.workdir.cleanup()
+
+    def decode(self, payload, heatshrink=False, base=None, splits=False):
+        """(exit code, decoded bytes, stderr) of ota_decode"""
+        path = os.path.join(self.workdir.name, "payload")
+        output = os.path.join(self.workdir.name, "output")
+        with open(path, "wb") as f:
+            f.write(payload)
+        command = [OTA_DECODE]
+        if heatshrink:
+            command.append("--heatshrink")
+        if base is not None:
+            with open(os.path.join(self.workdir.name, "base"), "wb") as f:
+                f.write(base)
+            command += ["--delta", os.path.join(self.workdir.name, "base")]
+        if splits:
+            command.append("--splits")
+        result = subprocess.run(command + [path, output], capture_output=True, text=True)
+        decoded = b""
+        if result.returncode == 0:
+            with open(output, "rb") as f:
+                decoded = f.read()
+        return result.returncode, decoded, result.stderr
+
+    def assertDecodes(self, payload, image, **kwargs):
+        code, decoded, stderr = self.decode(payload, **kwargs)
+        self.assertEqual(code, 0, stderr)
+        self.assertEqual(len(decoded), len(image))
+        self.assertTrue(decoded == image, "decoded image differs")
+
+    # each encoding, and both, over a whole image
+
+    def test_heatshrink(self):
+        payload = ota_pack.heatshrink_encode(self.image)
+        self.assertLess(len(payload), len(self.image) // 2)
+        self.assertDecodes(payload, self.image, heatshrink=True)
+
+    def test_delta(self):
+        payload = ota_pack.delta_encode(self.base, self.image)
+        self.assertLess(len(payload), len(self.image) // 20)
+        self.assertDecodes(payload, self.image, base=self.base)
+
+    def test_heatshrink_delta(self):
+        payload = ota_pack.heatshrink_encode(ota_pack.delta_encode(self.base, self.image))
+        self.assertDecodes(payload, self.image, heatshrink=True, base=self.base)
+
+    def test_unchanged(self):
+        payload = ota_pack.delta_encode(self.base, self.base)
+        self.assertEqual(len(payload), 4 + 9)
+        self.assertDecodes(payload, self.base, base=self.base)
+
+    def test_empty(self):
+        self.assertDecodes(ota_pack.heatshrink_encode(b""), b"", heatshrink=True)
+        self.assertDecodes(ota_pack.delta_encode(self.base, b""), b"", base=self.base)
+
+    # split at every byte: each state of the bit reservoir and the delta parser
+
+    def test_splits(self):
+        delta = ota_pack.delta_encode(self.small_base, self.small_image)
+        cases = [
+            (ota_pack.heatshrink_encode(self.small_image), dict(heatshrink=True)),
+            (delta, dict(base=self.small_base)),
+            (ota_pack.heatshrink_encode(delta), dict(heatshrink=True, base=self.small_base)),
+        ]
+        for payload, kwargs in cases:
+            with self.subTest(**{k: bool(v) for k, v in kwargs.items()}):
+                self.assertDecodes(payload, self.small_image, splits=True, **kwargs)
+
+    # damaged payloads
+
+    def test_truncated_delta(self):
+        payload = ota_pack.delta_encode(self.small_base, self.small_image)
+        # cut inside the magic, an op's arguments or an insert's bytes: every seventh
+        #  place that isn't between two operations
+        ends = [1, 2, 3]
+        at = 4
+        while at < len(payload):
+            if payload[at:at + 1] == b"C":
+                ends += range(at + 1, at + 9)
+                at += 9
+            else:
+                (n,) = struct.unpack_from("<I", payload, at + 1)
+                ends += range(at + 1, at + 5 + n)
+                at += 5 + n
+        self.assertEqual(at, len(payload))
+        for end in ends[::7]:
+            with self.subTest(end=end):
+                code, _, stderr = self.decode(payload[:end], base=self.small_base, splits=True)
+                self.assertEqual(code, 1, stderr)
+
+    def test_truncated_heatshrink(self):
+        # the stream has no length, so a cut one decodes to a shorter image, which
+        #  X-Image-SHA256 or the image checks then reject
+        payload = ota_pack.heatshrink_encode(self.small_image)
+        for end in (0, 1, len(payload) // 3, len(payload) - 1):
+            with self.subTest(end=end):
+                code, decoded, stderr = self.decode(payload[:end], heatshrink=True, splits=True)
+                self.assertEqual(code, 0, stderr)
+                self.assertLess(len(decoded), len(self.small_image))
+                self.assertTrue(self.small_image.startswith(decoded))
+
+    def test_truncated_heatshrink_delta(self):
+        delta = ota_pack.delta_encode(self.small_base, self.small_image)
+        payload = ota_pack.heatshrink_encode(delta)
+        code, _, stderr = self.decode(payload[:len(payload) // 2], heatshrink=True, base=self.small_base)
+        self.assertEqual(code, 1, stderr)
+
+    def test_copy_past_base(self):
+        size = base_partition_size()
+        inside = [(0, size), (size - 16, 16), (size, 0)]
+        outside = [(size - 16, 17), (size, 1), (size + 1, 0), (0, size + 1),
+                   (0xffffffff, 2), (16, 0xfffffff8)]
+        for offset, length in inside + outside:
+            payload = ota_pack.DELTA_MAGIC + b"C" + struct.pack("<II", offset, length)
+            with self.subTest(offset=offset, length=length):
+                code, decoded, stderr = self.decode(payload, base=self.small_base)
+                if (offset, length) in inside:
+                    self.assertEqual(code, 0, stderr)
+                    self.assertEqual(len(decoded), length)
+                else:
+                    self.assertEqual(code, 1, stderr)
+
+    def test_bad_op(self):
+        for payload in (b"ODLX", ota_pack.DELTA_MAGIC + b"X", ota_pack.DELTA_MAGIC + b"I\1\0\0\0zC"):
+            with self.subTest(payload=payload):
+                code, _, stderr = self.decode(payload, base=self.small_base, splits=True)
+                self.assertEqual(code, 1, stderr)
+
+
+if __name__ == "__main__":
+    unittest.main()
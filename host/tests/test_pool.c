@@ -0,0 +1,115 @@
+// pool.c on its own: blocks carved in order then reused from the free list, exhaustion
+//  counted rather than fatal, and the used and peak counts /metrics reports. Then an
+//  SSE event sent while its frame pool is empty: dropped, and counted
+
+#include <stdint.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include "check.h"
+#include "pool.h"
+#include "sse.h"
+
+#define BLOCKS 4
+
+// 30 bytes, so blocks are rounded up to keep them aligned
+POOL_DEFINE(test_pool, "test", 30, BLOCKS);
+
+static void check_stats(uint8_t used, uint8_t peak, uint32_t exhausted) {
+    pool_stats_t stats;
+    pool_get_stats(&test_pool, &stats);
+    CHECK(strcmp(stats.name, "test") == 0);
+    CHECK_EQ(stats.block_size, 32);
+    CHECK_EQ(stats.count, BLOCKS);
+    CHECK_EQ(stats.used, used);
+    CHECK_EQ(stats.peak, peak);
+    CHECK_EQ(stats.exhausted, exhausted);
+}
+
+static void test_sse_frames(void) {
+    int fds[2];
+    char buf[512];
+    CHECK(socketpair(AF_UNIX, SOCK_STREAM, 0, fds) == 0);
+    sse_init(NULL);
+    CHECK(sse_add_client(fds[0], NULL, NULL));
+
+    // take every small frame, as a backlog of slow subscribers would
+    void *taken[CONFIG_SSE_FRAME_POOL];
+    int count = 0;
+    while (count < CONFIG_SSE_FRAME_POOL && (taken[count] = pool_alloc(&sse_frame_pool)) != NULL) {
+        count++;
+    }
+    pool_stats_t before, after;
+    pool_get_stats(&sse_frame_pool, &before);
+    sse_broadcast("{\"progress\":\"10\"}", "update", false);
+    sse_broadcast_log("lost", NULL, 3, "main", 4);
+    pool_get_stats(&sse_frame_pool, &after);
+    CHECK(after.exhausted > before.exhausted);
+    CHECK_EQ(sse_client_flush(fds[0]), 0);
+
+    // and the next one goes through once frames are back
+    while (count > 0) {
+        pool_free(&sse_frame_pool, taken[--count]);
+    }
+    sse_broadcast_log("kept", NULL, 3, "main", 4);
+    CHECK(sse_client_flush(fds[0]) > 0);
+    ssize_t n = recv(fds[1], buf, sizeof(buf) - 1, MSG_DONTWAIT);
+    buf[n > 0 ? n : 0] = '\0';
+    CHECK(strstr(buf, "data: kept\n") != NULL);
+    CHECK(strstr(buf, "lost") == NULL && strstr(buf, "progress") == NULL);
+
+    sse_remove_client(fds[0]);
+    close(fds[0]);
+    close(fds[1]);
+}
+
+int main(void) {
+    uint8_t *blocks[BLOCKS];
+    check_stats(0, 0, 0);
+
+    for (int i = 0; i < BLOCKS; i++) {
+        blocks[i] = pool_alloc(&test_pool);
+        CHECK(blocks[i] != NULL);
+        CHECK(pool_owns(&test_pool, blocks[i]));
+        CHECK_EQ((uintptr_t)blocks[i] % 4, 0);
+        // every byte of a block is the caller's
+        memset(blocks[i], 0xa0 + i, 30);
+    }
+    for (int i = 0; i < BLOCKS; i++) {
+        for (int j = 0; j < 30; j++) {
+            CHECK_EQ(blocks[i][j], 0xa0 + i);
+        }
+    }
+    check_stats(BLOCKS, BLOCKS, 0);
+
+    // exhausted: NULL, and counted each time
+    CHECK(pool_alloc(&test_pool) == NULL);
+    CHECK(pool_alloc(&test_pool) == NULL);
+    check_stats(BLOCKS, BLOCKS, 2);
+
+    // a freed block is the next one given out, whatever was written over it
+    pool_free(&test_pool, blocks[1]);
+    pool_free(&test_pool, blocks[3]);
+    check_stats(BLOCKS - 2, BLOCKS, 2);
+    CHECK(pool_alloc(&test_pool) == blocks[3]);
+    CHECK(pool_alloc(&test_pool) == blocks[1]);
+    CHECK(pool_alloc(&test_pool) == NULL);
+    check_stats(BLOCKS, BLOCKS, 3);
+    CHECK_EQ(blocks[0][29], 0xa0);
+    CHECK_EQ(blocks[2][0], 0xa2);
+
+    // NULL is ignored, and the peak stays once blocks are back
+    pool_free(&test_pool, NULL);
+    for (int i = 0; i < BLOCKS; i++) {
+        pool_free(&test_pool, blocks[i]);
+    }
+    check_stats(0, BLOCKS, 3);
+
+    uint8_t outside[32];
+    CHECK(!pool_owns(&test_pool, outside));
+    CHECK(!pool_owns(&test_pool, blocks[0] + BLOCKS * 32));
+
+    test_sse_frames();
+    return check_result();
+}
@@ -0,0 +1,123 @@
+"""relay.c between two relay_peer instances on loopback: one serving a file backed
+image as GET /firmware, the other pulling it, through a dropped connection and with a
+digest that doesn't match. Then the Range requests relay_serve() answers"""
+
+import hashlib
+import os
+import socket
+import subprocess
+import sys
+import tempfile
+import time
+import unittest
+
+sys.path.insert(0, os.path.join(os.path.dirname(os.path.abspath(__file__)), "..", "sim"))
+from ota_sim import free_port, read_response  # noqa: E402
+
+RELAY_PEER = os.environ["RELAY_PEER"]
+
+IMAGE_SIZE = 20000          # not a multiple of relay_peer's 1024 byte reads
+
+
+class RelayTest(unittest.TestCase):
+
+    def setUp(self):
+        self.workdir = tempfile.TemporaryDirectory()
+        self.image = os.urandom(IMAGE_SIZE)
+        self.image_path = os.path.join(self.workdir.name, "image.bin")
+        with open(self.image_path, "wb") as f:
+            f.write(self.image)
+        self.output = os.path.join(self.workdir.name, "pulled.bin")
+        self.server = None
+
+    def tearDown(self):
+        if self.server is not None:
+            self.server.kill()
+            self.server.wait()
+        self.workdir.cleanup()
+
+    def serve(self, *options):
+        self.port = free_port()
+        self.server = subprocess.Popen([RELAY_PEER, "serve"] + list(options) + [str(self.port), self.image_path],
+                                       stderr=subprocess.DEVNULL)
+        deadline = time.monotonic() + 10
+        while True:
+            try:
+                socket.create_connection(("127.0.0.1", self.port), timeout=1).close()
+                return
+            except OSError:
+                if self.server.poll() is not None or time.monotonic() > deadline:
+                    raise RuntimeError("relay_peer serve didn't start")
+                time.sleep(0.02)
+
+    def pull(self, port=None):
+        url = "http://127.0.0.1:%d/firmware" % (port or self.port)
+        return subprocess.run([RELAY_PEER, "pull", url, self.output], capture_output=True, text=True, timeout=30)
+
+    def get(self, path, headers=()):
+        lines = ["GET %s HTTP/1.1" % path, "Host: 127.0.0.1"] + ["%s: %s" % h for h in headers]
+        with socket.create_connection(("127.0.0.1", self.port), timeout=5) as sock:
+            sock.sendall(("\r\n".join(lines) + "\r\n\r\n").encode())
+            return read_response(sock)
+
+    def pulled(self):
+        with open(self.output, "rb") as f:
+            return f.read()
+
+    def test_pull(self):
+        self.serve()
+        result = self.pull()
+        self.assertEqual(result.returncode, 0, result.stderr)
+        self.assertEqual(result.stdout.split(), [str(IMAGE_SIZE), "bytes,", "0", "resumed"])
+        self.assertEqual(self.pulled(), self.image)
+
+    def test_resume(self):
+        # the first connection ends part way; the rest comes with a Range request
+        self.serve("--drop-at", "8192")
+        result = self.pull()
+        self.assertEqual(result.returncode, 0, result.stderr)
+        self.assertEqual(result.stdout.split()[2], "1")
+        self.assertEqual(self.pulled(), self.image)
+
+    def test_bad_sha256(self):
+        self.serve("--bad-sha256")
+        self.assertEqual(self.pull().returncode, 3)
+        self.assertFalse(os.path.exists(self.output))
+
+    def test_unreachable(self):
+        self.assertEqual(self.pull(free_port()).returncode, 1)
+
+    def test_ranges(self):
+        self.serve()
+        status, headers, body = self.get("/firmware")
+        self.assertEqual(status, 200)
+        self.assertEqual(body, self.image)
+        self.assertEqual(headers["x-image-sha256"], hashlib.sha256(self.image).hexdigest())
+        self.assertEqual(headers["accept-ranges"], "bytes")
+
+        cases = [
+            ("bytes=100-199", 100, 199),
+            ("bytes=19000-", 19000, IMAGE_SIZE - 1),
+            ("bytes=-50", IMAGE_SIZE - 50, IMAGE_SIZE - 1),
+            ("bytes=19990-30000", 19990, IMAGE_SIZE - 1),        # clamped to the image
+            ("bytes=-30000", 0, IMAGE_SIZE - 1),
+        ]
+        for value, first, last in cases:
+            with self.subTest(range=value):
+                status, headers, body = self.get("/firmware", [("Range", value)])
+                self.assertEqual(status, 206)
+                self.assertEqual(headers["content-range"], "bytes %d-%d/%d" % (first, last, IMAGE_SIZE))
+                self.assertEqual(body, self.image[first:last + 1])
+
+        for value in ("bytes=20000-", "bytes=200-100", "bytes=-0", "bytes=0-1,5-6", "lines=0-1"):
+            with self.subTest(range=value):
+                status, headers, body = self.get("/firmware", [("Range", value)])
+                self.assertEqual(status, 416)
+                self.assertEqual(headers["content-range"], "bytes */%d" % IMAGE_SIZE)
+                self.assertEqual(body, b"")
+
+        self.assertEqual(self.get("/other")[0], 404)
+
+
+if __name__ == "__main__":
+    unittest.main()
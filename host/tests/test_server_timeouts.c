@@ -0,0 +1,271 @@
+// server.c's deadlines on a fake clock, with server_run() on a thread of its own: the
+//  header timeout (from a request's first byte, however it trickles in), the idle
+//  timeout, and on a stream the on_idle keepalive every half idle timeout, a stalled
+//  stream closed, and the SSE role's TCP keepalive. After each step of the clock a
+//  probe request round trip shows the loop has been through server_check_timeouts()
+
+#include <arpa/inet.h>
+#include <errno.h>
+#include <netinet/tcp.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include "check.h"
+#include "host.h"
+#include "server.h"
+
+#define MS(ms) ((ms) / portTICK_PERIOD_MS)
+
+static uint16_t port;
+static volatile bool listening;
+static volatile int idle_calls;
+static volatile bool stalled;               // the stream has data queued that doesn't move
+static volatile int stream_writes;          // on_writable() calls that sent something
+static volatile int stream_fd = -1;         // the server's end
+
+static int on_request(server_conn_t *conn) {
+    static const char ok[] = "HTTP/1.1 204 No Content\r\nContent-Length: 0\r\n\r\n";
+    const http_parser_t *req = &conn->parser;
+    if (http_slice_equals(conn->buffer, req->path, "/event")) {
+        static const char header[] = "HTTP/1.1 200 OK\r\nContent-Type: text/event-stream\r\n\r\n";
+        server_set_role(conn->fd, SERVER_ROLE_SSE);
+        // a send buffer left to grow to megabytes takes a stalled stream long to fill
+        int sndbuf = 16384;
+        setsockopt(conn->fd, SOL_SOCKET, SO_SNDBUF, &sndbuf, sizeof(sndbuf));
+        stream_fd = conn->fd;
+        conn->state = SERVER_CONN_STREAM;
+        send(conn->fd, header, strlen(header), 0);
+        return 0;
+    }
+    send(conn->fd, ok, strlen(ok), 0);
+    // /probe closes; anything else stays open for the next request
+    return http_slice_equals(conn->buffer, req->path, "/probe") ? -1 : 0;
+}
+
+static bool wants_write(server_conn_t *conn) {
+    return stalled;
+}
+
+static int on_writable(server_conn_t *conn) {
+    // until the subscriber's socket is full
+    static char data[4096];
+    int sent = send(conn->fd, data, sizeof(data), MSG_DONTWAIT);
+    if (sent < 0) {
+        return 0;
+    }
+    stream_writes++;
+    return sent;
+}
+
+static void on_idle(server_conn_t *conn) {
+    static const char ping[] = ": ping\n\n";
+    send(conn->fd, ping, strlen(ping), 0);
+    idle_calls++;
+}
+
+static void on_listening(void) {
+    listening = true;
+}
+
+static const server_handlers_t handlers = {
+    .on_request = on_request,
+    .wants_write = wants_write,
+    .on_writable = on_writable,
+    .on_idle = on_idle,
+    .on_listening = on_listening,
+};
+
+static void *server_thread(void *param) {
+    server_run(port, &handlers);
+    return NULL;
+}
+
+static int client(void) {
+    struct sockaddr_in addr = { .sin_family = AF_INET, .sin_port = htons(port) };
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    int fd = socket(AF_INET, SOCK_STREAM, 0);
+    struct timeval tv = { .tv_sec = 5 };
+    setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+    CHECK(connect(fd, (struct sockaddr *)&addr, sizeof(addr)) == 0);
+    return fd;
+}
+
+static void send_text(int fd, const char *text) {
+    CHECK_EQ(send(fd, text, strlen(text), 0), strlen(text));
+}
+
+// Everything up to the close, or up to 'until' if given
+static size_t receive(int fd, char *buf, size_t size, const char *until) {
+    size_t len = 0;
+    while (len < size - 1) {
+        ssize_t n = recv(fd, buf + len, size - 1 - len, 0);
+        if (n <= 0) {
+            break;
+        }
+        len += n;
+        buf[len] = '\0';
+        if (until != NULL && strstr(buf, until) != NULL) {
+            break;
+        }
+    }
+    buf[len] = '\0';
+    return len;
+}
+
+// Two request round trips on new connections. The second one's select() loop pass
+//  started after the first was answered, so after the clock last moved
+static void sync_loop(void) {
+    server_wake();
+    for (int i = 0; i < 2; i++) {
+        char buf[128];
+        int fd = client();
+        send_text(fd, "GET /probe HTTP/1.1\r\n\r\n");
+        receive(fd, buf, sizeof(buf), NULL);
+        CHECK(strncmp(buf, "HTTP/1.1 204", 12) == 0);
+        close(fd);
+    }
+}
+
+// Synced on both sides: whatever the server was doing with the last bytes sent (it stamps
+//  last_activity after a response has gone) happens before the clock moves
+static void advance_ms(uint32_t ms) {
+    sync_loop();
+    host_clock_advance(MS(ms));
+    sync_loop();
+}
+
+static bool is_open(int fd) {
+    char c;
+    ssize_t n = recv(fd, &c, 1, MSG_DONTWAIT | MSG_PEEK);
+    return n > 0 || (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK));
+}
+
+// the server closes it: whatever was still unread, then the end
+static bool is_closed(int fd) {
+    static char buf[65536];
+    while (true) {
+        ssize_t n = recv(fd, buf, sizeof(buf), MSG_DONTWAIT);
+        if (n == 0) {
+            return true;
+        }
+        if (n < 0) {
+            return errno == ECONNRESET;
+        }
+    }
+}
+
+static void test_header_timeout(void) {
+    int fd = client();
+    send_text(fd, "GET / HTTP/1.1\r\n");
+    advance_ms(CONFIG_SERVER_HEADER_TIMEOUT_MS / 2);
+    // more of the header doesn't move the deadline
+    send_text(fd, "Host: x\r\n");
+    advance_ms(CONFIG_SERVER_HEADER_TIMEOUT_MS / 2 - 10);
+    CHECK(is_open(fd));
+    advance_ms(10);
+    CHECK(is_closed(fd));
+    close(fd);
+}
+
+static void test_idle_timeout(void) {
+    // connected and silent
+    int fd = client();
+    advance_ms(CONFIG_SERVER_IDLE_TIMEOUT_MS - 10);
+    CHECK(is_open(fd));
+    advance_ms(10);
+    CHECK(is_closed(fd));
+    close(fd);
+
+    // kept open after a response, and idle from when it went
+    char buf[128];
+    fd = client();
+    advance_ms(CONFIG_SERVER_IDLE_TIMEOUT_MS / 2);
+    send_text(fd, "GET / HTTP/1.1\r\n\r\n");
+    receive(fd, buf, sizeof(buf), "\r\n\r\n");
+    CHECK(strncmp(buf, "HTTP/1.1 204", 12) == 0);
+    advance_ms(CONFIG_SERVER_IDLE_TIMEOUT_MS - 10);
+    CHECK(is_open(fd));
+    advance_ms(10);
+    CHECK(is_closed(fd));
+    close(fd);
+}
+
+static void test_stream(void) {
+    char buf[256];
+    int fd = client();
+    send_text(fd, "GET /event HTTP/1.1\r\n\r\n");
+    receive(fd, buf, sizeof(buf), "\r\n\r\n");
+    CHECK(strncmp(buf, "HTTP/1.1 200", 12) == 0);
+
+    // the SSE role's socket options, for the stack to notice a vanished subscriber
+    int on = 0, idle = 0;
+    socklen_t len = sizeof(int);
+    CHECK(getsockopt(stream_fd, SOL_SOCKET, SO_KEEPALIVE, &on, &len) == 0 && on);
+    CHECK(getsockopt(stream_fd, IPPROTO_TCP, TCP_KEEPIDLE, &idle, &len) == 0);
+    CHECK_EQ(idle, CONFIG_SERVER_SSE_KEEPALIVE_S);
+
+    // nothing queued: a keepalive each half idle timeout, and never closed
+    int calls = idle_calls;
+    advance_ms(CONFIG_SERVER_IDLE_TIMEOUT_MS / 2 - 10);
+    CHECK_EQ(idle_calls, calls);
+    advance_ms(10);
+    CHECK_EQ(idle_calls, calls + 1);
+    receive(fd, buf, sizeof(buf), "\n\n");
+    CHECK(strcmp(buf, ": ping\n\n") == 0);
+    for (int i = 0; i < 4; i++) {
+        advance_ms(CONFIG_SERVER_IDLE_TIMEOUT_MS / 2);
+    }
+    CHECK_EQ(idle_calls, calls + 5);
+    CHECK(is_open(fd));
+
+    // queued data the subscriber doesn't take: no keepalives, closed once idle
+    stalled = true;
+    server_wake();
+    int writes;
+    do {
+        // until select() stops finding room in the socket
+        writes = stream_writes;
+        usleep(50000);
+    } while (stream_writes != writes);
+    CHECK(writes > 0);
+    calls = idle_calls;
+    advance_ms(CONFIG_SERVER_IDLE_TIMEOUT_MS - 10);
+    CHECK_EQ(idle_calls, calls);
+    CHECK(is_open(fd));
+    advance_ms(10);
+    CHECK(is_closed(fd));
+    stalled = false;
+    close(fd);
+}
+
+int main(void) {
+    host_log_quiet(false);
+    host_clock_fake();
+    // off 0 ms, which server.c's request_start takes as no request yet
+    host_clock_advance(MS(1000));
+
+    // a free port, for server_run() to bind again
+    struct sockaddr_in addr = { .sin_family = AF_INET };
+    socklen_t addr_len = sizeof(addr);
+    int probe = socket(AF_INET, SOCK_STREAM, 0);
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    CHECK(bind(probe, (struct sockaddr *)&addr, sizeof(addr)) == 0);
+    CHECK(getsockname(probe, (struct sockaddr *)&addr, &addr_len) == 0);
+    port = ntohs(addr.sin_port);
+    close(probe);
+
+    pthread_t thread;
+    pthread_create(&thread, NULL, server_thread, NULL);
+    for (int i = 0; i < 5000 && !listening; i++) {
+        usleep(1000);
+    }
+    CHECK(listening);
+
+    test_header_timeout();
+    test_idle_timeout();
+    test_stream();
+    return check_result();
+}
@@ -0,0 +1,117 @@
+"""Skipping unchanged sectors together with erasing ahead, in ota_sim: the main slot is
+given an old image straight in its flash file, then a new one is uploaded over it. The
+sectors written and skipped, from the response and the 'sectors' event, and the new
+image on flash afterwards"""
+
+import json
+import os
+import socket
+import sys
+import tempfile
+import unittest
+
+sys.path.insert(0, os.path.join(os.path.dirname(os.path.abspath(__file__)), "..", "sim"))
+from ota_sim import MAIN_ADDRESS, Sim, app_image, read_response  # noqa: E402
+
+OTA_SIM = os.environ["OTA_SIM"]
+SECTOR = 4096
+SECTORS = 7
+IMAGE_SIZE = (SECTORS - 1) * SECTOR + 1024      # a partial last sector
+
+
+class SkipUnchangedTest(unittest.TestCase):
+
+    def setUp(self):
+        self.workdir = tempfile.TemporaryDirectory()
+        self.sim = Sim(OTA_SIM, self.workdir.name)
+        # once, to create the flash file the old image goes into
+        self.sim.start()
+        self.sim.stop()
+        self.old = app_image(MAIN_ADDRESS, IMAGE_SIZE)
+        with open(self.sim.flash, "r+b") as f:
+            f.seek(MAIN_ADDRESS)
+            f.write(self.old)
+
+    def tearDown(self):
+        self.sim.stop()
+        self.workdir.cleanup()
+
+    def changed(self, *sectors):
+        """The old image with 'sectors' changed, and its checksum still right"""
+        data = bytearray(self.old)
+        for sector in sectors:
+            # two bytes flipped alike cancel out in the XOR checksum, which is in the
+            #  last sector
+            at = sector * SECTOR + 100
+            data[at] ^= 0x5a
+            data[at + 1] ^= 0x5a
+        return bytes(data)
+
+    def subscribe(self):
+        sock = self.sim.connect()
+        sock.sendall(b"GET /event?level=N HTTP/1.1\r\nHost: 127.0.0.1\r\n\r\n")
+        head = b""
+        while b"\r\n\r\n" not in head:
+            chunk = sock.recv(1)
+            self.assertTrue(chunk, "closed before the response header")
+            head += chunk
+        self.assertTrue(head.startswith(b"HTTP/1.1 200"), head)
+        return sock
+
+    def sectors_event(self, sock):
+        """The data of the 'sectors' event, read until the app restarts"""
+        sock.settimeout(10)
+        stream = b""
+        try:
+            while True:
+                chunk = sock.recv(4096)
+                if not chunk:
+                    break
+                stream += chunk
+        except (socket.timeout, ConnectionResetError):
+            pass
+        sock.close()
+        for frame in stream.decode(errors="replace").split("\n\n"):
+            fields = frame.split("\n")
+            if "event: sectors" in fields:
+                return json.loads(next(f[len("data: "):] for f in fields if f.startswith("data: ")))
+        self.fail("no sectors event")
+
+    def upload(self, image):
+        """(response body, sectors event) of a POST /send to main, once installed"""
+        self.sim.start()
+        events = self.subscribe()
+        header = ("POST /send HTTP/1.1\r\nHost: 127.0.0.1\r\nContent-Length: %d\r\n\r\n"
+                  % len(image)).encode()
+        with self.sim.connect() as sock:
+            sock.sendall(header + image)
+            status, _, body = read_response(sock)
+        self.assertEqual(status, 200)
+        event = self.sectors_event(events)
+        self.assertEqual(self.sim.wait(), 3)
+        with open(self.sim.flash, "rb") as f:
+            f.seek(MAIN_ADDRESS)
+            self.assertEqual(f.read(len(image)), image)
+        return json.loads(body), event
+
+    def test_identical(self):
+        body, event = self.upload(self.old)
+        self.assertEqual(body, {"written": 0, "skipped": SECTORS})
+        self.assertEqual(event, body)
+
+    def test_one_changed(self):
+        # a lone change erases nothing ahead: one erase and write, then skipping again
+        body, event = self.upload(self.changed(3))
+        self.assertEqual(body, {"written": 1, "skipped": SECTORS - 1})
+        self.assertEqual(event, body)
+
+    def test_run_of_changes(self):
+        # 2 and 3 changed start erasing ahead; 4 is erased ahead and differs, so 5 is
+        #  too. 5 held the same data: it's written back, and 6 is compared and skipped
+        body, event = self.upload(self.changed(2, 3, 4))
+        self.assertEqual(body, {"written": 4, "skipped": SECTORS - 4})
+        self.assertEqual(event, body)
+
+
+if __name__ == "__main__":
+    unittest.main()
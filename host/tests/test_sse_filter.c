@@ -0,0 +1,260 @@
+// sse.c's per-subscriber log filter over socketpairs: level, include and exclude tags,
+//  the rate limit, batching and its ordering against named events, and a filtered replay
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include "check.h"
+#include "sse.h"
+
+#define LOG_E 1
+#define LOG_W 2
+#define LOG_I 3
+#define LOG_D 4
+
+typedef struct {
+    int fd;                 // the server's end, as sse.c sees it
+    int peer;               // the subscriber's
+} client_t;
+
+static int notified;
+
+static void notify(void) {
+    notified++;
+}
+
+// What the subscriber has been sent since the last call
+static char *receive(client_t *c) {
+    static char buf[8192];
+    size_t len = 0;
+    CHECK(sse_client_flush(c->fd) >= 0);
+    while (len < sizeof(buf) - 1) {
+        ssize_t n = recv(c->peer, buf + len, sizeof(buf) - 1 - len, MSG_DONTWAIT);
+        if (n <= 0) {
+            break;
+        }
+        len += n;
+    }
+    buf[len] = '\0';
+    return buf;
+}
+
+// A subscriber that has already caught up on the history
+static client_t subscribe(const sse_filter_t *filter) {
+    client_t c;
+    int fds[2];
+    CHECK(socketpair(AF_UNIX, SOCK_STREAM, 0, fds) == 0);
+    c.fd = fds[0];
+    c.peer = fds[1];
+    CHECK(sse_add_client(c.fd, filter, NULL));
+    receive(&c);
+    return c;
+}
+
+static void unsubscribe(client_t *c) {
+    sse_remove_client(c->fd);
+    close(c->fd);
+    close(c->peer);
+}
+
+static void log_line(uint8_t level, const char *tag, const char *message) {
+    sse_broadcast_log(message, NULL, level, tag, strlen(tag));
+}
+
+static int count(const char *s, const char *what) {
+    int n = 0;
+    for (const char *p = strstr(s, what); p != NULL; p = strstr(p + 1, what)) {
+        n++;
+    }
+    return n;
+}
+
+static sse_filter_t filter(uint8_t level, const char *include, const char *exclude) {
+    sse_filter_t f = SSE_FILTER_ALL;
+    f.level = level;
+    if (include != NULL) {
+        f.include[f.include_count++] = sse_tag_hash(include, strlen(include));
+    }
+    if (exclude != NULL) {
+        f.exclude[f.exclude_count++] = sse_tag_hash(exclude, strlen(exclude));
+    }
+    return f;
+}
+
+static void test_match(void) {
+    uint32_t ota = sse_tag_hash("ota", 3);
+    uint32_t main_tag = sse_tag_hash("main", 4);
+    sse_filter_t f = filter(LOG_W, NULL, NULL);
+    CHECK(sse_filter_match(&f, LOG_E, ota));
+    CHECK(sse_filter_match(&f, LOG_W, ota));
+    CHECK(!sse_filter_match(&f, LOG_I, ota));
+    // a line without a level counts as info
+    CHECK(!sse_filter_match(&f, 0, ota));
+    f.level = LOG_I;
+    CHECK(sse_filter_match(&f, 0, ota));
+
+    // level 0 ('N') sends no log lines at all
+    f.level = 0;
+    CHECK(!sse_filter_match(&f, LOG_E, ota));
+
+    f = filter(5, "ota", NULL);
+    f.include[f.include_count++] = sse_tag_hash("sse", 3);
+    CHECK(sse_filter_match(&f, LOG_D, ota));
+    CHECK(sse_filter_match(&f, LOG_D, sse_tag_hash("sse", 3)));
+    CHECK(!sse_filter_match(&f, LOG_E, main_tag));
+
+    // exclude wins over include
+    f = filter(5, "ota", "ota");
+    CHECK(!sse_filter_match(&f, LOG_E, ota));
+    f = filter(5, NULL, "ota");
+    CHECK(!sse_filter_match(&f, LOG_E, ota));
+    CHECK(sse_filter_match(&f, LOG_E, main_tag));
+}
+
+static void test_broadcast(void) {
+    sse_filter_t warn = filter(LOG_W, NULL, NULL);
+    sse_filter_t ota = filter(5, "ota", NULL);
+    sse_filter_t quiet = filter(5, NULL, "noisy");
+    client_t a = subscribe(&warn);
+    client_t b = subscribe(&ota);
+    client_t c = subscribe(&quiet);
+
+    log_line(LOG_E, "ota", "one");
+    log_line(LOG_I, "ota", "two");
+    log_line(LOG_W, "noisy", "three");
+    log_line(LOG_D, "main", "four");
+    sse_broadcast("{\"progress\":\"50\"}", "update", false);
+
+    char *got = receive(&a);
+    CHECK(strstr(got, "data: one\n") && strstr(got, "data: three\n") && strstr(got, "event: update\n"));
+    CHECK(!strstr(got, "two") && !strstr(got, "four"));
+    CHECK(strstr(got, "one") < strstr(got, "three") && strstr(got, "three") < strstr(got, "update"));
+
+    got = receive(&b);
+    CHECK(strstr(got, "data: one\n") && strstr(got, "data: two\n") && strstr(got, "event: update\n"));
+    CHECK(!strstr(got, "three") && !strstr(got, "four"));
+
+    got = receive(&c);
+    CHECK(strstr(got, "data: one\n") && strstr(got, "data: two\n") && strstr(got, "data: four\n"));
+    CHECK(!strstr(got, "three") && strstr(got, "event: update\n"));
+
+    unsubscribe(&a);
+    unsubscribe(&b);
+    unsubscribe(&c);
+}
+
+// Only lines that pass the level and tags use up the rate, and named events never do
+static void test_rate(void) {
+    sse_filter_t f = filter(5, "ota", NULL);
+    f.rate = 2;
+    client_t c = subscribe(&f);
+    sse_stats_t before, after;
+    sse_get_stats(&before);
+
+    log_line(LOG_I, "main", "skipped");
+    log_line(LOG_I, "ota", "first");
+    log_line(LOG_I, "main", "skipped");
+    log_line(LOG_I, "ota", "second");
+    log_line(LOG_I, "ota", "third");
+    log_line(LOG_I, "ota", "fourth");
+    sse_broadcast("{}", "sectors", false);
+
+    sse_get_stats(&after);
+    char *got = receive(&c);
+    CHECK_EQ(count(got, "data: "), 3);
+    CHECK(strstr(got, "first") && strstr(got, "second") && strstr(got, "event: sectors"));
+    CHECK(!strstr(got, "third") && !strstr(got, "skipped"));
+    CHECK_EQ(after.rate_limited - before.rate_limited, 2);
+    unsubscribe(&c);
+}
+
+static void test_batch(void) {
+    sse_filter_t f = SSE_FILTER_ALL;
+    f.batch = 4;
+    client_t batched = subscribe(&f);
+    client_t plain = subscribe(NULL);
+
+    for (int i = 0; i < 6; i++) {
+        char line[16];
+        sprintf(line, "line %d", i);
+        log_line(LOG_I, "main", line);
+    }
+    // one frame of four lines, the other two held back
+    char *got = receive(&batched);
+    CHECK_EQ(count(got, "data: "), 4);
+    CHECK_EQ(count(got, "\n\n"), 1);
+    CHECK_EQ(count(got, "id: "), 1);
+    CHECK(strstr(got, "line 0") < strstr(got, "line 3"));
+    got = receive(&plain);
+    CHECK_EQ(count(got, "data: "), 6);
+    CHECK_EQ(count(got, "\n\n"), 6);
+
+    // not old enough to send yet
+    sse_flush_batches(SSE_BATCH_MAX_MS);
+    CHECK_EQ(strlen(receive(&batched)), 0);
+
+    // a named event sends what was batched before it, first
+    sse_broadcast("{\"progress\":\"60\"}", "update", false);
+    got = receive(&batched);
+    CHECK(strstr(got, "data: line 4\ndata: line 5\n") != NULL);
+    CHECK(strstr(got, "line 5") < strstr(got, "event: update"));
+    CHECK_EQ(count(got, "\n\n"), 2);
+
+    // and an old batch is sent on its own
+    log_line(LOG_I, "main", "alone");
+    CHECK_EQ(strlen(receive(&batched)), 0);
+    sse_flush_batches(0);
+    got = receive(&batched);
+    CHECK(strstr(got, "data: alone\n") != NULL);
+
+    // a line too long for any batch goes out as its own frame
+    char long_line[SSE_BATCH_BYTES + 16];
+    memset(long_line, 'x', sizeof(long_line) - 1);
+    long_line[sizeof(long_line) - 1] = '\0';
+    log_line(LOG_I, "main", long_line);
+    got = receive(&batched);
+    CHECK(strstr(got, long_line) != NULL);
+
+    unsubscribe(&batched);
+    unsubscribe(&plain);
+}
+
+// A subscriber picking up from Last-Event-ID gets only the kept lines its filter passes
+static void test_replay(void) {
+    client_t all = subscribe(NULL);
+    log_line(LOG_I, "main", "before");
+    char *got = receive(&all);
+    const char *id_line = strstr(got, "id: ");
+    CHECK(id_line != NULL);
+    uint32_t last_id = id_line ? strtoul(id_line + 4, NULL, 10) : 0;
+
+    log_line(LOG_E, "ota", "wanted");
+    log_line(LOG_I, "ota", "too verbose");
+    log_line(LOG_E, "main", "other tag");
+    sse_broadcast("{\"progress\":\"70\"}", "update", false);
+    unsubscribe(&all);
+
+    int fds[2];
+    CHECK(socketpair(AF_UNIX, SOCK_STREAM, 0, fds) == 0);
+    client_t c = { fds[0], fds[1] };
+    sse_filter_t f = filter(LOG_E, "ota", NULL);
+    CHECK(sse_add_client(c.fd, &f, &last_id));
+    got = receive(&c);
+    CHECK(strstr(got, "data: wanted\n") && strstr(got, "event: update\n"));
+    CHECK(!strstr(got, "before") && !strstr(got, "too verbose") && !strstr(got, "other tag"));
+    unsubscribe(&c);
+}
+
+int main(void) {
+    sse_init(notify);
+    test_match();
+    test_broadcast();
+    test_rate();
+    test_batch();
+    test_replay();
+    CHECK(notified > 0);
+    return check_result();
+}
@@ -0,0 +1,165 @@
+// sse.c's slow client policies over socketpairs, built once per policy: a subscriber
+//  that never reads has its queue filled past CONFIG_SSE_CLIENT_QUEUE_DEPTH, and the
+//  frames that survive (or the close, with CONFIG_SSE_SLOW_CLIENT_DISCONNECT) are
+//  checked, alongside one that keeps up. Built without replay, so only live frames queue
+
+#include <stdio.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include "check.h"
+#include "pool.h"
+#include "sse.h"
+
+#define DEPTH CONFIG_SSE_CLIENT_QUEUE_DEPTH
+
+typedef struct {
+    int fd;                 // the server's end, as sse.c sees it
+    int peer;               // the subscriber's
+} client_t;
+
+static client_t subscribe(void) {
+    client_t c;
+    int fds[2];
+    CHECK(socketpair(AF_UNIX, SOCK_STREAM, 0, fds) == 0);
+    c.fd = fds[0];
+    c.peer = fds[1];
+    CHECK(sse_add_client(c.fd, NULL, NULL));
+    return c;
+}
+
+static void unsubscribe(client_t *c) {
+    sse_remove_client(c->fd);
+    close(c->fd);
+    close(c->peer);
+}
+
+// The data lines the subscriber has been sent since the last call, joined with ','.
+//  'flushed' is sse_client_flush()'s result: -1 once the server would close the fd
+static const char *receive(client_t *c, int *flushed) {
+    static char buf[8192], data[1024];
+    size_t len = 0, out = 0;
+    *flushed = sse_client_flush(c->fd);
+    while (len < sizeof(buf) - 1) {
+        ssize_t n = recv(c->peer, buf + len, sizeof(buf) - 1 - len, MSG_DONTWAIT);
+        if (n <= 0) {
+            break;
+        }
+        len += n;
+    }
+    buf[len] = '\0';
+    data[0] = '\0';
+    for (char *line = strstr(buf, "data: "); line != NULL; line = strstr(line, "\ndata: ")) {
+        line += (line[0] == '\n') ? 7 : 6;
+        int n = (int)strcspn(line, "\n");
+        out += snprintf(data + out, sizeof(data) - out, "%s%.*s", out ? "," : "", n, line);
+    }
+    return data;
+}
+
+static uint32_t dropped(void) {
+    sse_stats_t stats;
+    sse_get_stats(&stats);
+    return stats.dropped;
+}
+
+// 'count' events named 'event', "<prefix>0" on. The fast subscriber gets each one
+//  straight away
+static void broadcast(client_t *fast, const char *prefix, int count, const char *event, bool coalesce) {
+    char message[16];
+    int flushed;
+    for (int i = 0; i < count; i++) {
+        sprintf(message, "%s%d", prefix, i);
+        sse_broadcast(message, event, coalesce);
+        CHECK(strcmp(receive(fast, &flushed), message) == 0);
+        CHECK(flushed > 0);
+    }
+}
+
+#if !CONFIG_SSE_SLOW_CLIENT_DISCONNECT
+// "<prefix>first" to "<prefix>last", joined as receive() does
+static const char *expected(const char *prefix, int first, int last) {
+    static char buf[1024];
+    size_t len = 0;
+    for (int i = first; i <= last; i++) {
+        len += snprintf(buf + len, sizeof(buf) - len, "%s%s%d", len ? "," : "", prefix, i);
+    }
+    return buf;
+}
+#endif
+
+static void test_full_queue(void) {
+    // DEPTH + 4 events that don't coalesce, to a subscriber that doesn't read
+    client_t fast = subscribe();
+    client_t slow = subscribe();
+    uint32_t dropped_before = dropped();
+    int flushed;
+    broadcast(&fast, "e", DEPTH + 4, "note", false);
+
+#if CONFIG_SSE_SLOW_CLIENT_DISCONNECT
+    // dropped on the first frame with no room, and nothing more queued for it
+    CHECK_EQ(dropped() - dropped_before, 1);
+    CHECK(sse_client_pending(slow.fd));
+    CHECK(strcmp(receive(&slow, &flushed), "") == 0);
+    CHECK_EQ(flushed, -1);
+#else
+    // the oldest go, the newest DEPTH are sent once it reads
+    CHECK_EQ(dropped() - dropped_before, 4);
+    CHECK(strcmp(receive(&slow, &flushed), expected("e", 4, DEPTH + 3)) == 0);
+    CHECK(flushed > 0);
+    CHECK(!sse_client_pending(slow.fd));
+    // and caught up, it gets the next one as it comes
+    broadcast(&fast, "f", 1, "note", false);
+    CHECK(strcmp(receive(&slow, &flushed), "f0") == 0);
+#endif
+
+    unsubscribe(&slow);
+    unsubscribe(&fast);
+    CHECK_EQ(sse_frame_pool.used, 0);
+    CHECK_EQ(sse_large_frame_pool.used, 0);
+}
+
+static void test_progress(void) {
+    // progress events, which coalesce, among ones that don't: fewer than DEPTH of those,
+    //  but more than DEPTH frames in all
+    client_t fast = subscribe();
+    client_t slow = subscribe();
+    uint32_t dropped_before = dropped();
+    int flushed;
+    broadcast(&fast, "n", 2, "note", false);
+    broadcast(&fast, "p", DEPTH, "update", true);
+    broadcast(&fast, "m", 2, "note", false);
+
+#if CONFIG_SSE_SLOW_CLIENT_DISCONNECT
+    CHECK_EQ(dropped() - dropped_before, 1);
+    CHECK(strcmp(receive(&slow, &flushed), "") == 0);
+    CHECK_EQ(flushed, -1);
+#elif CONFIG_SSE_SLOW_CLIENT_COALESCE
+    // each newer progress event took the queued one's place; nothing else was dropped
+    CHECK_EQ(dropped() - dropped_before, DEPTH - 1);
+    char want[64];
+    sprintf(want, "n0,n1,p%d,m0,m1", DEPTH - 1);
+    CHECK(strcmp(receive(&slow, &flushed), want) == 0);
+    CHECK(flushed > 0);
+#else
+    // all queued in order, so the oldest went
+    CHECK_EQ(dropped() - dropped_before, 4);
+    char want[128];
+    sprintf(want, "%s,m0,m1", expected("p", 2, DEPTH - 1));
+    CHECK(strcmp(receive(&slow, &flushed), want) == 0);
+    CHECK(flushed > 0);
+#endif
+
+    unsubscribe(&slow);
+    unsubscribe(&fast);
+    CHECK_EQ(sse_frame_pool.used, 0);
+    CHECK_EQ(sse_large_frame_pool.used, 0);
+}
+
+int main(void) {
+    sse_init(NULL);
+    test_full_queue();
+    test_progress();
+    return check_result();
+}
@@ -0,0 +1,89 @@
+"""POST /send against ota_sim: the body split in awkward places, and what gets booted"""
+
+import os
+import struct
+import sys
+import tempfile
+import time
+import unittest
+
+sys.path.insert(0, os.path.join(os.path.dirname(os.path.abspath(__file__)), "..", "sim"))
+from ota_sim import MAIN_ADDRESS, Sim, app_image, read_response  # noqa: E402
+
+OTA_SIM = os.environ["OTA_SIM"]
+OTADATA_ADDRESS = 0xe000
+
+
+class UploadTest(unittest.TestCase):
+
+    def setUp(self):
+        self.workdir = tempfile.TemporaryDirectory()
+        self.sim = None
+
+    def tearDown(self):
+        if self.sim is not None:
+            self.sim.stop()
+        self.workdir.cleanup()
+
+    def start(self, name="sim"):
+        """A simulator on a new, erased flash"""
+        if self.sim is not None:
+            self.sim.stop()
+        path = os.path.join(self.workdir.name, name)
+        os.mkdir(path)
+        self.sim = Sim(OTA_SIM, path)
+        self.sim.start()
+
+    def flash(self, address, length):
+        with open(self.sim.flash, "rb") as f:
+            f.seek(address)
+            return f.read(length)
+
+    def boot_slot(self):
+        """ota_N the bootloader would start, from the otadata sequence number"""
+        seq, = struct.unpack("<I", self.flash(OTADATA_ADDRESS, 4))
+        return 0 if seq == 0xffffffff else (seq - 1) % 2
+
+    def send_split(self, image, first):
+        """The request with 'first' bytes of the body, then after a pause the rest"""
+        header = ("POST /send HTTP/1.1\r\nHost: 127.0.0.1\r\nContent-Length: %d\r\n\r\n"
+                  % len(image)).encode()
+        with self.sim.connect() as sock:
+            sock.sendall(header + image[:first])
+            time.sleep(0.2)
+            sock.sendall(image[first:])
+            return read_response(sock)[0]
+
+    def assert_restarted(self, slot):
+        # the app restarts after any upload to the boot slot, installed or not
+        self.assertEqual(self.sim.wait(), 3)
+        self.assertEqual(self.boot_slot(), slot)
+        self.sim.restart()
+        self.assertEqual(self.sim.request("GET", "/metrics")[0], 200)
+
+    def test_short_first_fragment(self):
+        # none, part or all of the 8 byte image header with the request
+        for first in (0, 1, 3, 7, 8):
+            with self.subTest(first=first):
+                self.start("first_%d" % first)
+                image = app_image(MAIN_ADDRESS, 16 * 1024)
+                self.assertEqual(self.send_split(image, first), 200)
+                self.assertEqual(self.flash(MAIN_ADDRESS, len(image)), image)
+                self.assert_restarted(1)
+
+    def test_short_body_refused(self):
+        self.start()
+        status, _, _ = self.sim.request("POST", "/send", body=b"\xe9\x01\x00")
+        self.assertEqual(status, 400)
+        self.assert_restarted(0)
+
+    def test_bad_magic_refused(self):
+        self.start()
+        image = bytearray(app_image(MAIN_ADDRESS, 8 * 1024))
+        image[0] = 0xE8
+        self.assertEqual(self.send_split(bytes(image), 3), 400)
+        self.assert_restarted(0)
+
+
+if __name__ == "__main__":
+    unittest.main()
@@ -0,0 +1,164 @@
+"""POST /send?part= and GET /ws?part= against ota_sim: each kind of target in custom.csv
+written through the same pipeline, what happens after (restart or not), and the
+targets and options that are refused"""
+
+import hashlib
+import os
+import struct
+import subprocess
+import sys
+import tempfile
+import unittest
+
+sys.path.insert(0, os.path.join(os.path.dirname(os.path.abspath(__file__)), "..", "sim"))
+from ota_sim import BOOT_ADDRESS, MAIN_ADDRESS, Sim, app_image, read_response  # noqa: E402
+
+REPO_DIR = os.path.join(os.path.dirname(os.path.abspath(__file__)), "..", "..")
+WS_UPLOAD = os.path.join(REPO_DIR, "tools", "ws_upload.py")
+OTA_SIM = os.environ["OTA_SIM"]
+
+# custom.csv
+NVS_ADDRESS, NVS_SIZE = 0x9000, 16 * 1024
+HOMEKIT_ADDRESS, HOMEKIT_SIZE = 0xd000, 4 * 1024
+OTADATA_ADDRESS = 0xe000
+
+NVS_PAGE_STATE_ACTIVE = 0xfffffffe
+
+
+def nvs_image(size):
+    """A first page in use, as nvs_partition_gen.py writes, then anything"""
+    return struct.pack("<I", NVS_PAGE_STATE_ACTIVE) + os.urandom(size - 4)
+
+
+class UploadPartTest(unittest.TestCase):
+
+    def setUp(self):
+        self.workdir = tempfile.TemporaryDirectory()
+        self.sim = Sim(OTA_SIM, self.workdir.name)
+        self.sim.start()
+
+    def tearDown(self):
+        self.sim.stop()
+        self.workdir.cleanup()
+
+    def flash(self, address, length):
+        with open(self.sim.flash, "rb") as f:
+            f.seek(address)
+            return f.read(length)
+
+    def send(self, part, body, headers=()):
+        """The status, once the upload task has closed the connection and can take
+        another"""
+        lines = ["POST /send?part=%s HTTP/1.1" % part, "Host: 127.0.0.1", "Content-Length: %d" % len(body)]
+        lines += ["%s: %s" % h for h in headers]
+        with self.sim.connect() as sock:
+            sock.sendall(("\r\n".join(lines) + "\r\n\r\n").encode() + body)
+            status = read_response(sock)[0]
+            # a refused upload is closed with its body unread, which is a reset here
+            try:
+                while sock.recv(4096):
+                    pass
+            except ConnectionResetError:
+                pass
+        return status
+
+    def boot_slot(self):
+        seq, = struct.unpack("<I", self.flash(OTADATA_ADDRESS, 4))
+        return 0 if seq == 0xffffffff else (seq - 1) % 2
+
+    def assert_running(self):
+        # still up, and nothing was switched
+        self.assertIsNone(self.sim.process.poll())
+        self.assertEqual(self.sim.request("GET", "/metrics")[0], 200)
+        self.assertEqual(self.boot_slot(), 0)
+
+    def assert_restarted(self, slot):
+        self.assertEqual(self.sim.wait(), 3)
+        self.assertEqual(self.boot_slot(), slot)
+        self.sim.restart()
+
+    def test_homekit(self):
+        # written in place, the rest of the partition left erased, and no restart
+        first = os.urandom(HOMEKIT_SIZE)
+        self.assertEqual(self.send("homekit", first), 200)
+        self.assertEqual(self.flash(HOMEKIT_ADDRESS, HOMEKIT_SIZE), first)
+        self.assert_running()
+
+        data = os.urandom(1000)
+        digest = hashlib.sha256(data).hexdigest()
+        self.assertEqual(self.send("homekit", data, [("X-Image-SHA256", digest)]), 200)
+        self.assertEqual(self.flash(HOMEKIT_ADDRESS, HOMEKIT_SIZE), data + b"\xff" * (HOMEKIT_SIZE - len(data)))
+        self.assert_running()
+
+    def test_homekit_digest_mismatch(self):
+        data = os.urandom(1000)
+        self.assertEqual(self.send("homekit", data, [("X-Image-SHA256", "00" * 32)]), 400)
+        self.assert_running()
+
+    def test_nvs(self):
+        # the running app has NVS open, so it restarts; the boot slot stays
+        self.assertEqual(self.send("nvs", nvs_image(NVS_SIZE)), 200)
+        self.assert_restarted(0)
+        image = nvs_image(8 * 1024)
+        self.assertEqual(self.send("nvs", image), 200)
+        self.assertEqual(self.flash(NVS_ADDRESS, NVS_SIZE), image + b"\xff" * (NVS_SIZE - len(image)))
+        self.assert_restarted(0)
+
+    def test_nvs_refused(self):
+        image = b"\x78\x56\x34\x12" + os.urandom(4092)
+        self.assertEqual(self.send("nvs", image), 400)
+        self.assertEqual(self.flash(NVS_ADDRESS, 4), b"\xff" * 4)
+        self.assert_restarted(0)
+
+    def test_main_by_label(self):
+        image = app_image(MAIN_ADDRESS, 16 * 1024)
+        self.assertEqual(self.send("main", image), 200)
+        self.assertEqual(self.flash(MAIN_ADDRESS, len(image)), image)
+        self.assert_restarted(1)
+
+    def test_refused_targets(self):
+        image = app_image(BOOT_ADDRESS, 8 * 1024)
+        running = self.flash(BOOT_ADDRESS, len(image))
+        otadata = self.flash(OTADATA_ADDRESS, 8 * 1024)
+        # the running app, a partition without a rule, one that isn't there, and an
+        #  empty label
+        for part in ("boot", "otadata", "nosuch", ""):
+            with self.subTest(part=part):
+                self.assertEqual(self.send(part, image), 400)
+                self.assert_running()
+        self.assertEqual(self.flash(BOOT_ADDRESS, len(image)), running)
+        self.assertEqual(self.flash(OTADATA_ADDRESS, 8 * 1024), otadata)
+
+    def test_refused_options(self):
+        data = os.urandom(HOMEKIT_SIZE + 1)
+        cases = [
+            ("larger than the partition", data, []),
+            ("delta", data[:100], [("Content-Encoding", "x-ota-delta")]),
+            ("Content-Range", data[:100], [("Content-Range", "bytes 0-99/100")]),
+        ]
+        for name, body, headers in cases:
+            with self.subTest(case=name):
+                self.assertEqual(self.send("homekit", body, headers), 400)
+                self.assert_running()
+        self.assertEqual(self.flash(HOMEKIT_ADDRESS, HOMEKIT_SIZE), b"\xff" * HOMEKIT_SIZE)
+
+    def test_ws(self):
+        data = os.urandom(3000)
+        path = os.path.join(self.workdir.name, "homekit.bin")
+        with open(path, "wb") as f:
+            f.write(data)
+        subprocess.run([sys.executable, WS_UPLOAD, "--host", "127.0.0.1", "--port", str(self.sim.port),
+                        "--part", "homekit", "--level", "N", path], check=True, capture_output=True, timeout=30)
+        self.assertEqual(self.flash(HOMEKIT_ADDRESS, len(data)), data)
+        self.assert_running()
+
+        result = subprocess.run([sys.executable, WS_UPLOAD, "--host", "127.0.0.1", "--port", str(self.sim.port),
+                                 "--part", "otadata", "--level", "N", path], capture_output=True, text=True,
+                                timeout=30)
+        self.assertNotEqual(result.returncode, 0)
+        self.assertIn("failed", result.stderr)
+        self.assert_running()
+
+
+if __name__ == "__main__":
+    unittest.main()
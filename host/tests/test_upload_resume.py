@@ -0,0 +1,155 @@
+"""Resumable POST /send against ota_sim: an image sent as Content-Range pieces, carried
+on from the session's committed offset (after a restart too), a piece that starts
+anywhere else refused with 416, the digest of the first piece checked against the
+whole image, and GET /session"""
+
+import hashlib
+import json
+import os
+import struct
+import sys
+import tempfile
+import unittest
+
+sys.path.insert(0, os.path.join(os.path.dirname(os.path.abspath(__file__)), "..", "sim"))
+from ota_sim import MAIN_ADDRESS, Sim, app_image, read_response  # noqa: E402
+
+OTA_SIM = os.environ["OTA_SIM"]
+OTADATA_ADDRESS = 0xe000
+SECTOR = 4096
+IMAGE_SIZE = 3 * SECTOR + 1024       # a partial last sector
+
+
+class UploadResumeTest(unittest.TestCase):
+
+    def setUp(self):
+        self.workdir = tempfile.TemporaryDirectory()
+        self.sim = Sim(OTA_SIM, self.workdir.name)
+        self.sim.start()
+        self.image = app_image(MAIN_ADDRESS, IMAGE_SIZE)
+        self.sha256 = hashlib.sha256(self.image).hexdigest()
+
+    def tearDown(self):
+        self.sim.stop()
+        self.workdir.cleanup()
+
+    def flash(self, address, length):
+        with open(self.sim.flash, "rb") as f:
+            f.seek(address)
+            return f.read(length)
+
+    def boot_slot(self):
+        seq, = struct.unpack("<I", self.flash(OTADATA_ADDRESS, 4))
+        return 0 if seq == 0xffffffff else (seq - 1) % 2
+
+    def send(self, first, last, session=None, sha256=None):
+        """image[first:last + 1] as a Content-Range piece: (status, headers, body), once
+        the upload task has closed the connection and can take the next one"""
+        body = self.image[first:last + 1]
+        lines = ["POST /send HTTP/1.1", "Host: 127.0.0.1", "Content-Length: %d" % len(body),
+                 "Content-Range: bytes %d-%d/%d" % (first, last, len(self.image))]
+        if session is not None:
+            lines.append("X-OTA-Session: %s" % session)
+        if sha256 is not None:
+            lines.append("X-Image-SHA256: %s" % sha256)
+        with self.sim.connect() as sock:
+            sock.sendall(("\r\n".join(lines) + "\r\n\r\n").encode() + body)
+            status, headers, data = read_response(sock)
+            try:
+                while sock.recv(4096):
+                    pass
+            except ConnectionResetError:
+                pass
+        return status, headers, data
+
+    def send_piece(self, first, last, **kwargs):
+        """A piece that leaves the image unfinished: the session it went to"""
+        status, headers, body = self.send(first, last, **kwargs)
+        self.assertEqual(status, 200)
+        session = json.loads(body)
+        self.assertEqual(session["session"], headers["x-ota-session"])
+        self.assertEqual(session["length"], IMAGE_SIZE)
+        return session
+
+    def get_session(self):
+        status, _, body = self.sim.request("GET", "/session")
+        return json.loads(body) if status == 200 else None
+
+    def assert_installed(self):
+        self.assertEqual(self.sim.wait(), 3)
+        self.assertEqual(self.boot_slot(), 1)
+        self.assertEqual(self.flash(MAIN_ADDRESS, IMAGE_SIZE), self.image)
+
+    def test_continue(self):
+        self.assertIsNone(self.get_session())
+        # only whole sectors count; the rest of a piece is sent again
+        session = self.send_piece(0, SECTOR + 99, sha256=self.sha256)
+        self.assertEqual(session["offset"], SECTOR)
+        self.assertEqual(self.get_session(), session)
+
+        session = self.send_piece(SECTOR, 3 * SECTOR - 1, session=session["session"])
+        self.assertEqual(session["offset"], 3 * SECTOR)
+        self.assertEqual(self.get_session(), session)
+
+        status, _, body = self.send(3 * SECTOR, IMAGE_SIZE - 1, session=session["session"])
+        self.assertEqual(status, 200)
+        self.assertEqual(json.loads(body)["written"], 1)
+        self.assert_installed()
+        self.sim.start()
+        self.assertIsNone(self.get_session())
+
+    def test_wrong_start(self):
+        session = self.send_piece(0, 2 * SECTOR - 1, sha256=self.sha256)
+        # before, after, and the right offset with another session's id
+        for first, id in ((SECTOR, session["session"]), (3 * SECTOR, session["session"]),
+                          (2 * SECTOR, "%08x" % (int(session["session"], 16) ^ 1))):
+            with self.subTest(first=first, session=id):
+                status, headers, body = self.send(first, IMAGE_SIZE - 1, session=id)
+                self.assertEqual(status, 416)
+                # where to carry on from
+                self.assertEqual(json.loads(body), session)
+                self.assertEqual(self.boot_slot(), 0)
+        self.assertEqual(self.get_session(), session)
+        self.assertEqual(self.flash(MAIN_ADDRESS, 2 * SECTOR), self.image[:2 * SECTOR])
+
+    def test_start_over(self):
+        # a client starting from zero with the id it had is given a new session
+        session = self.send_piece(0, 2 * SECTOR - 1, sha256=self.sha256)
+        restarted = self.send_piece(0, SECTOR - 1, session=session["session"], sha256=self.sha256)
+        self.assertNotEqual(restarted["session"], session["session"])
+        self.assertEqual(restarted["offset"], SECTOR)
+        self.assertEqual(self.send(2 * SECTOR, IMAGE_SIZE - 1, session=session["session"])[0], 416)
+
+        status, _, _ = self.send(SECTOR, IMAGE_SIZE - 1, session=restarted["session"])
+        self.assertEqual(status, 200)
+        self.assert_installed()
+
+    def test_restart(self):
+        # killed, as a power cut would; the session and what it committed are kept
+        session = self.send_piece(0, 2 * SECTOR - 1, sha256=self.sha256)
+        self.sim.stop()
+        self.sim.start()
+        self.assertEqual(self.get_session(), session)
+
+        status, _, _ = self.send(2 * SECTOR, IMAGE_SIZE - 1, session=session["session"])
+        self.assertEqual(status, 200)
+        self.assert_installed()
+
+    def test_digest(self):
+        # the digest comes with the first piece only; the image is checked against it
+        #  once whole, pieces written before a restart included
+        wrong = hashlib.sha256(b"another image").hexdigest()
+        session = self.send_piece(0, 2 * SECTOR - 1, sha256=wrong)
+        self.sim.stop()
+        self.sim.start()
+        status, _, _ = self.send(2 * SECTOR, IMAGE_SIZE - 1, session=session["session"])
+        self.assertEqual(status, 400)
+        self.assertEqual(self.sim.wait(), 3)
+        self.assertEqual(self.boot_slot(), 0)
+        # and it has to be sent again from the start
+        self.sim.start()
+        self.assertIsNone(self.get_session())
+
+
+if __name__ == "__main__":
+    unittest.main()
@@ -0,0 +1,207 @@
+// ws.c's framing over socketpairs, the device's end of GET /ws: the handshake key,
+//  masked client frames with short and 16 bit lengths, a frame arriving a byte at a
+//  time and read in odd sized pieces, the frames refused, and the frames sent
+
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include "check.h"
+#include "ws.h"
+
+// A masked client frame of 'len' bytes of 'payload' into 'out'. Returns its length
+static size_t client_frame(uint8_t *out, uint8_t opcode, const uint8_t *mask, const void *payload, size_t len) {
+    const uint8_t *p = payload;
+    size_t n = 0;
+    out[n++] = 0x80 | opcode;
+    if (len < 126) {
+        out[n++] = 0x80 | len;
+    } else {
+        out[n++] = 0x80 | 126;
+        out[n++] = len >> 8;
+        out[n++] = len & 0xff;
+    }
+    memcpy(out + n, mask, 4);
+    n += 4;
+    for (size_t i = 0; i < len; i++) {
+        out[n++] = p[i] ^ mask[i & 3];
+    }
+    return n;
+}
+
+typedef struct {
+    int fd;
+    const uint8_t *data;
+    size_t len;
+} dribble_t;
+
+// One byte per send(), so every read on the other end comes up short
+static void *dribble(void *param) {
+    dribble_t *d = param;
+    for (size_t i = 0; i < d->len; i++) {
+        send(d->fd, d->data + i, 1, 0);
+        usleep(200);
+    }
+    return NULL;
+}
+
+static void test_accept_key(void) {
+    // RFC 6455, 1.3
+    char accept[WS_ACCEPT_LEN + 1];
+    CHECK(ws_accept_key("dGhlIHNhbXBsZSBub25jZQ==", 24, accept));
+    CHECK(strcmp(accept, "s3pPLMBiTxaQ9kYGzzhZRbK+xOo=") == 0);
+    CHECK(!ws_accept_key("dGhlIHNhbXBsZSBub25jZQ", 22, accept));
+}
+
+static void test_masked(int fds[2]) {
+    // RFC 6455, 5.7: a masked "Hello"
+    static const uint8_t hello[] = { 0x81, 0x85, 0x37, 0xfa, 0x21, 0x3d, 0x7f, 0x9f, 0x4d, 0x51, 0x58 };
+    ws_frame_t frame;
+    char buf[16];
+    send(fds[1], hello, sizeof(hello), 0);
+    CHECK(ws_recv_header(fds[0], &frame));
+    CHECK(frame.fin);
+    CHECK_EQ(frame.opcode, WS_OP_TEXT);
+    CHECK_EQ(frame.len, 5);
+    CHECK_EQ(ws_recv_message(fds[0], &frame, buf, sizeof(buf)), 5);
+    CHECK(memcmp(buf, "Hello", 5) == 0);
+    CHECK_EQ(ws_recv(fds[0], &frame, buf, sizeof(buf)), 0);
+}
+
+static void test_extended(int fds[2]) {
+    // a 16 bit length, read 7 bytes at a time: the mask carries on across reads
+    static const uint8_t mask[4] = { 0xa5, 0x01, 0xff, 0x5a };
+    uint8_t payload[300], out[310], got[300];
+    for (size_t i = 0; i < sizeof(payload); i++) {
+        payload[i] = i * 7;
+    }
+    size_t n = client_frame(out, WS_OP_BINARY, mask, payload, sizeof(payload));
+    CHECK_EQ(n, 4 + 4 + sizeof(payload));
+    send(fds[1], out, n, 0);
+
+    ws_frame_t frame;
+    CHECK(ws_recv_header(fds[0], &frame));
+    CHECK_EQ(frame.opcode, WS_OP_BINARY);
+    CHECK_EQ(frame.len, sizeof(payload));
+    size_t total = 0;
+    int r;
+    while ((r = ws_recv(fds[0], &frame, got + total, 7)) > 0) {
+        CHECK(r <= 7);
+        total += r;
+    }
+    CHECK_EQ(r, 0);
+    CHECK_EQ(total, sizeof(payload));
+    CHECK(memcmp(got, payload, sizeof(payload)) == 0);
+}
+
+static void test_split(int fds[2]) {
+    // header, extended length, mask and payload each split across arrivals
+    static const uint8_t mask[4] = { 1, 2, 3, 4 };
+    uint8_t payload[200], out[210], got[200];
+    for (size_t i = 0; i < sizeof(payload); i++) {
+        payload[i] = 255 - i;
+    }
+    dribble_t d = { fds[1], out, client_frame(out, WS_OP_BINARY, mask, payload, sizeof(payload)) };
+    pthread_t thread;
+    pthread_create(&thread, NULL, dribble, &d);
+
+    ws_frame_t frame;
+    CHECK(ws_recv_header(fds[0], &frame));
+    CHECK_EQ(frame.len, sizeof(payload));
+    CHECK_EQ(ws_recv_message(fds[0], &frame, got, sizeof(got)), sizeof(payload));
+    CHECK(memcmp(got, payload, sizeof(payload)) == 0);
+    pthread_join(thread, NULL);
+}
+
+static void test_refused(void) {
+    static const uint8_t mask[4] = { 9, 8, 7, 6 };
+    uint8_t out[64], buf[8];
+    ws_frame_t frame;
+    int fds[2];
+
+    // a client frame without a mask, and one with a 64 bit length
+    static const uint8_t unmasked[] = { 0x82, 0x02, 'h', 'i' };
+    static const uint8_t oversized[] = { 0x82, 0xff, 0, 0, 0, 0, 0, 1, 0, 0 };
+    const uint8_t *bad[] = { unmasked, oversized };
+    size_t bad_len[] = { sizeof(unmasked), sizeof(oversized) };
+    for (int i = 0; i < 2; i++) {
+        CHECK(socketpair(AF_UNIX, SOCK_STREAM, 0, fds) == 0);
+        send(fds[1], bad[i], bad_len[i], 0);
+        CHECK(!ws_recv_header(fds[0], &frame));
+        close(fds[0]);
+        close(fds[1]);
+    }
+
+    // a message longer than the buffer, then one skipped: the next frame reads fine
+    CHECK(socketpair(AF_UNIX, SOCK_STREAM, 0, fds) == 0);
+    size_t n = client_frame(out, WS_OP_BINARY, mask, "0123456789", 10);
+    n += client_frame(out + n, WS_OP_BINARY, mask, "skipped", 7);
+    n += client_frame(out + n, WS_OP_BINARY, mask, "next", 4);
+    send(fds[1], out, n, 0);
+    CHECK(ws_recv_header(fds[0], &frame));
+    CHECK_EQ(ws_recv_message(fds[0], &frame, buf, sizeof(buf)), -1);
+    CHECK(ws_skip(fds[0], &frame));
+    CHECK(ws_recv_header(fds[0], &frame));
+    CHECK(ws_skip(fds[0], &frame));
+    CHECK(ws_recv_header(fds[0], &frame));
+    CHECK_EQ(ws_recv_message(fds[0], &frame, buf, sizeof(buf)), 4);
+    CHECK(memcmp(buf, "next", 4) == 0);
+
+    // and the client leaving part way through a payload
+    n = client_frame(out, WS_OP_BINARY, mask, "0123456789", 10);
+    send(fds[1], out, n - 4, 0);
+    close(fds[1]);
+    CHECK(ws_recv_header(fds[0], &frame));
+    CHECK_EQ(ws_recv_message(fds[0], &frame, buf, sizeof(buf)), -1);
+    close(fds[0]);
+}
+
+static void test_send(int fds[2]) {
+    // unmasked and unfragmented, short and 16 bit lengths, inline and not
+    static uint8_t data[3000], got[3010];
+    for (size_t i = 0; i < sizeof(data); i++) {
+        data[i] = i ^ (i >> 8);
+    }
+    size_t sizes[] = { 5, 125, 126, 160, 161, sizeof(data) };
+    for (size_t i = 0; i < sizeof(sizes) / sizeof(sizes[0]); i++) {
+        size_t len = sizes[i];
+        size_t header_len = (len < 126) ? 2 : 4;
+        CHECK(ws_send(fds[0], WS_OP_BINARY, data, len));
+        size_t total = 0;
+        while (total < header_len + len) {
+            ssize_t n = recv(fds[1], got + total, sizeof(got) - total, 0);
+            CHECK(n > 0);
+            if (n <= 0) {
+                break;
+            }
+            total += n;
+        }
+        CHECK_EQ(total, header_len + len);
+        CHECK_EQ(got[0], 0x80 | WS_OP_BINARY);
+        if (len < 126) {
+            CHECK_EQ(got[1], len);
+        } else {
+            CHECK_EQ(got[1], 126);
+            CHECK_EQ((got[2] << 8) | got[3], len);
+        }
+        CHECK(memcmp(got + header_len, data, len) == 0);
+    }
+}
+
+int main(void) {
+    int fds[2];
+    CHECK(socketpair(AF_UNIX, SOCK_STREAM, 0, fds) == 0);
+
+    test_accept_key();
+    test_masked(fds);
+    test_extended(fds);
+    test_split(fds);
+    test_send(fds);
+    test_refused();
+
+    close(fds[0]);
+    close(fds[1]);
+    return check_result();
+}
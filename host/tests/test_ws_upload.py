@@ -0,0 +1,176 @@
+"""GET /ws uploads against ota_sim, the other end of tools/ws_upload.py: DATA frames
+split across TCP sends, the credit window (the client stalls at its limit until an ACK
+raises it), a ping answered mid-upload and the RESULT. Then the messages that end an
+upload: data past the announced length, a text frame, an unmasked frame and CANCEL"""
+
+import hashlib
+import os
+import struct
+import sys
+import tempfile
+import time
+import unittest
+
+TESTS_DIR = os.path.dirname(os.path.abspath(__file__))
+sys.path.insert(0, os.path.join(TESTS_DIR, "..", "sim"))
+sys.path.insert(0, os.path.join(TESTS_DIR, "..", "..", "tools"))
+from ota_sim import MAIN_ADDRESS, Sim, app_image  # noqa: E402
+import ws_upload  # noqa: E402
+from ws_upload import MSG_ACK, MSG_BEGIN, MSG_CANCEL, MSG_DATA, MSG_RESULT, OP_BINARY, OP_CLOSE  # noqa: E402
+
+OTA_SIM = os.environ["OTA_SIM"]
+OTADATA_ADDRESS = 0xe000
+
+WINDOW = 8192               # CONFIG_WS_UPLOAD_WINDOW
+OP_TEXT = 0x1
+
+ESP_FAIL = -1
+ESP_ERR_INVALID_ARG = 0x102
+ESP_ERR_INVALID_SIZE = 0x104
+
+
+def frame(payload, opcode=OP_BINARY, masked=True):
+    """A client frame, masked unless told otherwise"""
+    mask = os.urandom(4) if masked else b""
+    length = len(payload)
+    flag = 0x80 if masked else 0
+    if length < 126:
+        header = struct.pack("!BB", 0x80 | opcode, flag | length)
+    else:
+        header = struct.pack("!BBH", 0x80 | opcode, flag | 126, length)
+    if masked:
+        payload = bytes(b ^ mask[i & 3] for i, b in enumerate(payload))
+    return header + mask + payload
+
+
+class WsUploadTest(unittest.TestCase):
+
+    def setUp(self):
+        self.workdir = tempfile.TemporaryDirectory()
+        self.sim = Sim(OTA_SIM, self.workdir.name)
+        self.sim.start()
+
+    def tearDown(self):
+        self.sim.stop()
+        self.workdir.cleanup()
+
+    def connect(self, part=None):
+        path = "/ws?level=N" + ("&part=%s" % part if part else "")
+        return ws_upload.WebSocket("127.0.0.1", self.sim.port, path)
+
+    def message(self, ws):
+        """The next upload message, past log lines and control frames"""
+        while True:
+            opcode, payload = ws.recv()
+            if opcode == OP_CLOSE:
+                return None
+            if opcode == OP_BINARY and payload[0] in (MSG_ACK, MSG_RESULT, ws_upload.MSG_PROGRESS):
+                return payload
+
+    def ack(self, ws):
+        while True:
+            msg = self.message(ws)
+            self.assertIsNotNone(msg)
+            if msg[0] == MSG_ACK:
+                return struct.unpack_from("<II", msg, 1)
+            self.assertNotEqual(msg[0], MSG_RESULT, "RESULT %r before the upload finished" % msg)
+
+    def result(self, ws):
+        while True:
+            msg = self.message(ws)
+            self.assertIsNotNone(msg, "closed without a RESULT")
+            if msg[0] == MSG_RESULT:
+                code, writes, skipped = struct.unpack_from("<iHH", msg, 1)
+                return code, writes, skipped, msg[9:41]
+
+    def boot_slot(self):
+        with open(self.sim.flash, "rb") as f:
+            f.seek(OTADATA_ADDRESS)
+            seq, = struct.unpack("<I", f.read(4))
+        return 0 if seq == 0xffffffff else (seq - 1) % 2
+
+    def test_upload(self):
+        image = app_image(MAIN_ADDRESS, 6 * 4096)
+        sha256 = hashlib.sha256(image).digest()
+        ws = self.connect()
+        ws.send(struct.pack("<BIB", MSG_BEGIN, len(image), 0) + sha256)
+        received, limit = self.ack(ws)
+        self.assertEqual((received, limit), (0, WINDOW))
+
+        sent = 0
+        stalls = 0
+        pinged = False
+        while sent < len(image):
+            if sent == limit:
+                # out of credit: nothing more goes until an ACK raises the limit
+                stalls += 1
+                received, limit = self.ack(ws)
+                self.assertLessEqual(received, sent)
+                self.assertEqual(limit, received + WINDOW)
+                continue
+            n = min(1000, limit - sent, len(image) - sent)
+            data = frame(bytes([MSG_DATA]) + image[sent:sent + n])
+            # split inside the header and again inside the payload
+            for piece in (data[:1], data[1:7], data[7:501], data[501:]):
+                ws.sock.sendall(piece)
+                time.sleep(0.001)
+            sent += n
+            if not pinged and sent > len(image) // 2:
+                ws.sock.sendall(frame(b"mid-upload", ws_upload.OP_PING))
+                pinged = True
+        self.assertGreaterEqual(stalls, 2)
+
+        code, writes, skipped, digest = self.result(ws)
+        self.assertEqual(code, 0)
+        self.assertEqual(digest, sha256)
+        self.assertEqual(writes, 6)
+        self.assertEqual(skipped, 0)
+        ws.wait_closed()
+        self.assertEqual(self.sim.wait(), 3)
+        self.assertEqual(self.boot_slot(), 1)
+
+    def test_ping(self):
+        ws = self.connect(part="homekit")
+        ws.sock.sendall(frame(b"are you there", ws_upload.OP_PING))
+        opcode, payload = ws.recv()
+        while opcode != ws_upload.OP_PONG:
+            opcode, payload = ws.recv()
+        self.assertEqual(payload, b"are you there")
+
+    def failed(self, *frames, begin_length=100):
+        """The RESULT code after BEGIN and 'frames', on the homekit partition"""
+        ws = self.connect(part="homekit")
+        ws.send(struct.pack("<BIB", MSG_BEGIN, begin_length, 0))
+        self.ack(ws)
+        for data in frames:
+            ws.sock.sendall(data)
+        code = self.result(ws)[0]
+        ws.wait_closed()
+        self.assertIsNone(self.sim.process.poll())
+        return code
+
+    def test_overrun(self):
+        self.assertEqual(self.failed(frame(bytes([MSG_DATA]) + os.urandom(200))), ESP_ERR_INVALID_SIZE)
+
+    def test_not_binary(self):
+        self.assertEqual(self.failed(frame(bytes([MSG_DATA]) + b"text", OP_TEXT)), ESP_ERR_INVALID_ARG)
+
+    def test_cancel(self):
+        self.assertEqual(self.failed(frame(bytes([MSG_DATA]) + os.urandom(50)), frame(bytes([MSG_CANCEL]))),
+                         ESP_FAIL)
+
+    def test_unmasked(self):
+        # a protocol error at the framing level: dropped, with nothing sent
+        ws = self.connect(part="homekit")
+        ws.send(struct.pack("<BIB", MSG_BEGIN, 100, 0))
+        self.ack(ws)
+        ws.sock.sendall(frame(bytes([MSG_DATA]) + b"plain", masked=False))
+        with self.assertRaises(ConnectionError):
+            while self.message(ws) is not None:
+                pass
+        ws.wait_closed()
+        self.assertEqual(self.sim.request("GET", "/metrics")[0], 200)
+
+
+if __name__ == "__main__":
+    unittest.main()
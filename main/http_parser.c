@@ -0,0 +1,249 @@
+#include <string.h>
+#include <strings.h>
+
+#include "http_parser.h"
+
+enum {
+    HTTP_STATE_METHOD = 0,
+    HTTP_STATE_URI,
+    HTTP_STATE_QUERY,
+    HTTP_STATE_VERSION,
+    HTTP_STATE_REQUEST_LF,
+    HTTP_STATE_HEADER_START,
+    HTTP_STATE_HEADER_NAME,
+    HTTP_STATE_HEADER_VALUE_WS,
+    HTTP_STATE_HEADER_VALUE,
+    HTTP_STATE_HEADER_LF,
+    HTTP_STATE_END_LF,
+    HTTP_STATE_DONE,
+    HTTP_STATE_ERROR,
+};
+
+#define HTTP_MAX_METHOD_LEN 7
+
+static http_slice_t http_slice(uint16_t start, uint16_t end) {
+    http_slice_t s = { .off = start, .len = end - start };
+    return s;
+}
+
+static bool http_slice_iequals(const char *buf, http_slice_t slice, const char *str) {
+    return strlen(str) == slice.len && strncasecmp(buf + slice.off, str, slice.len) == 0;
+}
+
+static bool http_is_ctl(char c) {
+    return (unsigned char)c < 0x20 || c == 0x7f;
+}
+
+static bool http_parser_wants(const http_parser_t *p, const char *buf) {
+    if (p->wanted == NULL) {
+        return true;
+    }
+    for (const char *const *name = p->wanted; *name != NULL; name++) {
+        if (http_slice_iequals(buf, p->name, *name)) {
+            return true;
+        }
+    }
+    return false;
+}
+
+// false if the header should be kept and there is no room left
+static bool http_parser_add_header(http_parser_t *p, const char *buf, http_slice_t value) {
+    // trim trailing whitespace
+    while (value.len > 0 && (buf[value.off + value.len - 1] == ' ' || buf[value.off + value.len - 1] == '\t')) {
+        value.len--;
+    }
+
+    if (http_slice_iequals(buf, p->name, "Content-Length")) {
+        // anything that doesn't fit a uint32_t is as invalid as a non-digit
+        uint32_t n = 0;
+        bool valid = value.len > 0;
+        for (int i = 0; i < value.len && valid; i++) {
+            uint32_t digit = buf[value.off + i] - '0';
+            valid = digit <= 9 && n <= (UINT32_MAX - digit) / 10;
+            n = n * 10 + digit;
+        }
+        p->has_content_length = valid;
+        p->content_length = valid ? n : 0;
+    }
+
+    if (!http_parser_wants(p, buf)) {
+        return true;
+    }
+    if (p->header_count == HTTP_MAX_HEADERS) {
+        return false;
+    }
+    p->headers[p->header_count].name = p->name;
+    p->headers[p->header_count].value = value;
+    p->header_count++;
+    return true;
+}
+
+void http_parser_init(http_parser_t *p, const char *const *wanted) {
+    memset(p, 0, sizeof(http_parser_t));
+    p->state = HTTP_STATE_METHOD;
+    p->wanted = wanted;
+}
+
+http_parse_result_t http_parser_feed(http_parser_t *p, const char *buf, size_t len) {
+    while (p->pos < len) {
+        char c = buf[p->pos];
+
+        switch (p->state) {
+            case HTTP_STATE_METHOD:
+                if (c == ' ' && p->pos > p->mark) {
+                    p->method = http_slice(p->mark, p->pos);
+                    p->mark = p->pos + 1;
+                    p->state = HTTP_STATE_URI;
+                }
+                else if (c < 'A' || c > 'Z' || p->pos - p->mark >= HTTP_MAX_METHOD_LEN) {
+                    p->state = HTTP_STATE_ERROR;
+                }
+                break;
+
+            case HTTP_STATE_URI:
+            case HTTP_STATE_QUERY:
+                if (c == ' ') {
+                    if (p->state == HTTP_STATE_URI) {
+                        p->path = http_slice(p->mark, p->pos);
+                    } else {
+                        p->query = http_slice(p->mark, p->pos);
+                    }
+                    p->state = p->path.len > 0 ? HTTP_STATE_VERSION : HTTP_STATE_ERROR;
+                }
+                else if (c == '?' && p->state == HTTP_STATE_URI) {
+                    p->path = http_slice(p->mark, p->pos);
+                    p->mark = p->pos + 1;
+                    p->state = HTTP_STATE_QUERY;
+                }
+                else if (http_is_ctl(c)) {
+                    p->state = HTTP_STATE_ERROR;
+                }
+                break;
+
+            case HTTP_STATE_VERSION:
+                // not interested in the version, just find the end of the line
+                if (c == '\r') {
+                    p->state = HTTP_STATE_REQUEST_LF;
+                }
+                else if (c == '\n') {
+                    p->state = HTTP_STATE_HEADER_START;
+                }
+                break;
+
+            case HTTP_STATE_REQUEST_LF:
+            case HTTP_STATE_HEADER_LF:
+                p->state = (c == '\n') ? HTTP_STATE_HEADER_START : HTTP_STATE_ERROR;
+                break;
+
+            case HTTP_STATE_HEADER_START:
+                if (c == '\r') {
+                    p->state = HTTP_STATE_END_LF;
+                }
+                else if (c == '\n') {
+                    // bare LF line ending
+                    p->state = HTTP_STATE_END_LF;
+                    continue;
+                }
+                else if (c == ':' || c == ' ' || http_is_ctl(c)) {
+                    p->state = HTTP_STATE_ERROR;
+                }
+                else {
+                    p->mark = p->pos;
+                    p->state = HTTP_STATE_HEADER_NAME;
+                }
+                break;
+
+            case HTTP_STATE_HEADER_NAME:
+                if (c == ':') {
+                    p->name = http_slice(p->mark, p->pos);
+                    p->state = HTTP_STATE_HEADER_VALUE_WS;
+                }
+                else if (http_is_ctl(c)) {
+                    p->state = HTTP_STATE_ERROR;
+                }
+                break;
+
+            case HTTP_STATE_HEADER_VALUE_WS:
+                if (c == ' ' || c == '\t') {
+                    break;
+                }
+                p->mark = p->pos;
+                p->state = HTTP_STATE_HEADER_VALUE;
+                continue;   // re-examine this byte as part of the value
+
+            case HTTP_STATE_HEADER_VALUE:
+                if (c == '\r' || c == '\n') {
+                    if (!http_parser_add_header(p, buf, http_slice(p->mark, p->pos))) {
+                        p->state = HTTP_STATE_ERROR;
+                        return HTTP_PARSE_TOO_MANY_HEADERS;
+                    }
+                    p->state = (c == '\r') ? HTTP_STATE_HEADER_LF : HTTP_STATE_HEADER_START;
+                }
+                break;
+
+            case HTTP_STATE_END_LF:
+                if (c != '\n') {
+                    p->state = HTTP_STATE_ERROR;
+                    break;
+                }
+                p->pos++;
+                p->body_offset = p->pos;
+                p->state = HTTP_STATE_DONE;
+                return HTTP_PARSE_DONE;
+
+            case HTTP_STATE_DONE:
+                return HTTP_PARSE_DONE;
+
+            default:
+                return HTTP_PARSE_ERROR;
+        }
+
+        if (p->state == HTTP_STATE_ERROR) {
+            return HTTP_PARSE_ERROR;
+        }
+        p->pos++;
+    }
+
+    if (p->state == HTTP_STATE_DONE) {
+        return HTTP_PARSE_DONE;
+    }
+    return HTTP_PARSE_INCOMPLETE;
+}
+
+const http_header_t *http_parser_find_header(const http_parser_t *p, const char *buf, const char *name) {
+    for (int i = 0; i < p->header_count; i++) {
+        if (http_slice_iequals(buf, p->headers[i].name, name)) {
+            return &p->headers[i];
+        }
+    }
+    return NULL;
+}
+
+bool http_slice_equals(const char *buf, http_slice_t slice, const char *str) {
+    return strlen(str) == slice.len && strncmp(buf + slice.off, str, slice.len) == 0;
+}
+
+bool http_query_param(const char *buf, http_slice_t query, const char *name, http_slice_t *value) {
+    size_t name_len = strlen(name);
+    uint16_t pos = query.off;
+    uint16_t end = query.off + query.len;
+
+    while (pos < end) {
+        uint16_t next = pos;
+        while (next < end && buf[next] != '&') {
+            next++;
+        }
+        if ((size_t)(next - pos) > name_len && buf[pos + name_len] == '=' && strncmp(buf + pos, name, name_len) == 0) {
+            value->off = pos + name_len + 1;
+            value->len = next - value->off;
+            return true;
+        }
+        if ((size_t)(next - pos) == name_len && strncmp(buf + pos, name, name_len) == 0) {
+            value->off = next;
+            value->len = 0;
+            return true;
+        }
+        pos = next + 1;
+    }
+    return false;
+}
@@ -0,0 +1,73 @@
+#pragma once
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#define HTTP_MAX_HEADERS 12
+
+// Offset and length of a token inside the caller's receive buffer. Nothing is copied.
+typedef struct {
+    uint16_t off;
+    uint16_t len;
+} http_slice_t;
+
+typedef struct {
+    http_slice_t name;
+    http_slice_t value;
+} http_header_t;
+
+typedef enum {
+    HTTP_PARSE_INCOMPLETE = 0,  // need more bytes
+    HTTP_PARSE_DONE,            // request line and headers complete. body starts at body_offset
+    HTTP_PARSE_ERROR,
+    HTTP_PARSE_TOO_MANY_HEADERS,    // more than HTTP_MAX_HEADERS to keep. answer 431
+} http_parse_result_t;
+
+typedef struct {
+    // private
+    uint8_t state;
+    uint16_t pos;               // bytes of the buffer already consumed
+    uint16_t mark;              // start of the token being scanned
+    http_slice_t name;          // header name waiting for its value
+    const char *const *wanted;  // names of the headers to keep, NULL terminated. NULL: all
+
+    // results, valid once HTTP_PARSE_DONE is returned
+    http_slice_t method;
+    http_slice_t path;          // uri without the query string
+    http_slice_t query;         // text after '?', len 0 if none
+    http_header_t headers[HTTP_MAX_HEADERS];
+    uint8_t header_count;
+    bool has_content_length;
+    uint32_t content_length;
+    uint16_t body_offset;
+} http_parser_t;
+
+// 'wanted' lists the headers http_parser_find_header() will be asked for (case does 
+//  not matter) and must outlive the parser. Others are parsed and skipped, so browsers 
+//  sending a dozen or more can't crowd them out. With NULL every header is kept. Either 
+//  way a request with more than HTTP_MAX_HEADERS to keep gets HTTP_PARSE_TOO_MANY_HEADERS
+void http_parser_init(http_parser_t *parser, const char *const *wanted);
+
+// Resume parsing. 'buf' holds every byte received for this request so far and 'len' is
+//  its total length; only bytes not seen on a previous call are scanned. Slices in the
+//  parser point into 'buf', so the buffer must not move between calls.
+http_parse_result_t http_parser_feed(http_parser_t *parser, const char *buf, size_t len);
+
+// Case-insensitive header lookup. Returns NULL if not present.
+const http_header_t *http_parser_find_header(const http_parser_t *parser, const char *buf, const char *name);
+
+// Exact (case-sensitive) comparison of a slice against a C string
+bool http_slice_equals(const char *buf, http_slice_t slice, const char *str);
+
+// Value of 'name' in a query string ('a=1&b'). 'b' has an empty value. Returns false if 
+//  absent. The value is not percent-decoded.
+bool http_query_param(const char *buf, http_slice_t query, const char *name, http_slice_t *value);
+
+#ifdef __cplusplus
+}
+#endif
@@ -0,0 +1,58 @@
+#include <string.h>
+
+#include "log_binary.h"
+#include "log_capture.h"
+
+// Record layout, all little endian:
+//  u32 site ID, then per argument u32 | u64 | f64 | u8 length + bytes.
+//  An argument that doesn't fit ends the record; the decoder marks what is missing.
+
+static void log_binary_put(log_binary_writer_t *w, const void *data, size_t len) {
+    if (!w->full && w->len + len <= LOG_BINARY_RECORD_MAX) {
+        memcpy(w->data + w->len, data, len);
+        w->len += len;
+    }
+    else {
+        w->full = true;     // nothing after this either
+    }
+}
+
+void log_binary_begin(log_binary_writer_t *w, const log_binary_site_t *site) {
+    w->len = 0;
+    w->full = false;
+    log_binary_put_u32(w, (uint32_t)(uintptr_t)site);
+}
+
+// the lx106 is little endian, like the record, so values are copied as they are
+void log_binary_put_u32(log_binary_writer_t *w, uint32_t value) {
+    log_binary_put(w, &value, sizeof(value));
+}
+
+void log_binary_put_u64(log_binary_writer_t *w, uint64_t value) {
+    log_binary_put(w, &value, sizeof(value));
+}
+
+void log_binary_put_double(log_binary_writer_t *w, double value) {
+    log_binary_put(w, &value, sizeof(value));
+}
+
+void log_binary_put_ptr(log_binary_writer_t *w, const void *value) {
+    log_binary_put_u32(w, (uint32_t)(uintptr_t)value);
+}
+
+void log_binary_put_str(log_binary_writer_t *w, const char *value) {
+    if (value == NULL) {
+        value = "(null)";
+    }
+    // bounded, as '%.*s' arguments need not be terminated
+    uint8_t len = strnlen(value, LOG_BINARY_STRING_MAX);
+    if (w->len + 1 + len > LOG_BINARY_RECORD_MAX && w->len < LOG_BINARY_RECORD_MAX) {
+        len = LOG_BINARY_RECORD_MAX - w->len - 1;   // keep what fits
+    }
+    log_binary_put(w, &len, 1);
+    log_binary_put(w, value, len);
+}
+
+void log_binary_end(log_binary_writer_t *w) {
+    log_capture_write_binary(w->data, w->len);
+}
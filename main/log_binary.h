@@ -0,0 +1,105 @@
+#pragma once
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "esp_log.h"
+
+// LOGB_E/W/I/D/V take the same arguments as ESP_LOGx.
+//
+// With CONFIG_LOG_BINARY off they are ESP_LOGx. With it on, nothing is formatted on
+//  the device: each call site gets a static log_binary_site_t, whose address is its ID,
+//  and the call stores that ID and the raw arguments in the log capture ring. The sse
+//  task sends them base64 encoded as 'logb' events, and tools/log_decode.py turns them
+//  back into text using a dictionary read out of the ELF at build time.
+//
+// Arguments are stored by their C type: 4 bytes for integers and pointers, 8 for
+//  64 bit integers and doubles, and a length prefixed copy (at most
+//  LOG_BINARY_STRING_MAX bytes) for char pointers. At most 8 arguments.
+
+#define LOG_BINARY_RECORD_MAX 80
+#define LOG_BINARY_STRING_MAX 64
+
+// Read by the host tool from the ELF, never by the device. Its layout is part of
+//  the format tools/log_decode.py understands.
+typedef struct {
+    const char *format;
+    const char *const *tag;
+    uint32_t level;
+} log_binary_site_t;
+
+typedef struct {
+    uint8_t len;
+    bool full;
+    uint8_t data[LOG_BINARY_RECORD_MAX];
+} log_binary_writer_t;
+
+void log_binary_begin(log_binary_writer_t *w, const log_binary_site_t *site);
+void log_binary_put_u32(log_binary_writer_t *w, uint32_t value);
+void log_binary_put_u64(log_binary_writer_t *w, uint64_t value);
+void log_binary_put_double(log_binary_writer_t *w, double value);
+void log_binary_put_ptr(log_binary_writer_t *w, const void *value);
+void log_binary_put_str(log_binary_writer_t *w, const char *value);
+// Hand the record to the log capture ring
+void log_binary_end(log_binary_writer_t *w);
+
+// '+ 0' decays arrays and promotes small integers before the type is matched
+#define LOG_BINARY_PUT(w, x) _Generic((x) + 0, \
+        char *: log_binary_put_str, \
+        const char *: log_binary_put_str, \
+        float: log_binary_put_double, \
+        double: log_binary_put_double, \
+        long long: log_binary_put_u64, \
+        unsigned long long: log_binary_put_u64, \
+        void *: log_binary_put_ptr, \
+        const void *: log_binary_put_ptr, \
+        default: log_binary_put_u32)(w, x);
+
+#define LOG_BINARY_NARGS(...) LOG_BINARY_NARGS_(_, ##__VA_ARGS__, 8, 7, 6, 5, 4, 3, 2, 1, 0)
+#define LOG_BINARY_NARGS_(_, a1, a2, a3, a4, a5, a6, a7, a8, n, ...) n
+#define LOG_BINARY_CAT(a, b) LOG_BINARY_CAT_(a, b)
+#define LOG_BINARY_CAT_(a, b) a##b
+
+#define LOG_BINARY_PUT_0(w)
+#define LOG_BINARY_PUT_1(w, a) LOG_BINARY_PUT(w, a)
+#define LOG_BINARY_PUT_2(w, a, ...) LOG_BINARY_PUT(w, a) LOG_BINARY_PUT_1(w, __VA_ARGS__)
+#define LOG_BINARY_PUT_3(w, a, ...) LOG_BINARY_PUT(w, a) LOG_BINARY_PUT_2(w, __VA_ARGS__)
+#define LOG_BINARY_PUT_4(w, a, ...) LOG_BINARY_PUT(w, a) LOG_BINARY_PUT_3(w, __VA_ARGS__)
+#define LOG_BINARY_PUT_5(w, a, ...) LOG_BINARY_PUT(w, a) LOG_BINARY_PUT_4(w, __VA_ARGS__)
+#define LOG_BINARY_PUT_6(w, a, ...) LOG_BINARY_PUT(w, a) LOG_BINARY_PUT_5(w, __VA_ARGS__)
+#define LOG_BINARY_PUT_7(w, a, ...) LOG_BINARY_PUT(w, a) LOG_BINARY_PUT_6(w, __VA_ARGS__)
+#define LOG_BINARY_PUT_8(w, a, ...) LOG_BINARY_PUT(w, a) LOG_BINARY_PUT_7(w, __VA_ARGS__)
+
+// The site is named log_binary_site so the dictionary tool can find every one of them
+//  in the ELF symbol table
+#define LOG_BINARY(level, tag, format, ...) do { \
+        if (LOG_LOCAL_LEVEL >= level) { \
+            static const log_binary_site_t log_binary_site = { format, &(tag), level }; \
+            log_binary_writer_t log_binary_w; \
+            log_binary_begin(&log_binary_w, &log_binary_site); \
+            LOG_BINARY_CAT(LOG_BINARY_PUT_, LOG_BINARY_NARGS(__VA_ARGS__))(&log_binary_w, ##__VA_ARGS__) \
+            log_binary_end(&log_binary_w); \
+        } \
+    } while (0)
+
+#if CONFIG_LOG_BINARY
+#define LOGB_E(tag, format, ...) LOG_BINARY(ESP_LOG_ERROR,   tag, format, ##__VA_ARGS__)
+#define LOGB_W(tag, format, ...) LOG_BINARY(ESP_LOG_WARN,    tag, format, ##__VA_ARGS__)
+#define LOGB_I(tag, format, ...) LOG_BINARY(ESP_LOG_INFO,    tag, format, ##__VA_ARGS__)
+#define LOGB_D(tag, format, ...) LOG_BINARY(ESP_LOG_DEBUG,   tag, format, ##__VA_ARGS__)
+#define LOGB_V(tag, format, ...) LOG_BINARY(ESP_LOG_VERBOSE, tag, format, ##__VA_ARGS__)
+#else
+#define LOGB_E(tag, format, ...) ESP_LOGE(tag, format, ##__VA_ARGS__)
+#define LOGB_W(tag, format, ...) ESP_LOGW(tag, format, ##__VA_ARGS__)
+#define LOGB_I(tag, format, ...) ESP_LOGI(tag, format, ##__VA_ARGS__)
+#define LOGB_D(tag, format, ...) ESP_LOGD(tag, format, ##__VA_ARGS__)
+#define LOGB_V(tag, format, ...) ESP_LOGV(tag, format, ##__VA_ARGS__)
+#endif
+
+#ifdef __cplusplus
+}
+#endif
@@ -0,0 +1,222 @@
+#include <string.h>
+
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "freertos/semphr.h"
+
+#include "esp_log.h"
+
+#include "log_capture.h"
+
+// Any task can log, so each one assembles its current line in a staging slot it
+//  claims on the first character and releases on '\n'. A finished line is then
+//  copied into the ring with a single reserve/commit, so lines from different 
+//  tasks never interleave and the putchar hook is O(1) per character.
+#define LOG_CAPTURE_PRODUCERS 4
+
+#define LOG_RECORD_SKIP 0       // pads out the end of the ring, nothing to read
+#define LOG_RECORD_LINE 1
+#define LOG_RECORD_BINARY 2
+
+typedef struct {
+    uint16_t size;              // whole record, header included, rounded up to 4
+    volatile uint8_t committed; // set by the producer once the text is in place
+    uint8_t type;
+    uint16_t len;
+    uint16_t reserved;
+    uint32_t timestamp;
+    char task[LOG_CAPTURE_TASK_NAME_LEN];
+} log_record_header_t;
+
+typedef struct {
+    TaskHandle_t volatile owner;
+    uint32_t timestamp;
+    uint16_t len;
+    char line[LOG_CAPTURE_LINE_MAX];
+} log_producer_t;
+
+static log_producer_t producers[LOG_CAPTURE_PRODUCERS];
+
+// records are 4 byte aligned, and so is what is left before the end of the ring
+_Static_assert(CONFIG_LOG_CAPTURE_RING_SIZE % 4 == 0, "CONFIG_LOG_CAPTURE_RING_SIZE must be a multiple of 4");
+// head and tail run free and are reduced % the size. When they wrap past 2^32 the
+//  offsets only carry on from where they were if the size divides 2^32
+_Static_assert((CONFIG_LOG_CAPTURE_RING_SIZE & (CONFIG_LOG_CAPTURE_RING_SIZE - 1)) == 0,
+    "CONFIG_LOG_CAPTURE_RING_SIZE must be a power of 2");
+
+static uint8_t ring[CONFIG_LOG_CAPTURE_RING_SIZE] __attribute__((aligned(4)));
+static volatile uint32_t ring_head;     // next byte to reserve (free running)
+static volatile uint32_t ring_tail;     // next byte to consume (free running)
+static volatile uint32_t dropped;
+
+static SemaphoreHandle_t ring_ready;
+static putchar_like_t old_putchar = NULL;
+
+// The lx106 has no atomic read-modify-write instructions. On this single core part 
+//  masking interrupts for a handful of cycles is the compare-and-swap; nothing below
+//  ever blocks or calls out while inside.
+static bool log_capture_cas(TaskHandle_t volatile *p, TaskHandle_t expected, TaskHandle_t desired) {
+    bool swapped = false;
+    portENTER_CRITICAL();
+    if (*p == expected) {
+        *p = desired;
+        swapped = true;
+    }
+    portEXIT_CRITICAL();
+    return swapped;
+}
+
+static log_producer_t *log_capture_producer(TaskHandle_t task) {
+    for (int i = 0; i < LOG_CAPTURE_PRODUCERS; i++) {
+        if (producers[i].owner == task) {
+            return &producers[i];
+        }
+    }
+    for (int i = 0; i < LOG_CAPTURE_PRODUCERS; i++) {
+        if (log_capture_cas(&producers[i].owner, NULL, task)) {
+            producers[i].len = 0;
+            producers[i].timestamp = esp_log_timestamp();
+            return &producers[i];
+        }
+    }
+    return NULL;
+}
+
+// Returns the ring offset of 'size' reserved bytes, or -1 if full
+static int32_t log_capture_reserve(uint32_t size) {
+    int32_t offset = -1;
+
+    portENTER_CRITICAL();
+    uint32_t head = ring_head;
+    uint32_t to_end = CONFIG_LOG_CAPTURE_RING_SIZE - (head % CONFIG_LOG_CAPTURE_RING_SIZE);
+    uint32_t needed = (to_end < size) ? to_end + size : size;
+
+    if (needed <= CONFIG_LOG_CAPTURE_RING_SIZE - (head - ring_tail)) {
+        if (to_end < size) {
+            // not enough room before the end; pad it out and wrap. less room than a
+            //  header is skipped by the reader without one
+            if (to_end >= sizeof(log_record_header_t)) {
+                log_record_header_t *skip = (log_record_header_t *)&ring[head % CONFIG_LOG_CAPTURE_RING_SIZE];
+                skip->size = to_end;
+                skip->type = LOG_RECORD_SKIP;
+                skip->committed = 1;
+            }
+            head += to_end;
+        }
+        offset = head % CONFIG_LOG_CAPTURE_RING_SIZE;
+
+        // the reader may look at this header as soon as ring_head moves. until then it
+        //  holds whatever an older record left there, which could pass for committed
+        log_record_header_t *hdr = (log_record_header_t *)&ring[offset];
+        hdr->size = size;
+        hdr->committed = 0;
+        ring_head = head + size;
+    }
+    else {
+        dropped++;
+    }
+    portEXIT_CRITICAL();
+
+    return offset;
+}
+
+static void log_capture_commit(uint8_t type, uint32_t timestamp, const void *data, uint16_t len) {
+    uint32_t size = (sizeof(log_record_header_t) + len + 3) & ~3;
+    int32_t offset = log_capture_reserve(size);
+    if (offset < 0) {
+        return;
+    }
+
+    // size and committed were set by log_capture_reserve()
+    log_record_header_t *hdr = (log_record_header_t *)&ring[offset];
+    hdr->type = type;
+    hdr->len = len;
+    hdr->timestamp = timestamp;
+    strncpy(hdr->task, pcTaskGetTaskName(NULL), LOG_CAPTURE_TASK_NAME_LEN - 1);
+    hdr->task[LOG_CAPTURE_TASK_NAME_LEN - 1] = '\0';
+    memcpy(ring + offset + sizeof(log_record_header_t), data, len);
+    __asm__ __volatile__("" ::: "memory");
+    hdr->committed = 1;
+
+    if (ring_ready != NULL) {
+        xSemaphoreGive(ring_ready);
+    }
+}
+
+static int log_capture_putchar(int chr) {
+    TaskHandle_t task = xTaskGetCurrentTaskHandle();
+    log_producer_t *p = log_capture_producer(task);
+
+    if (p == NULL) {
+        if (chr == '\n') {
+            portENTER_CRITICAL();
+            dropped++;
+            portEXIT_CRITICAL();
+        }
+    }
+    else if (chr == '\n') {
+        log_capture_commit(LOG_RECORD_LINE, p->timestamp, p->line, p->len);
+        p->owner = NULL;
+    }
+    else if (p->len < LOG_CAPTURE_LINE_MAX - 1) {
+        p->line[p->len++] = chr;
+    }
+
+    // still send to console
+    return old_putchar(chr);
+}
+
+// A whole record at once, so unlike a line it needs no staging slot
+void log_capture_write_binary(const void *data, size_t len) {
+    if (len > LOG_CAPTURE_LINE_MAX - 1) {
+        len = LOG_CAPTURE_LINE_MAX - 1;
+    }
+    log_capture_commit(LOG_RECORD_BINARY, esp_log_timestamp(), data, len);
+}
+
+void log_capture_init(void) {
+    ring_ready = xSemaphoreCreateBinary();
+    old_putchar = esp_log_set_putchar(&log_capture_putchar);
+}
+
+bool log_capture_read(log_record_t *record, TickType_t wait) {
+    while (1) {
+        if (ring_tail != ring_head) {
+            uint32_t to_end = CONFIG_LOG_CAPTURE_RING_SIZE - (ring_tail % CONFIG_LOG_CAPTURE_RING_SIZE);
+            if (to_end < sizeof(log_record_header_t)) {
+                // too short for a record, so the writer has wrapped
+                ring_tail += to_end;
+                continue;
+            }
+            log_record_header_t *hdr = (log_record_header_t *)&ring[ring_tail % CONFIG_LOG_CAPTURE_RING_SIZE];
+            if (hdr->committed) {
+                uint32_t size = hdr->size;
+                bool is_record = (hdr->type != LOG_RECORD_SKIP);
+                if (is_record) {
+                    record->binary = (hdr->type == LOG_RECORD_BINARY);
+                    record->timestamp = hdr->timestamp;
+                    memcpy(record->task, hdr->task, LOG_CAPTURE_TASK_NAME_LEN);
+                    record->task[LOG_CAPTURE_TASK_NAME_LEN - 1] = '\0';
+                    record->len = hdr->len;
+                    memcpy(record->text, (char *)hdr + sizeof(log_record_header_t), hdr->len);
+                    record->text[hdr->len] = '\0';
+                }
+                hdr->committed = 0;
+                // hand the space back to producers only once it has been copied out
+                ring_tail += size;
+                if (is_record) {
+                    return true;
+                }
+                continue;
+            }
+        }
+        // empty, or the oldest reservation is still being filled in
+        if (xSemaphoreTake(ring_ready, wait) != pdTRUE) {
+            return false;
+        }
+    }
+}
+
+uint32_t log_capture_dropped(void) {
+    return dropped;
+}
@@ -0,0 +1,41 @@
+#pragma once
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "freertos/FreeRTOS.h"
+
+#define LOG_CAPTURE_LINE_MAX 120
+#define LOG_CAPTURE_TASK_NAME_LEN 8
+
+typedef struct {
+    uint32_t timestamp;                     // esp_log_timestamp() when the line started
+    char task[LOG_CAPTURE_TASK_NAME_LEN];   // (truncated) name of the task that logged it
+    bool binary;                            // 'text' holds a log_binary record, not a line
+    uint16_t len;
+    char text[LOG_CAPTURE_LINE_MAX];        // without the '\n', NUL terminated
+} log_record_t;
+
+// Hook esp_log_set_putchar() and start capturing complete lines into the ring.
+//  Characters are still passed on to the console.
+void log_capture_init(void);
+
+// Queue a LOGB_x record (see log_binary.h). 'len' is at most LOG_CAPTURE_LINE_MAX - 1.
+//  Records queued before log_capture_init() wait in the ring.
+void log_capture_write_binary(const void *data, size_t len);
+
+// Take the oldest captured line or record. Blocks up to 'wait' ticks if none is available.
+//  Only one consumer task is supported.
+bool log_capture_read(log_record_t *record, TickType_t wait);
+
+// Lines lost because the ring was full (or too many tasks logged at once)
+uint32_t log_capture_dropped(void);
+
+#ifdef __cplusplus
+}
+#endif
@@ -1,7 +1,9 @@
 #include <string.h>
+#include <stdlib.h>
 
 #include "freertos/FreeRTOS.h"
 #include "freertos/task.h"
+#include "freertos/queue.h"
 #include "lwip/sockets.h"
 #include <freertos/timers.h>
 
@@ -12,382 +14,1650 @@
 #include "esp_ota_ops.h"
 
 #include "esp_log.h"
+#include "mbedtls/base64.h"
 static const char *TAG = "main";
 
+#include "http_parser.h"
+#include "log_binary.h"
+#include "log_capture.h"
+#include "metrics.h"
+#include "ota_pipeline.h"
+#include "ota_session.h"
+#include "ota_target.h"
+#include "relay.h"
+#include "server.h"
+#include "sse.h"
+#include "ws.h"
+
 #include "led_status.h"
 static led_status_t led_status;
-static led_status_pattern_t running = LED_STATUS_PATTERN({500, -500});
-static led_status_pattern_t client_connected = LED_STATUS_PATTERN({500, -500, 100, -100});
-static led_status_pattern_t downloading = LED_STATUS_PATTERN({50, -50});
+static const led_status_pattern_t running = LED_STATUS_PATTERN({500, -500});
+static const led_status_pattern_t client_connected = LED_STATUS_PATTERN({500, -500, 100, -100});
+static const led_status_pattern_t downloading = LED_STATUS_PATTERN({50, -50});
 
+// the host build's simulator passes its own
+#ifndef OTA_LISTEN_PORT
 #define OTA_LISTEN_PORT 80
-#define OTA_BUFF_SIZE 1024
+#endif
+
+// upload UI, gzipped at build time (see CMakeLists.txt)
+extern const uint8_t index_html_gz_start[] asm("_binary_index_html_gz_start");
+extern const uint8_t index_html_gz_end[]   asm("_binary_index_html_gz_end");
+
+// Parse 64 hex digits into 32 bytes. Returns false if malformed
+static bool parse_sha256(const char *hex, size_t len, uint8_t *digest) {
+    if (len != 64) {
+        return false;
+    }
+    for (int i = 0; i < 64; i++) {
+        char c = hex[i];
+        uint8_t nibble;
+        if (c >= '0' && c <= '9')       nibble = c - '0';
+        else if (c >= 'a' && c <= 'f')  nibble = c - 'a' + 10;
+        else if (c >= 'A' && c <= 'F')  nibble = c - 'A' + 10;
+        else return false;
+        digest[i / 2] = (i % 2) ? (digest[i / 2] | nibble) : (nibble << 4);
+    }
+    return true;
+}
+
+// Content-Encoding tokens to OTA_ENCODING_* flags
+static esp_err_t parse_content_encoding(const char *value, size_t len, uint8_t *encoding) {
+    *encoding = OTA_ENCODING_NONE;
+    size_t i = 0;
+    while (i < len) {
+        while (i < len && (value[i] == ' ' || value[i] == ',')) {
+            i++;
+        }
+        size_t start = i;
+        while (i < len && value[i] != ' ' && value[i] != ',') {
+            i++;
+        }
+        size_t n = i - start;
+        if (n == 0) {
+            continue;
+        }
+        if (n == strlen("heatshrink") && strncmp(value + start, "heatshrink", n) == 0) {
+            *encoding |= OTA_ENCODING_HEATSHRINK;
+        }
+        else if (n == strlen("x-ota-delta") && strncmp(value + start, "x-ota-delta", n) == 0) {
+            *encoding |= OTA_ENCODING_DELTA;
+        }
+        else if (!(n == strlen("identity") && strncmp(value + start, "identity", n) == 0)) {
+            LOGB_E(TAG, "unsupported Content-Encoding %.*s", n, value + start);
+            return ESP_ERR_NOT_SUPPORTED;
+        }
+    }
+    return ESP_OK;
+}
 
-// needs to be accessible in sse_task if a client closes
-static fd_set master_set;
-// set volatile as a client could be removed at any time and the sse_task needs to make sure it has an updated copy
-#define MAX_SSE_CLIENTS 3
-volatile int sse_sockets[MAX_SSE_CLIENTS];
+// 'bytes <first>-<last>/<length>'. Returns false if malformed or out of order
+static bool parse_content_range(const char *value, size_t len, uint32_t *first, uint32_t *last, uint32_t *length) {
+    char range[40];
+    if (len >= sizeof(range)) {
+        return false;
+    }
+    memcpy(range, value, len);
+    range[len] = '\0';
 
-#define LOG_BUF_MAX_LINE_SIZE 120
-char log_buf[LOG_BUF_MAX_LINE_SIZE];
-static QueueHandle_t q_sse_message_queue;
-static putchar_like_t old_function = NULL;
+    unsigned int a, b, n;
+    if (sscanf(range, "bytes %u-%u/%u", &a, &b, &n) != 3 || a > b || b >= n) {
+        return false;
+    }
+    *first = a;
+    *last = b;
+    *length = n;
+    return true;
+}
 
-int sse_logging_putchar(int chr) {
-    if(chr == '\n'){
-        // send without the '\n'
-        xQueueSendToBack(q_sse_message_queue, log_buf, 0);
-        // 'clear' string
-        log_buf[0] = '\0';    
-    } else {
-        size_t len = strlen(log_buf);
-        if (len < LOG_BUF_MAX_LINE_SIZE - 1) {
-            log_buf[len] = chr;
-            log_buf[len+1] = '\0';
+// Unsigned decimal query or header value. Returns false if empty, not a number or over 'max'
+static bool parse_slice_uint(const char *buf, http_slice_t value, uint32_t max, uint32_t *out) {
+    uint64_t n = 0;
+    if (value.len == 0 || value.len > 10) {
+        return false;
+    }
+    for (int i = 0; i < value.len; i++) {
+        char c = buf[value.off + i];
+        if (c < '0' || c > '9') {
+            return false;
         }
+        n = n * 10 + (c - '0');
     }
-    // still send to console
-	return old_function( chr );
+    *out = n;
+    return n <= max;
 }
 
-void send_sse_message (char* message, char* event) {
-    const char *sse_data = "data: ";
-    const char *sse_event = "\nevent: ";
-    const char *sse_end_message = "\n\n";
+// 'tag,tag,..' into sse_tag_hash()es
+static bool parse_tag_list(const char *buf, http_slice_t value, uint32_t *hashes, uint8_t *count) {
+    uint16_t pos = value.off;
+    uint16_t end = value.off + value.len;
+    *count = 0;
+    while (pos < end) {
+        uint16_t next = pos;
+        while (next < end && buf[next] != ',') {
+            next++;
+        }
+        if (next > pos) {
+            if (*count == SSE_FILTER_TAGS) {
+                return false;
+            }
+            hashes[(*count)++] = sse_tag_hash(buf + pos, next - pos);
+        }
+        pos = next + 1;
+    }
+    return true;
+}
 
-    size_t event_len = 0;
-    if (event != NULL) {
-        event_len = strlen(sse_event) + strlen(event);
+// GET /event?level=W&tags=main,ota_writer&exclude=server&rate=10&batch=4
+//  level is the most verbose sent: E, W, I, D, V, or N for no log lines at all
+static bool parse_event_filter(const char *buf, http_slice_t query, sse_filter_t *filter) {
+    static const char levels[] = "NEWIDV";
+    const sse_filter_t all = SSE_FILTER_ALL;
+    http_slice_t value;
+    uint32_t n;
+
+    *filter = all;
+    if (http_query_param(buf, query, "level", &value)) {
+        const char *level = (value.len == 1 && buf[value.off] != '\0') ? strchr(levels, buf[value.off]) : NULL;
+        if (level == NULL) {
+            return false;
+        }
+        filter->level = level - levels;
+    }
+    if (http_query_param(buf, query, "tags", &value) && 
+            !parse_tag_list(buf, value, filter->include, &filter->include_count)) {
+        return false;
     }
-    char send_buf[strlen(sse_data) + strlen(message) + event_len + strlen(sse_end_message)];
-    memset(send_buf, 0 , sizeof(send_buf));
-    strcpy(send_buf, sse_data);
-    strcat(send_buf, message);
+    if (http_query_param(buf, query, "exclude", &value) && 
+            !parse_tag_list(buf, value, filter->exclude, &filter->exclude_count)) {
+        return false;
+    }
+    if (http_query_param(buf, query, "rate", &value)) {
+        if (!parse_slice_uint(buf, value, UINT16_MAX, &n)) {
+            return false;
+        }
+        filter->rate = n;
+    }
+    if (http_query_param(buf, query, "batch", &value)) {
+        if (!parse_slice_uint(buf, value, SSE_BATCH_MAX, &n) || n == 0) {
+            return false;
+        }
+        filter->batch = n;
+    }
+    return true;
+}
 
-    if (event != NULL) {
-        strcat(send_buf, sse_event);
-        strcat(send_buf, event);
+// Level (1 error .. 5 verbose) and tag of a captured ESP_LOGx line, 
+//  '[colour]L (timestamp) tag: text'. 0 and an empty tag if it isn't one
+static uint8_t parse_log_line(const char *text, const char **tag, size_t *tag_len) {
+    static const char levels[] = "EWIDV";
+    *tag = text;
+    *tag_len = 0;
+    if (text[0] == '\033') {
+        const char *m = strchr(text, 'm');
+        if (m == NULL) {
+            return 0;
+        }
+        text = m + 1;
     }
-    strcat(send_buf, sse_end_message);
-    
-    size_t message_len = strlen(send_buf);
+    const char *level = (text[0] != '\0') ? strchr(levels, text[0]) : NULL;
+    if (level == NULL || text[1] != ' ' || text[2] != '(') {
+        return 0;
+    }
+    const char *start = strstr(text, ") ");
+    const char *end = (start != NULL) ? strchr(start + 2, ':') : NULL;
+    if (end == NULL) {
+        return 0;
+    }
+    *tag = start + 2;
+    *tag_len = end - *tag;
+    return level - levels + 1;
+}
 
-    int return_code;
-    for (int i = 0; i < MAX_SSE_CLIENTS; i++) {
-        if (sse_sockets[i] != 0) {
+// HTTP response carrying the state of a resumable upload. Returns its length
+static int format_session_response(char *buffer, const char *status, const ota_session_t *session) {
+    char body[80];
+    int body_len = sprintf(body, "{\"session\":\"%08x\",\"offset\":%d,\"length\":%d}", 
+        session->id, session->committed, session->length);
+    return sprintf(buffer, "HTTP/1.1 %s\r\n"
+                           "X-OTA-Session: %08x\r\n"
+                           "Content-Type: application/json\r\n"
+                           "Content-Length: %d\r\n\r\n%s", status, session->id, body_len, body);
+}
 
-            return_code = send(sse_sockets[i], send_buf, message_len, 0);
+// ?part=<label> of POST /send and GET /ws. The main app slot if there is none
+static esp_err_t find_upload_target(const char *buf, http_slice_t query, ota_target_t *target) {
+    http_slice_t part;
+    if (!http_query_param(buf, query, "part", &part)) {
+        return ota_target_find(NULL, 0, target);
+    }
+    return ota_target_find(buf + part.off, part.len, target);
+}
 
-            if (return_code < 0) {
-                close(sse_sockets[i]);
-                FD_CLR(sse_sockets[i], &master_set);
-                sse_sockets[i] = 0;
-            }
+// custom.csv's 'homekit' (type 0x40) holds pairing data the app reads on demand, so it
+//  is streamed in as is, with nothing to check and no restart
+static const ota_target_rule_t homekit_target = { 
+    (esp_partition_type_t)0x40, ESP_PARTITION_SUBTYPE_ANY, NULL, 0 
+};
+
+// the upload worker. handle_request() queues a POST /send connection to it and forgets it
+static QueueHandle_t upload_queue;
+static volatile int upload_fd = -1;         // socket of the upload in progress, -1 if none
+static volatile bool upload_cancelled;      // POST /cancel. checked by the upload loop
+
+// log lines for a GET /ws upload, handed over by the sse task. only the upload task 
+//  sends on that socket, so nothing interleaves with its frames
+static QueueHandle_t ws_log_queue;          // of log_record_t. NULL if CONFIG_WS_LOG_QUEUE_DEPTH is 0
+static sse_filter_t ws_log_filter;          // from the /ws query
+static volatile bool ws_log_active;
+
+// ETag of the embedded page. it only changes with the firmware, so it is worked out once
+static const char *index_etag(void) {
+    static char etag[11];
+    if (etag[0] == '\0') {
+        uint32_t hash = 2166136261;
+        for (const uint8_t *p = index_html_gz_start; p < index_html_gz_end; p++) {
+            hash = (hash ^ *p) * 16777619;
         }
-    } //for
+        sprintf(etag, "\"%08x\"", hash);
+    }
+    return etag;
 }
 
-esp_err_t read_from_client (int client_fd) {
-    char buffer[OTA_BUFF_SIZE] = {0};
+// the page is already gzipped, and every browser accepts that, so it is sent as is 
+//  straight from flash. no-cache makes a repeat visit one If-None-Match round trip
+static void serve_index(server_conn_t *conn) {
+    const http_parser_t *req = &conn->parser;
+    const char *etag = index_etag();
+    char header[200];
     int len;
 
-    len = read(client_fd, buffer, OTA_BUFF_SIZE);
-    if (len < 0) {
-        // Read error
-        ESP_LOGE(TAG, "client read err: %d", errno);
-        return -1; 
+    const http_header_t *if_none_match = http_parser_find_header(req, conn->buffer, "If-None-Match");
+    if (if_none_match != NULL && http_slice_equals(conn->buffer, if_none_match->value, etag)) {
+        len = sprintf(header, "HTTP/1.1 304 Not Modified\r\n"
+                              "Cache-Control: no-cache\r\n"
+                              "ETag: %s\r\n\r\n", etag);
+        send(conn->fd, header, len, 0);
+        return;
     }
-    else if (len == 0) {
-        // Normal connection close from client
-        ESP_LOGI(TAG, "client %d close connection", client_fd); 
-        return -1;
+
+    size_t body_len = index_html_gz_end - index_html_gz_start;
+    len = sprintf(header, "HTTP/1.1 200 OK\r\n"
+                          "Content-Type: text/html\r\n"
+                          "Content-Encoding: gzip\r\n"
+                          "Cache-Control: no-cache\r\n"
+                          "ETag: %s\r\n"
+                          "Content-Length: %d\r\n\r\n", etag, (int)body_len);
+    send(conn->fd, header, len, 0);
+    server_conn_send_static(conn, index_html_gz_start, body_len);
+}
+
+// Writer task and buffers for an upload into 'target' from 'offset'. 'size' is that
+//  of the whole image, for erasing ahead
+static ota_pipeline_t upload_pipeline_start(const ota_target_t *target, uint32_t offset, 
+        uint32_t size, uint8_t encoding) {
+    ota_pipeline_config_t pipeline_config = {
+        .partition = target->partition,
+        .offset = offset,
+        // a decoded image's size isn't known up front
+        .size = (encoding != OTA_ENCODING_NONE) ? 0 : size,
+        .encoding = encoding,
+        .delta_base = esp_ota_get_running_partition(),
+        // a continuation doesn't start with the image header
+        .validate = (offset == 0) ? target->rule->validate : NULL,
+        .validate_ctx = (void *)target->partition,
+    };
+    return ota_pipeline_start(&pipeline_config);
+}
+
+// we use int, so no decimals. only send message on 1% change. progress from 10->95%.
+//  Returns true if it changed
+static bool upload_progress(uint8_t *progress, uint32_t received, uint32_t length) {
+    char sse_msg[60];
+    if (length == 0 || *progress == (received*85/length)+10) {
+        return false;
+    }
+    *progress = (received*85/length)+10;
+    sprintf(sse_msg, "{\"progress\":\"%d\", \"status\":\"Downloading..\"}", *progress);
+    sse_broadcast(sse_msg, "update", true);
+    return true;
+}
+
+// Flash counters and where the time went, to the log and the 'sectors' event
+static void upload_report(const ota_writer_stats_t *stats, int64_t upload_start, 
+        uint32_t network_us, uint32_t flash_wait_us) {
+    char sse_msg[50];
+    LOGB_I(TAG, "Flash writes: %d, %d to %d bytes each. %d sectors unchanged (%d ms comparing)", 
+        stats->writes, stats->min_write, stats->max_write, stats->skipped, stats->compare_time_us / 1000);
+    // erase and program overlap with the network, so these add up to more than the total
+    LOGB_I(TAG, "Upload took %d ms. network %d ms, waiting on flash %d ms, "
+        "erase %d ms (%d sectors), program %d ms", 
+        (uint32_t)((esp_timer_get_time() - upload_start) / 1000), network_us / 1000, 
+        flash_wait_us / 1000, stats->erase_time_us / 1000, stats->erases, 
+        stats->write_time_us / 1000);
+
+    sprintf(sse_msg, "{\"written\":%d,\"skipped\":%d}", stats->writes, stats->skipped);
+    sse_broadcast(sse_msg, "sectors", false);
+}
+
+// After a finished upload, installed or not. Tells the subscribers, and if the running
+//  app depends on what was written, restarts into whatever the boot partition now is
+static void upload_done(const ota_target_t *target, esp_err_t err) {
+    char sse_msg[100];
+    if (target->partition == NULL || !(target->rule->flags & OTA_TARGET_RESTART)) {
+        // no such target, or provisioning data nothing has open; that is in use from 
+        //  the next read
+        sprintf(sse_msg, "{\"progress\":\"100\", \"status\":\"%s '%s'\"}", 
+            (err == ESP_OK) ? "Written to" : "Failed writing", 
+            (target->partition != NULL) ? target->partition->label : "");
+        sse_broadcast(sse_msg, "update", true);
+        led_status_set(led_status, &client_connected);
+        return;
     }
+
+    const esp_partition_t *boot_partition = esp_ota_get_boot_partition();
+    LOGB_W(TAG, "Next boot partition '%s' at offset 0x%x",
+        boot_partition->label, boot_partition->address);
+
+    sprintf(sse_msg, "{\"progress\":\"100\", \"status\":\"%s. Restarting to '%s'...\"}", 
+        (err == ESP_OK) ? "Firmware Installed" : "Failed", boot_partition->label);
+    sse_broadcast(sse_msg, "update", true);
+
+    led_status_set(led_status, &client_connected);
+
+    vTaskDelay(2000/portTICK_PERIOD_MS);
+    esp_wifi_stop();
+    esp_restart();
+}
+
+// POST /send, on the upload task. 'conn' is a copy of the server's; its socket and 
+//  buffer belong to this task now
+static void handle_upload(server_conn_t *conn) {
+    int client_fd = conn->fd;
+    char *buffer = conn->buffer;
+    const http_parser_t *req = &conn->parser;
+    int len = conn->len;
+
+    char *body_start_p = buffer + req->body_offset;
+    int body_part_len = len - req->body_offset;
+
+    led_status_set(led_status, &downloading);
+
+    ota_pipeline_t pipeline = NULL;
+    esp_err_t err = ESP_OK;
+
+    char sse_msg[100];
+
+    // the main app slot, or the partition named by ?part=
+    ota_target_t target;
+    err = find_upload_target(buffer, req->query, &target);
+    const esp_partition_t *partition = target.partition;
+
+    uint32_t content_length = 0;                
+    if (!req->has_content_length) {
+        LOGB_E(TAG, "Content-Length not found.\r\n%.*s", req->body_offset, buffer); 
+        err = ESP_ERR_INVALID_ARG;
+    } 
     else {
-        // Data read   
-        const char *method_start_p = buffer;
-        const char *method_end_p = strstr(method_start_p, " ");
-        const char *uri_start_p = method_end_p + 1;
-        const char *uri_end_p = strstr(uri_start_p, " ");
-    
-        const char *header_end = "\r\n\r\n";
-        char *body_start_p = strstr(buffer, header_end) + strlen(header_end);
-        int body_part_len = len - (body_start_p - buffer);
-
-        ESP_LOGI(TAG, "read %d. body len %d. method requested %.*s. uri requested %.*s", 
-            len, body_part_len, (method_end_p - method_start_p), method_start_p, (uri_end_p - uri_start_p), uri_start_p); 
-
-        ESP_LOGD(TAG, "\r\n%.*s", (body_start_p - buffer), buffer); 
-
-        if (  strncmp(method_start_p, "GET", strlen("GET")) == 0 && 
-              strncmp(uri_start_p, "/event", strlen("/event")) == 0    ) {
-            // disable sending to sse_socket until a proper HTTP 200 OK response has been sent back to client
-            old_function = esp_log_set_putchar(old_function);
-
-            int i;
-            for (i = 0; i < MAX_SSE_CLIENTS; i++) {
-                if (sse_sockets[i] == 0) {
-                    sse_sockets[i] = client_fd;
-                    ESP_LOGI(TAG, "sse_socket: %d slot %d ", sse_sockets[i], i);
-                    break;
+        content_length = req->content_length;
+        LOGB_I(TAG, "Detected content length: %d", content_length);
+        if (partition != NULL && content_length > partition->size) {
+            LOGB_E(TAG, "Content-Length of %d larger than partition size of %d", content_length, partition->size); 
+            err = ESP_ERR_INVALID_SIZE;
+        }
+    }
+ 
+    // optional digest of the whole body, checked against the one computed while streaming
+    uint8_t expected_sha256[32];
+    bool has_expected_sha256 = false;
+    const http_header_t *sha_header = http_parser_find_header(req, buffer, "X-Image-SHA256");
+    if (sha_header != NULL) {
+        has_expected_sha256 = parse_sha256(buffer + sha_header->value.off, sha_header->value.len, expected_sha256);
+        if (!has_expected_sha256) {
+            LOGB_E(TAG, "X-Image-SHA256 must be 64 hex digits");
+            err = ESP_ERR_INVALID_ARG;
+        }
+    }
+
+    // compressed and/or delta payloads are decoded on the fly in the writer task
+    uint8_t encoding = OTA_ENCODING_NONE;
+    const http_header_t *encoding_header = http_parser_find_header(req, buffer, "Content-Encoding");
+    if (encoding_header != NULL) {
+        esp_err_t encoding_err = parse_content_encoding(buffer + encoding_header->value.off, 
+            encoding_header->value.len, &encoding);
+        if (err == ESP_OK) {
+            err = encoding_err;
+        }
+        // a delta is against the running app
+        if (err == ESP_OK && (encoding & OTA_ENCODING_DELTA) && !(target.rule->flags & OTA_TARGET_DELTA)) {
+            LOGB_E(TAG, "partition '%s' can't take a delta", partition->label);
+            err = ESP_ERR_NOT_SUPPORTED;
+        }
+    }
+
+    // a Content-Range makes this one piece of a resumable upload. it is written at its 
+    //  offset in the partition and the high-water mark is kept in NVS, so a dropped 
+    //  connection (or a restart) only costs the sector that was in flight
+    ota_session_t session = { 0 };
+    bool resumable = false;
+    uint32_t range_start = 0;
+    const http_header_t *range_header = http_parser_find_header(req, buffer, "Content-Range");
+    if (range_header != NULL) {
+        uint32_t range_end = 0, image_length = 0;
+        resumable = true;
+        if (!parse_content_range(buffer + range_header->value.off, range_header->value.len, 
+                &range_start, &range_end, &image_length) || 
+            range_end + 1 - range_start != content_length) {
+            LOGB_E(TAG, "Content-Range %.*s does not match the body", 
+                range_header->value.len, buffer + range_header->value.off);
+            err = ESP_ERR_INVALID_ARG;
+        }
+        else if (encoding != OTA_ENCODING_NONE) {
+            // the decoder can't pick up part way through a payload
+            LOGB_E(TAG, "Content-Range can't be combined with Content-Encoding");
+            err = ESP_ERR_NOT_SUPPORTED;
+        }
+        else if (err == ESP_OK && !(target.rule->flags & OTA_TARGET_BOOT)) {
+            // the session is kept in NVS, which may be the very target. data partitions
+            //  are small enough to send whole
+            LOGB_E(TAG, "Content-Range is only for app images");
+            err = ESP_ERR_NOT_SUPPORTED;
+        }
+        else if (partition != NULL && image_length > partition->size) {
+            LOGB_E(TAG, "image of %d larger than partition size of %d", image_length, partition->size); 
+            err = ESP_ERR_INVALID_SIZE;
+        }
+
+        if (err == ESP_OK) {
+            const http_header_t *id_header = http_parser_find_header(req, buffer, "X-OTA-Session");
+            char id[9] = "";
+            bool found = (ota_session_load(&session) == ESP_OK);
+            if (found) {
+                sprintf(id, "%08x", session.id);
+            } else {
+                memset(&session, 0, sizeof(session));
+            }
+            bool matches = found && id_header != NULL && 
+                http_slice_equals(buffer, id_header->value, id) && session.length == image_length &&
+                session.address == partition->address;
+
+            if (range_start == 0) {
+                // the image from the start: a new session, whichever id the client 
+                //  sends. only a retry of a session with nothing written yet keeps its id
+                if (!matches || session.committed != 0) {
+                    err = ota_session_begin(&session, partition, image_length, 
+                        has_expected_sha256 ? expected_sha256 : NULL);
+                }
+                else if (!has_expected_sha256 && session.has_sha256) {
+                    memcpy(expected_sha256, session.sha256, sizeof(expected_sha256));
+                    has_expected_sha256 = true;
                 }
             }
-            if (i == MAX_SSE_CLIENTS) {
-                len = sprintf(buffer, "HTTP/1.1 503 Server Busy\r\n\r\n");
-                send(client_fd, buffer, len, 0);
-                return -1; // close connection
+            else if (!matches || range_start != session.committed) {
+                // the response tells the client where to carry on from
+                LOGB_E(TAG, "range starts at %d, session %s has %d bytes", range_start, id, session.committed);
+                err = ESP_ERR_INVALID_STATE;
             }
+            else if (!has_expected_sha256 && session.has_sha256) {
+                // continuations are checked against the digest given with the first range
+                memcpy(expected_sha256, session.sha256, sizeof(expected_sha256));
+                has_expected_sha256 = true;
+            }
+        }
+    }
 
-            len = sprintf(buffer, "HTTP/1.1 200 OK\r\n"
-                                  "Connection: Keep-Alive\r\n"
-                                  "Content-Type: text/event-stream\r\n"
-                                  "Cache-Control: no-cache\r\n\r\n");
-            send(client_fd, buffer, len, 0);
-
-            sprintf(buffer, "{\"progress\":\"5\", \"status\":\"Connected..\"}");
-            send_sse_message(buffer, "update");
-            
-            // enable sse logging again
-            old_function = esp_log_set_putchar(old_function);   
+#if CONFIG_OTA_REQUIRE_SHA256
+    if (sha_header == NULL && range_start == 0) {
+        LOGB_E(TAG, "X-Image-SHA256 header required");
+        err = ESP_ERR_INVALID_ARG;
+    }
+#endif
+
+    sprintf(sse_msg, "{\"progress\":\"10\", \"status\":\"Sending File Size %dKB\"}", 
+        (resumable ? session.length : content_length)/1024);
+    sse_broadcast(sse_msg, "update", true);
+
+    len = body_part_len;
+    char *buffer_p = body_start_p;
+    // pipeline buffer buffer_p points into, if any. the first body fragment is in 'buffer'
+    uint8_t *chunk = NULL;
+    size_t chunk_size = 0;
+
+    // progress is over the whole image, of which this request may only be a part
+    uint32_t image_length = (resumable && session.length != 0) ? session.length : content_length;
+    uint32_t remaining = content_length;
+    uint32_t written = 0;                   // by the pipeline, from range_start
+    uint8_t progress = 0;
+    bool is_image_header_checked = false;
+    bool more_content = true;
+    bool disconnected = false;
+
+    // where the time goes: blocked in read(), or waiting for the writer task to free a 
+    //  buffer. erase and program time is counted by the writer itself
+    int64_t upload_start = esp_timer_get_time();
+    uint32_t network_us = 0;
+    uint32_t flash_wait_us = 0;
+    metrics_upload_begin();
+
+    while (more_content) {
+        // a plain image is checked by its header, which TCP may well split. a shorter 
+        //  first fragment is kept at the front of 'buffer' and read onto until it is whole
+        if (err == ESP_OK && !is_image_header_checked && encoding == OTA_ENCODING_NONE && 
+                range_start == 0 && len < (int)sizeof(esp_image_header_t) && (uint32_t)len < remaining) {
+            memmove(buffer, buffer_p, len);
+            buffer_p = buffer;
+            int n = read(client_fd, buffer + len, SERVER_BUFF_SIZE - len);
+            if (n <= 0) {
+                LOGB_E(TAG, "Error: recv data error! err: %d", errno);
+                err = ESP_FAIL;
+                disconnected = true;
+                break;
+            }
+            len += n;
+            continue;
         }
-        else if (    strncmp(method_start_p, "POST", strlen("POST")) == 0 && 
-                     strncmp(uri_start_p, "/send", strlen("/send")) == 0          ) {
 
-            led_status_set(led_status, &downloading);
+        if (err == ESP_OK && !is_image_header_checked && 
+            (encoding != OTA_ENCODING_NONE || range_start != 0 || len >= (int)sizeof(esp_image_header_t) || 
+             (uint32_t)len == remaining)) {
+            // a plain image is checked before the first sector is erased. an encoded one
+            //  can only be checked by the writer once its start has been decoded
+            if (encoding == OTA_ENCODING_NONE && range_start == 0 && target.rule->validate != NULL) {
+                err = target.rule->validate((uint8_t *)buffer_p, len, (void *)partition);
+            }
 
-            esp_ota_handle_t ota_handle; 
-            esp_err_t err = ESP_OK;
+            if (err == ESP_OK) {
+                // no esp_ota_begin(); it would erase the whole partition before the first 
+                //  write while the client's window stalls. the writer erases only the 
+                //  sectors the image covers, one ahead of the data, leaving anything 
+                //  below a resumed session's high-water mark in place
+                if (resumable) {
+                    LOGB_I(TAG, "Writing to partition '%s' from 0x%x of session %08x",
+                        partition->label, range_start, session.id);
+                } else {
+                    LOGB_I(TAG, "Writing to partition '%s' at offset 0x%x",
+                        partition->label, partition->address);
+                }
 
-            char sse_msg[100];
+                // flash writes happen in their own task from here on, so the 
+                //  next read() overlaps with erasing and writing
+                pipeline = upload_pipeline_start(&target, range_start, image_length, encoding);
+                if (pipeline == NULL) {
+                    err = ESP_ERR_NO_MEM;
+                }
+            }
+            is_image_header_checked = true;
+        }
 
-            const esp_partition_t *main_partition;
-            main_partition = esp_partition_find_first(ESP_PARTITION_TYPE_APP, ESP_PARTITION_SUBTYPE_APP_OTA_1, NULL);
-            if (main_partition == NULL) {
-                err = ESP_ERR_OTA_SELECT_INFO_INVALID;
+        // if no previous errors, continue to write. otherwise, just read the incoming data until it completes
+        //  and send the HTTP error response back. stopping the connection early causes the client to
+        //  display an ERROR CONNECTION CLOSED response instead of a meaningful error
+        if (err == ESP_OK && pipeline != NULL) {
+            if (chunk == NULL) {
+                // the first fragment, read into 'buffer' with the request
+                _Static_assert(CONFIG_OTA_PIPELINE_BUFFER_SIZE >= SERVER_BUFF_SIZE, 
+                    "CONFIG_OTA_PIPELINE_BUFFER_SIZE too small for the first body fragment");
+                chunk = ota_pipeline_acquire(pipeline, &chunk_size);
+                memcpy(chunk, buffer_p, len);
             }
+            ota_pipeline_submit(pipeline, chunk, len);
+            err = ota_pipeline_progress(pipeline, &written);
+        }
+        else if (chunk != NULL) {
+            ota_pipeline_submit(pipeline, chunk, 0);
+        }
+        chunk = NULL;
 
-            uint32_t content_length = 0;                
-            const char *content_length_start = "Content-Length: ";
-            char *content_length_start_p = strstr(buffer, content_length_start);
-            if (content_length_start_p == NULL) {
-                ESP_LOGE(TAG, "Content-Length not found.\r\n%s", buffer); 
-                err = ESP_ERR_INVALID_ARG;
-            } 
+        remaining -= len;
+        metrics_add_received(len);
+
+        upload_progress(&progress, range_start + content_length - remaining, image_length);
+
+        // whole sectors only, until the pipeline writes the tail. 'written' was read 
+        //  with 'err', so it never counts a sector that failed
+        if (resumable && pipeline != NULL && err == ESP_OK && range_start + written > session.committed) {
+            ota_session_commit(&session, range_start + written);
+        }
+  
+        if (remaining != 0) {
+            if (err == ESP_OK && pipeline != NULL) {
+                // read straight into a free pipeline buffer; blocks only when
+                //  all buffers are still queued for flash
+                int64_t start = esp_timer_get_time();
+                chunk = ota_pipeline_acquire(pipeline, &chunk_size);
+                int64_t acquired = esp_timer_get_time();
+                buffer_p = (char *)chunk;
+                len = read(client_fd, chunk, chunk_size);
+                flash_wait_us += (uint32_t)(acquired - start);
+                network_us += (uint32_t)(esp_timer_get_time() - acquired);
+            }
             else {
-                sscanf(content_length_start_p + strlen(content_length_start), "%d", &content_length);
-                ESP_LOGI(TAG, "Detected content length: %d", content_length);
-                if (main_partition != NULL && content_length > main_partition->size) {
-                    ESP_LOGE(TAG, "Content-Length of %d larger than partition size of %d", content_length, main_partition->size); 
-                    err = ESP_ERR_INVALID_SIZE;
+                len = read(client_fd, buffer, SERVER_BUFF_SIZE);
+                buffer_p = buffer;
+            }
+            if (len <= 0) {
+                LOGB_E(TAG, "Error: recv data error! err: %d", errno);
+                if (chunk != NULL) {
+                    ota_pipeline_submit(pipeline, chunk, 0);
                 }
+                err = ESP_FAIL;
+                disconnected = true;
+                break;
             }
- 
-            sprintf(sse_msg, "{\"progress\":\"10\", \"status\":\"Sending File Size %dKB\"}", content_length/1024);
-            send_sse_message(sse_msg, "update");
-
-            len = body_part_len;
-            char *buffer_p = body_start_p;
-
-            uint32_t remaining = content_length;
-            uint8_t progress = 0;
-            bool is_image_header_checked = false;
-            bool more_content = true;
-
-            while (more_content) {
-                // if the first packet has a body length between 0 and 8 bytes (unlikely), 
-                //  the whole OTA process will fail. try again...
-                if (err == ESP_OK && len > sizeof(esp_image_header_t) && !is_image_header_checked) {
-                    esp_image_header_t check_header; 
-                    memcpy(&check_header, buffer_p, sizeof(esp_image_header_t));
-                    int32_t entry = check_header.entry_addr - 0x40200010;
-
-                    if (check_header.magic != 0xE9) {
-                        ESP_LOGE(TAG, "OTA image has invalid magic byte (expected 0xE9, saw 0x%x)", check_header.magic);
-                        err = ESP_ERR_OTA_VALIDATE_FAILED;
-                    }
-                    else if ( (entry < main_partition->address)  ||
-                        (entry > main_partition->address + main_partition->size) ) {
-                        ESP_LOGE(TAG, "OTA binary start entry 0x%x, partition start from 0x%x to 0x%x", entry, 
-                            main_partition->address, main_partition->address + main_partition->size);
-                        err = ESP_ERR_OTA_VALIDATE_FAILED;
-                    }
-
-                    if (err == ESP_OK) {
-                        // esp_ota_begin erases the partition, so only call it if the incoming file 
-                        //  looks OK.
-                        err = esp_ota_begin(main_partition, OTA_SIZE_UNKNOWN, &ota_handle);
-                        if (err != ESP_OK) {
-                            ESP_LOGE(TAG, "Error esp_ota_begin()"); 
-                        } 
-                        else {
-                            ESP_LOGI(TAG, "Writing to partition '%s' at offset 0x%x",
-                                main_partition->label, main_partition->address);
-                        }
-                    }
-                    is_image_header_checked = true;
+            if (upload_cancelled) {
+                LOGB_W(TAG, "Upload cancelled");
+                if (chunk != NULL) {
+                    ota_pipeline_submit(pipeline, chunk, 0);
                 }
+                err = ESP_FAIL;
+                disconnected = true;
+                break;
+            }
+        }
+        else {
+            more_content = false;
+        }
+    } // end while(). no more content to read
 
-                // if no previous errors, continue to write. otherwise, just read the incoming data until it completes
-                //  and send the HTTP error response back. stopping the connection early causes the client to
-                //  display an ERROR CONNECTION CLOSED response instead of a meaningful error
-                if (err == ESP_OK && is_image_header_checked) {
-                    err = esp_ota_write(ota_handle, buffer_p, len);
-                }
+    LOGB_I(TAG, "Binary transferred finished: %d bytes", content_length - remaining);
+    metrics_upload_end();
 
-                // we use int, so no decimals. only send message on 1% change. progress from 10->95%
-                
-                if (content_length != 0 && progress != ((content_length-remaining)*85/content_length)+10) {
-                    progress = ((content_length-remaining)*85/content_length)+10;    
-                    sprintf(sse_msg, "{\"progress\":\"%d\", \"status\":\"Downloading..\"}", progress);
-                    send_sse_message(sse_msg, "update");
-                }
+    // a plain upload is always the whole image
+    bool complete = !resumable;
+    ota_writer_stats_t stats = { 0 };
+    if (pipeline != NULL) {
+        esp_err_t write_err = ota_pipeline_finish(pipeline, &stats);
+        if (err == ESP_OK) {
+            err = write_err;
+        }
+        upload_report(&stats, upload_start, network_us, flash_wait_us);
+
+        if (resumable) {
+            // a partial tail sector is written, but it is erased and written again when 
+            //  the client resumes, so it doesn't count. after a failure nothing new does
+            uint32_t written = range_start + stats.bytes;
+            if (err == ESP_OK && written == session.length) {
+                complete = true;
+            }
+            else {
+                written -= written % OTA_WRITER_SECTOR_SIZE;
+            }
+            if (written > session.committed && write_err == ESP_OK && (err == ESP_OK || disconnected)) {
+                ota_session_commit(&session, written);
+            }
+            if (complete) {
+                // earlier ranges may have been written before a restart; hash them from flash
+                err = ota_session_digest(partition, session.length, stats.sha256);
+            }
+        }
 
-                remaining -= len;
-          
-                if (remaining != 0) {
-                    len = read(client_fd, buffer, OTA_BUFF_SIZE);
-                    buffer_p = buffer;
-                    if (len < 0) {
-                        ESP_LOGE(TAG, "Error: recv data error! err: %d", errno);
-                        break;
-                    }
-                }
-                else {
-                    more_content = false;
-                }
-            } // end while(). no more content to read
+        if (complete) {
+            char hex[65];
+            for (int i = 0; i < 32; i++) {
+                sprintf(hex + i * 2, "%02x", stats.sha256[i]);
+            }
+            LOGB_I(TAG, "Image SHA-256 %s", hex);
+
+            if (err == ESP_OK && has_expected_sha256 && memcmp(stats.sha256, expected_sha256, 32) != 0) {
+                LOGB_E(TAG, "Image SHA-256 does not match X-Image-SHA256");
+                err = ESP_ERR_OTA_VALIDATE_FAILED;
+            }
+        }
+    }
+
+    // never point the bootloader at an image that failed any check
+    if (err == ESP_OK && complete) {
+        err = ota_target_install(&target, resumable ? session.length : stats.bytes);
+    }
+    if (resumable && complete) {
+        // installed, or the assembled image is bad and has to be sent again from the start
+        ota_session_clear();
+    }
+
+    // nothing has changed on the boot partition, so there is no reason to restart. 
+    //  a resumable upload keeps its session for the client to carry on with
+    if (disconnected || (resumable && !complete)) {
+        led_status_set(led_status, &client_connected);
+        if (resumable && session.id != 0) {
+            sprintf(sse_msg, "{\"progress\":\"%d\", \"status\":\"Received %dKB of %dKB\"}", 
+                progress, session.committed/1024, session.length/1024);
+        } else {
+            sprintf(sse_msg, "{\"progress\":\"%d\", \"status\":\"%s\"}", progress, 
+                upload_cancelled ? "Cancelled" : "Connection lost");
+        }
+        sse_broadcast(sse_msg, "update", true);
+        if (disconnected) {
+            return;
+        }
+        len = format_session_response(buffer, (err == ESP_OK) ? "200 OK" : 
+            (err == ESP_ERR_INVALID_STATE) ? "416 Range Not Satisfiable" : "400 Bad Update", &session);
+        send(client_fd, buffer, len, 0);
+        return;
+    }
+
+    // sectors written and left unchanged by this request
+    char body[40];
+    int body_len = sprintf(body, "{\"written\":%d,\"skipped\":%d}", stats.writes, stats.skipped);
+
+    len = sprintf(buffer, "HTTP/1.1 %s\r\nContent-Type: application/json\r\n"
+        "Content-Length: %d\r\n\r\n%s", (err == ESP_OK) ? "200 OK" : "400 Bad Update", body_len, body);
+    send(client_fd, buffer, len, 0);
+
+    upload_done(&target, err);
+}
+
+// the lx106 is little endian, like the messages in ws.h, so fields are copied as they are
+static bool ws_send_ack(int fd, uint32_t received, uint32_t limit) {
+    uint8_t msg[1 + 4 + 4] = { WS_MSG_ACK };
+    memcpy(msg + 1, &received, 4);
+    memcpy(msg + 5, &limit, 4);
+    return ws_send(fd, WS_OP_BINARY, msg, sizeof(msg));
+}
+
+static bool ws_send_progress(int fd, uint8_t progress, uint32_t written) {
+    uint8_t msg[1 + 1 + 4] = { WS_MSG_PROGRESS, progress };
+    memcpy(msg + 2, &written, 4);
+    return ws_send(fd, WS_OP_BINARY, msg, sizeof(msg));
+}
+
+// Send what the sse task has queued for this client. Returns false on a socket error
+static bool ws_send_logs(int fd) {
+    log_record_t record;
+    uint8_t msg[1 + 1 + 4 + LOG_CAPTURE_LINE_MAX];
+
+    while (ws_log_queue != NULL && xQueueReceive(ws_log_queue, &record, 0) == pdTRUE) {
+        size_t len = 0;
+        if (record.binary) {
+            msg[len++] = WS_MSG_LOGB;
+        } else {
+            const char *tag;
+            size_t tag_len;
+            msg[len++] = WS_MSG_LOG;
+            msg[len++] = parse_log_line(record.text, &tag, &tag_len);
+        }
+        memcpy(msg + len, &record.timestamp, 4);
+        len += 4;
+        memcpy(msg + len, record.text, record.len);
+        len += record.len;
+        if (!ws_send(fd, WS_OP_BINARY, msg, len)) {
+            return false;
+        }
+    }
+    return true;
+}
 
-            ESP_LOGI(TAG, "Binary transferred finished: %d bytes", content_length);
+static bool ws_readable(int fd, uint32_t ms) {
+    fd_set read_set;
+    FD_ZERO(&read_set);
+    FD_SET(fd, &read_set);
+    struct timeval tv = { .tv_sec = ms / 1000, .tv_usec = (ms % 1000) * 1000 };
+    return select(fd + 1, &read_set, NULL, NULL, &tv) > 0;
+}
 
-            if (ota_handle) {
-                err = esp_ota_end(ota_handle);
-            } 
+// GET /ws, on the upload task once the 101 has gone out. Runs the upload protocol 
+//  described in ws.h. Unlike POST /send, a failure is reported (RESULT) as soon as it 
+//  happens rather than after the client has sent the rest of the image
+static void handle_ws_upload(server_conn_t *conn) {
+    int fd = conn->fd;
+    uint8_t msg[1 + 4 + 1 + 32];            // BEGIN, the longest message read whole
+    ws_frame_t frame;
+    esp_err_t err = ESP_OK;
+    char sse_msg[100];
+
+    // ?part=, as for POST /send. a bad one fails the upload with the first RESULT
+    ota_target_t target;
+    err = find_upload_target(conn->buffer, conn->parser.query, &target);
+    const esp_partition_t *partition = target.partition;
+
+    ota_pipeline_t pipeline = NULL;
+    uint32_t length = 0;                    // of the payload, as given by BEGIN
+    uint32_t received = 0;
+    uint32_t acked = 0;                     // 'received' as of the last ACK
+    uint8_t expected_sha256[32];
+    bool has_expected_sha256 = false;
+    uint8_t progress = 0;
+    bool disconnected = false;
+    bool closed = false;                    // the client sent a close frame
+    bool cancelled = false;
+
+    int64_t upload_start = 0;
+    uint32_t network_us = 0;
+    uint32_t flash_wait_us = 0;
+    int64_t last_frame = esp_timer_get_time();
+
+    // ACK and PROGRESS are small writes straight after one another; without this the 
+    //  second waits for the client's delayed ACK of the first. set whatever the upload
+    //  role says
+    int nodelay = 1;
+    setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &nodelay, sizeof(nodelay));
+
+    if (ws_log_queue != NULL) {
+        xQueueReset(ws_log_queue);          // left over from the last client
+    }
+    ws_log_active = true;
 
-            esp_ota_set_boot_partition(main_partition);
-            const esp_partition_t *boot_partition = esp_ota_get_boot_partition();
-            ESP_LOGW(TAG, "Next boot partition '%s' at offset 0x%x",
-                boot_partition->label, boot_partition->address);
+    while (err == ESP_OK && !(pipeline != NULL && received == length)) {
+        // log lines go out between messages, and while the client is quiet
+        if (!ws_send_logs(fd)) {
+            disconnected = true;
+            break;
+        }
+        if (upload_cancelled) {
+            cancelled = true;
+            break;
+        }
+        if (!ws_readable(fd, 100)) {
+            if (esp_timer_get_time() - last_frame > CONFIG_SERVER_IDLE_TIMEOUT_MS * 1000LL) {
+                LOGB_E(TAG, "ws client sent nothing for %d ms", CONFIG_SERVER_IDLE_TIMEOUT_MS);
+                disconnected = true;
+                break;
+            }
+            continue;
+        }
+        if (!ws_recv_header(fd, &frame)) {
+            disconnected = true;
+            break;
+        }
+        last_frame = esp_timer_get_time();
+
+        if (frame.opcode == WS_OP_PING) {
+            // control frames carry at most 125 bytes
+            uint8_t payload[125];
+            int n = ws_recv_message(fd, &frame, payload, sizeof(payload));
+            if (n < 0 || !ws_send(fd, WS_OP_PONG, payload, n)) {
+                disconnected = true;
+                break;
+            }
+            continue;
+        }
+        if (frame.opcode == WS_OP_PONG) {
+            if (!ws_skip(fd, &frame)) {
+                disconnected = true;
+                break;
+            }
+            continue;
+        }
+        if (frame.opcode == WS_OP_CLOSE) {
+            closed = ws_skip(fd, &frame);
+            disconnected = true;
+            break;
+        }
+        if (frame.opcode != WS_OP_BINARY || !frame.fin || ws_recv(fd, &frame, msg, 1) != 1) {
+            LOGB_E(TAG, "ws messages must be single binary frames");
+            err = ESP_ERR_INVALID_ARG;
+            break;
+        }
 
+        if (msg[0] == WS_MSG_BEGIN && pipeline == NULL) {
+            int n = ws_recv_message(fd, &frame, msg + 1, sizeof(msg) - 1);
+            if (n != 5 && n != 5 + 32) {
+                LOGB_E(TAG, "malformed BEGIN");
+                err = ESP_ERR_INVALID_ARG;
+                break;
+            }
+            memcpy(&length, msg + 1, 4);
+            uint8_t encoding = msg[5];
+            has_expected_sha256 = (n == 5 + 32);
+            memcpy(expected_sha256, msg + 6, sizeof(expected_sha256));
+
+            if (length == 0 || length > partition->size) {
+                LOGB_E(TAG, "image of %d bytes, partition size %d", length, partition->size);
+                err = ESP_ERR_INVALID_SIZE;
+            }
+            else if (encoding & ~(OTA_ENCODING_HEATSHRINK | OTA_ENCODING_DELTA)) {
+                LOGB_E(TAG, "unsupported encoding 0x%x", encoding);
+                err = ESP_ERR_NOT_SUPPORTED;
+            }
+            else if ((encoding & OTA_ENCODING_DELTA) && !(target.rule->flags & OTA_TARGET_DELTA)) {
+                LOGB_E(TAG, "partition '%s' can't take a delta", partition->label);
+                err = ESP_ERR_NOT_SUPPORTED;
+            }
+#if CONFIG_OTA_REQUIRE_SHA256
+            else if (!has_expected_sha256) {
+                LOGB_E(TAG, "image SHA-256 required");
+                err = ESP_ERR_INVALID_ARG;
+            }
+#endif
+            if (err != ESP_OK) {
+                break;
+            }
+
+            LOGB_I(TAG, "Writing %d bytes to partition '%s' at offset 0x%x",
+                length, partition->label, partition->address);
+            sprintf(sse_msg, "{\"progress\":\"10\", \"status\":\"Sending File Size %dKB\"}", length/1024);
+            sse_broadcast(sse_msg, "update", true);
+
+            pipeline = upload_pipeline_start(&target, 0, length, encoding);
+            if (pipeline == NULL) {
+                err = ESP_ERR_NO_MEM;
+                break;
+            }
+            led_status_set(led_status, &downloading);
+            upload_start = esp_timer_get_time();
+            metrics_upload_begin();
+
+            if (!ws_send_ack(fd, 0, CONFIG_WS_UPLOAD_WINDOW)) {
+                disconnected = true;
+                break;
+            }
+        }
+        else if (msg[0] == WS_MSG_DATA && pipeline != NULL) {
+            // straight into free pipeline buffers, as for POST /send
+            while (frame.offset < frame.len) {
+                size_t chunk_size;
+                int64_t start = esp_timer_get_time();
+                uint8_t *chunk = ota_pipeline_acquire(pipeline, &chunk_size);
+                int64_t acquired = esp_timer_get_time();
+                int n = ws_recv(fd, &frame, chunk, chunk_size);
+                flash_wait_us += (uint32_t)(acquired - start);
+                network_us += (uint32_t)(esp_timer_get_time() - acquired);
+                if (n <= 0 || received + n > length) {
+                    ota_pipeline_submit(pipeline, chunk, 0);
+                    if (n <= 0) {
+                        disconnected = true;
+                    } else {
+                        LOGB_E(TAG, "more data than the %d bytes announced", length);
+                        err = ESP_ERR_INVALID_SIZE;
+                    }
+                    break;
+                }
+                ota_pipeline_submit(pipeline, chunk, n);
+                received += n;
+                metrics_add_received(n);
+            }
+            if (disconnected) {
+                break;
+            }
             if (err == ESP_OK) {
-                len = sprintf(buffer, "HTTP/1.1 200 OK\r\nContent-Length: 0\r\n\r\n");
-                send(client_fd, buffer, len, 0);
-                sprintf(sse_msg, "{\"progress\":\"100\", \"status\":\"Firmware Installed. Restarting to '%s'...\"}", boot_partition->label);
-                send_sse_message(sse_msg, "update");
-            } else {
-                len = sprintf(buffer, "HTTP/1.1 400 Bad Update\r\nContent-Length: 0\r\n\r\n");
-                send(client_fd, buffer, len, 0);
-                sprintf(sse_msg, "{\"progress\":\"100\", \"status\":\"Failed. Restarting to '%s'...\"}", boot_partition->label);
-                send_sse_message(sse_msg, "update");
+                err = ota_pipeline_status(pipeline);
+            }
+            if (err != ESP_OK) {
+                break;
             }
-            
-            led_status_set(led_status, &client_connected);
 
-            vTaskDelay(2000/portTICK_PERIOD_MS);
-            esp_wifi_stop();
-            esp_restart(); 
+            if (upload_progress(&progress, received, length) && 
+                !ws_send_progress(fd, progress, ota_pipeline_written(pipeline))) {
+                disconnected = true;
+                break;
+            }
+            // credit goes back once half the window has been taken into buffers
+            if (received - acked >= CONFIG_WS_UPLOAD_WINDOW / 2 || received == length) {
+                acked = received;
+                if (!ws_send_ack(fd, received, received + CONFIG_WS_UPLOAD_WINDOW)) {
+                    disconnected = true;
+                    break;
+                }
+            }
+        }
+        else if (msg[0] == WS_MSG_CANCEL) {
+            cancelled = true;
+            break;
         }
         else {
-            len = sprintf(buffer, "HTTP/1.1 404 Not Found\r\nContent-Length: 0\r\n\r\n");
-            send(client_fd, buffer, len, 0); 
+            LOGB_E(TAG, "unexpected ws message 0x%x", msg[0]);
+            err = ESP_ERR_INVALID_STATE;
+            break;
         }
-    } //else
-    return 0; // success
+    }
+
+    ws_log_active = false;
+    if (cancelled) {
+        LOGB_W(TAG, "Upload cancelled");
+    }
+    if (cancelled || disconnected) {
+        err = ESP_FAIL;
+    }
+    LOGB_I(TAG, "Binary transferred finished: %d of %d bytes", received, length);
+
+    ota_writer_stats_t stats = { 0 };
+    if (pipeline != NULL) {
+        metrics_upload_end();
+        esp_err_t write_err = ota_pipeline_finish(pipeline, &stats);
+        if (err == ESP_OK) {
+            err = write_err;
+        }
+        upload_report(&stats, upload_start, network_us, flash_wait_us);
+
+        if (err == ESP_OK && has_expected_sha256 && memcmp(stats.sha256, expected_sha256, 32) != 0) {
+            LOGB_E(TAG, "Image SHA-256 does not match the one given with BEGIN");
+            err = ESP_ERR_OTA_VALIDATE_FAILED;
+        }
+        if (err == ESP_OK) {
+            err = ota_target_install(&target, stats.bytes);
+        }
+    }
+
+    if (!disconnected || closed) {
+        if (!disconnected) {
+            ws_send_logs(fd);
+            uint8_t result[1 + 4 + 2 + 2 + 32] = { WS_MSG_RESULT };
+            int32_t code = err;
+            uint16_t writes = stats.writes;
+            uint16_t skipped = stats.skipped;
+            memcpy(result + 1, &code, 4);
+            memcpy(result + 5, &writes, 2);
+            memcpy(result + 7, &skipped, 2);
+            memcpy(result + 9, stats.sha256, 32);
+            ws_send(fd, WS_OP_BINARY, result, sizeof(result));
+        }
+        // 1000, normal closure
+        static const uint8_t normal_closure[] = { 0x03, 0xe8 };
+        ws_send(fd, WS_OP_CLOSE, normal_closure, sizeof(normal_closure));
+    }
+
+    // as for POST /send: nothing new on flash, or the client went away, so no restart
+    if (pipeline == NULL || disconnected || cancelled) {
+        led_status_set(led_status, &client_connected);
+        if (pipeline != NULL) {
+            sprintf(sse_msg, "{\"progress\":\"%d\", \"status\":\"%s\"}", progress, 
+                cancelled ? "Cancelled" : "Connection lost");
+            sse_broadcast(sse_msg, "update", true);
+        }
+        return;
+    }
+    upload_done(&target, err);
 }
 
-static void sse_task(void * param)
-{
-    char recv_buf[LOG_BUF_MAX_LINE_SIZE];
+// relay_read_t for an image on flash. 'ctx' is its partition
+static bool firmware_read(void *ctx, uint32_t offset, void *buf, size_t len) {
+    return esp_partition_read((const esp_partition_t *)ctx, offset, buf, len) == ESP_OK;
+}
 
-    while(1) {
-        if (xQueueReceive(q_sse_message_queue, recv_buf, portMAX_DELAY) == pdTRUE) {
-            send_sse_message(recv_buf, NULL);
-        } // if
-    } //while
+// Length and SHA-256 of the app image in 'partition', if it verifies. Those of the 
+//  running app can't change, so they are only worked out once
+static esp_err_t firmware_image(const esp_partition_t *partition, relay_image_t *image) {
+    static relay_image_t running;
+    bool is_running = (partition == esp_ota_get_running_partition());
+    if (is_running && running.length != 0) {
+        *image = running;
+        return ESP_OK;
+    }
+
+    const esp_partition_pos_t pos = { .offset = partition->address, .size = partition->size };
+    esp_image_metadata_t metadata;
+    esp_err_t err = esp_image_verify(ESP_IMAGE_VERIFY_SILENT, &pos, &metadata);
+    if (err != ESP_OK) {
+        LOGB_W(TAG, "partition '%s' holds no valid image", partition->label);
+        return err;
+    }
+    image->length = metadata.image_len;
+    err = ota_session_digest(partition, image->length, image->sha256);
+    if (err == ESP_OK && is_running) {
+        running = *image;
+    }
+    return err;
 }
 
-static void socket_server_task(void * param)
-{
-    int return_code;
+// GET /firmware, on the upload task: the running app, or ?part= another app partition 
+//  (one staged by an upload, say), for a peer to pull with POST /pull. Range requests 
+//  let a peer carry on after a dropped connection
+static void handle_firmware(server_conn_t *conn) {
+    int client_fd = conn->fd;
+    char *buffer = conn->buffer;
+    const http_parser_t *req = &conn->parser;
+    int len;
+
+    const esp_partition_t *partition = esp_ota_get_running_partition();
+    http_slice_t part;
+    if (http_query_param(buffer, req->query, "part", &part)) {
+        char label[OTA_TARGET_LABEL_MAX + 1];
+        partition = NULL;
+        if (part.len > 0 && part.len <= OTA_TARGET_LABEL_MAX) {
+            memcpy(label, buffer + part.off, part.len);
+            label[part.len] = '\0';
+            partition = esp_partition_find_first(ESP_PARTITION_TYPE_APP, ESP_PARTITION_SUBTYPE_ANY, label);
+        }
+    }
 
-    int server_socket = 0;
-    server_socket = socket(AF_INET, SOCK_STREAM, 0);
-    if (server_socket < 0) {
-        ESP_LOGE(TAG, "socket err: %d", errno);
-//      quit task;
+    relay_image_t image;
+    if (partition == NULL || firmware_image(partition, &image) != ESP_OK) {
+        len = sprintf(buffer, "HTTP/1.1 404 Not Found\r\nContent-Length: 0\r\n\r\n");
+        send(client_fd, buffer, len, 0);
+        return;
     }
-    ESP_LOGD(TAG, "server socket. port %d. server_fd %d", OTA_LISTEN_PORT, server_socket);
 
-    // Set socket to be nonblocking.
-    int on = 1;
-    return_code = ioctl(server_socket, FIONBIO, (char *)&on);
-    if (return_code < 0) {
-        ESP_LOGE(TAG, "ioctl err: %d", errno);
-        close(server_socket);
-//      quit task;
+    // 'buffer' is reused for reading flash, so the header value is copied out first
+    char range[40];
+    size_t range_len = 0;
+    const http_header_t *range_header = http_parser_find_header(req, buffer, "Range");
+    if (range_header != NULL) {
+        range_len = (range_header->value.len < sizeof(range)) ? range_header->value.len : sizeof(range) - 1;
+        memcpy(range, buffer + range_header->value.off, range_len);
     }
 
-    struct sockaddr_in server_addr;
-    server_addr.sin_family = AF_INET;
-    server_addr.sin_port = htons(OTA_LISTEN_PORT);
-    server_addr.sin_addr.s_addr = htonl(INADDR_ANY);
-    if (bind(server_socket, (struct sockaddr *)&server_addr, sizeof(server_addr)) < 0) {
-        ESP_LOGE(TAG, "bind err: %d", errno);
-        close(server_socket);
-//      quit task;
+    LOGB_I(TAG, "Serving partition '%s', %d bytes%s%.*s", partition->label, image.length, 
+        range_header ? " " : "", range_len, range);
+    led_status_set(led_status, &downloading);
+    relay_serve(client_fd, &image, range_header ? range : NULL, range_len, 
+        firmware_read, (void *)partition, (uint8_t *)buffer, SERVER_BUFF_SIZE);
+    led_status_set(led_status, &client_connected);
+}
+
+// Copy 'len' bytes already received into pipeline buffers
+static void pull_submit(ota_pipeline_t pipeline, const uint8_t *data, size_t len) {
+    while (len > 0) {
+        size_t chunk_size;
+        uint8_t *chunk = ota_pipeline_acquire(pipeline, &chunk_size);
+        size_t n = (len < chunk_size) ? len : chunk_size;
+        memcpy(chunk, data, n);
+        ota_pipeline_submit(pipeline, chunk, n);
+        data += n;
+        len -= n;
+    }
+}
+
+// POST /pull, on the upload task. The body is the URL of a peer's GET /firmware; 
+//  the image is fetched from there and written like a POST /send of it, to the OTA_1
+//  app slot or ?part=. A dropped connection is picked up again with a Range request.
+//  The reply comes once the image is on flash
+static void handle_pull(server_conn_t *conn) {
+    int client_fd = conn->fd;
+    char *buffer = conn->buffer;
+    const http_parser_t *req = &conn->parser;
+    int len;
+    char sse_msg[100];
+
+    ota_target_t target;
+    esp_err_t err = find_upload_target(buffer, req->query, &target);
+    const esp_partition_t *partition = target.partition;
+
+    // the body, which may not all have come with the header
+    char url_text[RELAY_PATH_MAX + 32];
+    size_t url_len = req->content_length;
+    relay_url_t url;
+    if (!req->has_content_length || url_len >= sizeof(url_text)) {
+        LOGB_E(TAG, "POST /pull takes the peer's URL as its body");
+        err = ESP_ERR_INVALID_ARG;
     }
-    if (listen(server_socket, 5) < 0) {
-        ESP_LOGE(TAG, "listen err: %d", errno);
-        close(server_socket);
-//      quit task;
+    else {
+        size_t got = conn->len - req->body_offset;
+        if (got > url_len) {
+            got = url_len;
+        }
+        memcpy(url_text, buffer + req->body_offset, got);
+        while (got < url_len && (len = read(client_fd, url_text + got, url_len - got)) > 0) {
+            got += len;
+        }
+        // 'echo url | curl -d @-' sends a newline
+        while (url_len > 0 && (url_text[url_len - 1] == '\n' || url_text[url_len - 1] == '\r')) {
+            url_len--;
+        }
+        if (got < req->content_length || !relay_parse_url(url_text, url_len, &url)) {
+            LOGB_E(TAG, "bad peer URL %.*s", url_len, url_text);
+            err = ESP_ERR_INVALID_ARG;
+        }
     }
 
-    struct sockaddr_in client_addr;
-    size_t client_addrlen = sizeof(client_addr);
+    relay_response_t response = { .fd = -1 };
+    if (err == ESP_OK && 
+            !relay_fetch(&url, 0, CONFIG_SERVER_IDLE_TIMEOUT_MS, &response, buffer, SERVER_BUFF_SIZE)) {
+        err = ESP_ERR_NOT_FOUND;
+    }
+    if (err == ESP_OK && (response.length == 0 || response.length > partition->size)) {
+        LOGB_E(TAG, "image of %d bytes, partition size %d", response.length, partition->size);
+        err = ESP_ERR_INVALID_SIZE;
+    }
+#if CONFIG_OTA_REQUIRE_SHA256
+    if (err == ESP_OK && !response.has_sha256) {
+        LOGB_E(TAG, "peer sent no X-Image-SHA256");
+        err = ESP_ERR_INVALID_ARG;
+    }
+#endif
 
-    fd_set working_set;
-    // Initialize the set of active sockets (i.e. the server socket)
-    FD_ZERO (&master_set);
-    FD_SET (server_socket, &master_set);
+    ota_pipeline_t pipeline = NULL;
+    if (err == ESP_OK) {
+        LOGB_I(TAG, "Pulling %d bytes from %s%s into partition '%s'", 
+            response.length, url.host, url.path, partition->label);
+        sprintf(sse_msg, "{\"progress\":\"10\", \"status\":\"Pulling %dKB from %s\"}", 
+            response.length/1024, url.host);
+        sse_broadcast(sse_msg, "update", true);
+
+        // checked by the writer before the first sector is erased, as for an upload
+        pipeline = upload_pipeline_start(&target, 0, response.length, OTA_ENCODING_NONE);
+        if (pipeline == NULL) {
+            err = ESP_ERR_NO_MEM;
+        }
+    }
 
-    while (1) {
-        memcpy(&working_set, &master_set, sizeof(master_set));
+    uint32_t received = 0;
+    uint8_t progress = 0;
+    bool cancelled = false;
+    int retries = 3;
+    int64_t upload_start = esp_timer_get_time();
+    uint32_t network_us = 0;
+    uint32_t flash_wait_us = 0;
+    if (pipeline != NULL) {
+        led_status_set(led_status, &downloading);
+        metrics_upload_begin();
+        pull_submit(pipeline, (uint8_t *)buffer + response.body_off, response.body_len);
+        received = response.body_len;
+        metrics_add_received(received);
+    }
 
-        // Block until input arrives on one or more active sockets
-        if (select(FD_SETSIZE, &working_set, NULL, NULL, NULL) < 0) {
-            ESP_LOGE(TAG, "select err: %d", errno);
+    while (pipeline != NULL && err == ESP_OK && received < response.length) {
+        if (upload_cancelled) {
+            LOGB_W(TAG, "Pull cancelled");
+            cancelled = true;
+            err = ESP_FAIL;
             break;
         }
+        size_t chunk_size;
+        int64_t start = esp_timer_get_time();
+        uint8_t *chunk = ota_pipeline_acquire(pipeline, &chunk_size);
+        int64_t acquired = esp_timer_get_time();
+        if (chunk_size > response.length - received) {
+            chunk_size = response.length - received;
+        }
+        int n = recv(response.fd, chunk, chunk_size, 0);
+        flash_wait_us += (uint32_t)(acquired - start);
+        network_us += (uint32_t)(esp_timer_get_time() - acquired);
+
+        if (n <= 0) {
+            ota_pipeline_submit(pipeline, chunk, 0);
+            close(response.fd);
+            response.fd = -1;
+            // carry on from where the data stopped. the same image, or nothing
+            relay_response_t resumed;
+            LOGB_W(TAG, "peer connection lost at %d, %d retries left", received, retries);
+            if (retries-- == 0 || 
+                !relay_fetch(&url, received, CONFIG_SERVER_IDLE_TIMEOUT_MS, &resumed, buffer, SERVER_BUFF_SIZE)) {
+                err = ESP_FAIL;
+                break;
+            }
+            if (resumed.length != response.length || resumed.has_sha256 != response.has_sha256 ||
+                    memcmp(resumed.sha256, response.sha256, sizeof(resumed.sha256)) != 0) {
+                LOGB_E(TAG, "peer image changed");
+                close(resumed.fd);
+                err = ESP_ERR_INVALID_STATE;
+                break;
+            }
+            response.fd = resumed.fd;
+            pull_submit(pipeline, (uint8_t *)buffer + resumed.body_off, resumed.body_len);
+            n = resumed.body_len;
+        } else {
+            ota_pipeline_submit(pipeline, chunk, n);
+        }
+        received += n;
+        metrics_add_received(n);
+        upload_progress(&progress, received, response.length);
+        err = ota_pipeline_status(pipeline);
+    }
+    if (response.fd >= 0) {
+        close(response.fd);
+    }
 
-        // Service all the sockets with input pending
-        for (int fd = 0; fd < FD_SETSIZE; ++fd) {
-            if (FD_ISSET (fd, &working_set)) {
-                if (fd == server_socket) {
-                    int client_fd;
-                    client_fd = accept(server_socket, (struct sockaddr *)&client_addr, &client_addrlen);
+    ota_writer_stats_t stats = { 0 };
+    if (pipeline != NULL) {
+        LOGB_I(TAG, "Pull finished: %d of %d bytes", received, response.length);
+        metrics_upload_end();
+        esp_err_t write_err = ota_pipeline_finish(pipeline, &stats);
+        if (err == ESP_OK) {
+            err = write_err;
+        }
+        upload_report(&stats, upload_start, network_us, flash_wait_us);
 
-                    if (client_fd < 0) {
-                        ESP_LOGE(TAG, "accept err: %d", errno);
-                        break;
-                    }
-                    ESP_LOGI(TAG, "accept() connect from host %s, port %hu", 
-                        inet_ntoa (client_addr.sin_addr),  ntohs (client_addr.sin_port));
-                    FD_SET (client_fd, &master_set);                        
-                }
-                else {
-                    // Data arriving on an already-connected socket.
-                    if (read_from_client(fd) < 0) {
-                        close(fd);
-                        FD_CLR (fd, &master_set);
-                        for (int i = 0; i < MAX_SSE_CLIENTS; i++) {
-                            if (sse_sockets[i] == fd) {
-                                sse_sockets[i] = 0;
-                            }
-                        }
-                    }
+        if (err == ESP_OK && response.has_sha256 && memcmp(stats.sha256, response.sha256, 32) != 0) {
+            LOGB_E(TAG, "Image SHA-256 does not match the peer's X-Image-SHA256");
+            err = ESP_ERR_OTA_VALIDATE_FAILED;
+        }
+        if (err == ESP_OK) {
+            err = ota_target_install(&target, stats.bytes);
+        }
+    }
+
+    char body[40];
+    int body_len = sprintf(body, "{\"written\":%d,\"skipped\":%d}", stats.writes, stats.skipped);
+    len = sprintf(buffer, "HTTP/1.1 %s\r\nContent-Type: application/json\r\n"
+        "Content-Length: %d\r\n\r\n%s", (err == ESP_OK) ? "200 OK" : 
+        (pipeline == NULL && err == ESP_ERR_NOT_FOUND) ? "502 Bad Gateway" : "400 Bad Update", body_len, body);
+    send(client_fd, buffer, len, 0);
+
+    // as for an upload: no restart unless something new is on flash
+    if (pipeline == NULL || cancelled) {
+        led_status_set(led_status, &client_connected);
+        return;
+    }
+    upload_done(&target, err);
+}
+
+// From the sse task: pass a log line on to a GET /ws upload if its filter wants it.
+//  Never waits; a full queue only costs that client the line
+static void ws_log_forward(const log_record_t *record, uint8_t level, const char *tag, size_t tag_len) {
+    if (ws_log_queue != NULL && ws_log_active && 
+            sse_filter_match(&ws_log_filter, level, sse_tag_hash(tag, tag_len))) {
+        xQueueSendToBack(ws_log_queue, record, 0);
+    }
+}
+
+static int handle_request(server_conn_t *conn) {
+    int client_fd = conn->fd;
+    char *buffer = conn->buffer;
+    const http_parser_t *req = &conn->parser;
+    int len = conn->len;
+
+    char *body_start_p = buffer + req->body_offset;
+    int body_part_len = len - req->body_offset;
+
+    LOGB_I(TAG, "read %d. body len %d. method requested %.*s. uri requested %.*s", 
+        len, body_part_len, req->method.len, buffer + req->method.off, req->path.len, buffer + req->path.off); 
+
+    LOGB_D(TAG, "\r\n%.*s", (body_start_p - buffer), buffer); 
+
+    if (  http_slice_equals(buffer, req->method, "GET") && 
+          http_slice_equals(buffer, req->path, "/event")    ) {
+        sse_filter_t filter;
+        if (!parse_event_filter(buffer, req->query, &filter)) {
+            len = sprintf(buffer, "HTTP/1.1 400 Bad Request\r\nContent-Length: 0\r\n\r\n");
+            send(client_fd, buffer, len, 0);
+            return 0;
+        }
+        // sent by browsers reconnecting, so the history replay picks up where they left off
+        const http_header_t *last_event = http_parser_find_header(req, buffer, "Last-Event-ID");
+        uint32_t last_event_id;
+        bool has_last_event_id = (last_event != NULL && 
+            parse_slice_uint(buffer, last_event->value, UINT32_MAX, &last_event_id));
+
+        // frames queued for the new client are only sent from the server loop (this task),
+        //  so none can overtake the response header below
+        if (!sse_add_client(client_fd, &filter, has_last_event_id ? &last_event_id : NULL)) {
+            len = sprintf(buffer, "HTTP/1.1 503 Server Busy\r\n\r\n");
+            send(client_fd, buffer, len, 0);
+            return -1; // close connection
+        }
+        conn->state = SERVER_CONN_STREAM;
+        server_set_role(client_fd, SERVER_ROLE_SSE);
+
+        len = sprintf(buffer, "HTTP/1.1 200 OK\r\n"
+                              "Connection: Keep-Alive\r\n"
+                              "Content-Type: text/event-stream\r\n"
+                              "Cache-Control: no-cache\r\n\r\n");
+#if CONFIG_SSE_RETRY_MS
+        len += sprintf(buffer + len, "retry: %d\n\n", CONFIG_SSE_RETRY_MS);
+#endif
+        send(client_fd, buffer, len, 0);
+
+        sprintf(buffer, "{\"progress\":\"5\", \"status\":\"Connected..\"}");
+        sse_broadcast(buffer, "update", true);
+    }
+    else if (    http_slice_equals(buffer, req->method, "GET") && 
+                (http_slice_equals(buffer, req->path, "/") || 
+                 http_slice_equals(buffer, req->path, "/index.html"))   ) {
+        serve_index(conn);
+    }
+    else if (    http_slice_equals(buffer, req->method, "GET") && 
+                 http_slice_equals(buffer, req->path, "/metrics")       ) {
+        // body first, for its length. the header has its own buffer
+        _Static_assert(SERVER_BUFF_SIZE >= METRICS_JSON_MAX, "SERVER_BUFF_SIZE too small for /metrics");
+        char header[120];
+        char *body = buffer;
+        int body_len = metrics_format(body, METRICS_JSON_MAX);
+        len = sprintf(header, "HTTP/1.1 200 OK\r\n"
+                              "Content-Type: application/json\r\n"
+                              "Cache-Control: no-cache\r\n"
+                              "Content-Length: %d\r\n\r\n", body_len);
+        send(client_fd, header, len, 0);
+        send(client_fd, body, body_len, 0);
+    }
+    else if (    http_slice_equals(buffer, req->method, "GET") && 
+                 http_slice_equals(buffer, req->path, "/session")       ) {
+        ota_session_t session;
+        if (ota_session_load(&session) == ESP_OK) {
+            len = format_session_response(buffer, "200 OK", &session);
+        } else {
+            len = sprintf(buffer, "HTTP/1.1 404 Not Found\r\nContent-Length: 0\r\n\r\n");
+        }
+        send(client_fd, buffer, len, 0); 
+    }
+    else if (  ( http_slice_equals(buffer, req->method, "POST") && 
+                 http_slice_equals(buffer, req->path, "/send") ) ||
+               ( http_slice_equals(buffer, req->method, "POST") && 
+                 http_slice_equals(buffer, req->path, "/pull") ) ||
+               ( http_slice_equals(buffer, req->method, "GET") && 
+                 http_slice_equals(buffer, req->path, "/firmware") )    ) {
+        // one transfer at a time: an upload, an image served to a peer, or one pulled 
+        //  from a peer. it runs on its own task, so this loop stays free to 
+        //  accept, answer /metrics and /session and flush SSE meanwhile. the socket 
+        //  options are set, and the slot taken, before the task can have it: a short 
+        //  upload can be over before xQueueSendToBack() returns
+        server_set_role(client_fd, SERVER_ROLE_UPLOAD);
+        if (upload_fd >= 0) {
+            len = sprintf(buffer, "HTTP/1.1 409 Upload In Progress\r\nContent-Length: 0\r\nConnection: close\r\n\r\n");
+            send(client_fd, buffer, len, 0);
+            return -1; // close connection
+        }
+        upload_cancelled = false;
+        upload_fd = client_fd;
+        if (xQueueSendToBack(upload_queue, conn, 0) != pdTRUE) {
+            upload_fd = -1;
+            return -1;
+        }
+        return SERVER_REQUEST_DETACH;
+    }
+    else if (    http_slice_equals(buffer, req->method, "GET") && 
+                 http_slice_equals(buffer, req->path, "/ws")            ) {
+        // upgraded here, then handed to the upload task like POST /send. the query is
+        //  a log filter, as for /event
+        const http_header_t *key = http_parser_find_header(req, buffer, "Sec-WebSocket-Key");
+        char accept[WS_ACCEPT_LEN + 1];
+        sse_filter_t filter;
+        if (key == NULL || !ws_accept_key(buffer + key->value.off, key->value.len, accept) || 
+            !parse_event_filter(buffer, req->query, &filter)) {
+            len = sprintf(buffer, "HTTP/1.1 400 Bad Request\r\nContent-Length: 0\r\n\r\n");
+            send(client_fd, buffer, len, 0);
+            return 0;
+        }
+        if (upload_fd >= 0) {
+            len = sprintf(buffer, "HTTP/1.1 409 Upload In Progress\r\nContent-Length: 0\r\nConnection: close\r\n\r\n");
+            send(client_fd, buffer, len, 0);
+            return -1; // close connection
+        }
+        ws_log_filter = filter;
+        upload_cancelled = false;
+
+        // 'buffer' goes to the upload task with the request in it
+        char header[130];
+        len = sprintf(header, "HTTP/1.1 101 Switching Protocols\r\n"
+                              "Upgrade: websocket\r\n"
+                              "Connection: Upgrade\r\n"
+                              "Sec-WebSocket-Accept: %s\r\n\r\n", accept);
+        send(client_fd, header, len, 0);
+        server_set_role(client_fd, SERVER_ROLE_UPLOAD);
+        upload_fd = client_fd;
+        if (xQueueSendToBack(upload_queue, conn, 0) != pdTRUE) {
+            upload_fd = -1;
+            return -1;
+        }
+        return SERVER_REQUEST_DETACH;
+    }
+    else if (    http_slice_equals(buffer, req->method, "POST") && 
+                 http_slice_equals(buffer, req->path, "/cancel")        ) {
+        // seen by the upload loop after its next read. the socket itself is left to that 
+        //  task; lwIP sockets aren't meant to be shut down from under a blocked reader
+        if (upload_fd >= 0) {
+            upload_cancelled = true;
+            len = sprintf(buffer, "HTTP/1.1 200 OK\r\nContent-Length: 0\r\n\r\n");
+        } else {
+            len = sprintf(buffer, "HTTP/1.1 404 Not Found\r\nContent-Length: 0\r\n\r\n");
+        }
+        send(client_fd, buffer, len, 0);
+    }
+    else {
+        len = sprintf(buffer, "HTTP/1.1 404 Not Found\r\nContent-Length: 0\r\n\r\n");
+        send(client_fd, buffer, len, 0); 
+    }
+    return 0; // success
+}
+
+// Takes over POST /send, GET /ws, GET /firmware and POST /pull connections from the 
+//  server loop, one at a time
+static void upload_task(void * param)
+{
+    server_conn_t conn;
+    while (1) {
+        xQueueReceive(upload_queue, &conn, portMAX_DELAY);
+        if (http_slice_equals(conn.buffer, conn.parser.path, "/ws")) {
+            handle_ws_upload(&conn);
+        } else if (http_slice_equals(conn.buffer, conn.parser.path, "/firmware")) {
+            handle_firmware(&conn);
+        } else if (http_slice_equals(conn.buffer, conn.parser.path, "/pull")) {
+            handle_pull(&conn);
+        } else {
+            handle_upload(&conn);
+        }
+        // free before the close, so a client that waits for it can start the next one
+        pool_free(&server_buffer_pool, conn.buffer);
+        upload_fd = -1;
+        close(conn.fd);
+    }
+}
+
+// Boot is over once the listener is up and the AP has started, in either order. It's 
+//  marked once app_main has marked its own last phase too, so the 'boot' event has them all
+static uint8_t boot_waiting = 3;
+static uint32_t boot_ready_ms;              // the later of the listener and the AP
+static volatile bool boot_event_pending;    // the 'boot' event, sent by the sse task
+
+// One of the three in; 'ms' is 0 for app_main's, which doesn't move the ready time
+static void boot_countdown(uint32_t ms) {
+    taskENTER_CRITICAL();
+    if (ms > boot_ready_ms) {
+        boot_ready_ms = ms;
+    }
+    bool ready = (boot_waiting > 0 && --boot_waiting == 0);
+    taskEXIT_CRITICAL();
+    if (ready) {
+        // when the later of the two came up, not when app_main got here
+        metrics_boot_mark_at("ready", boot_ready_ms);
+        LOGB_I(TAG, "ready %d ms after reset", boot_ready_ms);
+        boot_event_pending = true;
+    }
+}
+
+static void boot_phase_done(const char *phase) {
+    boot_countdown(metrics_boot_mark(phase));
+}
+
+static void sse_task(void * param)
+{
+    log_record_t record;
+    char sse_msg[LOG_CAPTURE_TASK_NAME_LEN + LOG_CAPTURE_LINE_MAX + 4];
+    _Static_assert(sizeof(sse_msg) > (4 + LOG_BINARY_RECORD_MAX + 2) / 3 * 4, 
+        "sse_msg too small for a base64 LOGB_x record");
+    uint32_t dropped_reported = 0;
+
+#if CONFIG_METRICS_INTERVAL_MS
+    static char metrics_json[METRICS_JSON_MAX];
+    _Static_assert(METRICS_JSON_MAX + 64 <= SSE_FRAME_LARGE, "a metrics event must fit a large SSE frame");
+    const TickType_t metrics_interval = pdMS_TO_TICKS(CONFIG_METRICS_INTERVAL_MS);
+    TickType_t metrics_sent = xTaskGetTickCount();
+#else
+    const TickType_t metrics_interval = portMAX_DELAY;
+#endif
+    // wake often enough to send subscribers' batches on time
+    const TickType_t wait = (metrics_interval < pdMS_TO_TICKS(SSE_BATCH_MAX_MS)) ? 
+        metrics_interval : pdMS_TO_TICKS(SSE_BATCH_MAX_MS);
+
+    while(1) {
+        if (log_capture_read(&record, wait)) {
+            if (record.binary) {
+                // timestamp, then the LOGB_x record as stored. tools/log_decode.py 
+                //  turns it back into a line
+                uint8_t raw[sizeof(record.timestamp) + LOG_CAPTURE_LINE_MAX];
+                size_t encoded;
+                memcpy(raw, &record.timestamp, sizeof(record.timestamp));
+                memcpy(raw + sizeof(record.timestamp), record.text, record.len);
+                // the ID is the address of the call site's descriptor
+                const log_binary_site_t *site;
+                uint32_t id;
+                memcpy(&id, record.text, sizeof(id));
+                site = (const log_binary_site_t *)(uintptr_t)id;
+                if (mbedtls_base64_encode((unsigned char *)sse_msg, sizeof(sse_msg), &encoded, 
+                        raw, sizeof(record.timestamp) + record.len) == 0) {
+                    sse_broadcast_log(sse_msg, "logb", site->level, *site->tag, strlen(*site->tag));
                 }
+                ws_log_forward(&record, site->level, *site->tag, strlen(*site->tag));
             }
-        } // for FD_SETSIZE
-    } // while (1)
+            else {
+                const char *tag;
+                size_t tag_len;
+                uint8_t level = parse_log_line(record.text, &tag, &tag_len);
+                snprintf(sse_msg, sizeof(sse_msg), "[%s] %s", record.task, record.text);
+                sse_broadcast_log(sse_msg, NULL, level, tag, tag_len);
+                ws_log_forward(&record, level, tag, tag_len);
+            }
+            sse_flush_batches(SSE_BATCH_MAX_MS);
+        } // if
+        else {
+            // logging has gone quiet; nothing to wait for
+            sse_flush_batches(0);
+        }
+
+        if (boot_event_pending) {
+            // kept in the replay history, for subscribers that connect later
+            char boot_json[METRICS_BOOT_JSON_MAX];
+            boot_event_pending = false;
+            metrics_format_boot(boot_json, sizeof(boot_json));
+            sse_broadcast(boot_json, "boot", true);
+        }
+
+        uint32_t dropped = log_capture_dropped();
+        if (dropped != dropped_reported) {
+            dropped_reported = dropped;
+            sprintf(sse_msg, "{\"dropped\":%d}", dropped);
+            sse_broadcast(sse_msg, "log_dropped", true);
+        }
+
+#if CONFIG_METRICS_INTERVAL_MS
+        if (xTaskGetTickCount() - metrics_sent >= metrics_interval) {
+            metrics_sent = xTaskGetTickCount();
+            metrics_format(metrics_json, sizeof(metrics_json));
+            sse_broadcast(metrics_json, "metrics", true);
+        }
+#endif
+    } //while
+}
+
+static bool sse_wants_write(server_conn_t *conn) {
+    return sse_client_pending(conn->fd);
+}
+
+static int sse_on_writable(server_conn_t *conn) {
+    return sse_client_flush(conn->fd);
+}
+
+static void sse_on_idle(server_conn_t *conn) {
+    sse_client_ping(conn->fd);
+}
+
+static void on_close(server_conn_t *conn) {
+    sse_remove_client(conn->fd);
+}
+
+static void on_listening(void) {
+    boot_phase_done("listening");
+}
+
+static void socket_server_task(void * param)
+{
+    // every header handle_request() and the upload handlers look up
+    static const char *const request_headers[] = {
+        "Content-Encoding", "Content-Range", "If-None-Match", "Last-Event-ID", "Range", 
+        "Sec-WebSocket-Key", "X-Image-SHA256", "X-OTA-Session", NULL,
+    };
+    static const server_handlers_t handlers = {
+        .on_request = handle_request,
+        .wants_write = sse_wants_write,
+        .on_writable = sse_on_writable,
+        .on_idle = sse_on_idle,
+        .on_close = on_close,
+        .on_listening = on_listening,
+        .headers = request_headers,
+    };
+
+    server_run(OTA_LISTEN_PORT, &handlers);
+
+    LOGB_E(TAG, "server stopped");
+    vTaskDelete(NULL);
 }
 
 static void wifi_event_handler(void* arg, esp_event_base_t event_base,
@@ -399,16 +1669,134 @@ static void wifi_event_handler(void* arg, esp_event_base_t event_base,
         else if (event_id == WIFI_EVENT_AP_STADISCONNECTED) {
             led_status_set(led_status, &running);
         }
+        else if (event_id == WIFI_EVENT_AP_START) {
+            boot_phase_done("ap_start");
+        }
      }
 }
 
+// What app_main works out from NVS and the MAC on every boot. With CONFIG_FAST_START 
+//  it is kept in one NVS blob, so a restart costs a single read
+#define BOOT_CONFIG_NAMESPACE   "boot"
+#define BOOT_CONFIG_KEY         "config"
+#define BOOT_CONFIG_VERSION     1
+#define BOOT_CONFIG_NO_LED      0xff
+
+typedef struct {
+    uint8_t version;
+    uint8_t led_gpio;                       // BOOT_CONFIG_NO_LED if lights/status_led isn't set
+    wifi_ap_config_t ap;
+} boot_config_t;
+
+static void boot_config_derive(boot_config_t *config) {
+    memset(config, 0, sizeof(*config));
+    config->version = BOOT_CONFIG_VERSION;
+    config->led_gpio = BOOT_CONFIG_NO_LED;
+
+    nvs_handle lights_config_handle;
+    esp_err_t err = nvs_open("lights", NVS_READWRITE, &lights_config_handle);
+    if (err == ESP_OK) {
+        // Status LED
+        uint8_t status_led_gpio = 0;
+        err = nvs_get_u8(lights_config_handle, "status_led", &status_led_gpio); 
+        if (err == ESP_OK) {
+            config->led_gpio = status_led_gpio;
+        }
+        else {
+            LOGB_W(TAG, "error nvs_get_u8 status_led err %d", err);
+        }
+        nvs_close(lights_config_handle);
+    }
+    else {
+        LOGB_E(TAG, "nvs_open err %d ", err);
+    }
+
+    config->ap.authmode = WIFI_AUTH_OPEN;
+    config->ap.max_connection = 4;
+    uint8_t mac[6];
+    esp_read_mac(mac, 1);
+    snprintf((char *)config->ap.ssid, 11, "esp_%02x%02x%02x", mac[3], mac[4], mac[5]);
+}
+
+#if CONFIG_FAST_START
+// False if there is none, or it was written by a build with another layout
+static bool boot_config_load(boot_config_t *config) {
+    nvs_handle handle;
+    size_t len = sizeof(*config);
+    if (nvs_open(BOOT_CONFIG_NAMESPACE, NVS_READONLY, &handle) != ESP_OK) {
+        return false;
+    }
+    esp_err_t err = nvs_get_blob(handle, BOOT_CONFIG_KEY, config, &len);
+    nvs_close(handle);
+    return err == ESP_OK && len == sizeof(*config) && config->version == BOOT_CONFIG_VERSION;
+}
+
+static void boot_config_save(const boot_config_t *config) {
+    nvs_handle handle;
+    esp_err_t err = nvs_open(BOOT_CONFIG_NAMESPACE, NVS_READWRITE, &handle);
+    if (err == ESP_OK) {
+        err = nvs_set_blob(handle, BOOT_CONFIG_KEY, config, sizeof(*config));
+        if (err == ESP_OK) {
+            err = nvs_commit(handle);
+        }
+        nvs_close(handle);
+    }
+    if (err != ESP_OK) {
+        LOGB_W(TAG, "boot config not saved, err %d", err);
+    }
+}
+#endif
+
+static void start_tasks(void) {
+    sse_init(&server_wake);
+    ota_target_register(&homekit_target);
+
+    // Task priorities, highest first:
+    //  lwIP and wifi (SDK)
+    //  ota_upload (CONFIG_OTA_UPLOAD_TASK_PRIORITY) and ota_writer 
+    //   (CONFIG_OTA_PIPELINE_TASK_PRIORITY) - the transfer itself
+    //  socket_server (3) - pages, /metrics, /session and flushing SSE
+    //  sse (2) - log lines and metrics events
+    //  Progress reporting only runs when the transfer is waiting on the network or 
+    //  flash; if it falls behind, log lines are dropped (log_dropped) rather than 
+    //  the upload slowed down. Compare the upload rate and stack_free in /metrics 
+    //  when changing these.
+
+    // upload worker. the socket server hands POST /send and GET /ws over to it
+    upload_queue = xQueueCreate(1, sizeof(server_conn_t));
+#if CONFIG_WS_LOG_QUEUE_DEPTH
+    ws_log_queue = xQueueCreate(CONFIG_WS_LOG_QUEUE_DEPTH, sizeof(log_record_t));
+#endif
+    TaskHandle_t upload_handle = NULL;
+    xTaskCreate(&upload_task, "ota_upload", CONFIG_OTA_UPLOAD_TASK_STACK, NULL, CONFIG_OTA_UPLOAD_TASK_PRIORITY, &upload_handle);
+    metrics_watch_task("ota_upload", upload_handle);
+
+    // listen and read incoming sockets (HTTP). no longer runs the upload, so the 
+    //  stack only needs to cover request handling
+    TaskHandle_t socket_server_handle = NULL;
+    xTaskCreate(&socket_server_task, "socket_server", CONFIG_SOCKET_SERVER_TASK_STACK, NULL, 3, 
+        &socket_server_handle);
+    metrics_watch_task("socket_server", socket_server_handle);
+
+    // Task to take captured log lines and send to SSE clients
+    log_capture_init();
+    TaskHandle_t sse_handle = NULL;
+    xTaskCreate(&sse_task, "sse", CONFIG_SSE_TASK_STACK, NULL, 2, &sse_handle);
+    metrics_watch_task("sse", sse_handle);
+}
+
 void app_main(void)
 {
+    // each phase is timed from reset; /metrics and the 'boot' event report them
+    metrics_boot_mark("app_main");
+
     //nvs_flash_erase();
 
     ESP_ERROR_CHECK(esp_event_loop_create_default());
     ESP_ERROR_CHECK(esp_event_handler_register(WIFI_EVENT, WIFI_EVENT_AP_STACONNECTED, wifi_event_handler, NULL));
     ESP_ERROR_CHECK(esp_event_handler_register(WIFI_EVENT, WIFI_EVENT_AP_STADISCONNECTED, wifi_event_handler, NULL));
+    ESP_ERROR_CHECK(esp_event_handler_register(WIFI_EVENT, WIFI_EVENT_AP_START, wifi_event_handler, NULL));
+    metrics_boot_mark("event_loop");
 
 /*
     // Try and set partition to the main app1 partition. This allows you to çancel out
@@ -416,32 +1804,27 @@ void app_main(void)
     const esp_partition_t *main_partition;
     main_partition = esp_partition_find_first(ESP_PARTITION_TYPE_APP, ESP_PARTITION_SUBTYPE_APP_OTA_1, NULL);
     if (esp_ota_set_boot_partition(main_partition) != ESP_OK) {
-        ESP_LOGW(TAG, "Unable to set boot partition to '%s' at offset 0x%x",
+        LOGB_W(TAG, "Unable to set boot partition to '%s' at offset 0x%x",
                         main_partition->label, main_partition->address);
     }
 */
 
-    esp_err_t err;
-
-    nvs_handle lights_config_handle;
-    err = nvs_open("lights", NVS_READWRITE, &lights_config_handle);
-    if (err == ESP_OK) {
-        // Status LED
-        uint8_t status_led_gpio = 0;
-        err = nvs_get_u8(lights_config_handle, "status_led", &status_led_gpio); 
-        if (err == ESP_OK) {
-            led_status = led_status_init(status_led_gpio, false);   //don't care about inverted or not...
-        }
-        else {
-            ESP_LOGW(TAG, "error nvs_get_u8 status_led err %d", err);
-        }
-        nvs_close(lights_config_handle);
+    boot_config_t config;
+#if CONFIG_FAST_START
+    bool cached = boot_config_load(&config);
+    if (!cached) {
+        boot_config_derive(&config);
     }
-    else {
-        ESP_LOGE(TAG, "nvs_open err %d ", err);
+#else
+    boot_config_derive(&config);
+#endif
+
+    // Status LED
+    if (config.led_gpio != BOOT_CONFIG_NO_LED) {
+        led_status = led_status_init(config.led_gpio, false);   //don't care about inverted or not...
     }
-            
     led_status_set(led_status, &running);
+    metrics_boot_mark("config");
 
 
     #ifdef CONFIG_IDF_TARGET_ESP32
@@ -450,32 +1833,40 @@ void app_main(void)
     #elif CONFIG_IDF_TARGET_ESP8266
         tcpip_adapter_init();
     #endif
+    metrics_boot_mark("netif");
+
+#if CONFIG_FAST_START
+    // lwIP is up, so the listener can be bound while wifi starts, and accepts as 
+    //  soon as the AP is up
+    start_tasks();
+    metrics_boot_mark("tasks");
+#endif
 
     wifi_init_config_t cfg = WIFI_INIT_CONFIG_DEFAULT();
     ESP_ERROR_CHECK(esp_wifi_init(&cfg));
+    metrics_boot_mark("wifi_init");
 
-    wifi_config_t wifi_ap_config = {
-        .ap = {
-            .authmode = WIFI_AUTH_OPEN,
-            .max_connection = 4,
-        },
-    };
-    uint8_t mac;
-    esp_read_mac(&mac, 1);
-    snprintf((char *)wifi_ap_config.ap.ssid, 11, "esp_%02x%02x%02x", (&mac)[3], (&mac)[4], (&mac)[5]);
+    wifi_config_t wifi_ap_config = { .ap = config.ap };
 
     ESP_ERROR_CHECK(esp_wifi_set_mode(WIFI_MODE_AP));       
     ESP_ERROR_CHECK(esp_wifi_set_config(ESP_IF_WIFI_AP, &wifi_ap_config));
 
     ESP_ERROR_CHECK(esp_wifi_start());
-
-    // listen and read incoming sockets (HTTP)
-    xTaskCreate(&socket_server_task, "socket_server", 4096, NULL, 2, NULL);
-
-    // Task to accept messages from queue and send to SSE clients
-    q_sse_message_queue = xQueueCreate( 10, sizeof(char)*LOG_BUF_MAX_LINE_SIZE );
-    xTaskCreate(&sse_task, "sse", 2048, NULL, 4, NULL);
-
-    old_function = esp_log_set_putchar(&sse_logging_putchar);
-
+    metrics_boot_mark("wifi_start");
+
+#if CONFIG_FAST_START
+    // off the boot path now. a cache that no longer matches NVS (the status LED 
+    //  was changed) or the MAC is replaced, and takes effect on the next boot
+    boot_config_t derived;
+    if (cached) {
+        boot_config_derive(&derived);
+    }
+    if (!cached || memcmp(&derived, &config, sizeof(config)) != 0) {
+        boot_config_save(cached ? &derived : &config);
+    }
+#else
+    start_tasks();
+    metrics_boot_mark("tasks");
+#endif
+    boot_countdown(0);
 }
@@ -0,0 +1,214 @@
+#include <stdio.h>
+#include <stdbool.h>
+#include <string.h>
+
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "freertos/timers.h"
+
+#include "esp_system.h"
+#include "esp_timer.h"
+
+#include "log_capture.h"
+#include "metrics.h"
+#include "server.h"
+#include "sse.h"
+
+#define METRICS_MAX_TASKS 4
+#define METRICS_RATE_WINDOW_MS 1000
+
+static const uint32_t flash_bucket_ms[] = METRICS_FLASH_BUCKETS;
+#define METRICS_FLASH_BUCKET_COUNT (sizeof(flash_bucket_ms) / sizeof(flash_bucket_ms[0]) + 1)
+
+static uint32_t metrics_now_ms(void) {
+    return (uint32_t)(esp_timer_get_time() / 1000);
+}
+
+static struct {
+    volatile uint32_t rx_bytes;             // every body byte received since boot
+    volatile bool upload_active;
+    volatile uint32_t upload_bytes;         // of the current (or last) upload
+    volatile uint32_t upload_start_ms;
+    volatile uint32_t upload_end_ms;
+    volatile uint32_t rate_bps;             // over the last complete window
+    volatile uint32_t window_start_ms;
+    uint32_t window_bytes;
+    volatile uint32_t flash_hist[METRICS_FLASH_BUCKET_COUNT];
+    const char *task_names[METRICS_MAX_TASKS];
+    TaskHandle_t tasks[METRICS_MAX_TASKS];  // NULL for one that has exited
+    uint32_t exited_free[METRICS_MAX_TASKS];
+    int task_count;
+    const char *boot_phases[METRICS_BOOT_PHASES];
+    uint32_t boot_ms[METRICS_BOOT_PHASES];  // esp_timer, which starts just after reset
+    volatile uint8_t boot_count;
+} metrics;
+
+void metrics_upload_begin(void) {
+    uint32_t now = metrics_now_ms();
+    metrics.upload_bytes = 0;
+    metrics.upload_start_ms = now;
+    metrics.rate_bps = 0;
+    metrics.window_start_ms = now;
+    metrics.window_bytes = 0;
+    metrics.upload_active = true;
+}
+
+void metrics_upload_end(void) {
+    metrics.upload_end_ms = metrics_now_ms();
+    metrics.upload_active = false;
+}
+
+void metrics_add_received(uint32_t bytes) {
+    metrics.rx_bytes += bytes;
+    metrics.upload_bytes += bytes;
+    metrics.window_bytes += bytes;
+
+    uint32_t now = metrics_now_ms();
+    uint32_t elapsed = now - metrics.window_start_ms;
+    if (elapsed >= METRICS_RATE_WINDOW_MS) {
+        metrics.rate_bps = (uint32_t)((uint64_t)metrics.window_bytes * 1000 / elapsed);
+        metrics.window_start_ms = now;
+        metrics.window_bytes = 0;
+    }
+}
+
+void metrics_flash_write(uint32_t us) {
+    // "le": a bucket holds the writes up to and including its bound
+    size_t i = 0;
+    while (i < METRICS_FLASH_BUCKET_COUNT - 1 && us > flash_bucket_ms[i] * 1000) {
+        i++;
+    }
+    metrics.flash_hist[i]++;
+}
+
+void metrics_watch_task(const char *name, TaskHandle_t task) {
+    if (metrics.task_count < METRICS_MAX_TASKS && task != NULL) {
+        metrics.task_names[metrics.task_count] = name;
+        metrics.tasks[metrics.task_count] = task;
+        metrics.task_count++;
+    }
+}
+
+void metrics_task_exit(const char *name) {
+    uint32_t free = uxTaskGetStackHighWaterMark(NULL);
+    for (int i = 0; i < metrics.task_count; i++) {
+        if (metrics.tasks[i] == NULL && strcmp(metrics.task_names[i], name) == 0) {
+            if (free < metrics.exited_free[i]) {
+                metrics.exited_free[i] = free;
+            }
+            return;
+        }
+    }
+    if (metrics.task_count < METRICS_MAX_TASKS) {
+        metrics.task_names[metrics.task_count] = name;
+        metrics.tasks[metrics.task_count] = NULL;
+        metrics.exited_free[metrics.task_count] = free;
+        metrics.task_count++;
+    }
+}
+
+uint32_t metrics_boot_mark(const char *phase) {
+    uint32_t now = metrics_now_ms();
+    metrics_boot_mark_at(phase, now);
+    return now;
+}
+
+void metrics_boot_mark_at(const char *phase, uint32_t ms) {
+    // app_main, the server and the wifi event task all mark phases
+    taskENTER_CRITICAL();
+    if (metrics.boot_count < METRICS_BOOT_PHASES) {
+        metrics.boot_phases[metrics.boot_count] = phase;
+        metrics.boot_ms[metrics.boot_count] = ms;
+        metrics.boot_count++;
+    }
+    taskEXIT_CRITICAL();
+}
+
+// snprintf that keeps appending at 'len' and never runs past 'size'
+#define METRICS_APPEND(...) do { \
+        if (len < (int)size) { \
+            len += snprintf(buf + len, size - len, __VA_ARGS__); \
+        } \
+    } while (0)
+
+int metrics_format_boot(char *buf, size_t size) {
+    int len = 0;
+    METRICS_APPEND("{");
+    for (int i = 0; i < metrics.boot_count; i++) {
+        METRICS_APPEND("%s\"%s\":%u", i ? "," : "", metrics.boot_phases[i], metrics.boot_ms[i]);
+    }
+    METRICS_APPEND("}");
+    return (len < (int)size) ? len : (int)size - 1;
+}
+
+int metrics_format(char *buf, size_t size) {
+    int len = 0;
+    uint32_t now = metrics_now_ms();
+
+    // a stalled upload has no window completing, so its last rate would stick
+    uint32_t rate = metrics.rate_bps;
+    if (!metrics.upload_active || now - metrics.window_start_ms > 2 * METRICS_RATE_WINDOW_MS) {
+        rate = 0;
+    }
+    uint32_t upload_ms = (metrics.upload_active ? now : metrics.upload_end_ms) - metrics.upload_start_ms;
+    uint32_t avg = (upload_ms > 0) ? (uint32_t)((uint64_t)metrics.upload_bytes * 1000 / upload_ms) : 0;
+
+    METRICS_APPEND("{\"uptime_ms\":%u,\"rx_bytes\":%u,", now, metrics.rx_bytes);
+    METRICS_APPEND("\"upload\":{\"active\":%s,\"bytes\":%u,\"rate_bps\":%u,\"avg_bps\":%u},", 
+        metrics.upload_active ? "true" : "false", metrics.upload_bytes, rate, avg);
+
+    METRICS_APPEND("\"flash_ms\":{\"le\":[");
+    for (size_t i = 0; i < METRICS_FLASH_BUCKET_COUNT - 1; i++) {
+        METRICS_APPEND("%s%u", i ? "," : "", flash_bucket_ms[i]);
+    }
+    METRICS_APPEND("],\"count\":[");
+    for (size_t i = 0; i < METRICS_FLASH_BUCKET_COUNT; i++) {
+        METRICS_APPEND("%s%u", i ? "," : "", metrics.flash_hist[i]);
+    }
+    METRICS_APPEND("]},");
+
+    sse_stats_t sse;
+    sse_get_stats(&sse);
+    METRICS_APPEND("\"sse\":{\"dropped\":%u,\"rate_limited\":%u,\"log_dropped\":%u,"
+        "\"history\":%u,\"history_bytes\":%u,\"clients\":[", 
+        sse.dropped, sse.rate_limited, log_capture_dropped(), sse.history, sse.history_bytes);
+    for (int i = 0; i < sse.clients; i++) {
+        METRICS_APPEND("%s{\"fd\":%d,\"depth\":%u,\"backlog\":%u}", i ? "," : "", 
+            sse.client[i].fd, sse.client[i].depth, sse.client[i].backlog);
+    }
+    METRICS_APPEND("]},");
+
+    METRICS_APPEND("\"heap\":{\"free\":%u,\"min_free\":%u},", 
+        esp_get_free_heap_size(), esp_get_minimum_free_heap_size());
+
+    // [used, peak, count, exhausted] of each static pool
+    pool_t *pools[] = { &server_buffer_pool, &sse_frame_pool, &sse_large_frame_pool };
+    METRICS_APPEND("\"pools\":{");
+    for (size_t i = 0; i < sizeof(pools) / sizeof(pools[0]); i++) {
+        pool_stats_t p;
+        pool_get_stats(pools[i], &p);
+        METRICS_APPEND("%s\"%s\":[%u,%u,%u,%u]", i ? "," : "", pools[i]->name, 
+            p.used, p.peak, p.count, p.exhausted);
+    }
+    METRICS_APPEND("},");
+
+    METRICS_APPEND("\"boot\":");
+    if (len < (int)size) {
+        len += metrics_format_boot(buf + len, size - len);
+    }
+    METRICS_APPEND(",");
+
+    // bytes of stack never touched
+    METRICS_APPEND("\"stack_free\":{");
+    for (int i = 0; i < metrics.task_count; i++) {
+        METRICS_APPEND("%s\"%s\":%u", i ? "," : "", metrics.task_names[i], (metrics.tasks[i] != NULL) ?
+            (uint32_t)uxTaskGetStackHighWaterMark(metrics.tasks[i]) : metrics.exited_free[i]);
+    }
+#if INCLUDE_xTimerGetTimerDaemonTaskHandle
+    METRICS_APPEND("%s\"timer\":%u", metrics.task_count ? "," : "", 
+        (uint32_t)uxTaskGetStackHighWaterMark(xTimerGetTimerDaemonTaskHandle()));
+#endif
+    METRICS_APPEND("}}");
+
+    return (len < (int)size) ? len : (int)size - 1;
+}
@@ -0,0 +1,61 @@
+#pragma once
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+
+// room for the JSON written by metrics_format()
+#define METRICS_JSON_MAX 1024
+
+// boot phases kept by metrics_boot_mark(), and room for metrics_format_boot()'s JSON
+#define METRICS_BOOT_PHASES 12
+#define METRICS_BOOT_JSON_MAX (2 + METRICS_BOOT_PHASES * 20)
+
+// upper bounds (ms) of the flash write latency histogram. one more bucket holds the rest
+#define METRICS_FLASH_BUCKETS { 5, 10, 20, 40, 80, 160 }
+
+// Counters are plain 32 bit words, each with a single writer task, so updating them on
+//  the hot path is a load and a store and readers need no lock.
+
+// An upload started or finished. ota_upload task only
+void metrics_upload_begin(void);
+void metrics_upload_end(void);
+
+// Body bytes read from the client. ota_upload task only
+void metrics_add_received(uint32_t bytes);
+
+// Time to erase and program one sector. OTA writer task only
+void metrics_flash_write(uint32_t us);
+
+// Report the stack high-water mark of 'task' (at most 4). The timer task is added 
+//  where FreeRTOS exposes its handle
+void metrics_watch_task(const char *name, TaskHandle_t task);
+
+// The calling task is about to delete itself. Its high-water mark is kept under 'name',
+//  the lowest of every run, in the same (at most 4) slots. For tasks that come and go,
+//  such as the OTA writer
+void metrics_task_exit(const char *name);
+
+// A boot phase has just finished. 'phase' must be a string literal. Any task; only 
+//  the first METRICS_BOOT_PHASES are kept. Returns the time marked, ms since reset
+uint32_t metrics_boot_mark(const char *phase);
+
+// As metrics_boot_mark(), at 'ms' rather than now: a phase that ends with another
+void metrics_boot_mark_at(const char *phase, uint32_t ms);
+
+// The boot phases as ms since reset, '{"app_main":283,"netif":301,..}' in the order 
+//  they were marked. Returns the length written
+int metrics_format_boot(char *buf, size_t size);
+
+// Snapshot everything as JSON. Returns the length written
+int metrics_format(char *buf, size_t size);
+
+#ifdef __cplusplus
+}
+#endif
@@ -0,0 +1,249 @@
+#include <stdlib.h>
+#include <string.h>
+
+#include "esp_log.h"
+static const char *TAG = "ota_decoder";
+
+#include "log_binary.h"
+#include "ota_decoder.h"
+
+#define HS_WINDOW_SIZE      (1 << OTA_HEATSHRINK_WINDOW_BITS)
+#define OUT_BUF_SIZE        256
+
+enum {
+    HS_TAG = 0,
+    HS_LITERAL,
+    HS_INDEX,
+    HS_COUNT,
+};
+
+enum {
+    DELTA_MAGIC = 0,
+    DELTA_OP,
+    DELTA_ARGS,
+    DELTA_INSERT,
+};
+
+struct ota_decoder {
+    uint8_t encoding;
+    ota_decoder_sink_t sink;
+    void *ctx;
+
+    // heatshrink
+    uint8_t hs_state;
+    uint8_t nbits;
+    uint32_t bits;                  // bit reservoir, MSB first
+    uint16_t hs_index;
+    uint16_t hs_head;
+    uint8_t *window;                // HS_WINDOW_SIZE, only allocated for heatshrink
+    uint16_t out_len;
+    uint8_t out[OUT_BUF_SIZE];      // decompressed bytes on their way to the delta stage / sink
+
+    // delta
+    const esp_partition_t *base;
+    uint8_t delta_state;
+    uint8_t op;
+    uint8_t args_len;
+    uint8_t args_needed;
+    uint8_t args[8];
+    uint32_t insert_remaining;
+    uint8_t copy[OUT_BUF_SIZE];     // base partition reads for 'C' operations
+};
+
+static uint32_t le32(const uint8_t *p) {
+    return p[0] | (p[1] << 8) | (p[2] << 16) | ((uint32_t)p[3] << 24);
+}
+
+static esp_err_t ota_delta_copy(ota_decoder_t d, uint32_t offset, uint32_t len) {
+    if (d->base == NULL || offset > d->base->size || len > d->base->size - offset) {
+        LOGB_E(TAG, "delta copy 0x%x+%d outside base partition", offset, len);
+        return ESP_ERR_INVALID_ARG;
+    }
+    while (len > 0) {
+        size_t n = (len < sizeof(d->copy)) ? len : sizeof(d->copy);
+        esp_err_t err = esp_partition_read(d->base, offset, d->copy, n);
+        if (err == ESP_OK) {
+            err = d->sink(d->ctx, d->copy, n);
+        }
+        if (err != ESP_OK) {
+            return err;
+        }
+        offset += n;
+        len -= n;
+    }
+    return ESP_OK;
+}
+
+static esp_err_t ota_delta_write(ota_decoder_t d, const uint8_t *data, size_t len) {
+    esp_err_t err = ESP_OK;
+
+    while (len > 0 && err == ESP_OK) {
+        switch (d->delta_state) {
+            case DELTA_MAGIC:
+                if (*data != OTA_DELTA_MAGIC[d->args_len]) {
+                    LOGB_E(TAG, "not an x-ota-delta payload");
+                    return ESP_ERR_INVALID_ARG;
+                }
+                data++; len--;
+                if (++d->args_len == 4) {
+                    d->delta_state = DELTA_OP;
+                }
+                break;
+
+            case DELTA_OP:
+                d->op = *data;
+                data++; len--;
+                if (d->op == 'C') {
+                    d->args_needed = 8;
+                } else if (d->op == 'I') {
+                    d->args_needed = 4;
+                } else {
+                    LOGB_E(TAG, "bad delta op 0x%x", d->op);
+                    return ESP_ERR_INVALID_ARG;
+                }
+                d->args_len = 0;
+                d->delta_state = DELTA_ARGS;
+                break;
+
+            case DELTA_ARGS:
+                d->args[d->args_len++] = *data;
+                data++; len--;
+                if (d->args_len == d->args_needed) {
+                    if (d->op == 'C') {
+                        err = ota_delta_copy(d, le32(d->args), le32(d->args + 4));
+                        d->delta_state = DELTA_OP;
+                    } else {
+                        d->insert_remaining = le32(d->args);
+                        d->delta_state = d->insert_remaining ? DELTA_INSERT : DELTA_OP;
+                    }
+                }
+                break;
+
+            case DELTA_INSERT: {
+                size_t n = (len < d->insert_remaining) ? len : d->insert_remaining;
+                err = d->sink(d->ctx, data, n);
+                data += n; len -= n;
+                d->insert_remaining -= n;
+                if (d->insert_remaining == 0) {
+                    d->delta_state = DELTA_OP;
+                }
+                break;
+            }
+        }
+    }
+    return err;
+}
+
+// output of the decompression stage
+static esp_err_t ota_decoder_emit(ota_decoder_t d, const uint8_t *data, size_t len) {
+    if (d->encoding & OTA_ENCODING_DELTA) {
+        return ota_delta_write(d, data, len);
+    }
+    return d->sink(d->ctx, data, len);
+}
+
+static esp_err_t ota_hs_output(ota_decoder_t d, uint8_t c) {
+    d->window[d->hs_head++ & (HS_WINDOW_SIZE - 1)] = c;
+    d->out[d->out_len++] = c;
+    if (d->out_len == sizeof(d->out)) {
+        d->out_len = 0;
+        return ota_decoder_emit(d, d->out, sizeof(d->out));
+    }
+    return ESP_OK;
+}
+
+static uint16_t ota_hs_take(ota_decoder_t d, uint8_t n) {
+    d->nbits -= n;
+    return (d->bits >> d->nbits) & ((1 << n) - 1);
+}
+
+static esp_err_t ota_hs_write(ota_decoder_t d, const uint8_t *data, size_t len) {
+    esp_err_t err = ESP_OK;
+
+    for (size_t i = 0; i < len && err == ESP_OK; i++) {
+        d->bits = (d->bits << 8) | data[i];
+        d->nbits += 8;
+
+        bool more = true;
+        while (more && err == ESP_OK) {
+            switch (d->hs_state) {
+                case HS_TAG:
+                    if ((more = d->nbits >= 1)) {
+                        d->hs_state = ota_hs_take(d, 1) ? HS_LITERAL : HS_INDEX;
+                    }
+                    break;
+                case HS_LITERAL:
+                    if ((more = d->nbits >= 8)) {
+                        err = ota_hs_output(d, ota_hs_take(d, 8));
+                        d->hs_state = HS_TAG;
+                    }
+                    break;
+                case HS_INDEX:
+                    if ((more = d->nbits >= OTA_HEATSHRINK_WINDOW_BITS)) {
+                        d->hs_index = ota_hs_take(d, OTA_HEATSHRINK_WINDOW_BITS) + 1;
+                        d->hs_state = HS_COUNT;
+                    }
+                    break;
+                case HS_COUNT:
+                    if ((more = d->nbits >= OTA_HEATSHRINK_LOOKAHEAD_BITS)) {
+                        int count = ota_hs_take(d, OTA_HEATSHRINK_LOOKAHEAD_BITS) + 1;
+                        for (int j = 0; j < count && err == ESP_OK; j++) {
+                            err = ota_hs_output(d, d->window[(d->hs_head - d->hs_index) & (HS_WINDOW_SIZE - 1)]);
+                        }
+                        d->hs_state = HS_TAG;
+                    }
+                    break;
+            }
+        }
+    }
+    return err;
+}
+
+ota_decoder_t ota_decoder_create(uint8_t encoding, const esp_partition_t *delta_base, 
+                                 ota_decoder_sink_t sink, void *ctx) {
+    struct ota_decoder *d = calloc(1, sizeof(struct ota_decoder));
+    if (d == NULL) {
+        return NULL;
+    }
+    d->encoding = encoding;
+    d->base = delta_base;
+    d->sink = sink;
+    d->ctx = ctx;
+
+    if (encoding & OTA_ENCODING_HEATSHRINK) {
+        // heatshrink starts with a zeroed window
+        d->window = calloc(1, HS_WINDOW_SIZE);
+        if (d->window == NULL) {
+            free(d);
+            return NULL;
+        }
+    }
+    return d;
+}
+
+esp_err_t ota_decoder_write(ota_decoder_t d, const uint8_t *data, size_t len) {
+    if (d->encoding & OTA_ENCODING_HEATSHRINK) {
+        return ota_hs_write(d, data, len);
+    }
+    return ota_decoder_emit(d, data, len);
+}
+
+esp_err_t ota_decoder_finish(ota_decoder_t d) {
+    esp_err_t err = ESP_OK;
+
+    // anything left in the bit reservoir is padding
+    if (d->out_len > 0) {
+        err = ota_decoder_emit(d, d->out, d->out_len);
+        d->out_len = 0;
+    }
+    if (err == ESP_OK && (d->encoding & OTA_ENCODING_DELTA) && d->delta_state != DELTA_OP) {
+        LOGB_E(TAG, "delta payload truncated");
+        err = ESP_ERR_INVALID_SIZE;
+    }
+    return err;
+}
+
+void ota_decoder_delete(ota_decoder_t d) {
+    free(d->window);
+    free(d);
+}
@@ -0,0 +1,46 @@
+#pragma once
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "esp_err.h"
+#include "esp_partition.h"
+
+// Payload encodings, combinable. When both are set the payload is a heatshrink 
+//  compressed delta ("Content-Encoding: x-ota-delta, heatshrink").
+#define OTA_ENCODING_NONE           0x00
+#define OTA_ENCODING_HEATSHRINK     0x01    // heatshrink -w 10 -l 5
+#define OTA_ENCODING_DELTA          0x02    // x-ota-delta against a base partition
+
+#define OTA_HEATSHRINK_WINDOW_BITS      10
+#define OTA_HEATSHRINK_LOOKAHEAD_BITS   5
+
+// x-ota-delta format: "ODLT", followed by any number of
+//  'C' <u32le offset> <u32le len>    copy len bytes of the base partition from offset
+//  'I' <u32le len> <len bytes>       insert literal bytes
+#define OTA_DELTA_MAGIC "ODLT"
+
+typedef esp_err_t (*ota_decoder_sink_t)(void *ctx, const uint8_t *data, size_t len);
+
+typedef struct ota_decoder * ota_decoder_t;
+
+// Streaming decoder with bounded RAM (the heatshrink window plus small staging 
+//  buffers). Decoded bytes are passed to 'sink'. Returns NULL if out of memory.
+ota_decoder_t ota_decoder_create(uint8_t encoding, const esp_partition_t *delta_base, 
+                                 ota_decoder_sink_t sink, void *ctx);
+
+// Decode an arbitrary length fragment of the payload
+esp_err_t ota_decoder_write(ota_decoder_t decoder, const uint8_t *data, size_t len);
+
+// End of payload. Fails if the stream stopped part way through a delta operation.
+esp_err_t ota_decoder_finish(ota_decoder_t decoder);
+
+void ota_decoder_delete(ota_decoder_t decoder);
+
+#ifdef __cplusplus
+}
+#endif
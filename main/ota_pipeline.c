@@ -0,0 +1,175 @@
+#include <stdlib.h>
+
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "freertos/queue.h"
+#include "freertos/semphr.h"
+
+#include "esp_log.h"
+static const char *TAG = "ota_pipeline";
+
+#include "log_binary.h"
+#include "metrics.h"
+#include "ota_pipeline.h"
+#include "ota_writer.h"
+
+typedef struct {
+    uint8_t *buf;                   // NULL tells the writer task to stop
+    size_t len;
+} ota_chunk_t;
+
+struct ota_pipeline {
+    ota_decoder_t decoder;          // NULL for a plain payload
+    ota_writer_t writer;            // coalesces received chunks into sector writes
+    uint8_t *buffers;               // CONFIG_OTA_PIPELINE_BUFFERS * CONFIG_OTA_PIPELINE_BUFFER_SIZE
+    QueueHandle_t free_queue;       // buffers the reader can fill
+    QueueHandle_t full_queue;       // buffers waiting to be written to flash
+    SemaphoreHandle_t done;
+    volatile esp_err_t err;
+    volatile uint32_t written;      // copy of the writer's byte count for the reader
+};
+
+static esp_err_t ota_pipeline_sink(void *ctx, const uint8_t *data, size_t len) {
+    return ota_writer_write((ota_writer_t)ctx, data, len);
+}
+
+static void ota_pipeline_writer_task(void * param) {
+    struct ota_pipeline *p = param;
+    ota_chunk_t chunk;
+
+    while (1) {
+        if (xQueueReceive(p->full_queue, &chunk, portMAX_DELAY) != pdTRUE) {
+            continue;
+        }
+        if (chunk.buf == NULL) {
+            if (p->err == ESP_OK && p->decoder != NULL) {
+                p->err = ota_decoder_finish(p->decoder);
+            }
+            if (p->err == ESP_OK) {
+                p->err = ota_writer_flush(p->writer);
+            }
+            break;
+        }
+        // after the first failure keep draining, so the reader never blocks waiting
+        //  on a free buffer while the client finishes sending
+        if (p->err == ESP_OK && chunk.len > 0) {
+            esp_err_t err;
+            if (p->decoder != NULL) {
+                err = ota_decoder_write(p->decoder, chunk.buf, chunk.len);
+            } else {
+                err = ota_writer_write(p->writer, chunk.buf, chunk.len);
+            }
+            ota_writer_stats_t stats;
+            ota_writer_get_stats(p->writer, &stats);
+            // together, for ota_pipeline_progress()
+            portENTER_CRITICAL();
+            p->err = err;
+            p->written = stats.bytes;
+            portEXIT_CRITICAL();
+        }
+        xQueueSendToBack(p->free_queue, &chunk.buf, portMAX_DELAY);
+    }
+
+    metrics_task_exit("ota_writer");
+    xSemaphoreGive(p->done);
+    vTaskDelete(NULL);
+}
+
+ota_pipeline_t ota_pipeline_start(const ota_pipeline_config_t *config) {
+    struct ota_pipeline *p = calloc(1, sizeof(struct ota_pipeline));
+    if (p == NULL) {
+        return NULL;
+    }
+    p->err = ESP_OK;
+    p->writer = ota_writer_create(config->partition, config->offset, config->size, 
+        config->validate, config->validate_ctx);
+    if (p->writer != NULL && config->encoding != OTA_ENCODING_NONE) {
+        p->decoder = ota_decoder_create(config->encoding, config->delta_base, ota_pipeline_sink, p->writer);
+    }
+    p->buffers = malloc(CONFIG_OTA_PIPELINE_BUFFERS * CONFIG_OTA_PIPELINE_BUFFER_SIZE);
+    p->free_queue = xQueueCreate(CONFIG_OTA_PIPELINE_BUFFERS, sizeof(uint8_t *));
+    // one extra slot for the stop marker
+    p->full_queue = xQueueCreate(CONFIG_OTA_PIPELINE_BUFFERS + 1, sizeof(ota_chunk_t));
+    p->done = xSemaphoreCreateBinary();
+
+    if (p->writer == NULL || (config->encoding != OTA_ENCODING_NONE && p->decoder == NULL) || 
+        p->buffers == NULL || p->free_queue == NULL || p->full_queue == NULL || p->done == NULL) {
+        LOGB_E(TAG, "out of memory allocating %d x %d byte buffers", 
+            CONFIG_OTA_PIPELINE_BUFFERS, CONFIG_OTA_PIPELINE_BUFFER_SIZE);
+        goto fail;
+    }
+
+    for (int i = 0; i < CONFIG_OTA_PIPELINE_BUFFERS; i++) {
+        uint8_t *buf = p->buffers + i * CONFIG_OTA_PIPELINE_BUFFER_SIZE;
+        xQueueSendToBack(p->free_queue, &buf, 0);
+    }
+
+    if (xTaskCreate(&ota_pipeline_writer_task, "ota_writer", CONFIG_OTA_PIPELINE_TASK_STACK, p, 
+            CONFIG_OTA_PIPELINE_TASK_PRIORITY, NULL) != pdPASS) {
+        LOGB_E(TAG, "unable to create writer task");
+        goto fail;
+    }
+
+    return p;
+
+fail:
+    if (p->done)        vSemaphoreDelete(p->done);
+    if (p->full_queue)  vQueueDelete(p->full_queue);
+    if (p->free_queue)  vQueueDelete(p->free_queue);
+    free(p->buffers);
+    if (p->decoder)     ota_decoder_delete(p->decoder);
+    if (p->writer)      ota_writer_delete(p->writer);
+    free(p);
+    return NULL;
+}
+
+uint8_t *ota_pipeline_acquire(ota_pipeline_t p, size_t *size) {
+    uint8_t *buf = NULL;
+    xQueueReceive(p->free_queue, &buf, portMAX_DELAY);
+    *size = CONFIG_OTA_PIPELINE_BUFFER_SIZE;
+    return buf;
+}
+
+void ota_pipeline_submit(ota_pipeline_t p, uint8_t *buf, size_t len) {
+    ota_chunk_t chunk = { .buf = buf, .len = len };
+    xQueueSendToBack(p->full_queue, &chunk, portMAX_DELAY);
+}
+
+esp_err_t ota_pipeline_status(ota_pipeline_t p) {
+    return p->err;
+}
+
+uint32_t ota_pipeline_written(ota_pipeline_t p) {
+    return p->written;
+}
+
+esp_err_t ota_pipeline_progress(ota_pipeline_t p, uint32_t *written) {
+    portENTER_CRITICAL();
+    esp_err_t err = p->err;
+    *written = p->written;
+    portEXIT_CRITICAL();
+    return err;
+}
+
+esp_err_t ota_pipeline_finish(ota_pipeline_t p, ota_writer_stats_t *stats) {
+    ota_chunk_t stop = { .buf = NULL, .len = 0 };
+    xQueueSendToBack(p->full_queue, &stop, portMAX_DELAY);
+    xSemaphoreTake(p->done, portMAX_DELAY);
+
+    esp_err_t err = p->err;
+    if (stats != NULL) {
+        ota_writer_get_stats(p->writer, stats);
+    }
+
+    vSemaphoreDelete(p->done);
+    vQueueDelete(p->full_queue);
+    vQueueDelete(p->free_queue);
+    free(p->buffers);
+    if (p->decoder != NULL) {
+        ota_decoder_delete(p->decoder);
+    }
+    ota_writer_delete(p->writer);
+    free(p);
+
+    return err;
+}
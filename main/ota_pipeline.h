@@ -0,0 +1,58 @@
+#pragma once
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "esp_err.h"
+#include "esp_partition.h"
+
+#include "ota_decoder.h"
+#include "ota_writer.h"
+
+typedef struct ota_pipeline * ota_pipeline_t;
+
+typedef struct {
+    const esp_partition_t *partition;       // written from the sector aligned 'offset' on
+    size_t offset;
+    size_t size;                            // of the (decoded) image, for erase ahead. 0 if unknown
+    uint8_t encoding;                       // OTA_ENCODING_* of the received payload
+    const esp_partition_t *delta_base;      // for OTA_ENCODING_DELTA
+    ota_writer_validate_t validate;         // checks the start of the decoded image. may be NULL
+    void *validate_ctx;
+} ota_pipeline_config_t;
+
+// Allocate CONFIG_OTA_PIPELINE_BUFFERS receive buffers and start a writer task that
+//  drains filled buffers through the payload decoder and an ota_writer into the 
+//  partition. Returns NULL if out of memory.
+ota_pipeline_t ota_pipeline_start(const ota_pipeline_config_t *config);
+
+// Block until a free buffer is available. 'size' is set to the buffer capacity.
+uint8_t *ota_pipeline_acquire(ota_pipeline_t pipeline, size_t *size);
+
+// Hand a buffer obtained from ota_pipeline_acquire() to the writer task. 
+//  A 'len' of 0 just returns the buffer to the free list.
+void ota_pipeline_submit(ota_pipeline_t pipeline, uint8_t *buf, size_t len);
+
+// First write error seen by the writer task so far (non-blocking).
+esp_err_t ota_pipeline_status(ota_pipeline_t pipeline);
+
+// Bytes the writer task has put on flash so far (non-blocking). A whole number of
+//  sectors until ota_pipeline_finish() writes the tail.
+uint32_t ota_pipeline_written(ota_pipeline_t pipeline);
+
+// Both of the above, read together: 'written' never includes data the error was for,
+//  so it is safe to record as a resumable upload's high-water mark
+esp_err_t ota_pipeline_progress(ota_pipeline_t pipeline, uint32_t *written);
+
+// Wait for all submitted buffers to be written, flush the partial last sector, stop the
+//  writer task and free the buffers. Returns the first write error, if any. 'stats' 
+//  (optional) receives the flash write counters.
+esp_err_t ota_pipeline_finish(ota_pipeline_t pipeline, ota_writer_stats_t *stats);
+
+#ifdef __cplusplus
+}
+#endif
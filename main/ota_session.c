@@ -0,0 +1,141 @@
+#include <string.h>
+
+#include "esp_system.h"
+#include "nvs.h"
+#include "mbedtls/sha256.h"
+
+#include "esp_log.h"
+static const char *TAG = "ota_session";
+
+#include "log_binary.h"
+#include "ota_session.h"
+
+#define OTA_SESSION_NAMESPACE   "ota_session"
+
+// everything but the high-water mark is written once per session, in one blob. 
+//  'committed' has its own key as it is rewritten after every sector
+typedef struct {
+    uint32_t id;
+    uint32_t address;
+    uint32_t length;
+    uint8_t has_sha256;
+    uint8_t sha256[32];
+} ota_session_blob_t;
+
+esp_err_t ota_session_load(ota_session_t *session) {
+    nvs_handle handle;
+    esp_err_t err = nvs_open(OTA_SESSION_NAMESPACE, NVS_READONLY, &handle);
+    if (err != ESP_OK) {
+        return ESP_ERR_NOT_FOUND;
+    }
+
+    ota_session_blob_t blob;
+    size_t size = sizeof(blob);
+    err = nvs_get_blob(handle, "session", &blob, &size);
+    if (err == ESP_OK && size != sizeof(blob)) {
+        err = ESP_ERR_INVALID_SIZE;
+    }
+    if (err == ESP_OK) {
+        err = nvs_get_u32(handle, "committed", &session->committed);
+    }
+    nvs_close(handle);
+
+    if (err != ESP_OK) {
+        return ESP_ERR_NOT_FOUND;
+    }
+    session->id = blob.id;
+    session->address = blob.address;
+    session->length = blob.length;
+    session->has_sha256 = blob.has_sha256;
+    memcpy(session->sha256, blob.sha256, sizeof(session->sha256));
+    return ESP_OK;
+}
+
+esp_err_t ota_session_begin(ota_session_t *session, const esp_partition_t *partition, 
+        uint32_t length, const uint8_t *sha256) {
+    ota_session_blob_t blob = {
+        .id = esp_random(),
+        .address = partition->address,
+        .length = length,
+        .has_sha256 = (sha256 != NULL),
+    };
+    if (sha256 != NULL) {
+        memcpy(blob.sha256, sha256, sizeof(blob.sha256));
+    }
+
+    nvs_handle handle;
+    esp_err_t err = nvs_open(OTA_SESSION_NAMESPACE, NVS_READWRITE, &handle);
+    if (err != ESP_OK) {
+        LOGB_E(TAG, "nvs_open err %d", err);
+        return err;
+    }
+    // committed first, so a stale high-water mark can never pair with the new session
+    err = nvs_set_u32(handle, "committed", 0);
+    if (err == ESP_OK) {
+        err = nvs_set_blob(handle, "session", &blob, sizeof(blob));
+    }
+    if (err == ESP_OK) {
+        err = nvs_commit(handle);
+    }
+    nvs_close(handle);
+
+    if (err != ESP_OK) {
+        LOGB_E(TAG, "unable to store session err %d", err);
+        return err;
+    }
+    session->id = blob.id;
+    session->address = blob.address;
+    session->length = length;
+    session->committed = 0;
+    session->has_sha256 = blob.has_sha256;
+    memcpy(session->sha256, blob.sha256, sizeof(session->sha256));
+    LOGB_I(TAG, "session %08x started for %d bytes", session->id, length);
+    return ESP_OK;
+}
+
+esp_err_t ota_session_commit(ota_session_t *session, uint32_t committed) {
+    nvs_handle handle;
+    esp_err_t err = nvs_open(OTA_SESSION_NAMESPACE, NVS_READWRITE, &handle);
+    if (err != ESP_OK) {
+        return err;
+    }
+    err = nvs_set_u32(handle, "committed", committed);
+    if (err == ESP_OK) {
+        err = nvs_commit(handle);
+    }
+    nvs_close(handle);
+
+    if (err == ESP_OK) {
+        session->committed = committed;
+    } else {
+        LOGB_E(TAG, "unable to store offset %d err %d", committed, err);
+    }
+    return err;
+}
+
+void ota_session_clear(void) {
+    nvs_handle handle;
+    if (nvs_open(OTA_SESSION_NAMESPACE, NVS_READWRITE, &handle) == ESP_OK) {
+        nvs_erase_key(handle, "session");
+        nvs_erase_key(handle, "committed");
+        nvs_commit(handle);
+        nvs_close(handle);
+    }
+}
+
+esp_err_t ota_session_digest(const esp_partition_t *partition, uint32_t length, uint8_t *sha256) {
+    uint8_t buf[256];
+    mbedtls_sha256_context sha;
+    esp_err_t err = ESP_OK;
+
+    mbedtls_sha256_init(&sha);
+    mbedtls_sha256_starts_ret(&sha, 0);
+    for (uint32_t offset = 0; offset < length && err == ESP_OK; offset += sizeof(buf)) {
+        size_t n = (length - offset < sizeof(buf)) ? length - offset : sizeof(buf);
+        err = esp_partition_read(partition, offset, buf, n);
+        mbedtls_sha256_update_ret(&sha, buf, n);
+    }
+    mbedtls_sha256_finish_ret(&sha, sha256);
+    mbedtls_sha256_free(&sha);
+    return err;
+}
@@ -0,0 +1,43 @@
+#pragma once
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "esp_err.h"
+#include "esp_partition.h"
+
+// A resumable upload. Kept in NVS so an interrupted transfer, or a restart, carries 
+//  on from 'committed' instead of erasing and receiving the whole image again.
+typedef struct {
+    uint32_t id;                // random, handed to the client in X-OTA-Session
+    uint32_t address;           // of the partition it is written to
+    uint32_t length;            // size of the complete image
+    uint32_t committed;         // bytes known to be on flash. whole sectors until complete
+    bool has_sha256;
+    uint8_t sha256[32];         // expected digest of the complete image
+} ota_session_t;
+
+// Load the stored session. ESP_ERR_NOT_FOUND if there is none
+esp_err_t ota_session_load(ota_session_t *session);
+
+// Replace any stored session with a new one for an image of 'length' bytes, written to
+//  'partition'. 'sha256' may be NULL
+esp_err_t ota_session_begin(ota_session_t *session, const esp_partition_t *partition, 
+    uint32_t length, const uint8_t *sha256);
+
+// Persist a new high-water mark
+esp_err_t ota_session_commit(ota_session_t *session, uint32_t committed);
+
+void ota_session_clear(void);
+
+// SHA-256 of the first 'length' bytes of 'partition', read back from flash
+esp_err_t ota_session_digest(const esp_partition_t *partition, uint32_t length, uint8_t *sha256);
+
+#ifdef __cplusplus
+}
+#endif
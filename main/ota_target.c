@@ -0,0 +1,146 @@
+#include <string.h>
+
+#include "esp_image_format.h"
+#include "esp_ota_ops.h"
+
+#include "esp_log.h"
+static const char *TAG = "ota_target";
+
+#include "log_binary.h"
+#include "ota_target.h"
+
+// state word at the start of an NVS page, as the nvs_flash component writes it
+#define NVS_PAGE_STATE_ACTIVE   0xfffffffe
+#define NVS_PAGE_STATE_FULL     0xfffffffc
+
+// the ESP8266 maps flash at 0x40200000. an image's entry point is 0x10 into it
+#define APP_ENTRY_BASE          0x40200010
+
+static const ota_target_rule_t ota_target_builtin[] = {
+    { ESP_PARTITION_TYPE_APP, ESP_PARTITION_SUBTYPE_ANY, ota_target_validate_app,
+        OTA_TARGET_BOOT | OTA_TARGET_RESTART | OTA_TARGET_DELTA },
+    // nvs_flash_init() has the page state cached, so the new contents only count after a restart
+    { ESP_PARTITION_TYPE_DATA, ESP_PARTITION_SUBTYPE_DATA_NVS, ota_target_validate_nvs,
+        OTA_TARGET_RESTART },
+};
+
+static const ota_target_rule_t *ota_target_rules[OTA_TARGET_RULES_MAX];
+static uint8_t ota_target_rule_count;
+
+esp_err_t ota_target_register(const ota_target_rule_t *rule) {
+    if (ota_target_rule_count == OTA_TARGET_RULES_MAX) {
+        return ESP_ERR_NO_MEM;
+    }
+    ota_target_rules[ota_target_rule_count++] = rule;
+    return ESP_OK;
+}
+
+// registered rules first, newest first, then the built-in ones
+static const ota_target_rule_t *ota_target_rule(int i) {
+    if (i < ota_target_rule_count) {
+        return ota_target_rules[ota_target_rule_count - 1 - i];
+    }
+    i -= ota_target_rule_count;
+    return (i < (int)(sizeof(ota_target_builtin) / sizeof(ota_target_builtin[0]))) ? &ota_target_builtin[i] : NULL;
+}
+
+esp_err_t ota_target_find(const char *label, size_t len, ota_target_t *target) {
+    char name[OTA_TARGET_LABEL_MAX + 1];
+    const ota_target_rule_t *rule;
+
+    target->partition = NULL;
+    target->rule = NULL;
+    if (label == NULL) {
+        target->partition = esp_partition_find_first(ESP_PARTITION_TYPE_APP, ESP_PARTITION_SUBTYPE_APP_OTA_1, NULL);
+        target->rule = &ota_target_builtin[0];
+    }
+    else if (len == 0 || len > OTA_TARGET_LABEL_MAX) {
+        return ESP_ERR_NOT_FOUND;
+    }
+    else {
+        memcpy(name, label, len);
+        name[len] = '\0';
+        for (int i = 0; (rule = ota_target_rule(i)) != NULL && target->partition == NULL; i++) {
+            target->partition = esp_partition_find_first(rule->type, rule->subtype, name);
+            target->rule = rule;
+        }
+        if (target->partition == NULL) {
+            bool exists = esp_partition_find_first(ESP_PARTITION_TYPE_APP, ESP_PARTITION_SUBTYPE_ANY, name) != NULL ||
+                esp_partition_find_first(ESP_PARTITION_TYPE_DATA, ESP_PARTITION_SUBTYPE_ANY, name) != NULL;
+            LOGB_E(TAG, "partition '%s' %s", name, exists ? "can't be written over the air" : "not found");
+            return exists ? ESP_ERR_NOT_SUPPORTED : ESP_ERR_NOT_FOUND;
+        }
+    }
+
+    if (target->partition == NULL) {
+        return ESP_ERR_NOT_FOUND;
+    }
+    if (target->partition == esp_ota_get_running_partition()) {
+        LOGB_E(TAG, "partition '%s' is running", target->partition->label);
+        target->partition = NULL;
+        return ESP_ERR_INVALID_STATE;
+    }
+    return ESP_OK;
+}
+
+esp_err_t ota_target_install(const ota_target_t *target, uint32_t length) {
+    const esp_partition_t *partition = target->partition;
+
+    if (target->rule->flags & OTA_TARGET_BOOT) {
+        // without esp_ota_begin() there is no esp_ota_end(); esp_ota_set_boot_partition()
+        //  verifies the image itself
+        return esp_ota_set_boot_partition(partition);
+    }
+
+    uint32_t end = (length + OTA_WRITER_SECTOR_SIZE - 1) & ~(OTA_WRITER_SECTOR_SIZE - 1);
+    if (end < partition->size) {
+        esp_err_t err = esp_partition_erase_range(partition, end, partition->size - end);
+        if (err != ESP_OK) {
+            LOGB_E(TAG, "esp_partition_erase_range err %d at 0x%x", err, end);
+            return err;
+        }
+    }
+    LOGB_I(TAG, "Partition '%s' written, %d bytes", partition->label, length);
+    return ESP_OK;
+}
+
+esp_err_t ota_target_validate_app(const uint8_t *data, size_t len, void *ctx) {
+    const esp_partition_t *partition = ctx;
+    esp_image_header_t check_header;
+
+    if (len < sizeof(esp_image_header_t)) {
+        LOGB_E(TAG, "OTA image too short (%d bytes)", len);
+        return ESP_ERR_OTA_VALIDATE_FAILED;
+    }
+    memcpy(&check_header, data, sizeof(esp_image_header_t));
+    // unsigned like the partition bounds: an entry below the base wraps past the end
+    uint32_t entry = check_header.entry_addr - APP_ENTRY_BASE;
+
+    if (check_header.magic != 0xE9) {
+        LOGB_E(TAG, "OTA image has invalid magic byte (expected 0xE9, saw 0x%x)", check_header.magic);
+        return ESP_ERR_OTA_VALIDATE_FAILED;
+    }
+    else if ( (entry < partition->address)  ||
+        (entry > partition->address + partition->size) ) {
+        LOGB_E(TAG, "OTA binary start entry 0x%x, partition start from 0x%x to 0x%x", entry,
+            partition->address, partition->address + partition->size);
+        return ESP_ERR_OTA_VALIDATE_FAILED;
+    }
+    return ESP_OK;
+}
+
+esp_err_t ota_target_validate_nvs(const uint8_t *data, size_t len, void *ctx) {
+    uint32_t state;
+
+    // a generated image has at least one page in use, and it comes first
+    if (len < sizeof(state)) {
+        LOGB_E(TAG, "NVS image too short (%d bytes)", len);
+        return ESP_ERR_OTA_VALIDATE_FAILED;
+    }
+    memcpy(&state, data, sizeof(state));
+    if (state != NVS_PAGE_STATE_ACTIVE && state != NVS_PAGE_STATE_FULL) {
+        LOGB_E(TAG, "not an NVS image, first page state 0x%x", state);
+        return ESP_ERR_OTA_VALIDATE_FAILED;
+    }
+    return ESP_OK;
+}
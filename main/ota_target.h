@@ -0,0 +1,64 @@
+#pragma once
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "esp_err.h"
+#include "esp_partition.h"
+
+#include "ota_writer.h"
+
+// Where an upload is written. POST /send and GET /ws pick one by partition label
+//  (?part=homekit), and every target goes through the same pipeline; what differs is
+//  how its start is checked and what happens once it is complete. That comes from the
+//  rule for its partition type, so a partition without one can't be written at all.
+//  App slots and NVS have built-in rules; others are added with ota_target_register().
+
+#define OTA_TARGET_LABEL_MAX 16
+
+// ota_target_rule_t.flags
+#define OTA_TARGET_BOOT     (1 << 0)    // an app image; made the boot partition once complete
+#define OTA_TARGET_RESTART  (1 << 1)    // the running app has it open; restart once written
+#define OTA_TARGET_DELTA    (1 << 2)    // may be sent as a delta against the running app
+
+typedef struct {
+    esp_partition_type_t type;
+    esp_partition_subtype_t subtype;    // or ESP_PARTITION_SUBTYPE_ANY
+    ota_writer_validate_t validate;     // given the target partition as 'ctx'. may be NULL
+    uint8_t flags;                      // OTA_TARGET_*
+} ota_target_rule_t;
+
+typedef struct {
+    const esp_partition_t *partition;
+    const ota_target_rule_t *rule;
+} ota_target_t;
+
+// Add a rule, checked before the built-in ones. 'rule' must outlive the app.
+//  ESP_ERR_NO_MEM if there are already OTA_TARGET_RULES_MAX
+#define OTA_TARGET_RULES_MAX 4
+esp_err_t ota_target_register(const ota_target_rule_t *rule);
+
+// The partition labelled 'label' ('len' bytes, not terminated), or the main app slot
+//  (ota_1) if 'label' is NULL. ESP_ERR_NOT_FOUND if there is no such partition,
+//  ESP_ERR_NOT_SUPPORTED if no rule covers it, ESP_ERR_INVALID_STATE if it is the
+//  partition running. 'target->partition' is NULL after any error
+esp_err_t ota_target_find(const char *label, size_t len, ota_target_t *target);
+
+// After a complete upload of 'length' bytes has passed every check: an app slot becomes
+//  the boot partition; anything else has the rest of the partition erased, so nothing
+//  left over from before follows the new data
+esp_err_t ota_target_install(const ota_target_t *target, uint32_t length);
+
+// ota_writer_validate_t for app images
+esp_err_t ota_target_validate_app(const uint8_t *data, size_t len, void *ctx);
+
+// ota_writer_validate_t for NVS partition images, such as nvs_partition_gen.py makes
+esp_err_t ota_target_validate_nvs(const uint8_t *data, size_t len, void *ctx);
+
+#ifdef __cplusplus
+}
+#endif
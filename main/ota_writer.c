@@ -0,0 +1,234 @@
+#include <stdlib.h>
+#include <string.h>
+
+#include "esp_timer.h"
+#include "mbedtls/sha256.h"
+
+#include "esp_log.h"
+static const char *TAG = "ota_writer";
+
+#include "log_binary.h"
+#include "metrics.h"
+#include "ota_writer.h"
+
+struct ota_writer {
+    const esp_partition_t *partition;
+    size_t offset;                              // next partition offset to write
+    size_t erased;                              // erased from 'offset' up to here
+    size_t erase_limit;                         // end of the image, rounded up to a sector
+    uint32_t ahead_hash;                        // what the sector erased ahead held
+    uint8_t changed;                            // sectors changed in a row, counted up to 2
+    ota_writer_validate_t validate;             // cleared once it has been called
+    void *validate_ctx;
+    size_t fill;                                // bytes currently buffered in 'sector'
+    ota_writer_stats_t stats;
+    mbedtls_sha256_context sha;
+    uint8_t sector[OTA_WRITER_SECTOR_SIZE];
+};
+
+static esp_err_t ota_writer_erase(ota_writer_t w) {
+    int64_t start = esp_timer_get_time();
+    esp_err_t err = esp_partition_erase_range(w->partition, w->erased, OTA_WRITER_SECTOR_SIZE);
+    w->stats.erase_time_us += (uint32_t)(esp_timer_get_time() - start);
+    w->stats.erases++;
+
+    if (err != ESP_OK) {
+        LOGB_E(TAG, "esp_partition_erase_range err %d at 0x%x", err, w->erased);
+    }
+    w->erased += OTA_WRITER_SECTOR_SIZE;
+    return err;
+}
+
+#if CONFIG_OTA_SKIP_UNCHANGED_SECTORS
+// true if flash at the write cursor already holds 'data'
+static bool ota_writer_unchanged(ota_writer_t w, const uint8_t *data, size_t len) {
+    uint8_t flash[256];
+    bool same = true;
+
+    int64_t start = esp_timer_get_time();
+    for (size_t i = 0; i < len && same; i += sizeof(flash)) {
+        size_t n = (len - i < sizeof(flash)) ? len - i : sizeof(flash);
+        same = esp_partition_read(w->partition, w->offset + i, flash, n) == ESP_OK && 
+            memcmp(flash, data + i, n) == 0;
+    }
+    w->stats.compare_time_us += (uint32_t)(esp_timer_get_time() - start);
+    return same;
+}
+
+// FNV-1a. only used to tell whether a sector erased ahead would have been unchanged
+static uint32_t ota_writer_hash(uint32_t hash, const uint8_t *data, size_t len) {
+    for (size_t i = 0; i < len; i++) {
+        hash = (hash ^ data[i]) * 16777619;
+    }
+    return hash;
+}
+
+static uint32_t ota_writer_hash_flash(ota_writer_t w, size_t offset) {
+    uint8_t flash[256];
+    uint32_t hash = 2166136261;
+
+    int64_t start = esp_timer_get_time();
+    for (size_t i = 0; i < OTA_WRITER_SECTOR_SIZE; i += sizeof(flash)) {
+        if (esp_partition_read(w->partition, offset + i, flash, sizeof(flash)) != ESP_OK) {
+            break;
+        }
+        hash = ota_writer_hash(hash, flash, sizeof(flash));
+    }
+    w->stats.compare_time_us += (uint32_t)(esp_timer_get_time() - start);
+    return hash;
+}
+#endif
+
+// only ever called at sector boundaries; the tail is the last write of an upload
+static esp_err_t ota_writer_issue(ota_writer_t w, const void *data, size_t len) {
+    esp_err_t err = ESP_OK;
+    bool erased_ahead = (w->offset < w->erased);
+    if (w->validate != NULL) {
+        err = w->validate(data, len, w->validate_ctx);
+        w->validate = NULL;
+        if (err != ESP_OK) {
+            return err;
+        }
+    }
+
+#if CONFIG_OTA_SKIP_UNCHANGED_SECTORS
+    // a sector erased ahead has nothing left to compare against
+    if (!erased_ahead && ota_writer_unchanged(w, data, len)) {
+        w->offset += len;
+        w->erased = w->offset;
+        w->changed = 0;
+        w->stats.skipped++;
+        w->stats.bytes += len;
+        return ESP_OK;
+    }
+#endif
+
+    int64_t sector_start = esp_timer_get_time();
+    if (w->offset == w->erased) {
+        err = ota_writer_erase(w);
+    }
+    if (err == ESP_OK) {
+        int64_t start = esp_timer_get_time();
+        err = esp_partition_write(w->partition, w->offset, data, len);
+        w->stats.write_time_us += (uint32_t)(esp_timer_get_time() - start);
+        metrics_flash_write((uint32_t)(esp_timer_get_time() - sector_start));
+    }
+    // a sector that didn't make it isn't counted, so a resumable upload's high-water 
+    //  mark never passes it
+    if (err != ESP_OK) {
+        LOGB_E(TAG, "flash write err %d after %d bytes", err, w->stats.bytes);
+        return err;
+    }
+    w->offset += len;
+
+    w->stats.writes++;
+    w->stats.bytes += len;
+    if (w->stats.min_write == 0 || len < w->stats.min_write) {
+        w->stats.min_write = len;
+    }
+    if (len > w->stats.max_write) {
+        w->stats.max_write = len;
+    }
+
+#if CONFIG_OTA_SKIP_UNCHANGED_SECTORS
+    // a sector erased ahead that turns out to have held the same data wasn't a change
+    if (erased_ahead && ota_writer_hash(2166136261, data, len) == w->ahead_hash) {
+        w->changed = 0;
+    } else if (w->changed < 2) {
+        w->changed++;
+    }
+#endif
+
+    // erase the next sector now, while the reader is still receiving its data, so 
+    //  the next write doesn't wait for it
+    if (w->offset == w->erased && w->erased < w->erase_limit) {
+#if CONFIG_OTA_SKIP_UNCHANGED_SECTORS
+        // that loses the chance to compare it, so only once changes run on, two sectors 
+        //  in a row: a lone changed sector costs one erase and one write
+        if (w->changed == 2) {
+            w->ahead_hash = ota_writer_hash_flash(w, w->erased);
+            err = ota_writer_erase(w);
+        }
+#else
+        err = ota_writer_erase(w);
+#endif
+    }
+    return err;
+}
+
+ota_writer_t ota_writer_create(const esp_partition_t *partition, size_t offset, size_t size,
+        ota_writer_validate_t validate, void *validate_ctx) {
+    if (offset % OTA_WRITER_SECTOR_SIZE != 0) {
+        LOGB_E(TAG, "offset 0x%x not sector aligned", offset);
+        return NULL;
+    }
+    struct ota_writer *w = calloc(1, sizeof(struct ota_writer));
+    if (w == NULL) {
+        LOGB_E(TAG, "out of memory allocating sector buffer");
+        return NULL;
+    }
+    w->partition = partition;
+    w->offset = offset;
+    w->erased = offset;
+    w->erase_limit = (size != 0) ? 
+        (size + OTA_WRITER_SECTOR_SIZE - 1) / OTA_WRITER_SECTOR_SIZE * OTA_WRITER_SECTOR_SIZE : 
+        partition->size;
+    w->validate = validate;
+    w->validate_ctx = validate_ctx;
+    mbedtls_sha256_init(&w->sha);
+    mbedtls_sha256_starts_ret(&w->sha, 0);
+    return w;
+}
+
+esp_err_t ota_writer_write(ota_writer_t w, const void *data, size_t len) {
+    const uint8_t *p = data;
+    esp_err_t err = ESP_OK;
+
+    // hashed here, while the reader is already waiting on the next segment, so
+    //  verification never needs a second pass over the partition
+    mbedtls_sha256_update_ret(&w->sha, data, len);
+
+    while (len > 0 && err == ESP_OK) {
+        // a whole sector in the caller's buffer and nothing pending; write it without copying
+        if (w->fill == 0 && len >= OTA_WRITER_SECTOR_SIZE) {
+            err = ota_writer_issue(w, p, OTA_WRITER_SECTOR_SIZE);
+            p += OTA_WRITER_SECTOR_SIZE;
+            len -= OTA_WRITER_SECTOR_SIZE;
+            continue;
+        }
+
+        size_t n = OTA_WRITER_SECTOR_SIZE - w->fill;
+        if (n > len) {
+            n = len;
+        }
+        memcpy(w->sector + w->fill, p, n);
+        w->fill += n;
+        p += n;
+        len -= n;
+
+        if (w->fill == OTA_WRITER_SECTOR_SIZE) {
+            err = ota_writer_issue(w, w->sector, OTA_WRITER_SECTOR_SIZE);
+            w->fill = 0;
+        }
+    }
+    return err;
+}
+
+esp_err_t ota_writer_flush(ota_writer_t w) {
+    esp_err_t err = ESP_OK;
+    if (w->fill > 0) {
+        err = ota_writer_issue(w, w->sector, w->fill);
+        w->fill = 0;
+    }
+    mbedtls_sha256_finish_ret(&w->sha, w->stats.sha256);
+    return err;
+}
+
+void ota_writer_get_stats(ota_writer_t w, ota_writer_stats_t *stats) {
+    *stats = w->stats;
+}
+
+void ota_writer_delete(ota_writer_t w) {
+    mbedtls_sha256_free(&w->sha);
+    free(w);
+}
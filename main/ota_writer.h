@@ -0,0 +1,56 @@
+#pragma once
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "esp_err.h"
+#include "esp_partition.h"
+
+#define OTA_WRITER_SECTOR_SIZE 4096
+
+typedef struct ota_writer * ota_writer_t;
+
+// Called once with the start of the image (the first sector, or the whole image if 
+//  shorter) before anything is written. Any error aborts the write.
+typedef esp_err_t (*ota_writer_validate_t)(const uint8_t *data, size_t len, void *ctx);
+
+typedef struct {
+    uint32_t writes;            // flash writes issued
+    uint32_t skipped;           // sectors left alone because flash already held the same data
+    uint32_t bytes;             // total bytes now on flash, written or skipped
+    uint32_t min_write;         // smallest single write (only the final tail can be < sector)
+    uint32_t max_write;
+    uint32_t erases;            // sectors erased
+    uint32_t erase_time_us;     // wall time spent in esp_partition_erase_range()
+    uint32_t write_time_us;     // wall time spent in esp_partition_write()
+    uint32_t compare_time_us;   // wall time spent reading back sectors to compare
+    uint8_t sha256[32];         // digest of every byte passed to ota_writer_write(). valid after flush
+} ota_writer_stats_t;
+
+// Accumulates arbitrary length fragments and only issues sector sized, sector aligned 
+//  writes into 'partition' from the sector aligned 'offset' on, hashing the data (SHA-256)
+//  on the way through. Nothing is erased up front; each sector is erased just before it 
+//  is needed and the one after it straight after it is written, up to the end of an 
+//  image of 'size' bytes (0 if not known, e.g. when it is decoded). With 
+//  CONFIG_OTA_SKIP_UNCHANGED_SECTORS, sectors whose content is already on flash are 
+//  skipped, and erasing ahead waits for two changed sectors in a row. Returns NULL if 
+//  the sector buffer can't be allocated. 'validate' may be NULL.
+ota_writer_t ota_writer_create(const esp_partition_t *partition, size_t offset, size_t size,
+    ota_writer_validate_t validate, void *validate_ctx);
+
+esp_err_t ota_writer_write(ota_writer_t writer, const void *data, size_t len);
+
+// Write out any partial sector still buffered and finalize the digest
+esp_err_t ota_writer_flush(ota_writer_t writer);
+
+void ota_writer_get_stats(ota_writer_t writer, ota_writer_stats_t *stats);
+
+void ota_writer_delete(ota_writer_t writer);
+
+#ifdef __cplusplus
+}
+#endif
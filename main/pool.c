@@ -0,0 +1,57 @@
+#include <string.h>
+
+#include "port.h"
+
+#include "pool.h"
+
+void *pool_alloc(pool_t *pool) {
+    void *block = NULL;
+
+    port_critical_enter();
+    if (pool->free_list != NULL) {
+        block = pool->free_list;
+        memcpy(&pool->free_list, block, sizeof(void *));
+    } else if (pool->carved < pool->count) {
+        // untouched storage, so the free list never has to be set up
+        block = pool->storage + pool->carved * pool->block_size;
+        pool->carved++;
+    }
+
+    if (block != NULL) {
+        pool->used++;
+        if (pool->used > pool->peak) {
+            pool->peak = pool->used;
+        }
+    } else {
+        pool->exhausted++;
+    }
+    port_critical_exit();
+    return block;
+}
+
+void pool_free(pool_t *pool, void *block) {
+    if (block == NULL) {
+        return;
+    }
+    port_critical_enter();
+    memcpy(block, &pool->free_list, sizeof(void *));
+    pool->free_list = block;
+    pool->used--;
+    port_critical_exit();
+}
+
+bool pool_owns(const pool_t *pool, const void *block) {
+    const uint8_t *p = block;
+    return p >= pool->storage && p < pool->storage + pool->count * pool->block_size;
+}
+
+void pool_get_stats(const pool_t *pool, pool_stats_t *stats) {
+    port_critical_enter();
+    stats->name = pool->name;
+    stats->block_size = pool->block_size;
+    stats->count = pool->count;
+    stats->used = pool->used;
+    stats->peak = pool->peak;
+    stats->exhausted = pool->exhausted;
+    port_critical_exit();
+}
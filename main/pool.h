@@ -0,0 +1,57 @@
+#pragma once
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+// Fixed size blocks carved out of a static array, so buffers that come and go for as
+//  long as the device runs never fragment the heap, and what they cost shows up in the
+//  link map. Blocks are handed out from a free list; allocation and release are O(1)
+//  and may be called from any task.
+
+#define POOL_ALIGN(size) (((size) + 3) & ~3)
+
+typedef struct {
+    const char *name;
+    uint16_t block_size;
+    uint8_t count;
+    uint8_t carved;             // blocks taken from 'storage' so far. the rest are untouched
+    uint8_t used;
+    uint8_t peak;
+    uint32_t exhausted;         // pool_alloc() calls that found no free block
+    void *free_list;            // released blocks, linked through their first word
+    uint8_t *storage;
+} pool_t;
+
+typedef struct {
+    const char *name;
+    uint16_t block_size;
+    uint8_t count;
+    uint8_t used;
+    uint8_t peak;
+    uint32_t exhausted;
+} pool_stats_t;
+
+// Define 'var', a pool of 'count' blocks of 'size' bytes, and its storage
+#define POOL_DEFINE(var, label, size, n) \
+    static uint8_t var##_storage[(n) * POOL_ALIGN(size)] __attribute__((aligned(4))); \
+    pool_t var = { .name = label, .block_size = POOL_ALIGN(size), .count = (n), .storage = var##_storage }
+
+// A free block, or NULL (counted in 'exhausted') if there is none
+void *pool_alloc(pool_t *pool);
+
+// Give back a block from pool_alloc(). NULL is ignored
+void pool_free(pool_t *pool, void *block);
+
+// Is 'block' one of this pool's
+bool pool_owns(const pool_t *pool, const void *block);
+
+void pool_get_stats(const pool_t *pool, pool_stats_t *stats);
+
+#ifdef __cplusplus
+}
+#endif
@@ -0,0 +1,100 @@
+#pragma once
+
+// The few platform services the server core needs, so server.c, http_parser.c and
+//  sse.c also build against plain POSIX sockets and pthreads (e.g. for load testing 
+//  on Linux). CONFIG_* values are then passed on the compiler command line.
+
+#include <stdint.h>
+
+#ifdef ESP_PLATFORM
+
+#include "freertos/FreeRTOS.h"
+#include "freertos/semphr.h"
+#include "lwip/sockets.h"
+#include "esp_timer.h"
+#include "esp_log.h"
+
+// TCP_KEEPIDLE, TCP_KEEPINTVL and TCP_KEEPCNT are only taken by an lwIP built with it
+#define PORT_TCP_KEEPALIVE LWIP_TCP_KEEPALIVE
+
+typedef SemaphoreHandle_t port_mutex_t;
+
+static inline port_mutex_t port_mutex_create(void) {
+    return xSemaphoreCreateMutex();
+}
+
+static inline void port_mutex_lock(port_mutex_t mutex) {
+    xSemaphoreTake(mutex, portMAX_DELAY);
+}
+
+static inline void port_mutex_unlock(port_mutex_t mutex) {
+    xSemaphoreGive(mutex);
+}
+
+// A few instructions' worth, from any task
+static inline void port_critical_enter(void) {
+    portENTER_CRITICAL();
+}
+
+static inline void port_critical_exit(void) {
+    portEXIT_CRITICAL();
+}
+
+#else
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <errno.h>
+#include <pthread.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <sys/select.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+
+#define PORT_TCP_KEEPALIVE 1
+
+#define ESP_LOGE(tag, fmt, ...) fprintf(stderr, "E %s: " fmt "\n", tag, ##__VA_ARGS__)
+#define ESP_LOGW(tag, fmt, ...) fprintf(stderr, "W %s: " fmt "\n", tag, ##__VA_ARGS__)
+#define ESP_LOGI(tag, fmt, ...) fprintf(stderr, "I %s: " fmt "\n", tag, ##__VA_ARGS__)
+#define ESP_LOGD(tag, fmt, ...) do { } while (0)
+
+static inline int64_t esp_timer_get_time(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (int64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+typedef pthread_mutex_t * port_mutex_t;
+
+static inline port_mutex_t port_mutex_create(void) {
+    port_mutex_t mutex = malloc(sizeof(pthread_mutex_t));
+    if (mutex != NULL) {
+        pthread_mutex_init(mutex, NULL);
+    }
+    return mutex;
+}
+
+static inline void port_mutex_lock(port_mutex_t mutex) {
+    pthread_mutex_lock(mutex);
+}
+
+static inline void port_mutex_unlock(port_mutex_t mutex) {
+    pthread_mutex_unlock(mutex);
+}
+
+// one lock per source file that uses it, which is all pool.c needs
+static pthread_mutex_t port_critical_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+static inline void port_critical_enter(void) {
+    pthread_mutex_lock(&port_critical_mutex);
+}
+
+static inline void port_critical_exit(void) {
+    pthread_mutex_unlock(&port_critical_mutex);
+}
+
+#endif
@@ -0,0 +1,325 @@
+#include <string.h>
+#include <strings.h>
+
+#include "port.h"
+static const char *TAG = "relay";
+
+#include "relay.h"
+
+static bool relay_send_all(int fd, const void *data, size_t len) {
+    const uint8_t *p = data;
+    while (len > 0) {
+        int n = send(fd, p, len, 0);
+        if (n <= 0) {
+            return false;
+        }
+        p += n;
+        len -= n;
+    }
+    return true;
+}
+
+static void relay_set_timeouts(int fd, uint32_t timeout_ms) {
+    struct timeval tv = {
+        .tv_sec = timeout_ms / 1000,
+        .tv_usec = (timeout_ms % 1000) * 1000,
+    };
+    setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+    setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &tv, sizeof(tv));
+}
+
+// Decimal digits at 'p' up to 'end'. Returns the first character after them, or NULL
+//  if there are none or the value doesn't fit
+static const char *relay_parse_uint(const char *p, const char *end, uint32_t *out) {
+    uint64_t n = 0;
+    const char *start = p;
+    for (; p < end && *p >= '0' && *p <= '9'; p++) {
+        n = n * 10 + (*p - '0');
+        if (n > UINT32_MAX) {
+            return NULL;
+        }
+    }
+    *out = n;
+    return (p > start) ? p : NULL;
+}
+
+static bool relay_parse_hex(const char *hex, size_t len, uint8_t *out, size_t out_len) {
+    if (len != out_len * 2) {
+        return false;
+    }
+    for (size_t i = 0; i < len; i++) {
+        char c = hex[i];
+        int v = (c >= '0' && c <= '9') ? c - '0' :
+                (c >= 'a' && c <= 'f') ? c - 'a' + 10 :
+                (c >= 'A' && c <= 'F') ? c - 'A' + 10 : -1;
+        if (v < 0) {
+            return false;
+        }
+        out[i / 2] = (i & 1) ? (out[i / 2] | v) : (v << 4);
+    }
+    return true;
+}
+
+bool relay_parse_range(const char *value, size_t len, uint32_t length, uint32_t *first, uint32_t *last) {
+    const char *p = value;
+    const char *end = value + len;
+    uint32_t a, b;
+
+    if (len < 7 || strncmp(p, "bytes=", 6) != 0 || length == 0) {
+        return false;
+    }
+    p += 6;
+    if (*p == '-') {
+        // the last 'b' bytes
+        p = relay_parse_uint(p + 1, end, &b);
+        if (p != end || b == 0) {
+            return false;
+        }
+        *first = (b < length) ? length - b : 0;
+        *last = length - 1;
+        return true;
+    }
+    p = relay_parse_uint(p, end, &a);
+    if (p == NULL || p == end || *p != '-' || a >= length) {
+        return false;
+    }
+    b = length - 1;
+    if (p + 1 < end) {
+        p = relay_parse_uint(p + 1, end, &b);
+        if (p != end || b < a) {
+            return false;
+        }
+        if (b >= length) {
+            b = length - 1;
+        }
+    }
+    *first = a;
+    *last = b;
+    return true;
+}
+
+bool relay_serve(int fd, const relay_image_t *image, const char *range, size_t range_len,
+        relay_read_t read, void *ctx, uint8_t *buf, size_t size) {
+    char header[256];
+    char sha[65];
+    uint32_t first = 0;
+    uint32_t last = image->length - 1;
+    int len;
+
+    for (int i = 0; i < 32; i++) {
+        sprintf(sha + i * 2, "%02x", image->sha256[i]);
+    }
+    relay_set_timeouts(fd, CONFIG_SERVER_IDLE_TIMEOUT_MS);
+
+    if (range != NULL && !relay_parse_range(range, range_len, image->length, &first, &last)) {
+        len = sprintf(header, "HTTP/1.1 416 Range Not Satisfiable\r\n"
+                              "Content-Range: bytes */%u\r\n"
+                              "Content-Length: 0\r\n\r\n", (unsigned)image->length);
+        return relay_send_all(fd, header, len);
+    }
+
+    len = sprintf(header, "HTTP/1.1 %s\r\n"
+                          "Content-Type: application/octet-stream\r\n"
+                          "Accept-Ranges: bytes\r\n"
+                          "X-Image-SHA256: %s\r\n"
+                          "Content-Length: %u\r\n",
+        (range != NULL) ? "206 Partial Content" : "200 OK", sha, (unsigned)(last + 1 - first));
+    if (range != NULL) {
+        len += sprintf(header + len, "Content-Range: bytes %u-%u/%u\r\n",
+            (unsigned)first, (unsigned)last, (unsigned)image->length);
+    }
+    len += sprintf(header + len, "\r\n");
+    if (!relay_send_all(fd, header, len)) {
+        return false;
+    }
+
+    for (uint32_t offset = first; offset <= last; ) {
+        size_t n = (last + 1 - offset < size) ? last + 1 - offset : size;
+        if (!read(ctx, offset, buf, n)) {
+            ESP_LOGE(TAG, "image read failed at %u", (unsigned)offset);
+            return false;
+        }
+        if (!relay_send_all(fd, buf, n)) {
+            ESP_LOGW(TAG, "client %d left at %u of %u", fd, (unsigned)offset, (unsigned)image->length);
+            return false;
+        }
+        offset += n;
+    }
+    return true;
+}
+
+bool relay_parse_url(const char *url, size_t len, relay_url_t *out) {
+    const char *end = url + len;
+    const char *p = url;
+    char addr[16];
+    uint32_t port = 80;
+
+    if (len < 8 || strncmp(p, "http://", 7) != 0) {
+        return false;
+    }
+    p += 7;
+    const char *host = p;
+    while (p < end && *p != ':' && *p != '/') {
+        p++;
+    }
+    if (p == host || (size_t)(p - host) >= sizeof(addr)) {
+        return false;
+    }
+    memcpy(addr, host, p - host);
+    addr[p - host] = '\0';
+    struct in_addr in;
+    if (inet_aton(addr, &in) == 0) {
+        return false;
+    }
+
+    if (p < end && *p == ':') {
+        p = relay_parse_uint(p + 1, end, &port);
+        if (p == NULL || port == 0 || port > 65535) {
+            return false;
+        }
+    }
+    if (p == end) {
+        p = "/";
+        end = p + 1;
+    }
+    if (*p != '/' || end - p > RELAY_PATH_MAX) {
+        return false;
+    }
+
+    out->addr = in.s_addr;
+    out->port = port;
+    if (port == 80) {
+        strcpy(out->host, addr);
+    } else {
+        sprintf(out->host, "%s:%u", addr, (unsigned)port);
+    }
+    memcpy(out->path, p, end - p);
+    out->path[end - p] = '\0';
+    return true;
+}
+
+// Value of header 'name' in a response header block, or NULL. 'len' gets its length
+static const char *relay_find_header(const char *header, const char *name, size_t *len) {
+    size_t name_len = strlen(name);
+    for (const char *line = strstr(header, "\r\n"); line != NULL; line = strstr(line, "\r\n")) {
+        line += 2;
+        if (strncasecmp(line, name, name_len) == 0 && line[name_len] == ':') {
+            const char *value = line + name_len + 1;
+            while (*value == ' ') {
+                value++;
+            }
+            const char *eol = strstr(value, "\r\n");
+            *len = (eol != NULL) ? (size_t)(eol - value) : strlen(value);
+            return value;
+        }
+    }
+    return NULL;
+}
+
+bool relay_fetch(const relay_url_t *url, uint32_t offset, uint32_t timeout_ms,
+        relay_response_t *response, char *buf, size_t size) {
+    memset(response, 0, sizeof(relay_response_t));
+
+    int fd = socket(AF_INET, SOCK_STREAM, 0);
+    if (fd < 0) {
+        ESP_LOGE(TAG, "socket err: %d", errno);
+        return false;
+    }
+    relay_set_timeouts(fd, timeout_ms);
+
+    struct sockaddr_in addr = { 0 };
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(url->port);
+    addr.sin_addr.s_addr = url->addr;
+    if (connect(fd, (struct sockaddr *)&addr, sizeof(addr)) != 0) {
+        ESP_LOGE(TAG, "connect to %s err: %d", url->host, errno);
+        close(fd);
+        return false;
+    }
+
+    char range[32] = "";
+    if (offset > 0) {
+        sprintf(range, "Range: bytes=%u-\r\n", (unsigned)offset);
+    }
+    int len = snprintf(buf, size, "GET %s HTTP/1.1\r\nHost: %s\r\nConnection: close\r\n%s\r\n",
+        url->path, url->host, range);
+    if (len < 0 || (size_t)len >= size || !relay_send_all(fd, buf, len)) {
+        close(fd);
+        return false;
+    }
+
+    // the header, and whatever of the body comes with it. one byte is kept for a
+    //  terminator so the header can be searched as a string
+    size_t got = 0;
+    char *body = NULL;
+    while (body == NULL) {
+        int n = recv(fd, buf + got, size - 1 - got, 0);
+        if (n <= 0) {
+            ESP_LOGE(TAG, "%s closed before the header", url->host);
+            close(fd);
+            return false;
+        }
+        got += n;
+        buf[got] = '\0';
+        body = strstr(buf, "\r\n\r\n");
+        if (body == NULL && got == size - 1) {
+            ESP_LOGE(TAG, "response header from %s too large", url->host);
+            close(fd);
+            return false;
+        }
+    }
+    body[2] = '\0';                 // the header block ends at its last CRLF
+    response->body_off = body + 4 - buf;
+    response->body_len = got - response->body_off;
+
+    // status line, then the headers that matter
+    uint32_t status = 0;
+    const char *space = strchr(buf, ' ');
+    if (strncmp(buf, "HTTP/1.", 7) != 0 || space == NULL ||
+            relay_parse_uint(space + 1, space + 4, &status) == NULL) {
+        ESP_LOGE(TAG, "bad response from %s", url->host);
+        close(fd);
+        return false;
+    }
+    if (status != ((offset > 0) ? 206 : 200)) {
+        ESP_LOGE(TAG, "%s%s answered %u", url->host, url->path, (unsigned)status);
+        close(fd);
+        return false;
+    }
+
+    size_t value_len;
+    const char *value = relay_find_header(buf, "Content-Length", &value_len);
+    uint32_t content_length;
+    if (value == NULL || relay_parse_uint(value, value + value_len, &content_length) != value + value_len) {
+        ESP_LOGE(TAG, "no Content-Length from %s", url->host);
+        close(fd);
+        return false;
+    }
+    response->length = content_length;
+    if (offset > 0) {
+        // bytes first-last/length
+        uint32_t first, last, length;
+        const char *p;
+        value = relay_find_header(buf, "Content-Range", &value_len);
+        if (value == NULL || value_len < 6 || strncmp(value, "bytes ", 6) != 0 ||
+                (p = relay_parse_uint(value + 6, value + value_len, &first)) == NULL || *p != '-' ||
+                (p = relay_parse_uint(p + 1, value + value_len, &last)) == NULL || *p != '/' ||
+                relay_parse_uint(p + 1, value + value_len, &length) != value + value_len ||
+                first != offset || last + 1 - first != content_length) {
+            ESP_LOGE(TAG, "%s sent the wrong range", url->host);
+            close(fd);
+            return false;
+        }
+        response->length = length;
+    }
+    response->offset = offset;
+
+    value = relay_find_header(buf, "X-Image-SHA256", &value_len);
+    response->has_sha256 = (value != NULL && relay_parse_hex(value, value_len, response->sha256, 32));
+
+    if (response->body_len > content_length) {
+        response->body_len = content_length;
+    }
+    response->fd = fd;
+    return true;
+}
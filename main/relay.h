@@ -0,0 +1,67 @@
+#pragma once
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+// Both ends of a device to device image relay, over plain HTTP/1.1: serving an image
+//  for GET /firmware (with Range), and fetching one from a peer's URL. Only sockets
+//  are used, through port.h, so like server.c this builds on a host, and two instances
+//  with file backed images can be run against each other on loopback.
+
+#define RELAY_HOST_MAX 21           // "255.255.255.255:65535"
+#define RELAY_PATH_MAX 96
+
+// Image being served: its length, and the SHA-256 sent as X-Image-SHA256 so the
+//  fetching end can check what it received end to end
+typedef struct {
+    uint32_t length;
+    uint8_t sha256[32];
+} relay_image_t;
+
+// Fill 'buf' with 'len' bytes of the image from 'offset'. Returns false on a read error
+typedef bool (*relay_read_t)(void *ctx, uint32_t offset, void *buf, size_t len);
+
+// 'bytes=first-last', 'bytes=first-' or 'bytes=-suffix', clamped to 'length'. Returns
+//  false if it isn't one range or can't be satisfied
+bool relay_parse_range(const char *value, size_t len, uint32_t length, uint32_t *first, uint32_t *last);
+
+// Send the whole response to a GET for 'image': 200, 206 for a 'range' header value
+//  (NULL if there is none) or 416. 'buf' is scratch for reading. Blocks until sent;
+//  returns false if the client went away or 'read' failed
+bool relay_serve(int fd, const relay_image_t *image, const char *range, size_t range_len,
+    relay_read_t read, void *ctx, uint8_t *buf, size_t size);
+
+typedef struct {
+    uint32_t addr;                  // IPv4, network order
+    uint16_t port;
+    char host[RELAY_HOST_MAX + 1];  // for the Host header
+    char path[RELAY_PATH_MAX + 1];
+} relay_url_t;
+
+// 'http://a.b.c.d[:port]/path'. No names: there is no DNS on the AP's network
+bool relay_parse_url(const char *url, size_t len, relay_url_t *out);
+
+typedef struct {
+    int fd;
+    uint32_t length;                // of the whole image
+    uint32_t offset;                // of the first body byte
+    bool has_sha256;
+    uint8_t sha256[32];
+    size_t body_off;                // body bytes that came with the header, in the
+    size_t body_len;                //  buffer given to relay_fetch()
+} relay_response_t;
+
+// Connect to 'url' and GET the image from 'offset' on (a Range request unless 0).
+//  'buf' takes the response header. On success 'response->fd' is left open at the
+//  body for the caller to recv() and close(). Sockets time out after 'timeout_ms'
+bool relay_fetch(const relay_url_t *url, uint32_t offset, uint32_t timeout_ms,
+    relay_response_t *response, char *buf, size_t size);
+
+#ifdef __cplusplus
+}
+#endif
@@ -0,0 +1,439 @@
+#include <stdlib.h>
+#include <string.h>
+
+#include "port.h"
+static const char *TAG = "server";
+
+#include "server.h"
+
+static server_conn_t connections[SERVER_MAX_CONNECTIONS];
+
+// one per connection in the middle of a request, and one held by a running upload
+POOL_DEFINE(server_buffer_pool, "conn", SERVER_BUFF_SIZE, CONFIG_SERVER_BUFFER_POOL);
+static const server_handlers_t *handlers;
+
+// Kconfig leaves a bool that is off undefined
+#ifndef CONFIG_SERVER_STATIC_NODELAY
+#define CONFIG_SERVER_STATIC_NODELAY 0
+#endif
+#ifndef CONFIG_SERVER_SSE_NODELAY
+#define CONFIG_SERVER_SSE_NODELAY 0
+#endif
+#ifndef CONFIG_SERVER_UPLOAD_NODELAY
+#define CONFIG_SERVER_UPLOAD_NODELAY 0
+#endif
+
+// without it the probes would only start after lwIP's default of two hours
+#if CONFIG_SERVER_SSE_KEEPALIVE_S > 0 && !PORT_TCP_KEEPALIVE
+#error "CONFIG_SERVER_SSE_KEEPALIVE_S needs lwIP built with LWIP_TCP_KEEPALIVE; set it to 0 otherwise"
+#endif
+
+// once the keepalive idle time has passed: probes this far apart, and how many go 
+//  unanswered before the stack drops the connection
+#define SERVER_KEEPALIVE_INTERVAL_S 2
+#define SERVER_KEEPALIVE_COUNT      3
+
+// socket options per server_role_t
+typedef struct {
+    uint8_t nodelay;
+    uint16_t keepalive_s;       // idle time before the first probe. 0 for none
+} server_profile_t;
+
+static const server_profile_t server_profiles[] = {
+    [SERVER_ROLE_STATIC] = { CONFIG_SERVER_STATIC_NODELAY, 0 },
+    [SERVER_ROLE_SSE]    = { CONFIG_SERVER_SSE_NODELAY, CONFIG_SERVER_SSE_KEEPALIVE_S },
+    [SERVER_ROLE_UPLOAD] = { CONFIG_SERVER_UPLOAD_NODELAY, 0 },
+};
+
+// loopback UDP socket other tasks send a datagram to, to break select() out
+static int wake_socket = -1;
+static struct sockaddr_in wake_addr;
+static volatile bool wake_pending = false;
+
+uint32_t server_now_ms(void) {
+    return (uint32_t)(esp_timer_get_time() / 1000);
+}
+
+void server_wake(void) {
+    if (wake_socket >= 0 && !wake_pending) {
+        wake_pending = true;
+        char c = 0;
+        sendto(wake_socket, &c, 1, 0, (struct sockaddr *)&wake_addr, sizeof(wake_addr));
+    }
+}
+
+void server_set_role(int fd, server_role_t role) {
+    const server_profile_t *profile = &server_profiles[role];
+    int nodelay = profile->nodelay;
+    int err = setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &nodelay, sizeof(nodelay));
+
+    // a role is only ever left for another, never back, so keepalive is not turned off
+#if PORT_TCP_KEEPALIVE
+    if (err == 0 && profile->keepalive_s > 0) {
+        int on = 1;
+        int idle = profile->keepalive_s;
+        int interval = SERVER_KEEPALIVE_INTERVAL_S;
+        int count = SERVER_KEEPALIVE_COUNT;
+        err = setsockopt(fd, SOL_SOCKET, SO_KEEPALIVE, &on, sizeof(on));
+        if (err == 0) {
+            err = setsockopt(fd, IPPROTO_TCP, TCP_KEEPIDLE, &idle, sizeof(idle));
+        }
+        if (err == 0) {
+            err = setsockopt(fd, IPPROTO_TCP, TCP_KEEPINTVL, &interval, sizeof(interval));
+        }
+        if (err == 0) {
+            err = setsockopt(fd, IPPROTO_TCP, TCP_KEEPCNT, &count, sizeof(count));
+        }
+    }
+#endif
+    if (err != 0) {
+        ESP_LOGW(TAG, "client %d: socket options for role %d err: %d", fd, role, errno);
+    }
+}
+
+static server_conn_t *server_conn_open(int fd) {
+    for (int i = 0; i < SERVER_MAX_CONNECTIONS; i++) {
+        server_conn_t *conn = &connections[i];
+        if (conn->state == SERVER_CONN_FREE) {
+            memset(conn, 0, sizeof(server_conn_t));
+            conn->fd = fd;
+            conn->state = SERVER_CONN_REQUEST;
+            conn->last_activity = server_now_ms();
+            return conn;
+        }
+    }
+    return NULL;
+}
+
+static void server_conn_close(server_conn_t *conn) {
+    if (handlers->on_close != NULL) {
+        handlers->on_close(conn);
+    }
+    close(conn->fd);
+    pool_free(&server_buffer_pool, conn->buffer);
+    memset(conn, 0, sizeof(server_conn_t));
+}
+
+static void server_conn_reply(server_conn_t *conn, const char *status) {
+    char response[96];
+    int len = snprintf(response, sizeof(response), 
+        "HTTP/1.1 %s\r\nContent-Length: 0\r\nConnection: close\r\n\r\n", status);
+    send(conn->fd, response, len, 0);
+}
+
+void server_conn_send_static(server_conn_t *conn, const void *data, size_t len) {
+    conn->tx = data;
+    conn->tx_len = len;
+}
+
+// Send what the socket takes of a static body. Returns bytes sent, or -1 on error
+static int server_conn_write(server_conn_t *conn) {
+    int sent = send(conn->fd, conn->tx, conn->tx_len, MSG_DONTWAIT);
+    if (sent < 0) {
+        if (errno == EAGAIN || errno == EWOULDBLOCK) {
+            return 0;
+        }
+        ESP_LOGE(TAG, "client %d send err: %d", conn->fd, errno);
+        return -1;
+    }
+    conn->tx += sent;
+    conn->tx_len -= sent;
+    return sent;
+}
+
+// Returns -1 if the connection should be closed
+static int server_conn_read(server_conn_t *conn) {
+    int len;
+
+    if (conn->state == SERVER_CONN_STREAM) {
+        // nothing is expected from a stream subscriber. just notice it closing
+        char discard[16];
+        len = recv(conn->fd, discard, sizeof(discard), MSG_DONTWAIT);
+        if (len == 0 || (len < 0 && errno != EAGAIN && errno != EWOULDBLOCK)) {
+            ESP_LOGI(TAG, "stream %d closed", conn->fd);
+            return -1;
+        }
+        return 0;
+    }
+
+    if (conn->buffer == NULL) {
+        // first bytes of a new request
+        conn->buffer = pool_alloc(&server_buffer_pool);
+        if (conn->buffer == NULL) {
+            // counted by the pool. the client may try again
+            ESP_LOGE(TAG, "client %d: no free request buffer", conn->fd);
+            server_conn_reply(conn, "503 Service Unavailable");
+            return -1;
+        }
+        conn->len = 0;
+        http_parser_init(&conn->parser, handlers->headers);
+    }
+
+    len = read(conn->fd, conn->buffer + conn->len, SERVER_BUFF_SIZE - conn->len);
+    if (len < 0) {
+        // Read error
+        ESP_LOGE(TAG, "client read err: %d", errno);
+        return -1; 
+    }
+    else if (len == 0) {
+        // Normal connection close from client
+        ESP_LOGI(TAG, "client %d close connection", conn->fd); 
+        return -1;
+    }
+
+    uint32_t now = server_now_ms();
+    conn->last_activity = now;
+    if (conn->request_start == 0) {
+        conn->request_start = now;
+    }
+    conn->len += len;
+
+    http_parse_result_t result = http_parser_feed(&conn->parser, conn->buffer, conn->len);
+    if (result == HTTP_PARSE_INCOMPLETE && conn->len < SERVER_BUFF_SIZE) {
+        // headers split across segments. keep what arrived and wait for the rest
+        return 0;
+    }
+    if (result != HTTP_PARSE_DONE) {
+        ESP_LOGE(TAG, "client %d bad request (%d bytes)", conn->fd, (int)conn->len);
+        server_conn_reply(conn, (result == HTTP_PARSE_INCOMPLETE || result == HTTP_PARSE_TOO_MANY_HEADERS) ? 
+            "431 Request Header Fields Too Large" : "400 Bad Request");
+        return -1;
+    }
+
+    int ret = handlers->on_request(conn);
+    if (ret == SERVER_REQUEST_DETACH) {
+        // socket and buffer now belong to the handler. forget the slot without closing
+        memset(conn, 0, sizeof(server_conn_t));
+        return 0;
+    }
+
+    // request handled. the buffer is only needed again if another request arrives
+    pool_free(&server_buffer_pool, conn->buffer);
+    conn->buffer = NULL;
+    conn->len = 0;
+    conn->request_start = 0;
+    conn->last_activity = server_now_ms();
+    return ret;
+}
+
+// Close connections past their deadline and return the ms until the next deadline
+static uint32_t server_check_timeouts(uint32_t now) {
+    uint32_t next = CONFIG_SERVER_IDLE_TIMEOUT_MS;
+
+    for (int i = 0; i < SERVER_MAX_CONNECTIONS; i++) {
+        server_conn_t *conn = &connections[i];
+        uint32_t deadline;
+
+        if (conn->state == SERVER_CONN_FREE) {
+            continue;
+        }
+        else if (conn->state == SERVER_CONN_REQUEST) {
+            deadline = conn->request_start ? 
+                conn->request_start + CONFIG_SERVER_HEADER_TIMEOUT_MS :
+                conn->last_activity + CONFIG_SERVER_IDLE_TIMEOUT_MS;
+        }
+        else if (handlers->wants_write(conn)) {
+            // stream with data queued that isn't moving
+            deadline = conn->last_activity + CONFIG_SERVER_IDLE_TIMEOUT_MS;
+        }
+        else {
+            uint32_t keepalive = conn->last_activity + CONFIG_SERVER_IDLE_TIMEOUT_MS / 2;
+            if ((int32_t)(now - keepalive) >= 0) {
+                handlers->on_idle(conn);
+                conn->last_activity = now;
+            }
+            deadline = conn->last_activity + CONFIG_SERVER_IDLE_TIMEOUT_MS / 2;
+        }
+
+        if ((int32_t)(now - deadline) >= 0) {
+            ESP_LOGI(TAG, "client %d timed out", conn->fd);
+            server_conn_close(conn);
+            continue;
+        }
+        if (deadline - now < next) {
+            next = deadline - now;
+        }
+    }
+    return next;
+}
+
+static void server_accept(int server_socket) {
+    struct sockaddr_in client_addr;
+    socklen_t client_addrlen = sizeof(client_addr);
+
+    while (1) {
+        int client_fd = accept(server_socket, (struct sockaddr *)&client_addr, &client_addrlen);
+        if (client_fd < 0) {
+            if (errno != EAGAIN && errno != EWOULDBLOCK) {
+                ESP_LOGE(TAG, "accept err: %d", errno);
+            }
+            return;
+        }
+        ESP_LOGI(TAG, "accept() connect from host %s, port %hu", 
+            inet_ntoa (client_addr.sin_addr),  ntohs (client_addr.sin_port));
+
+        if (server_conn_open(client_fd) == NULL) {
+            ESP_LOGE(TAG, "no free connection slot");
+            close(client_fd);
+            continue;
+        }
+
+        // handlers read request bodies with blocking reads; don't let a vanished
+        //  client hold one forever
+        struct timeval tv = {
+            .tv_sec = CONFIG_SERVER_IDLE_TIMEOUT_MS / 1000, 
+            .tv_usec = (CONFIG_SERVER_IDLE_TIMEOUT_MS % 1000) * 1000,
+        };
+        setsockopt(client_fd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+        server_set_role(client_fd, SERVER_ROLE_STATIC);
+    }
+}
+
+void server_run(uint16_t port, const server_handlers_t *h) {
+    int return_code;
+    handlers = h;
+
+    int server_socket = 0;
+    server_socket = socket(AF_INET, SOCK_STREAM, 0);
+    if (server_socket < 0) {
+        ESP_LOGE(TAG, "socket err: %d", errno);
+        return;
+    }
+    ESP_LOGD(TAG, "server socket. port %d. server_fd %d", port, server_socket);
+
+    // Set socket to be nonblocking.
+    int on = 1;
+    return_code = ioctl(server_socket, FIONBIO, (char *)&on);
+    if (return_code < 0) {
+        ESP_LOGE(TAG, "ioctl err: %d", errno);
+        close(server_socket);
+        return;
+    }
+
+    struct sockaddr_in server_addr;
+    server_addr.sin_family = AF_INET;
+    server_addr.sin_port = htons(port);
+    server_addr.sin_addr.s_addr = htonl(INADDR_ANY);
+    if (bind(server_socket, (struct sockaddr *)&server_addr, sizeof(server_addr)) < 0) {
+        ESP_LOGE(TAG, "bind err: %d", errno);
+        close(server_socket);
+        return;
+    }
+    // connections the stack completes before accept() gets to them. lwIP only holds
+    //  to it when built with TCP_LISTEN_BACKLOG
+    if (listen(server_socket, CONFIG_SERVER_LISTEN_BACKLOG) < 0) {
+        ESP_LOGE(TAG, "listen err: %d", errno);
+        close(server_socket);
+        return;
+    }
+
+    wake_socket = socket(AF_INET, SOCK_DGRAM, 0);
+    wake_addr.sin_family = AF_INET;
+    wake_addr.sin_port = 0;
+    wake_addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    socklen_t wake_addrlen = sizeof(wake_addr);
+    if (wake_socket < 0 ||
+        bind(wake_socket, (struct sockaddr *)&wake_addr, sizeof(wake_addr)) < 0 ||
+        getsockname(wake_socket, (struct sockaddr *)&wake_addr, &wake_addrlen) < 0) {
+        ESP_LOGE(TAG, "wake socket err: %d", errno);
+    }
+    ioctl(wake_socket, FIONBIO, (char *)&on);
+
+    if (handlers->on_listening != NULL) {
+        handlers->on_listening();
+    }
+
+    fd_set read_set;
+    fd_set write_set;
+
+    while (1) {
+        uint32_t wait_ms = server_check_timeouts(server_now_ms());
+
+        // build the interest sets from the connection table, not from FD_SETSIZE
+        FD_ZERO (&read_set);
+        FD_ZERO (&write_set);
+        FD_SET (server_socket, &read_set);
+        int max_fd = server_socket;
+        if (wake_socket >= 0) {
+            FD_SET (wake_socket, &read_set);
+            max_fd = (wake_socket > max_fd) ? wake_socket : max_fd;
+        }
+        for (int i = 0; i < SERVER_MAX_CONNECTIONS; i++) {
+            server_conn_t *conn = &connections[i];
+            if (conn->state == SERVER_CONN_FREE) {
+                continue;
+            }
+            if (conn->tx_len > 0) {
+                // a pipelined request waits until the body before it has gone
+                FD_SET (conn->fd, &write_set);
+            } 
+            else {
+                FD_SET (conn->fd, &read_set);
+                if (conn->state == SERVER_CONN_STREAM && handlers->wants_write(conn)) {
+                    FD_SET (conn->fd, &write_set);
+                }
+            }
+            max_fd = (conn->fd > max_fd) ? conn->fd : max_fd;
+        }
+
+        struct timeval tv = { .tv_sec = wait_ms / 1000, .tv_usec = (wait_ms % 1000) * 1000 };
+
+        // Block until a socket is ready or the next timeout is due
+        if (select(max_fd + 1, &read_set, &write_set, NULL, &tv) < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            ESP_LOGE(TAG, "select err: %d", errno);
+            break;
+        }
+
+        if (wake_socket >= 0 && FD_ISSET (wake_socket, &read_set)) {
+            char discard[8];
+            wake_pending = false;
+            while (recv(wake_socket, discard, sizeof(discard), 0) > 0);
+        }
+
+        if (FD_ISSET (server_socket, &read_set)) {
+            server_accept(server_socket);
+        }
+
+        for (int i = 0; i < SERVER_MAX_CONNECTIONS; i++) {
+            server_conn_t *conn = &connections[i];
+            if (conn->state == SERVER_CONN_FREE) {
+                continue;
+            }
+
+            if (conn->tx_len > 0) {
+                if (FD_ISSET (conn->fd, &write_set)) {
+                    int sent = server_conn_write(conn);
+                    if (sent < 0) {
+                        server_conn_close(conn);
+                    }
+                    else if (sent > 0) {
+                        conn->last_activity = server_now_ms();
+                    }
+                }
+                continue;
+            }
+
+            if (conn->state == SERVER_CONN_STREAM && FD_ISSET (conn->fd, &write_set)) {
+                int sent = handlers->on_writable(conn);
+                if (sent < 0) {
+                    server_conn_close(conn);
+                    continue;
+                }
+                if (sent > 0) {
+                    conn->last_activity = server_now_ms();
+                }
+            }
+
+            if (FD_ISSET (conn->fd, &read_set) && server_conn_read(conn) < 0) {
+                server_conn_close(conn);
+            }
+        }
+    } // while (1)
+
+    close(wake_socket);
+    wake_socket = -1;
+    close(server_socket);
+}
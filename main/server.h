@@ -0,0 +1,92 @@
+#pragma once
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "http_parser.h"
+#include "pool.h"
+
+#define SERVER_BUFF_SIZE 1024
+#define SERVER_MAX_CONNECTIONS CONFIG_LWIP_MAX_SOCKETS
+// on_request return value: the handler has taken the connection over
+#define SERVER_REQUEST_DETACH 1
+
+typedef enum {
+    SERVER_CONN_FREE = 0,
+    SERVER_CONN_REQUEST,        // waiting for / receiving a request line and headers
+    SERVER_CONN_STREAM,         // open ended response (SSE). only written to from here on
+} server_conn_state_t;
+
+typedef struct {
+    int fd;
+    uint8_t state;              // server_conn_state_t
+    uint32_t request_start;     // ms. first byte of the current request, 0 if none yet
+    uint32_t last_activity;     // ms. last read, or write progress on a stream
+    http_parser_t parser;
+    size_t len;                 // bytes received into buffer so far
+    char *buffer;               // from server_buffer_pool, only while a request is being received
+    const uint8_t *tx;          // response body still to send, owned by the caller (e.g. rodata)
+    size_t tx_len;
+} server_conn_t;
+
+typedef struct {
+    // Request line and headers are complete; the body (if any) starts at 
+    //  conn->buffer + conn->parser.body_offset and the rest can be read from conn->fd.
+    //  Return -1 to close the connection. Set conn->state to SERVER_CONN_STREAM to keep
+    //  the connection open as a stream. Return SERVER_REQUEST_DETACH to take over 
+    //  conn->fd and conn->buffer (copy *conn first); the server forgets the connection 
+    //  without closing it and the new owner must close() the socket and give the
+    //  buffer back to server_buffer_pool.
+    int (*on_request)(server_conn_t *conn);
+    // Streams: is there anything queued to write
+    bool (*wants_write)(server_conn_t *conn);
+    // Streams: socket is writable. Return bytes sent, or -1 to close
+    int (*on_writable)(server_conn_t *conn);
+    // Streams: nothing sent for half the idle timeout. Queue a keepalive. 
+    void (*on_idle)(server_conn_t *conn);
+    // Connection is about to be closed
+    void (*on_close)(server_conn_t *conn);
+    // Optional. The listening socket is up; called once, before the first accept()
+    void (*on_listening)(void);
+    // Optional. The request headers on_request looks up, NULL terminated; no others are
+    //  kept (see http_parser_init()). NULL keeps the first HTTP_MAX_HEADERS
+    const char *const *headers;
+} server_handlers_t;
+
+// What a connection is used for. Each role has its own socket options, from the
+//  CONFIG_SERVER_*_NODELAY and CONFIG_SERVER_SSE_KEEPALIVE_S settings
+typedef enum {
+    SERVER_ROLE_STATIC = 0,     // pages and API requests. every connection starts as one
+    SERVER_ROLE_SSE,            // an event stream
+    SERVER_ROLE_UPLOAD,         // a transfer on the upload task: /send, /ws, /pull, /firmware
+} server_role_t;
+
+// SERVER_BUFF_SIZE request buffers, CONFIG_SERVER_BUFFER_POOL of them
+extern pool_t server_buffer_pool;
+
+// Run the accept/select loop on the calling task. Only returns on a fatal socket error.
+//  This task is the only owner of the socket set; other tasks use server_wake().
+void server_run(uint16_t port, const server_handlers_t *handlers);
+
+// Callable from any task. Makes the server loop re-evaluate write interest.
+void server_wake(void);
+
+// From on_request, after the response header: send 'len' bytes of 'data' as the body,
+//  straight from where they are, as the socket drains. 'data' must outlive the 
+//  connection. No further request is read until it has all gone.
+void server_conn_send_static(server_conn_t *conn, const void *data, size_t len);
+
+// Apply the socket options of 'role' to 'fd', e.g. from on_request before a stream's
+//  response header goes out
+void server_set_role(int fd, server_role_t role);
+
+uint32_t server_now_ms(void);
+
+#ifdef __cplusplus
+}
+#endif
@@ -0,0 +1,592 @@
+#include <stdlib.h>
+#include <string.h>
+
+#include "port.h"
+static const char *TAG = "sse";
+
+#include "sse.h"
+
+// sse_frame_t.level of anything that isn't a log line. Never filtered
+#define SSE_LEVEL_EVENT 0xff
+// longest "id: N\n"
+#define SSE_ID_MAX 15
+
+typedef struct {
+    uint16_t refs;              // one per client queue (and the history) holding this frame
+    uint16_t len;
+    const char *coalesce;       // event name a newer frame may replace this one for, or NULL
+    uint32_t id;                // 0 for frames without one (pings, batches are per client)
+    uint8_t level;              // for filtering a replay
+    uint32_t tag;
+    char data[];
+} sse_frame_t;
+
+typedef struct {
+    int fd;                     // 0 = slot unused
+    bool dead;                  // failed send or dropped by policy. waiting to be closed
+    uint8_t head;
+    uint8_t count;
+    uint16_t offset;            // bytes of the head frame already sent
+    sse_frame_t *queue[CONFIG_SSE_CLIENT_QUEUE_DEPTH];
+
+    // catching up from the history. live frames are skipped meanwhile; they are in
+    //  the history too, and come out of it in order
+    bool replaying;
+    uint32_t replay_id;         // last event ID queued from the history
+
+    sse_filter_t filter;
+    uint32_t rate_window;       // ms when the current 1 s rate window started
+    uint16_t rate_count;        // log lines sent in it
+    sse_frame_t *batch;         // log lines collected for one frame, or NULL
+    const char *batch_event;
+    uint32_t batch_id;          // ID of its last line
+    uint8_t batch_lines;
+    uint32_t batch_start;       // ms when its first line arrived
+} sse_client_t;
+
+static sse_client_t sse_clients[MAX_SSE_CLIENTS];
+static port_mutex_t sse_mutex;
+static void (*sse_notify)(void);
+static uint32_t sse_dropped;
+static uint32_t sse_rate_limited;
+static uint32_t sse_last_id;
+
+// The last CONFIG_SSE_REPLAY_DEPTH frames with an ID, oldest first, for replay to 
+//  subscribers that (re)connect. Only the newest frame of a coalescing event is kept
+#if CONFIG_SSE_REPLAY_DEPTH
+static sse_frame_t *sse_history[CONFIG_SSE_REPLAY_DEPTH];
+#endif
+static uint8_t sse_history_count;
+
+static const char sse_data[] = "data: ";
+static const char sse_event[] = "event: ";
+
+POOL_DEFINE(sse_frame_pool, "sse", SSE_FRAME_SMALL, CONFIG_SSE_FRAME_POOL);
+POOL_DEFINE(sse_large_frame_pool, "sse_large", SSE_FRAME_LARGE, CONFIG_SSE_LARGE_FRAME_POOL);
+
+_Static_assert(sizeof(sse_frame_t) + SSE_BATCH_BYTES <= SSE_FRAME_LARGE, "a batch must fit a large frame");
+
+// A block for a frame with 'len' bytes of data. NULL if its pool is empty
+static sse_frame_t *sse_frame_alloc(size_t len) {
+    if (sizeof(sse_frame_t) + len <= SSE_FRAME_SMALL) {
+        return pool_alloc(&sse_frame_pool);
+    }
+    if (sizeof(sse_frame_t) + len <= SSE_FRAME_LARGE) {
+        return pool_alloc(&sse_large_frame_pool);
+    }
+    ESP_LOGE(TAG, "%d byte frame is too large", (int)len);
+    return NULL;
+}
+
+static pool_t *sse_frame_pool_of(const sse_frame_t *frame) {
+    return pool_owns(&sse_frame_pool, frame) ? &sse_frame_pool : &sse_large_frame_pool;
+}
+
+static void sse_frame_release(sse_frame_t *frame) {
+    if (--frame->refs == 0) {
+        pool_free(sse_frame_pool_of(frame), frame);
+    }
+}
+
+static sse_client_t *sse_find(int fd) {
+    for (int i = 0; i < MAX_SSE_CLIENTS; i++) {
+        if (sse_clients[i].fd == fd) {
+            return &sse_clients[i];
+        }
+    }
+    return NULL;
+}
+
+#define SSE_QUEUE_AT(c, i) ((c)->queue[((c)->head + (i)) % CONFIG_SSE_CLIENT_QUEUE_DEPTH])
+
+// remove entry i (0 = head) from the client's queue
+static void sse_queue_remove(sse_client_t *c, int i) {
+    sse_frame_release(SSE_QUEUE_AT(c, i));
+    for (; i > 0; i--) {
+        SSE_QUEUE_AT(c, i) = SSE_QUEUE_AT(c, i - 1);
+    }
+    c->head = (c->head + 1) % CONFIG_SSE_CLIENT_QUEUE_DEPTH;
+    c->count--;
+}
+
+static void sse_enqueue(sse_client_t *c, sse_frame_t *frame) {
+#if CONFIG_SSE_SLOW_CLIENT_DISCONNECT
+    if (c->count == CONFIG_SSE_CLIENT_QUEUE_DEPTH) {
+        sse_dropped++;
+        c->dead = true;
+        return;
+    }
+#else
+    // the head frame can't be touched once part of it is on the wire
+    int first = (c->offset > 0) ? 1 : 0;
+
+#if CONFIG_SSE_SLOW_CLIENT_COALESCE
+    if (frame->coalesce) {
+        for (int i = c->count - 1; i >= first; i--) {
+            const char *queued = SSE_QUEUE_AT(c, i)->coalesce;
+            if (queued != NULL && strcmp(queued, frame->coalesce) == 0) {
+                sse_frame_release(SSE_QUEUE_AT(c, i));
+                SSE_QUEUE_AT(c, i) = frame;
+                frame->refs++;
+                sse_dropped++;
+                return;
+            }
+        }
+    }
+#endif
+
+    if (c->count == CONFIG_SSE_CLIENT_QUEUE_DEPTH) {
+        sse_dropped++;
+        sse_queue_remove(c, first);
+    }
+#endif
+
+    SSE_QUEUE_AT(c, c->count) = frame;
+    c->count++;
+    frame->refs++;
+}
+
+static uint32_t sse_now_ms(void) {
+    return (uint32_t)(esp_timer_get_time() / 1000);
+}
+
+// Finish the client's open batch and queue it
+static void sse_batch_close(sse_client_t *c) {
+    sse_frame_t *frame = c->batch;
+    if (frame == NULL) {
+        return;
+    }
+    char *p = frame->data + frame->len;
+    p += sprintf(p, "id: %u\n", (unsigned)c->batch_id);
+    if (c->batch_event != NULL) {
+        size_t event_len = strlen(c->batch_event);
+        memcpy(p, sse_event, sizeof(sse_event) - 1);              p += sizeof(sse_event) - 1;
+        memcpy(p, c->batch_event, event_len);                     p += event_len;
+        *p++ = '\n';
+    }
+    *p++ = '\n';
+    frame->len = p - frame->data;
+
+    c->batch = NULL;
+    c->batch_lines = 0;
+    sse_enqueue(c, frame);
+    sse_frame_release(frame);
+}
+
+// Add a line to the client's batch. Returns false if it can never fit in one
+static bool sse_batch_add(sse_client_t *c, const char *message, size_t message_len, const char *event, 
+        uint32_t id, uint32_t now) {
+    // room for this line plus the closing id, event and blank lines
+    size_t needed = (sizeof(sse_data) - 1) + message_len + 1 + SSE_ID_MAX +
+        ((event != NULL) ? (sizeof(sse_event) - 1) + strlen(event) + 1 : 0) + 1;
+    if (needed > SSE_BATCH_BYTES) {
+        return false;
+    }
+    if (c->batch != NULL && (c->batch_event != event || c->batch->len + needed > SSE_BATCH_BYTES)) {
+        sse_batch_close(c);
+    }
+    if (c->batch == NULL) {
+        c->batch = sse_frame_alloc(SSE_BATCH_BYTES);
+        if (c->batch == NULL) {
+            sse_dropped++;
+            return true;
+        }
+        c->batch->refs = 1;
+        c->batch->len = 0;
+        c->batch->coalesce = NULL;
+        c->batch->id = 0;
+        c->batch->level = SSE_LEVEL_EVENT;
+        c->batch_event = event;
+        c->batch_start = now;
+    }
+
+    char *p = c->batch->data + c->batch->len;
+    memcpy(p, sse_data, sizeof(sse_data) - 1);                    p += sizeof(sse_data) - 1;
+    memcpy(p, message, message_len);                              p += message_len;
+    *p++ = '\n';
+    c->batch->len = p - c->batch->data;
+    c->batch_id = id;
+
+    if (++c->batch_lines >= c->filter.batch) {
+        sse_batch_close(c);
+    }
+    return true;
+}
+
+// Level and tags
+bool sse_filter_match(const sse_filter_t *f, uint8_t level, uint32_t tag) {
+    if (level == SSE_LEVEL_EVENT) {
+        return true;
+    }
+    if ((level ? level : 3) > f->level) {
+        return false;
+    }
+    if (f->include_count > 0) {
+        int i = 0;
+        while (i < f->include_count && f->include[i] != tag) {
+            i++;
+        }
+        if (i == f->include_count) {
+            return false;
+        }
+    }
+    for (int i = 0; i < f->exclude_count; i++) {
+        if (f->exclude[i] == tag) {
+            return false;
+        }
+    }
+    return true;
+}
+
+// Then the rate, so only lines that would be sent use it up
+static bool sse_filter_pass(sse_client_t *c, uint8_t level, uint32_t tag, uint32_t now) {
+    const sse_filter_t *f = &c->filter;
+    if (!sse_filter_match(f, level, tag)) {
+        return false;
+    }
+    if (f->rate > 0) {
+        if (now - c->rate_window >= 1000) {
+            c->rate_window = now;
+            c->rate_count = 0;
+        }
+        if (c->rate_count >= f->rate) {
+            sse_rate_limited++;
+            return false;
+        }
+        c->rate_count++;
+    }
+    return true;
+}
+
+static void sse_client_reset(sse_client_t *c) {
+    if (c->batch != NULL) {
+        sse_frame_release(c->batch);
+        c->batch = NULL;
+    }
+    c->batch_lines = 0;
+    c->replaying = false;
+    while (c->count > 0) {
+        sse_queue_remove(c, 0);
+    }
+    c->fd = 0;
+    c->dead = false;
+    c->head = 0;
+    c->offset = 0;
+}
+
+#if CONFIG_SSE_REPLAY_DEPTH
+static void sse_history_remove(int i) {
+    sse_frame_release(sse_history[i]);
+    sse_history_count--;
+    memmove(&sse_history[i], &sse_history[i + 1], (sse_history_count - i) * sizeof(sse_history[0]));
+}
+#endif
+
+static void sse_history_add(sse_frame_t *frame) {
+#if CONFIG_SSE_REPLAY_DEPTH
+    if (frame->coalesce != NULL) {
+        for (int i = sse_history_count - 1; i >= 0; i--) {
+            const char *kept = sse_history[i]->coalesce;
+            if (kept != NULL && strcmp(kept, frame->coalesce) == 0) {
+                sse_history_remove(i);
+                break;
+            }
+        }
+    }
+    if (sse_history_count == CONFIG_SSE_REPLAY_DEPTH) {
+        sse_history_remove(0);
+    }
+    sse_history[sse_history_count++] = frame;
+    frame->refs++;
+#endif
+}
+
+// Queue history frames after c->replay_id that pass the client's filter, as far as
+//  the queue has room. Ends the replay once the client has caught up
+static void sse_replay(sse_client_t *c) {
+#if CONFIG_SSE_REPLAY_DEPTH
+    int i = 0;
+    while (i < sse_history_count && sse_history[i]->id <= c->replay_id) {
+        i++;
+    }
+    for (; i < sse_history_count && c->count < CONFIG_SSE_CLIENT_QUEUE_DEPTH; i++) {
+        sse_frame_t *frame = sse_history[i];
+        if (sse_filter_match(&c->filter, frame->level, frame->tag)) {
+            sse_enqueue(c, frame);
+        }
+        c->replay_id = frame->id;
+    }
+    c->replaying = (i < sse_history_count);
+#else
+    c->replaying = false;
+#endif
+}
+
+void sse_init(void (*notify)(void)) {
+    sse_mutex = port_mutex_create();
+    sse_notify = notify;
+}
+
+uint32_t sse_tag_hash(const char *tag, size_t len) {
+    uint32_t hash = 2166136261;
+    for (size_t i = 0; i < len; i++) {
+        hash = (hash ^ (uint8_t)tag[i]) * 16777619;
+    }
+    return hash;
+}
+
+bool sse_add_client(int fd, const sse_filter_t *filter, const uint32_t *last_event_id) {
+    static const sse_filter_t all = SSE_FILTER_ALL;
+    bool added = false;
+    port_mutex_lock(sse_mutex);
+    sse_client_t *c = sse_find(0);
+    if (c != NULL) {
+        sse_client_reset(c);
+        c->fd = fd;
+        c->filter = (filter != NULL) ? *filter : all;
+        c->rate_window = sse_now_ms();
+        c->rate_count = 0;
+        // an ID from before a restart is newer than anything here; replay it all
+        c->replay_id = (last_event_id != NULL && *last_event_id <= sse_last_id) ? *last_event_id : 0;
+        c->replaying = (sse_history_count > 0);
+        added = true;
+        ESP_LOGI(TAG, "sse_socket: %d slot %d ", fd, (int)(c - sse_clients));
+    }
+    port_mutex_unlock(sse_mutex);
+    return added;
+}
+
+void sse_remove_client(int fd) {
+    if (fd == 0) {
+        return;
+    }
+    port_mutex_lock(sse_mutex);
+    sse_client_t *c = sse_find(fd);
+    if (c != NULL) {
+        sse_client_reset(c);
+    }
+    port_mutex_unlock(sse_mutex);
+}
+
+// One serialized frame, held (refs = 1) by the caller until every client has its own
+//  reference. NULL if its frame pool is empty
+static sse_frame_t *sse_frame_create(const char *message, size_t message_len, const char *event, bool coalesce,
+        uint32_t id, uint8_t level, uint32_t tag) {
+    char id_line[SSE_ID_MAX + 1];
+    size_t id_len = sprintf(id_line, "id: %u\n", (unsigned)id);
+    size_t event_len = (event != NULL) ? strlen(event) : 0;
+    size_t len = id_len + (sizeof(sse_data) - 1) + message_len + 2;
+    if (event != NULL) {
+        len += (sizeof(sse_event) - 1) + event_len + 1;
+    }
+
+    sse_frame_t *frame = sse_frame_alloc(len);
+    if (frame != NULL) {
+        frame->refs = 1;
+        frame->len = len;
+        frame->coalesce = (coalesce && event != NULL) ? event : NULL;
+        frame->id = id;
+        frame->level = level;
+        frame->tag = tag;
+
+        char *p = frame->data;
+        memcpy(p, id_line, id_len);                               p += id_len;
+        memcpy(p, sse_data, sizeof(sse_data) - 1);                p += sizeof(sse_data) - 1;
+        memcpy(p, message, message_len);                          p += message_len;
+        *p++ = '\n';
+        if (event != NULL) {
+            memcpy(p, sse_event, sizeof(sse_event) - 1);          p += sizeof(sse_event) - 1;
+            memcpy(p, event, event_len);                          p += event_len;
+            *p++ = '\n';
+        }
+        *p++ = '\n';
+    }
+    return frame;
+}
+
+void sse_broadcast(const char *message, const char *event, bool coalesce) {
+    port_mutex_lock(sse_mutex);
+
+    // kept for replay even with nobody listening
+    bool any_client = (CONFIG_SSE_REPLAY_DEPTH > 0);
+    for (int i = 0; i < MAX_SSE_CLIENTS; i++) {
+        any_client |= (sse_clients[i].fd != 0 && !sse_clients[i].dead);
+    }
+
+    sse_frame_t *frame = any_client ? sse_frame_create(message, strlen(message), event, coalesce, 
+        ++sse_last_id, SSE_LEVEL_EVENT, 0) : NULL;
+    if (frame != NULL) {
+        sse_history_add(frame);
+        for (int i = 0; i < MAX_SSE_CLIENTS; i++) {
+            if (sse_clients[i].fd != 0 && !sse_clients[i].dead && !sse_clients[i].replaying) {
+                // lines batched before this event go out before it
+                sse_batch_close(&sse_clients[i]);
+                sse_enqueue(&sse_clients[i], frame);
+            }
+        }
+        sse_frame_release(frame);
+    }
+
+    port_mutex_unlock(sse_mutex);
+
+    if (frame != NULL && sse_notify != NULL) {
+        sse_notify();
+    }
+}
+
+void sse_broadcast_log(const char *message, const char *event, uint8_t level, const char *tag, size_t tag_len) {
+    size_t message_len = strlen(message);
+    uint32_t tag_hash = sse_tag_hash(tag, tag_len);
+    uint32_t now = sse_now_ms();
+    sse_frame_t *frame = NULL;
+    bool queued = false;
+
+    port_mutex_lock(sse_mutex);
+    uint32_t id = ++sse_last_id;
+#if CONFIG_SSE_REPLAY_DEPTH
+    frame = sse_frame_create(message, message_len, event, false, id, level, tag_hash);
+    if (frame != NULL) {
+        sse_history_add(frame);
+    }
+#endif
+    for (int i = 0; i < MAX_SSE_CLIENTS; i++) {
+        sse_client_t *c = &sse_clients[i];
+        if (c->fd == 0 || c->dead || c->replaying || !sse_filter_pass(c, level, tag_hash, now)) {
+            continue;
+        }
+        if (c->filter.batch > 1 && sse_batch_add(c, message, message_len, event, id, now)) {
+            queued |= (c->batch == NULL);
+            continue;
+        }
+        // serialized once, for the first client that takes it as a frame of its own
+        if (frame == NULL) {
+            frame = sse_frame_create(message, message_len, event, false, id, level, tag_hash);
+            if (frame == NULL) {
+                sse_dropped++;
+                break;
+            }
+        }
+        sse_batch_close(c);
+        sse_enqueue(c, frame);
+        queued = true;
+    }
+    if (frame != NULL) {
+        sse_frame_release(frame);
+    }
+    port_mutex_unlock(sse_mutex);
+
+    if (queued && sse_notify != NULL) {
+        sse_notify();
+    }
+}
+
+void sse_flush_batches(uint32_t max_age_ms) {
+    uint32_t now = sse_now_ms();
+    bool queued = false;
+
+    port_mutex_lock(sse_mutex);
+    for (int i = 0; i < MAX_SSE_CLIENTS; i++) {
+        sse_client_t *c = &sse_clients[i];
+        if (c->batch != NULL && now - c->batch_start >= max_age_ms) {
+            sse_batch_close(c);
+            queued = true;
+        }
+    }
+    port_mutex_unlock(sse_mutex);
+
+    if (queued && sse_notify != NULL) {
+        sse_notify();
+    }
+}
+
+bool sse_client_pending(int fd) {
+    bool pending = false;
+    port_mutex_lock(sse_mutex);
+    sse_client_t *c = sse_find(fd);
+    if (c != NULL) {
+        pending = c->dead || c->count > 0 || c->replaying;
+    }
+    port_mutex_unlock(sse_mutex);
+    return pending;
+}
+
+int sse_client_flush(int fd) {
+    int ret = 0;
+    int total = 0;
+    port_mutex_lock(sse_mutex);
+    sse_client_t *c = sse_find(fd);
+    if (c != NULL) {
+        while (!c->dead) {
+            if (c->count == 0 && c->replaying) {
+                sse_replay(c);
+            }
+            if (c->count == 0) {
+                break;
+            }
+            sse_frame_t *frame = SSE_QUEUE_AT(c, 0);
+            int sent = send(fd, frame->data + c->offset, frame->len - c->offset, MSG_DONTWAIT);
+            if (sent < 0) {
+                if (errno != EAGAIN && errno != EWOULDBLOCK) {
+                    ESP_LOGD(TAG, "sse_socket %d send err %d", fd, errno);
+                    c->dead = true;
+                }
+                break;
+            }
+            c->offset += sent;
+            total += sent;
+            if (c->offset == frame->len) {
+                c->offset = 0;
+                sse_queue_remove(c, 0);
+            }
+        }
+        ret = c->dead ? -1 : total;
+    }
+    port_mutex_unlock(sse_mutex);
+    return ret;
+}
+
+void sse_client_ping(int fd) {
+    static const char ping[] = ": ping\n\n";
+
+    port_mutex_lock(sse_mutex);
+    sse_client_t *c = sse_find(fd);
+    sse_frame_t *frame = (c != NULL) ? sse_frame_alloc(sizeof(ping) - 1) : NULL;
+    if (frame != NULL) {
+        frame->refs = 1;
+        frame->len = sizeof(ping) - 1;
+        frame->coalesce = NULL;
+        memcpy(frame->data, ping, sizeof(ping) - 1);
+        sse_enqueue(c, frame);
+        sse_frame_release(frame);
+    }
+    port_mutex_unlock(sse_mutex);
+}
+
+void sse_get_stats(sse_stats_t *stats) {
+    port_mutex_lock(sse_mutex);
+    stats->dropped = sse_dropped;
+    stats->rate_limited = sse_rate_limited;
+    stats->history = sse_history_count;
+    stats->history_bytes = 0;
+#if CONFIG_SSE_REPLAY_DEPTH
+    for (int i = 0; i < sse_history_count; i++) {
+        stats->history_bytes += sse_frame_pool_of(sse_history[i])->block_size;
+    }
+#endif
+    stats->clients = 0;
+    for (int i = 0; i < MAX_SSE_CLIENTS; i++) {
+        sse_client_t *c = &sse_clients[i];
+        if (c->fd == 0) {
+            continue;
+        }
+        sse_client_stats_t *cs = &stats->client[stats->clients++];
+        cs->fd = c->fd;
+        cs->depth = c->count;
+        cs->backlog = 0;
+        for (int j = 0; j < c->count; j++) {
+            cs->backlog += SSE_QUEUE_AT(c, j)->len;
+        }
+        cs->backlog -= c->offset;
+    }
+    port_mutex_unlock(sse_mutex);
+}
@@ -0,0 +1,106 @@
+#pragma once
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "pool.h"
+
+#define MAX_SSE_CLIENTS 3
+#define SSE_FILTER_TAGS 4           // per include / exclude list
+#define SSE_BATCH_MAX 16            // log lines per frame
+#define SSE_BATCH_BYTES 512         // frame a batch is collected in
+#define SSE_BATCH_MAX_MS 500        // oldest line a batch may hold back
+
+// Frames are pool blocks, header included: a log line or progress event fits a small
+//  one; a batch or a metrics event (METRICS_JSON_MAX plus its framing) needs a large one
+#define SSE_FRAME_SMALL 192
+#define SSE_FRAME_LARGE 1088
+
+// A subscription's log filter, compiled once from the GET /event query. Applies to 
+//  log lines only; named events (progress, sectors, metrics) always go through.
+typedef struct {
+    uint8_t level;                      // most verbose level sent, 1 (error) to 5 (verbose). 0: none
+    uint8_t batch;                      // log lines per frame. 1: no batching
+    uint16_t rate;                      // log lines per second. 0: unlimited
+    uint8_t include_count;
+    uint8_t exclude_count;
+    uint32_t include[SSE_FILTER_TAGS];  // sse_tag_hash() of the tags to send. none: all
+    uint32_t exclude[SSE_FILTER_TAGS];  // sse_tag_hash() of the tags never to send
+} sse_filter_t;
+
+#define SSE_FILTER_ALL { .level = 5, .batch = 1 }
+
+typedef struct {
+    int fd;
+    uint8_t depth;              // frames queued
+    uint32_t backlog;           // bytes queued and not yet sent
+} sse_client_stats_t;
+
+typedef struct {
+    uint32_t dropped;           // frames discarded or replaced by the slow client policy
+    uint32_t rate_limited;      // log lines held back by a subscriber's rate
+    uint8_t history;            // events kept for replay
+    uint32_t history_bytes;     // and the pool blocks they hold
+    uint8_t clients;
+    sse_client_stats_t client[MAX_SSE_CLIENTS];
+} sse_stats_t;
+
+// 'notify' is called (from any task) whenever a client gains queued data, so the
+//  socket server can add it to its write set.
+void sse_init(void (*notify)(void));
+
+// Register a socket that has already been sent the text/event-stream response header.
+//  'filter' is copied; NULL sends everything. The client is first sent the kept events
+//  after 'last_event_id' (its Last-Event-ID), or all of them if NULL, before any new 
+//  ones. Returns false if all MAX_SSE_CLIENTS slots are in use.
+bool sse_add_client(int fd, const sse_filter_t *filter, const uint32_t *last_event_id);
+
+uint32_t sse_tag_hash(const char *tag, size_t len);
+
+// Would a log line of 'level' and sse_tag_hash() 'tag' pass the filter's level and tags
+bool sse_filter_match(const sse_filter_t *filter, uint8_t level, uint32_t tag);
+
+// Forget a client and release its queued frames. The caller closes the socket.
+void sse_remove_client(int fd);
+
+// Serialize the frame once, with the next event ID, and queue a reference to it for 
+//  every client and the replay history. Never blocks on the network. 'coalesce' marks 
+//  progress style events that may replace an older queued one of the same event
+//  (CONFIG_SSE_SLOW_CLIENT_COALESCE, and always in the history); 'event' must then be
+//  a string literal.
+void sse_broadcast(const char *message, const char *event, bool coalesce);
+
+// Like sse_broadcast(), for a log line. Each client's filter is applied before anything
+//  is serialized for it, and clients that batch collect the line in their open batch
+//  instead. 'level' is 1 (error) to 5 (verbose), or 0 if unknown (treated as info).
+void sse_broadcast_log(const char *message, const char *event, uint8_t level, const char *tag, size_t tag_len);
+
+// Queue every open batch whose oldest line is at least 'max_age_ms' old
+void sse_flush_batches(uint32_t max_age_ms);
+
+// True if the client has queued bytes (or needs closing), so it belongs in the write set
+bool sse_client_pending(int fd);
+
+// Send as much queued data as the socket accepts without blocking. Returns the bytes
+//  sent, or -1 if the client failed or was dropped by the slow client policy and must
+//  be closed.
+int sse_client_flush(int fd);
+
+// Queue an SSE comment line for one client, so a dead peer is noticed by TCP
+void sse_client_ping(int fd);
+
+void sse_get_stats(sse_stats_t *stats);
+
+// CONFIG_SSE_FRAME_POOL small and CONFIG_SSE_LARGE_FRAME_POOL large frames. When one
+//  runs out, the frame is dropped and counted in the pool's 'exhausted'
+extern pool_t sse_frame_pool;
+extern pool_t sse_large_frame_pool;
+
+#ifdef __cplusplus
+}
+#endif
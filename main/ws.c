@@ -0,0 +1,147 @@
+#include <string.h>
+
+#include "lwip/sockets.h"
+#include "mbedtls/base64.h"
+#include "mbedtls/sha1.h"
+
+#include "esp_log.h"
+static const char *TAG = "ws";
+
+#include "log_binary.h"
+#include "ws.h"
+
+static const char ws_guid[] = "258EAFA5-E914-47DA-95CA-C5AB0DC85B11";
+
+// small frames (acks, progress, log lines) go out in one send() with their header
+#define WS_SEND_INLINE 160
+
+bool ws_accept_key(const char *key, size_t key_len, char *accept) {
+    // a key is 16 random bytes, base64 encoded
+    char concat[24 + sizeof(ws_guid)];
+    unsigned char digest[20];
+    size_t len;
+
+    if (key_len != 24) {
+        return false;
+    }
+    memcpy(concat, key, key_len);
+    memcpy(concat + key_len, ws_guid, sizeof(ws_guid) - 1);
+    if (mbedtls_sha1_ret((unsigned char *)concat, key_len + sizeof(ws_guid) - 1, digest) != 0) {
+        return false;
+    }
+    return mbedtls_base64_encode((unsigned char *)accept, WS_ACCEPT_LEN + 1, &len,
+        digest, sizeof(digest)) == 0;
+}
+
+static bool ws_recv_all(int fd, uint8_t *buf, size_t len) {
+    while (len > 0) {
+        int n = recv(fd, buf, len, 0);
+        if (n <= 0) {
+            return false;
+        }
+        buf += n;
+        len -= n;
+    }
+    return true;
+}
+
+bool ws_recv_header(int fd, ws_frame_t *frame) {
+    uint8_t h[2];
+    if (!ws_recv_all(fd, h, sizeof(h))) {
+        return false;
+    }
+    frame->fin = (h[0] & 0x80) != 0;
+    frame->opcode = h[0] & 0x0f;
+    frame->offset = 0;
+
+    uint8_t len = h[1] & 0x7f;
+    if (!(h[1] & 0x80) || len == 127) {
+        LOGB_E(TAG, "%s frame", (len == 127) ? "oversized" : "unmasked");
+        return false;
+    }
+    if (len == 126) {
+        uint8_t ext[2];
+        if (!ws_recv_all(fd, ext, sizeof(ext))) {
+            return false;
+        }
+        frame->len = (ext[0] << 8) | ext[1];
+    } else {
+        frame->len = len;
+    }
+    return ws_recv_all(fd, frame->mask, sizeof(frame->mask));
+}
+
+int ws_recv(int fd, ws_frame_t *frame, void *buf, size_t len) {
+    size_t left = (size_t)(frame->len - frame->offset);
+    if (len > left) {
+        len = left;
+    }
+    if (len == 0) {
+        return 0;
+    }
+    int n = recv(fd, buf, len, 0);
+    if (n <= 0) {
+        return -1;
+    }
+    uint8_t *p = buf;
+    for (int i = 0; i < n; i++) {
+        p[i] ^= frame->mask[(frame->offset + i) & 3];
+    }
+    frame->offset += n;
+    return n;
+}
+
+int ws_recv_message(int fd, ws_frame_t *frame, void *buf, size_t size) {
+    size_t len = frame->len - frame->offset;
+    if (len > size) {
+        return -1;
+    }
+    for (size_t got = 0; got < len; ) {
+        int n = ws_recv(fd, frame, (uint8_t *)buf + got, len - got);
+        if (n <= 0) {
+            return -1;
+        }
+        got += n;
+    }
+    return len;
+}
+
+bool ws_skip(int fd, ws_frame_t *frame) {
+    uint8_t scratch[64];
+    int n;
+    while ((n = ws_recv(fd, frame, scratch, sizeof(scratch))) > 0);
+    return n == 0;
+}
+
+static bool ws_send_all(int fd, const void *data, size_t len) {
+    const uint8_t *p = data;
+    while (len > 0) {
+        int n = send(fd, p, len, 0);
+        if (n <= 0) {
+            return false;
+        }
+        p += n;
+        len -= n;
+    }
+    return true;
+}
+
+bool ws_send(int fd, uint8_t opcode, const void *data, size_t len) {
+    uint8_t frame[4 + WS_SEND_INLINE];
+    size_t header_len = 2;
+
+    frame[0] = 0x80 | opcode;
+    if (len < 126) {
+        frame[1] = len;
+    } else {
+        frame[1] = 126;
+        frame[2] = len >> 8;
+        frame[3] = len & 0xff;
+        header_len = 4;
+    }
+    if (len <= WS_SEND_INLINE) {
+        memcpy(frame + header_len, data, len);
+        return ws_send_all(fd, frame, header_len + len);
+    }
+    return ws_send_all(fd, frame, header_len) && ws_send_all(fd, data, len);
+}
@@ -0,0 +1,77 @@
+#pragma once
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+// RFC 6455 framing, just what the GET /ws upload socket needs: client frames are
+//  masked and at most 64 KB, and frames sent are never fragmented.
+
+#define WS_ACCEPT_LEN 28            // base64 of a SHA-1
+
+#define WS_OP_CONTINUATION  0x0
+#define WS_OP_TEXT          0x1
+#define WS_OP_BINARY        0x2
+#define WS_OP_CLOSE         0x8
+#define WS_OP_PING          0x9
+#define WS_OP_PONG          0xa
+
+// Upload protocol. Every message is one binary frame; the first byte is its type and
+//  multi-byte fields are little endian. tools/ws_upload.py is the reference client.
+//
+// Client to device:
+//  BEGIN   u32 image length, u8 OTA_ENCODING_* flags, optional 32 byte SHA-256
+//  DATA    the next bytes of the (encoded) image
+//  CANCEL  stop; nothing is installed
+// Device to client:
+//  ACK      u32 bytes received, u32 limit. DATA may be sent up to 'limit' bytes in all;
+//            anything beyond waits for the next ACK
+//  PROGRESS u8 percent, u32 bytes on flash
+//  LOG      u8 level, u32 timestamp (ms), the line. Only lines passing the /ws query filter
+//  LOGB     u32 timestamp (ms), then a LOGB_x record as stored (see log_binary.h)
+//  RESULT   i32 esp_err_t, u16 sectors written, u16 unchanged, 32 byte SHA-256 of the image
+#define WS_MSG_BEGIN        0x01
+#define WS_MSG_DATA         0x02
+#define WS_MSG_CANCEL       0x03
+#define WS_MSG_ACK          0x81
+#define WS_MSG_PROGRESS     0x82
+#define WS_MSG_LOG          0x83
+#define WS_MSG_LOGB         0x84
+#define WS_MSG_RESULT       0x85
+
+typedef struct {
+    uint8_t opcode;             // WS_OP_*
+    bool fin;
+    uint8_t mask[4];
+    uint16_t len;               // of the payload
+    uint16_t offset;            // payload bytes read so far
+} ws_frame_t;
+
+// Sec-WebSocket-Accept for a Sec-WebSocket-Key. 'accept' takes WS_ACCEPT_LEN + 1 bytes
+bool ws_accept_key(const char *key, size_t key_len, char *accept);
+
+// Block for the next frame header. Returns false if the socket failed or closed, or the
+//  frame is unmasked or longer than 64 KB
+bool ws_recv_header(int fd, ws_frame_t *frame);
+
+// Read (blocking) up to 'len' bytes of the frame's payload, unmasked. Returns the bytes
+//  read, 0 once the whole payload has been read, or -1 on a socket error
+int ws_recv(int fd, ws_frame_t *frame, void *buf, size_t len);
+
+// Read all that is left of the payload into 'buf'. Returns its length, or -1 on a 
+//  socket error or if it is longer than 'size'
+int ws_recv_message(int fd, ws_frame_t *frame, void *buf, size_t size);
+
+// Read and drop whatever is left of the payload. Returns false on a socket error
+bool ws_skip(int fd, ws_frame_t *frame);
+
+// Send one frame of at most 64 KB. Returns false on a socket error
+bool ws_send(int fd, uint8_t opcode, const void *data, size_t len);
+
+#ifdef __cplusplus
+}
+#endif
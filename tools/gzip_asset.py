@@ -0,0 +1,25 @@
+#!/usr/bin/env python3
+"""Gzip a web asset for embedding in the firmware.
+
+    gzip_asset.py main/www/index.html build/index.html.gz
+
+The header carries no file name or timestamp, so the output (and the ETag the device
+derives from it) only changes when the asset does.
+"""
+
+import gzip
+import sys
+
+
+def main():
+    if len(sys.argv) != 3:
+        sys.exit(__doc__)
+    with open(sys.argv[1], "rb") as f:
+        data = f.read()
+    with open(sys.argv[2], "wb") as out:
+        with gzip.GzipFile(filename="", mode="wb", compresslevel=9, fileobj=out, mtime=0) as gz:
+            gz.write(data)
+
+
+if __name__ == "__main__":
+    main()
@@ -0,0 +1,222 @@
+#!/usr/bin/env python3
+"""Turn binary log records (CONFIG_LOG_BINARY) back into text.
+
+The dictionary maps each LOGB_x call site to its level, tag and format string. It is
+read out of the ELF's log_binary_site symbols, and written by the build to
+build/log_dict.json:
+
+    log_decode.py dict build/esp8266_sse_ota_minimal.elf build/log_dict.json
+
+Records arrive as base64 'logb' events on /event. Other events are skipped; plain
+log lines are printed as they are:
+
+    curl -sN http://192.168.4.1/event | log_decode.py decode build/log_dict.json
+
+A record is u32 timestamp (ms), u32 site ID, then the arguments as the device stored
+them: u32, u64/f64 for 64 bit integers and doubles, u8 length + bytes for strings.
+The dictionary has to come from the firmware that is running.
+"""
+
+import argparse
+import base64
+import json
+import re
+import struct
+import sys
+
+SITE_SYMBOL = "log_binary_site"
+LEVELS = {1: "E", 2: "W", 3: "I", 4: "D", 5: "V"}
+
+SHT_SYMTAB = 2
+SHT_NOBITS = 8
+SHF_ALLOC = 2
+
+
+class Elf:
+    def __init__(self, data):
+        if data[:4] != b"\x7fELF":
+            raise ValueError("not an ELF file")
+        self.data = data
+        self.is64 = data[4] == 2
+        self.endian = "<" if data[5] == 1 else ">"
+        self.ptr = "Q" if self.is64 else "I"
+        if self.is64:
+            shoff, = struct.unpack_from(self.endian + "Q", data, 0x28)
+            shentsize, shnum = struct.unpack_from(self.endian + "HH", data, 0x3a)
+        else:
+            shoff, = struct.unpack_from(self.endian + "I", data, 0x20)
+            shentsize, shnum = struct.unpack_from(self.endian + "HH", data, 0x2e)
+        self.sections = []
+        for i in range(shnum):
+            if self.is64:
+                name, type_, flags, addr, offset, size, link, info, align, entsize = struct.unpack_from(
+                    self.endian + "IIQQQQIIQQ", data, shoff + i * shentsize)
+            else:
+                name, type_, flags, addr, offset, size, link, info, align, entsize = struct.unpack_from(
+                    self.endian + "IIIIIIIIII", data, shoff + i * shentsize)
+            self.sections.append((type_, flags, addr, offset, size, link, entsize))
+
+    def read(self, addr, size):
+        for type_, flags, base, offset, length, _, _ in self.sections:
+            if flags & SHF_ALLOC and type_ != SHT_NOBITS and base <= addr and addr + size <= base + length:
+                start = offset + addr - base
+                return self.data[start:start + size]
+        raise KeyError("0x%x is not in the image" % addr)
+
+    def read_ptr(self, addr):
+        return struct.unpack(self.endian + self.ptr, self.read(addr, struct.calcsize(self.ptr)))[0]
+
+    def read_cstring(self, addr):
+        out = bytearray()
+        while True:
+            c = self.read(addr + len(out), 1)
+            if c == b"\0":
+                return out.decode("utf-8", "replace")
+            out += c
+
+    def symbols(self):
+        for type_, _, _, offset, size, link, entsize in self.sections:
+            if type_ != SHT_SYMTAB:
+                continue
+            strtab = self.sections[link][3]
+            for i in range(size // entsize):
+                if self.is64:
+                    name, info, other, shndx, value, sym_size = struct.unpack_from(
+                        self.endian + "IBBHQQ", self.data, offset + i * entsize)
+                else:
+                    name, value, sym_size, info, other, shndx = struct.unpack_from(
+                        self.endian + "IIIBBH", self.data, offset + i * entsize)
+                end = self.data.index(b"\0", strtab + name)
+                yield self.data[strtab + name:end].decode(), value
+
+
+def build_dict(elf):
+    # log_binary_site_t: const char *format; const char *const *tag; uint32_t level
+    sites = {}
+    for name, addr in elf.symbols():
+        if name != SITE_SYMBOL and not name.startswith(SITE_SYMBOL + "."):
+            continue
+        step = struct.calcsize(elf.ptr)
+        format_ = elf.read_cstring(elf.read_ptr(addr))
+        tag = elf.read_cstring(elf.read_ptr(elf.read_ptr(addr + step)))
+        level, = struct.unpack(elf.endian + "I", elf.read(addr + 2 * step, 4))
+        sites["0x%08x" % addr] = {"level": LEVELS.get(level, "?"), "tag": tag, "format": format_}
+    return sites
+
+
+CONVERSION = re.compile(r"%([-+ #0]*)(\*|\d+)?(?:\.(\*|\d+))?(hh|h|ll|l|L|z|j|t)?([diouxXeEfFgGcsp%])")
+
+
+class Args:
+    def __init__(self, data):
+        self.data = data
+        self.pos = 0
+
+    def take(self, fmt):
+        size = struct.calcsize(fmt)
+        if self.pos + size > len(self.data):
+            raise IndexError
+        value, = struct.unpack_from(fmt, self.data, self.pos)
+        self.pos += size
+        return value
+
+    def string(self):
+        length = self.take("<B")
+        if self.pos + length > len(self.data):
+            raise IndexError
+        value = self.data[self.pos:self.pos + length].decode("utf-8", "replace")
+        self.pos += length
+        return value
+
+
+def format_record(format_, args):
+    def convert(m):
+        flags, width, precision, length, conv = m.groups()
+        if conv == "%":
+            return "%"
+        try:
+            if width == "*":
+                width = str(args.take("<i"))
+            if precision == "*":
+                precision = str(args.take("<i"))
+            spec = "%" + flags + (width or "") + ("." + precision if precision is not None else "")
+            if conv == "s":
+                return (spec + "s") % args.string()
+            if conv in "eEfFgG":
+                return (spec + conv) % args.take("<d")
+            wide = length in ("ll", "j")
+            if conv in "di":
+                return (spec + "d") % args.take("<q" if wide else "<i")
+            if conv == "c":
+                return (spec + "c") % chr(args.take("<I") & 0xff)
+            if conv == "p":
+                return "0x%x" % args.take("<I")
+            return (spec + ("d" if conv == "u" else conv)) % args.take("<Q" if wide else "<I")
+        except IndexError:
+            return "<?>"
+    return CONVERSION.sub(convert, format_)
+
+
+def decode_record(sites, raw):
+    if len(raw) < 8:
+        return "? malformed record"
+    timestamp, site = struct.unpack_from("<II", raw)
+    entry = sites.get("0x%08x" % site)
+    if entry is None:
+        return "? (%d) unknown site 0x%08x, is the dictionary from this firmware?" % (timestamp, site)
+    return "%s (%d) %s: %s" % (entry["level"], timestamp, entry["tag"],
+                               format_record(entry["format"], Args(raw[8:])))
+
+
+def decode_stream(sites, lines, out):
+    event = None
+    for line in lines:
+        line = line.rstrip("\r\n")
+        if line == "":
+            event = None
+        elif line.startswith("event:"):
+            event = line[6:].strip()
+        elif line.startswith("data:"):
+            data = line[5:].lstrip(" ")
+            if event == "logb":
+                out.write(decode_record(sites, base64.b64decode(data)) + "\n")
+            elif event is None:
+                out.write(data + "\n")
+        elif not line.startswith(":"):
+            # bare base64, one record per line
+            out.write(decode_record(sites, base64.b64decode(line)) + "\n")
+        out.flush()
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__, formatter_class=argparse.RawDescriptionHelpFormatter)
+    sub = parser.add_subparsers(dest="command")
+    p = sub.add_parser("dict", help="write the dictionary for an ELF")
+    p.add_argument("elf")
+    p.add_argument("output")
+    p = sub.add_parser("decode", help="decode an /event stream from stdin or a file")
+    p.add_argument("dictionary")
+    p.add_argument("input", nargs="?", help="defaults to stdin")
+    args = parser.parse_args()
+
+    if args.command == "dict":
+        with open(args.elf, "rb") as f:
+            sites = build_dict(Elf(f.read()))
+        with open(args.output, "w") as f:
+            json.dump(sites, f, indent=1, sort_keys=True)
+        print("%d log sites" % len(sites))
+    elif args.command == "decode":
+        with open(args.dictionary) as f:
+            sites = json.load(f)
+        if args.input:
+            with open(args.input) as f:
+                decode_stream(sites, f, sys.stdout)
+        else:
+            decode_stream(sites, sys.stdin, sys.stdout)
+    else:
+        parser.print_help()
+        sys.exit(1)
+
+
+if __name__ == "__main__":
+    main()
@@ -0,0 +1,156 @@
+#!/usr/bin/env python3
+"""Report static RAM and IRAM per component from the linker map, and optionally what
+the running device says about its task stacks and static pools.
+
+    mem_report.py build/esp8266_sse_ota_minimal.map
+    mem_report.py --top 15 build/esp8266_sse_ota_minimal.map
+    mem_report.py --metrics http://192.168.4.1 build/esp8266_sse_ota_minimal.map
+
+The build runs the first form as the mem_report target:
+
+    cmake --build build --target mem_report
+
+Sizes are summed from the input sections the map places in each output section:
+.data and .rodata that live in DRAM, .bss, and IRAM code. Every static buffer this
+app keeps (the request, SSE frame and OTA pipeline pools, the log ring, the replay
+history) is .bss of main. --top lists the largest of them by section name, which
+with -fdata-sections is the variable's name.
+
+Stack high-water marks only exist at run time: --metrics reads stack_free (the
+least each task has had free, in bytes) from GET /metrics and prints it with the pool
+usage.
+"""
+
+import argparse
+import collections
+import json
+import re
+import sys
+import urllib.request
+
+# output section name -> column. Anything else (flash text, rodata in flash, debug) is skipped
+CATEGORIES = [
+    (re.compile(r"^\.iram"), "iram"),
+    (re.compile(r"^\.(dram0\.)?bss"), "bss"),
+    (re.compile(r"^\.(dram0\.)?(data|rodata)"), "data"),
+]
+COLUMNS = ["data", "bss", "iram"]
+
+OUTPUT_SECTION = re.compile(r"^(\.\S+)")
+INPUT_SECTION = re.compile(r"^ (\.\S+|COMMON)?\s+0x([0-9a-f]+)\s+0x([0-9a-f]+)\s+(\S.*)$")
+ARCHIVE = re.compile(r"(?:^|/)lib([^/]+)\.a\(([^)]+)\)$")
+
+
+def category(output_section):
+    for pattern, name in CATEGORIES:
+        if pattern.match(output_section):
+            return name
+    return None
+
+
+def parse_map(lines):
+    """Yield (category, component, object, input section, size) for every input section
+    placed in RAM or IRAM"""
+    in_memory_map = False
+    output = None
+    pending = None          # an input section name too long to share a line with its address
+    for line in lines:
+        line = line.rstrip("\n")
+        if not in_memory_map:
+            in_memory_map = line.startswith("Linker script and memory map")
+            continue
+
+        m = OUTPUT_SECTION.match(line)
+        if m:
+            output = category(m.group(1))
+            pending = None
+            continue
+        if output is None:
+            continue
+
+        if re.match(r"^ \.\S+$", line) or line == " COMMON":
+            pending = line.strip()
+            continue
+        m = INPUT_SECTION.match(line)
+        if m is None:
+            pending = None
+            continue
+        name = m.group(1) or pending
+        pending = None
+        size = int(m.group(3), 16)
+        if name is None or size == 0:
+            continue
+        source = m.group(4).strip()
+        a = ARCHIVE.search(source)
+        if a:
+            component, obj = a.group(1), a.group(2)
+        else:
+            component, obj = "(linker)", source.split("/")[-1]
+        yield output, component, obj, name, size
+
+
+def print_components(sections):
+    totals = collections.defaultdict(lambda: collections.Counter())
+    for column, component, _, _, size in sections:
+        totals[component][column] += size
+
+    rows = sorted(totals.items(), key=lambda kv: -(kv[1]["data"] + kv[1]["bss"]))
+    print("%-24s %8s %8s %8s %8s" % ("component", "data", "bss", "ram", "iram"))
+    grand = collections.Counter()
+    for component, c in rows:
+        grand.update(c)
+        print("%-24s %8d %8d %8d %8d" % (component, c["data"], c["bss"], c["data"] + c["bss"], c["iram"]))
+    print("%-24s %8d %8d %8d %8d" % ("total", grand["data"], grand["bss"],
+                                     grand["data"] + grand["bss"], grand["iram"]))
+
+
+def print_top(sections, count):
+    ram = [s for s in sections if s[0] in ("data", "bss")]
+    ram.sort(key=lambda s: -s[4])
+    print()
+    print("largest static RAM")
+    for column, component, obj, name, size in ram[:count]:
+        print("%8d  %-4s  %-12s %-20s %s" % (size, column, component, obj, name))
+
+
+def print_metrics(url):
+    with urllib.request.urlopen(url.rstrip("/") + "/metrics", timeout=10) as response:
+        metrics = json.load(response)
+
+    print()
+    print("%-24s %8s" % ("task", "stack free"))
+    for task, free in sorted(metrics.get("stack_free", {}).items()):
+        # the SDK counts stacks in bytes, uxTaskGetStackHighWaterMark() included
+        print("%-24s %8d" % (task, free))
+
+    pools = metrics.get("pools", {})
+    if pools:
+        print()
+        print("%-24s %8s %8s %8s %9s" % ("pool", "used", "peak", "count", "exhausted"))
+        for name, (used, peak, count, exhausted) in pools.items():
+            print("%-24s %8d %8d %8d %9d" % (name, used, peak, count, exhausted))
+    print()
+    print("heap free %d, min free %d" % (metrics["heap"]["free"], metrics["heap"]["min_free"]))
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__, formatter_class=argparse.RawDescriptionHelpFormatter)
+    parser.add_argument("map", help="build/<project>.map")
+    parser.add_argument("--top", type=int, default=0, help="also list the N largest static RAM sections")
+    parser.add_argument("--metrics", help="device URL, e.g. http://192.168.4.1")
+    args = parser.parse_args()
+
+    with open(args.map, errors="replace") as f:
+        sections = list(parse_map(f))
+    if not sections:
+        sys.exit("no RAM sections found in %s. is it a GNU ld map?" % args.map)
+
+    print_components(sections)
+    if args.top:
+        print_top(sections, args.top)
+    if args.metrics:
+        print_metrics(args.metrics)
+
+
+if __name__ == "__main__":
+    main()
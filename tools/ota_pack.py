@@ -0,0 +1,227 @@
+#!/usr/bin/env python3
+"""Encode a firmware image for POST /send.
+
+Produces a heatshrink compressed (-w 10 -l 5) and/or x-ota-delta payload and prints
+the Content-Encoding and X-Image-SHA256 headers to send with it.
+
+    ota_pack.py build/app.bin app.bin.hs
+    ota_pack.py --base running.bin build/app.bin app.bin.delta
+    ota_pack.py --base running.bin --no-compress build/app.bin app.bin.delta
+
+The delta base is the image in the device's running partition.
+"""
+
+import argparse
+import hashlib
+import struct
+import sys
+
+WINDOW_BITS = 10
+LOOKAHEAD_BITS = 5
+WINDOW_SIZE = 1 << WINDOW_BITS
+MAX_MATCH = 1 << LOOKAHEAD_BITS
+MIN_MATCH = 2               # a backref costs 16 bits, a literal 9
+MAX_CHAIN = 64
+
+DELTA_MAGIC = b"ODLT"
+DELTA_BLOCK = 16            # shortest copy worth emitting
+
+
+class BitWriter:
+    def __init__(self):
+        self.out = bytearray()
+        self.acc = 0
+        self.nbits = 0
+
+    def put(self, value, bits):
+        self.acc = (self.acc << bits) | value
+        self.nbits += bits
+        while self.nbits >= 8:
+            self.nbits -= 8
+            self.out.append((self.acc >> self.nbits) & 0xFF)
+        self.acc &= (1 << self.nbits) - 1
+
+    def finish(self):
+        if self.nbits:
+            self.out.append((self.acc << (8 - self.nbits)) & 0xFF)
+        return bytes(self.out)
+
+
+def heatshrink_encode(data):
+    # the decoder's window starts zeroed, so matches may reach back before the start
+    buf = bytes(WINDOW_SIZE) + data
+    heads = {}
+    chain = [0] * len(buf)
+    for i in range(WINDOW_SIZE - MIN_MATCH + 1, WINDOW_SIZE):
+        key = buf[i:i + MIN_MATCH]
+        chain[i] = heads.get(key, -1)
+        heads[key] = i
+
+    w = BitWriter()
+    pos = WINDOW_SIZE
+    end = len(buf)
+    while pos < end:
+        best_len, best_dist = 0, 0
+        cand = heads.get(buf[pos:pos + MIN_MATCH], -1)
+        tries = 0
+        limit = min(MAX_MATCH, end - pos)
+        while cand >= 0 and pos - cand <= WINDOW_SIZE and tries < MAX_CHAIN:
+            n = 0
+            while n < limit and buf[cand + n] == buf[pos + n]:
+                n += 1
+            if n > best_len:
+                best_len, best_dist = n, pos - cand
+                if n == limit:
+                    break
+            cand = chain[cand]
+            tries += 1
+
+        step = best_len if best_len >= MIN_MATCH else 1
+        if step == 1:
+            w.put(1, 1)
+            w.put(buf[pos], 8)
+        else:
+            w.put(0, 1)
+            w.put(best_dist - 1, WINDOW_BITS)
+            w.put(best_len - 1, LOOKAHEAD_BITS)
+        for i in range(pos, pos + step):
+            if i + MIN_MATCH <= end:
+                key = buf[i:i + MIN_MATCH]
+                chain[i] = heads.get(key, -1)
+                heads[key] = i
+        pos += step
+    return w.finish()
+
+
+def heatshrink_decode(data):
+    window = bytearray(WINDOW_SIZE)
+    head = 0
+    out = bytearray()
+    acc, nbits = 0, 0
+    state = "tag"
+    index = 0
+
+    def emit(c):
+        nonlocal head
+        window[head & (WINDOW_SIZE - 1)] = c
+        head += 1
+        out.append(c)
+
+    for byte in data:
+        acc = (acc << 8) | byte
+        nbits += 8
+        while True:
+            need = {"tag": 1, "lit": 8, "idx": WINDOW_BITS, "cnt": LOOKAHEAD_BITS}[state]
+            if nbits < need:
+                break
+            nbits -= need
+            v = (acc >> nbits) & ((1 << need) - 1)
+            if state == "tag":
+                state = "lit" if v else "idx"
+            elif state == "lit":
+                emit(v)
+                state = "tag"
+            elif state == "idx":
+                index = v + 1
+                state = "cnt"
+            else:
+                for _ in range(v + 1):
+                    emit(window[(head - index) & (WINDOW_SIZE - 1)])
+                state = "tag"
+    return bytes(out)
+
+
+def delta_encode(base, target):
+    index = {}
+    for i in range(0, len(base) - DELTA_BLOCK + 1):
+        index.setdefault(base[i:i + DELTA_BLOCK], i)
+
+    out = bytearray(DELTA_MAGIC)
+    literal = bytearray()
+
+    def flush_literal():
+        if literal:
+            out.extend(b"I" + struct.pack("<I", len(literal)) + literal)
+            literal.clear()
+
+    pos = 0
+    while pos < len(target):
+        src = index.get(target[pos:pos + DELTA_BLOCK]) if pos + DELTA_BLOCK <= len(target) else None
+        if src is None:
+            literal.append(target[pos])
+            pos += 1
+            continue
+        n = DELTA_BLOCK
+        while pos + n < len(target) and src + n < len(base) and base[src + n] == target[pos + n]:
+            n += 1
+        flush_literal()
+        out.extend(b"C" + struct.pack("<II", src, n))
+        pos += n
+    flush_literal()
+    return bytes(out)
+
+
+def delta_decode(base, data):
+    if data[:4] != DELTA_MAGIC:
+        raise ValueError("not an x-ota-delta payload")
+    out = bytearray()
+    pos = 4
+    while pos < len(data):
+        op = data[pos:pos + 1]
+        if op == b"C":
+            src, n = struct.unpack_from("<II", data, pos + 1)
+            out.extend(base[src:src + n])
+            pos += 9
+        elif op == b"I":
+            (n,) = struct.unpack_from("<I", data, pos + 1)
+            out.extend(data[pos + 5:pos + 5 + n])
+            pos += 5 + n
+        else:
+            raise ValueError("bad delta op at %d" % pos)
+    return bytes(out)
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__, formatter_class=argparse.RawDescriptionHelpFormatter)
+    parser.add_argument("image")
+    parser.add_argument("output")
+    parser.add_argument("--base", help="running image to encode a delta against")
+    parser.add_argument("--no-compress", action="store_true", help="skip heatshrink compression")
+    args = parser.parse_args()
+
+    with open(args.image, "rb") as f:
+        image = f.read()
+
+    payload = image
+    encodings = []
+    base = None
+    if args.base:
+        with open(args.base, "rb") as f:
+            base = f.read()
+        payload = delta_encode(base, payload)
+        encodings.append("x-ota-delta")
+    if not args.no_compress:
+        payload = heatshrink_encode(payload)
+        encodings.append("heatshrink")
+
+    # decode again before anything is sent to a device
+    check = payload
+    if not args.no_compress:
+        check = heatshrink_decode(check)
+    if base is not None:
+        check = delta_decode(base, check)
+    if check != image:
+        sys.exit("round trip failed, not writing %s" % args.output)
+
+    with open(args.output, "wb") as f:
+        f.write(payload)
+
+    print("%d -> %d bytes (%.1f%%)" % (len(image), len(payload), 100.0 * len(payload) / max(len(image), 1)),
+          file=sys.stderr)
+    if encodings:
+        print("Content-Encoding: %s" % ", ".join(encodings))
+    print("X-Image-SHA256: %s" % hashlib.sha256(image).hexdigest())
+
+
+if __name__ == "__main__":
+    main()
@@ -0,0 +1,364 @@
+#!/usr/bin/env python3
+"""Sweep TCP and pipeline settings, and measure upload throughput and event latency
+for each combination.
+
+    tcp_bench.py --port /dev/ttyUSB0 --image build_app1/esp8266_sse_ota_minimal.bin
+    tcp_bench.py --port /dev/ttyUSB0 --image app1.bin --wnd 2920,5744,11488 \\
+        --buffer-size 1024,2048,4096 --nodelay none,sse,both --csv 4mb.csv
+    tcp_bench.py --no-build --image app1.bin
+
+For every combination a copy of the project's sdkconfig is made with these set, then
+built into build/bench/<name> and flashed over serial:
+
+    --wnd           CONFIG_LWIP_TCP_WND_DEFAULT, the receive window. lwIP sizes TCP
+                    buffers for the whole stack; SO_RCVBUF has no effect on its TCP
+                    sockets, so this is the receive buffer an upload actually gets
+    --buffer-size   CONFIG_OTA_PIPELINE_BUFFER_SIZE, each buffer between the socket
+                    and the flash writer
+    --nodelay       which roles set TCP_NODELAY (CONFIG_SERVER_SSE_NODELAY and
+                    CONFIG_SERVER_UPLOAD_NODELAY): none, sse, upload or both
+
+--no-build measures whatever is running, as one row labelled from --sdkconfig.
+
+Each run is a POST /send of the image's first sector followed by random data, with a
+Content-Range that claims one byte more than is sent. Every sector is erased and
+written (random data never matches what is on flash), but the image is never complete,
+so nothing is installed and the device doesn't restart. As for any resumable upload,
+the offset reached is kept in NVS as it goes. --image must be an app built for the
+OTA_1 slot, as the upload is refused unless its header is valid there.
+
+Event latency is the time from a new subscriber's GET /event to the 'Connected..'
+event that subscription broadcasts arriving on an existing stream: a request, the
+SSE queue and a frame out, all timed on this host's clock. It is sampled with the
+device idle and again every --probe-interval while an upload runs.
+
+The sdkconfig decides the flash variant. Run the sweep once per variant, e.g. with
+--sdkconfig sdkconfig.1mb and then sdkconfig.4mb, and compare the CSVs; the flash
+size is in every row.
+"""
+
+import argparse
+import csv
+import itertools
+import os
+import re
+import socket
+import statistics
+import subprocess
+import sys
+import threading
+import time
+import urllib.request
+
+SECTOR_SIZE = 4096
+MARKER = b"Connected.."
+
+NODELAY = {
+    "none": (False, False),
+    "sse": (True, False),
+    "upload": (False, True),
+    "both": (True, True),
+}
+
+# options an older sdkconfig still carries under their pre-LWIP_ names
+RENAMED = {
+    "CONFIG_LWIP_TCP_WND_DEFAULT": "CONFIG_TCP_WND_DEFAULT",
+}
+
+
+def int_list(value):
+    return [int(v, 0) for v in value.split(",")]
+
+
+def nodelay_list(value):
+    names = value.split(",")
+    for name in names:
+        if name not in NODELAY:
+            raise argparse.ArgumentTypeError("--nodelay takes %s" % ", ".join(NODELAY))
+    return names
+
+
+def read_sdkconfig(path):
+    values = {}
+    with open(path) as f:
+        for line in f:
+            m = re.match(r"^(CONFIG_\w+)=(.*)$", line.strip())
+            if m:
+                values[m.group(1)] = m.group(2)
+    return values
+
+
+def write_sdkconfig(base, path, overrides):
+    """Copy 'base' to 'path' with 'overrides' (name -> int or bool) replaced or added"""
+    pending = dict(overrides)
+    present = read_sdkconfig(base)
+    for new, old in RENAMED.items():
+        if new in pending and old in present:
+            pending[old] = pending[new]
+
+    def line_for(name, value):
+        if value is False:
+            return "# %s is not set\n" % name
+        if value is True:
+            return "%s=y\n" % name
+        return "%s=%d\n" % (name, value)
+
+    lines = []
+    with open(base) as f:
+        for line in f:
+            m = re.match(r"^(?:# )?(CONFIG_\w+)(?:=| is not set)", line)
+            if m and m.group(1) in pending:
+                line = line_for(m.group(1), pending.pop(m.group(1)))
+            lines.append(line)
+    for name, value in pending.items():
+        lines.append(line_for(name, value))
+
+    os.makedirs(os.path.dirname(path), exist_ok=True)
+    with open(path, "w") as f:
+        f.writelines(lines)
+
+
+def combinations(args):
+    """(name, sdkconfig overrides, columns) for every combination asked for"""
+    for wnd, size, nodelay in itertools.product(args.wnd, args.buffer_size, args.nodelay):
+        sse, upload = NODELAY[nodelay]
+        overrides = {
+            "CONFIG_LWIP_TCP_WND_DEFAULT": wnd,
+            "CONFIG_OTA_PIPELINE_BUFFER_SIZE": size,
+            "CONFIG_SERVER_SSE_NODELAY": sse,
+            "CONFIG_SERVER_UPLOAD_NODELAY": upload,
+        }
+        yield "wnd%d-buf%d-%s" % (wnd, size, nodelay), overrides, (wnd, size, nodelay)
+
+
+def build_and_flash(args, name, overrides):
+    build_dir = os.path.join(args.project, "build", "bench", name)
+    sdkconfig = os.path.join(build_dir, "sdkconfig")
+    write_sdkconfig(args.sdkconfig, sdkconfig, overrides)
+    command = ["idf.py", "-C", args.project, "-B", build_dir, "-D", "SDKCONFIG=" + sdkconfig]
+    if args.port:
+        command += ["-p", args.port]
+    command.append("flash")
+    print("building and flashing %s" % name, flush=True)
+    subprocess.run(command, check=True, stdout=None if args.verbose else subprocess.DEVNULL)
+
+
+def wait_for_device(host, timeout):
+    """Until GET /metrics answers; the station may have to rejoin the AP after a flash"""
+    deadline = time.monotonic() + timeout
+    while True:
+        try:
+            with urllib.request.urlopen("http://%s/metrics" % host, timeout=3) as response:
+                response.read()
+                return
+        except OSError:
+            if time.monotonic() > deadline:
+                sys.exit("%s didn't come back within %d s" % (host, timeout))
+            time.sleep(1)
+
+
+class EventStream(threading.Thread):
+    """A GET /event subscriber that notes when each 'Connected..' event arrives"""
+
+    def __init__(self, host):
+        super().__init__(daemon=True)
+        self.sock = socket.create_connection((host, 80), timeout=10)
+        self.sock.sendall(b"GET /event HTTP/1.1\r\nHost: %s\r\n\r\n" % host.encode())
+        self.sock.settimeout(None)
+        self.arrived = threading.Condition()
+        self.count = 0
+        self.last = 0.0
+        self.start()
+        # a new subscriber is replayed the last 'Connected..' kept, and its own is
+        #  broadcast too. probes count from after both
+        with self.arrived:
+            if not self.arrived.wait_for(lambda: self.count > 0, 10):
+                sys.exit("no events from %s/event" % host)
+        time.sleep(1)
+
+    def run(self):
+        pending = b""
+        while True:
+            try:
+                data = self.sock.recv(4096)
+            except OSError:
+                return
+            if not data:
+                return
+            now = time.monotonic()
+            pending += data
+            *lines, pending = pending.split(b"\n")
+            for line in lines:
+                if line.startswith(b"data:") and MARKER in line:
+                    with self.arrived:
+                        self.count += 1
+                        self.last = now
+                        self.arrived.notify_all()
+
+    def close(self):
+        self.sock.close()
+
+
+def probe(host, stream, timeout=5.0):
+    """Seconds from subscribing to the broadcast reaching 'stream', or None"""
+    with stream.arrived:
+        seen = stream.count
+    start = time.monotonic()
+    try:
+        sock = socket.create_connection((host, 80), timeout=timeout)
+    except OSError:
+        return None
+    try:
+        sock.sendall(b"GET /event HTTP/1.1\r\nHost: %s\r\n\r\n" % host.encode())
+        with stream.arrived:
+            if not stream.arrived.wait_for(lambda: stream.count > seen, timeout):
+                return None
+            return stream.last - start
+    finally:
+        sock.close()
+
+
+def upload(host, payload):
+    """Seconds for a POST /send of 'payload', sent as all but the last byte of an image"""
+    length = len(payload)
+    # the digest is never checked, but CONFIG_OTA_REQUIRE_SHA256 wants one
+    header = ("POST /send HTTP/1.1\r\nHost: %s\r\nContent-Length: %d\r\n"
+              "Content-Range: bytes 0-%d/%d\r\nX-Image-SHA256: %s\r\n\r\n"
+              % (host, length, length - 1, length + 1, "0" * 64))
+    sock = socket.create_connection((host, 80), timeout=60)
+    try:
+        start = time.monotonic()
+        sock.sendall(header.encode() + payload)
+        response = b""
+        while b"\r\n\r\n" not in response:
+            data = sock.recv(1024)
+            if not data:
+                break
+            response += data
+        elapsed = time.monotonic() - start
+    finally:
+        sock.close()
+    status = response.split(b" ", 2)[1] if response.startswith(b"HTTP/1.") else b"none"
+    if status != b"200":
+        raise RuntimeError("upload answered %s" % status.decode(errors="replace"))
+    return elapsed
+
+
+def percentile(samples, p):
+    if not samples:
+        return float("nan")
+    samples = sorted(samples)
+    return samples[min(len(samples) - 1, int(len(samples) * p))]
+
+
+def measure(args, header):
+    """One row: upload KB/s and event latency, idle and during uploads"""
+    stream = EventStream(args.host)
+    try:
+        idle = [probe(args.host, stream) for _ in range(args.probes)]
+
+        rates = []
+        loaded = []
+        for _ in range(args.repeat):
+            payload = header + os.urandom(args.size - len(header))
+            done = threading.Event()
+            result = {}
+
+            def run():
+                try:
+                    result["seconds"] = upload(args.host, payload)
+                except (OSError, RuntimeError) as e:
+                    result["error"] = e
+                done.set()
+
+            threading.Thread(target=run, daemon=True).start()
+            while not done.wait(args.probe_interval):
+                loaded.append(probe(args.host, stream))
+            if "error" in result:
+                sys.exit("upload failed: %s" % result["error"])
+            rates.append(len(payload) / result["seconds"] / 1024)
+    finally:
+        stream.close()
+
+    lost = sum(1 for s in idle + loaded if s is None)
+    idle = [s * 1000 for s in idle if s is not None]
+    loaded = [s * 1000 for s in loaded if s is not None]
+    return {
+        "kbps": statistics.median(rates),
+        "idle_ms": statistics.median(idle) if idle else float("nan"),
+        "idle_p95_ms": percentile(idle, 0.95),
+        "upload_ms": statistics.median(loaded) if loaded else float("nan"),
+        "upload_p95_ms": percentile(loaded, 0.95),
+        "probes": len(idle) + len(loaded),
+        "lost": lost,
+    }
+
+
+COLUMNS = ["flash", "wnd", "buffer", "nodelay", "kbps", "idle_ms", "idle_p95_ms",
+           "upload_ms", "upload_p95_ms", "probes", "lost"]
+
+
+def print_row(row):
+    print("%-5s %6s %6s %-7s %8.1f %8.1f %8.1f %9.1f %9.1f %6d %4d" % tuple(row[c] for c in COLUMNS),
+          flush=True)
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__, formatter_class=argparse.RawDescriptionHelpFormatter)
+    parser.add_argument("--image", required=True, help="an app image built for OTA_1")
+    parser.add_argument("--host", default="192.168.4.1")
+    parser.add_argument("--port", help="serial port to flash through")
+    parser.add_argument("--project", default=os.path.dirname(os.path.dirname(os.path.abspath(__file__))))
+    parser.add_argument("--sdkconfig", help="base configuration (default: the project's sdkconfig)")
+    parser.add_argument("--wnd", type=int_list, default=[2920, 5744, 11488])
+    parser.add_argument("--buffer-size", type=int_list, default=[1024, 2048, 4096])
+    parser.add_argument("--nodelay", type=nodelay_list, default=["none", "sse", "both"])
+    parser.add_argument("--size", type=int, default=256 * 1024, help="bytes per upload")
+    parser.add_argument("--repeat", type=int, default=3, help="uploads per combination")
+    parser.add_argument("--probes", type=int, default=10, help="latency samples with the device idle")
+    parser.add_argument("--probe-interval", type=float, default=0.25, help="seconds between samples during an upload")
+    parser.add_argument("--no-build", action="store_true", help="measure the firmware already running")
+    parser.add_argument("--csv", help="also write the rows here")
+    parser.add_argument("--verbose", action="store_true", help="show the build output")
+    args = parser.parse_args()
+    args.sdkconfig = args.sdkconfig or os.path.join(args.project, "sdkconfig")
+
+    with open(args.image, "rb") as f:
+        header = f.read(SECTOR_SIZE)
+    if len(header) < SECTOR_SIZE or header[0] != 0xE9:
+        sys.exit("%s is not an app image" % args.image)
+    if args.size < SECTOR_SIZE:
+        sys.exit("--size must be at least %d" % SECTOR_SIZE)
+
+    base = read_sdkconfig(args.sdkconfig)
+    flash = base.get("CONFIG_ESPTOOLPY_FLASHSIZE", "?").strip('"')
+    if args.no_build:
+        nodelay = [k for k, v in NODELAY.items()
+                   if v == (base.get("CONFIG_SERVER_SSE_NODELAY", "y") == "y",
+                            base.get("CONFIG_SERVER_UPLOAD_NODELAY") == "y")][0]
+        runs = [(None, None, (int(base.get("CONFIG_LWIP_TCP_WND_DEFAULT", 0)),
+                              int(base.get("CONFIG_OTA_PIPELINE_BUFFER_SIZE", 1024)), nodelay))]
+    else:
+        runs = list(combinations(args))
+
+    print("%-5s %6s %6s %-7s %8s %8s %8s %9s %9s %6s %4s" % ("flash", "wnd", "buffer", "nodelay",
+          "KB/s", "idle ms", "p95", "upload ms", "p95", "probes", "lost"))
+    rows = []
+    for name, overrides, (wnd, size, nodelay) in runs:
+        if name is not None:
+            build_and_flash(args, name, overrides)
+        wait_for_device(args.host, 90)
+        row = {"flash": flash, "wnd": wnd, "buffer": size, "nodelay": nodelay}
+        row.update(measure(args, header))
+        print_row(row)
+        rows.append(row)
+
+    if args.csv:
+        with open(args.csv, "w", newline="") as f:
+            writer = csv.DictWriter(f, fieldnames=COLUMNS)
+            writer.writeheader()
+            writer.writerows(rows)
+
+
+if __name__ == "__main__":
+    main()
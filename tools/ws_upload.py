@@ -0,0 +1,234 @@
+#!/usr/bin/env python3
+"""Upload a firmware image over GET /ws and report the throughput.
+
+    ws_upload.py build/app.bin
+    ws_upload.py --level W --dict build/log_dict.json build/app.bin
+    ws_upload.py --encoding heatshrink --sha256 <X-Image-SHA256> app.bin.hs
+    ws_upload.py --part homekit homekit.bin
+
+The payload is sent as DATA messages no further ahead than the device's ACKs allow,
+and the PROGRESS, LOG and LOGB messages it sends back on the same socket are printed
+as they arrive (LOGB records need the --dict written by the build). The protocol is
+described in main/ws.h.
+
+The summary doubles as a benchmark: payload rate, how long the sender sat waiting for
+credit, and the ACK count. Try --chunk and CONFIG_WS_UPLOAD_WINDOW against the time
+the same image takes through POST /send. A finished upload to an app or NVS partition
+restarts the device.
+"""
+
+import argparse
+import base64
+import hashlib
+import json
+import os
+import select
+import socket
+import struct
+import sys
+import time
+
+sys.path.insert(0, os.path.dirname(os.path.abspath(__file__)))
+import log_decode  # noqa: E402
+
+MSG_BEGIN = 0x01
+MSG_DATA = 0x02
+MSG_CANCEL = 0x03
+MSG_ACK = 0x81
+MSG_PROGRESS = 0x82
+MSG_LOG = 0x83
+MSG_LOGB = 0x84
+MSG_RESULT = 0x85
+
+OP_BINARY = 0x2
+OP_CLOSE = 0x8
+OP_PING = 0x9
+OP_PONG = 0xA
+
+ENCODINGS = {"identity": 0, "heatshrink": 0x01, "x-ota-delta": 0x02}
+GUID = b"258EAFA5-E914-47DA-95CA-C5AB0DC85B11"
+
+
+class WebSocket:
+    def __init__(self, host, port, path):
+        self.sock = socket.create_connection((host, port), timeout=30)
+        self.sock.setsockopt(socket.IPPROTO_TCP, socket.TCP_NODELAY, 1)
+        key = base64.b64encode(os.urandom(16))
+        self.sock.sendall(b"GET %s HTTP/1.1\r\nHost: %s\r\nUpgrade: websocket\r\nConnection: Upgrade\r\n"
+                          b"Sec-WebSocket-Key: %s\r\nSec-WebSocket-Version: 13\r\n\r\n"
+                          % (path.encode(), host.encode(), key))
+        response = b""
+        while b"\r\n\r\n" not in response:
+            data = self.sock.recv(1024)
+            if not data:
+                raise ConnectionError("closed during the handshake")
+            response += data
+        header, self.pending = response.split(b"\r\n\r\n", 1)
+        status = header.split(b"\r\n")[0].decode()
+        if " 101 " not in status:
+            raise ConnectionError(status)
+        accept = base64.b64encode(hashlib.sha1(key + GUID).digest())
+        if b"Sec-WebSocket-Accept: " + accept not in header:
+            raise ConnectionError("bad Sec-WebSocket-Accept")
+
+    def send(self, payload, opcode=OP_BINARY):
+        mask = os.urandom(4)
+        if len(payload) < 126:
+            header = struct.pack("!BB", 0x80 | opcode, 0x80 | len(payload))
+        else:
+            header = struct.pack("!BBH", 0x80 | opcode, 0x80 | 126, len(payload))
+        masked = bytes(b ^ mask[i & 3] for i, b in enumerate(payload))
+        self.sock.sendall(header + mask + masked)
+
+    def _read(self, n):
+        while len(self.pending) < n:
+            data = self.sock.recv(4096)
+            if not data:
+                raise ConnectionError("connection closed")
+            self.pending += data
+        out, self.pending = self.pending[:n], self.pending[n:]
+        return out
+
+    def wait_closed(self, timeout=10):
+        """Until the device closes the socket, which it does once it can take another
+        upload"""
+        self.sock.settimeout(timeout)
+        try:
+            while self.sock.recv(4096):
+                pass
+        except (socket.timeout, ConnectionError):
+            pass
+        self.sock.close()
+
+    def readable(self, timeout):
+        return bool(self.pending) or bool(select.select([self.sock], [], [], timeout)[0])
+
+    def recv(self):
+        b0, b1 = self._read(2)
+        length = b1 & 0x7F
+        if length == 126:
+            length, = struct.unpack("!H", self._read(2))
+        elif length == 127:
+            length, = struct.unpack("!Q", self._read(8))
+        return b0 & 0x0F, self._read(length)
+
+
+class Stats:
+    def __init__(self):
+        self.start = time.monotonic()
+        self.stalled = 0.0
+        self.acks = 0
+
+
+def print_log(msg, sites):
+    if msg[0] == MSG_LOG:
+        # the line has its own level and timestamp
+        print("  %s" % msg[6:].decode("utf-8", "replace").rstrip())
+    elif sites is not None:
+        print("  " + log_decode.decode_record(sites, msg[1:]))
+    else:
+        timestamp, site = struct.unpack_from("<II", msg, 1)
+        print("  ? (%d) LOGB record from site 0x%08x, pass --dict to decode" % (timestamp, site))
+
+
+def upload(ws, payload, encoding, sha256, chunk, sites):
+    begin = struct.pack("<BIB", MSG_BEGIN, len(payload), encoding) + (sha256 or b"")
+    ws.send(begin)
+
+    stats = Stats()
+    offset = 0
+    limit = 0                   # no DATA until the first ACK
+    while True:
+        can_send = offset < len(payload) and offset < limit
+        waited = time.monotonic()
+        readable = ws.readable(0 if can_send else 1.0)
+        if not can_send and offset < len(payload):
+            stats.stalled += time.monotonic() - waited
+        if not readable:
+            if can_send:
+                n = min(chunk, limit - offset, len(payload) - offset)
+                ws.send(bytes([MSG_DATA]) + payload[offset:offset + n])
+                offset += n
+            continue
+
+        opcode, msg = ws.recv()
+        if opcode == OP_CLOSE:
+            raise ConnectionError("device closed the socket without a RESULT")
+        if opcode == OP_PING:
+            ws.send(msg, OP_PONG)
+            continue
+        if opcode != OP_BINARY or not msg:
+            continue
+
+        if msg[0] == MSG_ACK:
+            received, limit = struct.unpack_from("<II", msg, 1)
+            stats.acks += 1
+        elif msg[0] == MSG_PROGRESS:
+            progress, written = struct.unpack_from("<BI", msg, 1)
+            print("%3d%%  %7d bytes sent, %7d on flash" % (progress, offset, written))
+        elif msg[0] in (MSG_LOG, MSG_LOGB):
+            print_log(msg, sites)
+        elif msg[0] == MSG_RESULT:
+            err, written, unchanged = struct.unpack_from("<iHH", msg, 1)
+            return err, written, unchanged, msg[9:41], stats
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__, formatter_class=argparse.RawDescriptionHelpFormatter)
+    parser.add_argument("image", help="image, or a payload from ota_pack.py")
+    parser.add_argument("--host", default="192.168.4.1")
+    parser.add_argument("--part", help="label of the partition to write. defaults to the OTA_1 app")
+    parser.add_argument("--port", type=int, default=80)
+    parser.add_argument("--encoding", default="identity", help="Content-Encoding printed by ota_pack.py")
+    parser.add_argument("--sha256", help="of the decoded image. defaults to that of a plain image")
+    parser.add_argument("--chunk", type=int, default=1024, help="bytes per DATA message (default 1024)")
+    parser.add_argument("--level", default="I", help="most verbose log lines sent back: N, E, W, I, D or V")
+    parser.add_argument("--dict", help="build/log_dict.json, to decode LOGB records")
+    args = parser.parse_args()
+
+    with open(args.image, "rb") as f:
+        payload = f.read()
+
+    encoding = 0
+    for token in args.encoding.replace(" ", "").split(","):
+        if token not in ENCODINGS:
+            sys.exit("unknown encoding %s" % token)
+        encoding |= ENCODINGS[token]
+
+    if args.sha256:
+        sha256 = bytes.fromhex(args.sha256)
+    elif encoding == 0:
+        sha256 = hashlib.sha256(payload).digest()
+    else:
+        sha256 = None
+
+    sites = None
+    if args.dict:
+        with open(args.dict) as f:
+            sites = json.load(f)
+
+    if not 1 <= args.chunk <= 65534:
+        sys.exit("--chunk must be 1 to 65534")
+
+    path = "/ws?level=%s" % args.level
+    if args.part:
+        path += "&part=%s" % args.part
+    ws = WebSocket(args.host, args.port, path)
+    try:
+        err, written, unchanged, digest, stats = upload(ws, payload, encoding, sha256, args.chunk, sites)
+    except KeyboardInterrupt:
+        ws.send(bytes([MSG_CANCEL]))
+        sys.exit("cancelled")
+    elapsed = time.monotonic() - stats.start
+    ws.wait_closed()
+
+    print("%d bytes in %.2f s, %.1f KB/s. %.2f s waiting for credit, %d ACKs" %
+          (len(payload), elapsed, len(payload) / 1024.0 / elapsed, stats.stalled, stats.acks))
+    print("%d sectors written, %d unchanged. image SHA-256 %s" % (written, unchanged, digest.hex()))
+    if err != 0:
+        sys.exit("failed: esp_err_t 0x%x" % (err & 0xFFFFFFFF))
+    print("written to '%s'" % args.part if args.part else "installed, the device is restarting")
+
+
+if __name__ == "__main__":
+    main()